@@ -0,0 +1,85 @@
+// This file is distributed under the MIT license.
+// See the LICENSE file for details.
+
+#pragma once
+
+#include "Wiimote/Wiimote.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace wii
+{
+
+//
+// Raw data of many data reports of one report mode, stored column by column.
+//
+// Element i of every column belongs to the i-th decoded report. Only the columns which the
+// report mode and the extension type provide are filled; all others are empty.
+// The values are the raw values of the State (see State, AccelData::raw, etc.).
+//
+struct ReportBatch
+{
+    // Number of decoded reports
+    size_t count;
+    // Data contained in each report (see State::Data).
+    // In pass-through mode, a report contains either motion-plus or extension data.
+    std::vector<uint16_t> data;
+    // Button state (see State::Button)
+    std::vector<uint16_t> buttons;
+    // Raw accelerometer data
+    std::vector<uint16_t> accelX;
+    std::vector<uint16_t> accelY;
+    std::vector<uint16_t> accelZ;
+    // Raw IR dot positions, one column per dot (0x3FF if not visible)
+    std::vector<uint16_t> irX[4];
+    std::vector<uint16_t> irY[4];
+    // IR dot sizes (Extended mode only)
+    std::vector<uint8_t> irSize[4];
+    // Normalized IR dot positions in [0,1]x[0,1]
+    std::vector<float> irNormalizedX[4];
+    std::vector<float> irNormalizedY[4];
+    // Visible IR dots: bit n is set if dot n is visible
+    std::vector<uint8_t> irVisible;
+    // Raw motion-plus angular rates
+    std::vector<uint16_t> mpX;
+    std::vector<uint16_t> mpY;
+    std::vector<uint16_t> mpZ;
+    // Motion-plus flags: bits 0-2 are set if x, y resp. z are in fast units, bit 3 is set
+    // if an extension is connected to the motion-plus
+    std::vector<uint8_t> mpFlags;
+    // Normalized motion-plus angular rates (see NormalizeMotionPlus())
+    std::vector<float> mpNormalizedX;
+    std::vector<float> mpNormalizedY;
+    std::vector<float> mpNormalizedZ;
+    // Nunchuk data
+    std::vector<uint8_t> nunchukStickX;
+    std::vector<uint8_t> nunchukStickY;
+    std::vector<uint16_t> nunchukAccelX;
+    std::vector<uint16_t> nunchukAccelY;
+    std::vector<uint16_t> nunchukAccelZ;
+    std::vector<uint8_t> nunchukButtons;
+    // Classic controller data, joysticks scaled to full range
+    std::vector<uint16_t> classicButtons;
+    std::vector<uint8_t> classicStickLX;
+    std::vector<uint8_t> classicStickLY;
+    std::vector<uint8_t> classicStickRX;
+    std::vector<uint8_t> classicStickRY;
+};
+
+// Decode the data reports in the given report mode into columns.
+// 'reports' points to 'count' input reports (including the report id) which are 'stride'
+// bytes apart. Reports of other kinds -- status reports, other report modes, etc. -- are
+// skipped. The IR mode is the one SetReportMode() selects for the report mode, 'extension'
+// is the extension type (see Extension::type).
+// Replaces the contents of 'batch' and returns the number of decoded reports.
+WIIAPI size_t DecodeReports(ReportBatch& batch, uint8_t const* reports, size_t count, Wiimote::ReportMode mode, unsigned extension = 0, size_t stride = 22);
+
+// Normalize the motion-plus angular rates of the batch with the calibration data of the
+// motion-plus which sent the reports (see MotionPlusData::normalized).
+// Fills mpNormalizedX/Y/Z for all reports; the values of reports without motion-plus data
+// (see ReportBatch::data) are meaningless.
+WIIAPI void NormalizeMotionPlus(ReportBatch& batch, MotionPlusData::CalibrationData const& cal);
+
+} // namespace wii
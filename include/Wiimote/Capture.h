@@ -0,0 +1,100 @@
+// This file is distributed under the MIT license.
+// See the LICENSE file for details.
+
+#pragma once
+
+#include "Wiimote/Wiimote.h"
+
+#include <cstdint>
+#include <memory>
+
+namespace wii
+{
+
+//
+// Records raw input and output reports into a capture file.
+//
+// Every record holds the time stamp, the device id, the direction and the raw report.
+// Records are appended by the recording threads into a buffer and written to the file by
+// an internal thread, so that recording never waits for the disk.
+//
+// A single capture may record any number of Wiimotes (see Wiimote::SetCapture()).
+// Record() may be called from any thread.
+//
+class CaptureWriter
+{
+    struct Impl;
+    std::unique_ptr<Impl> impl;
+
+public:
+    enum class Direction {
+        // Report read from the device
+        Input = 0,
+        // Report written to the device
+        Output = 1,
+    };
+
+    enum class Format {
+        // Fixed size records
+        Raw,
+        // Records store the changes to the previous report of the same kind; about a third
+        // of the size of raw records
+        Compressed,
+    };
+
+public:
+    // Constructor
+    WIIAPI CaptureWriter();
+
+    // Destructor
+    // Writes all buffered records and closes the file.
+    WIIAPI ~CaptureWriter();
+
+    // Open the capture file.
+    // Records are appended if the file already exists; it must have the same format, and
+    // its index -- if any -- must be intact.
+    WIIAPI bool Open(char const* path, Format format = Format::Raw);
+
+    // Write all buffered records and close the file
+    WIIAPI void Close();
+
+    // Whether the capture file is open
+    WIIAPI bool IsOpen() const;
+
+    // Record a report of len bytes (at most 22) at the given time (see GetTime()).
+    // Device ids are at most 0xFFFF; records of other devices are dropped, and so are records
+    // while the file is closed.
+    WIIAPI void Record(double time, unsigned device, Direction direction, uint8_t const* report, unsigned len);
+
+    // Returns the number of records written to the file
+    WIIAPI unsigned long long Written() const;
+
+    // Returns the number of records dropped since the file has been opened: records which
+    // could not be written, records of invalid devices and records while the file is closed.
+    // Every record is either written or dropped eventually.
+    WIIAPI unsigned long long Dropped() const;
+};
+
+// Statistics of ImportTrace()
+struct ImportStats
+{
+    // Number of packets in the trace
+    unsigned long long packets;
+    // Number of reports recorded
+    unsigned long long reports;
+    // Number of Wiimotes found
+    unsigned devices;
+};
+
+// Extract the Wiimote reports on the HID interrupt channels of a Bluetooth trace into the
+// capture.
+// Reads btsnoop files (HCI H1/H4 or btmon) and pcap and pcapng files (HCI H4, HCI H4 with
+// direction or Linux monitor). The trace is read front to back and never loaded as a whole.
+// Every Wiimote gets its own device id, in the order they appear, and reports are stamped
+// with the time stamps of the trace. Returns once the capture has written the reports.
+// Returns false if the trace could not be read, or if the capture dropped records during the
+// import (eg. because they could not be written, or the capture has been closed); the import
+// stops at the first dropped record.
+WIIAPI bool ImportTrace(char const* path, CaptureWriter& capture, ImportStats* stats = nullptr);
+
+} // namespace wii
@@ -0,0 +1,55 @@
+// This file is distributed under the MIT license.
+// See the LICENSE file for details.
+
+#pragma once
+
+#include "Wiimote/Wiimote.h"
+
+#include <memory>
+
+namespace wii
+{
+
+#ifndef _WIN32
+
+//
+// Watches for Wiimotes being plugged in (Linux only).
+//
+// The monitor watches the hidraw device nodes and attaches new Wiimotes to free slots of the
+// given Wiimote array. A slot is free if it has not been connected yet or if its link has
+// been lost; a lost Wiimote is reconnected as soon as it shows up again, with its report
+// mode, LEDs and rumble state restored.
+//
+// Wiimotes are recognized by the HID_ID of their sysfs node (vendor and product id).
+// The monitor must be updated on the thread which polls the Wiimotes. It must not be used
+// with Wiimotes owned by a WiimoteReactor.
+//
+class WiimoteMonitor
+{
+    struct Impl;
+    std::unique_ptr<Impl> impl;
+
+public:
+    // Watch the hidraw nodes in devRoot. The sysfs attributes of a node devRoot/<name> are
+    // looked up in sysRoot/<name>/device/uevent.
+    WIIAPI WiimoteMonitor(Wiimote* wiimotes, unsigned count, char const* devRoot = "/dev", char const* sysRoot = "/sys/class/hidraw");
+
+    // Destructor
+    WIIAPI ~WiimoteMonitor();
+
+    // Wait at most timeout ms for device changes and (re)connect all new Wiimotes.
+    // A negative timeout waits forever.
+    // Returns the number of Wiimotes (re)connected.
+    WIIAPI unsigned Update(int timeout);
+
+    // Returns a file descriptor which becomes readable if device nodes have changed
+    WIIAPI int Descriptor() const;
+
+    // Returns the time in seconds from losing the link of the given slot until the Wiimote
+    // was reconnected, or 0 if the slot has not been reconnected yet.
+    WIIAPI double GetReconnectLatency(unsigned slot) const;
+};
+
+#endif
+
+} // namespace wii
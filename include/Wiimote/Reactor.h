@@ -0,0 +1,68 @@
+// This file is distributed under the MIT license.
+// See the LICENSE file for details.
+
+#pragma once
+
+#include "Wiimote/Wiimote.h"
+#include "Wiimote/Transport.h"
+
+#include <cstddef>
+#include <memory>
+
+namespace wii
+{
+
+//
+// Services many Wiimotes from a single thread.
+//
+// The reactor owns its Wiimotes and waits for input reports on all of them at once.
+// Reports are processed as they arrive; the Wiimotes' Poll() must not be called.
+//
+class WiimoteReactor
+{
+    struct Impl;
+    std::unique_ptr<Impl> impl;
+
+public:
+    enum class Backend {
+        // Wait for input reports with epoll and read them one at a time
+        Epoll,
+        // Keep a read outstanding on every Wiimote and reap completed reads in batches.
+        // Transports without a raw descriptor (see Transport::RawDescriptor()), like L2CAP
+        // sockets, only have a poll outstanding and are read through the transport.
+        // Linux only; falls back to Epoll if io_uring is not available or does not support
+        // plain reads (before Linux 5.6).
+        Uring,
+    };
+
+public:
+    // Constructor
+    WIIAPI explicit WiimoteReactor(Backend backend = Backend::Epoll);
+
+    // Destructor
+    WIIAPI ~WiimoteReactor();
+
+    // Connect up to count Wiimotes.
+    // Returns the number of Wiimotes added.
+    WIIAPI unsigned Connect(unsigned count);
+
+    // Add a Wiimote at the other end of the given transport.
+    // Returns the new Wiimote, or null if the transport could not be attached.
+    WIIAPI Wiimote* Add(std::unique_ptr<Transport> transport);
+
+    // Wait at most timeout ms for input reports and process all reports which are ready.
+    // A negative timeout waits forever.
+    // Returns the number of reports processed.
+    WIIAPI unsigned Run(int timeout);
+
+    // Returns the backend in use
+    WIIAPI Backend GetBackend() const;
+
+    // Returns the number of Wiimotes
+    WIIAPI size_t Size() const;
+
+    // Returns the i-th Wiimote
+    WIIAPI Wiimote& operator [](size_t index);
+};
+
+} // namespace wii
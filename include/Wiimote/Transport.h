@@ -0,0 +1,102 @@
+// This file is distributed under the MIT license.
+// See the LICENSE file for details.
+
+#pragma once
+
+#include "Wiimote/Wiimote.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace wii
+{
+
+//
+// The link between a Wiimote and the device (or whatever stands in for the device).
+//
+// A transport moves raw HID reports: input reports are at most 22 bytes long, including
+// the report id in the first byte. Output reports include the report id, too.
+//
+// Read and Write may be called concurrently from two different threads.
+//
+class Transport
+{
+public:
+    enum class Result {
+        // A report has been read
+        OK,
+        // No report arrived within the timeout
+        Timeout,
+        // The link is broken
+        Error,
+    };
+
+public:
+    virtual ~Transport() {}
+
+    // Read a single input report into report[22].
+    // Stores the time the report has been received -- as close to its delivery by the OS
+    // as possible -- in 'time' (see GetTime()).
+    // Waits at most timeout microseconds for a report; a negative timeout waits forever.
+    virtual Result Read(uint8_t* report, double& time, int64_t timeout) = 0;
+
+    // Write an output report
+    virtual bool Write(uint8_t const* report, unsigned len) = 0;
+
+    // Returns a file descriptor which becomes readable once an input report is available,
+    // or -1 if this transport can not be waited on.
+    virtual int Descriptor() const { return -1; }
+
+    // Whether every read of Descriptor() yields exactly one input report as Read() returns
+    // it: no framing, and no receive time stamp which only Read() can fetch.
+    // Lets a reactor read the descriptor itself (see WiimoteReactor::Backend::Uring).
+    virtual bool RawDescriptor() const { return false; }
+
+    // Continue reading at the given recorded time (in seconds, see GetTime()).
+    // Only supported by transports which play back an indexed recording.
+    virtual bool Seek(double /*time*/) { return false; }
+};
+
+// Returns the current time in seconds.
+// All report time stamps are taken from this clock.
+WIIAPI double GetTime();
+
+// Creates an in-process emulated Wiimote.
+// The emulated Wiimote answers status, read and write requests and sends data reports in
+// the current report mode. 'extension' is either 0 or one of Extension::Nunchuk or
+// Extension::ClassicController.
+WIIAPI std::unique_ptr<Transport> CreateLoopbackTransport(unsigned extension = 0);
+
+// Creates a transport which plays back recorded input reports.
+// 'reports' points to 'count' consecutive input reports of 22 bytes each, which are copied.
+// Output reports are ignored. Once all reports have been read, the link is closed.
+WIIAPI std::unique_ptr<Transport> CreateReplayTransport(uint8_t const* reports, size_t count);
+
+// Creates a transport which plays back the input reports of the given device from a capture
+// file (see CaptureWriter). Once all reports have been read, the link is closed.
+// If speed is 0, the reports are delivered as fast as they are read and keep their recorded
+// time stamps; output reports are ignored.
+// Otherwise the reports are delivered at the recorded pace scaled by speed (eg. 0.5, 1, 10),
+// stamped with the playback time. Status, read and write requests are answered the way the
+// recorded device answered them.
+// Captures written by CaptureWriter have an index, so that playback can start at any time
+// (see Wiimote::Seek()).
+// Returns null if the file is not a valid capture.
+WIIAPI std::unique_ptr<Transport> CreateCaptureTransport(char const* path, unsigned device = 0, double speed = 0.0);
+
+#ifndef _WIN32
+// Creates a transport for an open hidraw device.
+// The descriptor may be any stand-in which delivers one report per read, like a pipe or
+// a socket. Takes ownership of the descriptor.
+WIIAPI std::unique_ptr<Transport> CreateHidrawTransport(int fd);
+
+// Creates a transport for connected L2CAP sockets of a Wiimote.
+// 'interrupt' is the HID interrupt channel (PSM 0x13) and 'control' the HID control channel
+// (PSM 0x11) or -1. Reports are framed with the HID transaction headers (0xA1 for input,
+// 0xA2 for output reports). Any SOCK_SEQPACKET socket may stand in for the channels.
+// Takes ownership of the descriptors.
+WIIAPI std::unique_ptr<Transport> CreateL2capTransport(int interrupt, int control = -1);
+#endif
+
+} // namespace wii
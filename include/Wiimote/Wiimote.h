@@ -3,17 +3,28 @@
 
 #pragma once
 
+#include <chrono>
+#include <functional>
 #include <memory>
 
+#ifdef _WIN32
 #ifdef WIIMOTE_EXPORTS
 #define WIIAPI __declspec(dllexport)
 #else
 #define WIIAPI __declspec(dllimport)
 #endif
+#else
+#define WIIAPI __attribute__((visibility("default")))
+#endif
 
 namespace wii
 {
 
+class CaptureWriter;
+class Transport;
+class WiimoteMonitor;
+class WiimoteReactor;
+
 struct Point2i
 {
     int x;
@@ -292,8 +303,10 @@ struct State
 
     // Determines what kind of data is valid (see 'enum Data')
     unsigned data;
-    // The current state's time in seconds
+    // The time the current report has been received in seconds (see GetTime())
     double time;
+    // The time the current report has been processed in seconds
+    double processTime;
     // Raw battery status (~180 for full, <60 for low)
     unsigned battery;
     // Whether the battery is nearly empty
@@ -322,8 +335,24 @@ struct State
     Extension extension;
 };
 
+// Output report statistics
+struct OutputStats
+{
+    // Number of output reports written
+    unsigned long long reports;
+    // Number of output reports which had to wait for the pacing limit
+    unsigned long long delayed;
+    // Total time output reports waited for the pacing limit in seconds
+    double waitTime;
+    // Longest time a single output report waited in seconds
+    double maxWaitTime;
+};
+
 class Wiimote
 {
+    friend class WiimoteMonitor;
+    friend class WiimoteReactor;
+
     struct Impl;
     std::unique_ptr<Impl> impl;
 
@@ -339,6 +368,15 @@ public:
         ButtonsAccelIRExt   = 0x37,
     };
 
+    enum class PollResult {
+        // A report has been processed
+        Report,
+        // No report arrived within the timeout
+        NoData,
+        // The link is broken or the Wiimote has been shut down
+        Error,
+    };
+
 public:
     // Constructor
     WIIAPI Wiimote();
@@ -349,6 +387,19 @@ public:
     // Connect to first found Wiimote
     WIIAPI bool Connect();
 
+    // Connect to the Wiimote at the other end of the given transport
+    WIIAPI bool Connect(std::unique_ptr<Transport> transport);
+
+#ifndef _WIN32
+    // Connect up to count Wiimotes to the hidraw nodes in devRoot, in the order of the nodes
+    // (hidraw0, hidraw1, ...). Stores the number of Wiimotes connected in 'count'.
+    // If devRoot is null, /dev is scanned and only hidraw devices are accepted. Otherwise,
+    // if sysRoot is given, nodes which are no hidraw devices -- stand-ins like FIFOs in a
+    // test tree -- are recognized by the HID_ID in sysRoot/<name>/device/uevent (see
+    // WiimoteMonitor).
+    WIIAPI static bool Connect(Wiimote* wiimotes, unsigned& count, char const* devRoot = nullptr, char const* sysRoot = "/sys/class/hidraw");
+#endif
+
     // Set the report mode
     // IR sensitivity level is set to Level3
     WIIAPI bool SetReportMode(ReportMode mode, bool continuous = true);
@@ -368,6 +419,58 @@ public:
     // Poll data from this wiimote
     WIIAPI bool Poll();
 
+    // Poll data from this wiimote
+    // Waits at most timeout for a report; a negative timeout waits forever.
+    WIIAPI PollResult Poll(std::chrono::microseconds timeout);
+
+    // Poll data from this wiimote if a report is available
+    // Never blocks.
+    WIIAPI PollResult TryPoll();
+
+    // Poll all reports which are already available -- but at most maxReports -- without
+    // waiting for new ones. Invokes the callback with the updated state after each report.
+    // Stores the number of reports processed in 'count'.
+    // Returns Error if the link is broken -- the reports read before are still processed --,
+    // Report if at least one report has been processed and NoData otherwise.
+    WIIAPI PollResult PollAll(unsigned& count, std::function<void (State const&)> const& callback = nullptr, unsigned maxReports = ~0u);
+
+    // Enable/Disable the reader thread.
+    // If enabled, an internal thread reads the reports from the device and Poll() only
+    // processes the reports which have already been read. A slow consumer then does not
+    // delay reading the device.
+    WIIAPI bool EnableReaderThread(bool enable);
+
+    // Enable or disable the writer thread.
+    // If enabled, output reports (LEDs, rumble, report mode, requests) are queued and written
+    // by an internal thread, so that a slow link does not block the caller. Queued LED/rumble
+    // and report mode updates are merged with newer ones before they are written.
+    WIIAPI bool EnableWriterThread(bool enable);
+
+    // Limit the output reports written to this Wiimote to 'rate' reports per second, with
+    // bursts of up to 'burst' reports. A rate of 0 disables the limit (the default).
+    // Without the writer thread, the caller waits for the limit.
+    WIIAPI void SetOutputPacing(double rate, unsigned burst = 1);
+
+    // Returns the output report statistics
+    WIIAPI OutputStats GetOutputStats() const;
+
+    // Record all input and output reports of this Wiimote into the given capture, tagged
+    // with the given device id (at most 0xFFFF). Output reports are recorded once they have
+    // been written. Pass null to stop recording.
+    // The capture must outlive the recording.
+    WIIAPI void SetCapture(CaptureWriter* capture, unsigned device = 0);
+
+    // Continue a capture playback at the given recorded time (see CreateCaptureTransport()).
+    // The Wiimote starts over: its calibration data, extension and motion-plus state are not
+    // restored from the capture's checkpoint but requested again, and the playback answers
+    // the requests the way the device was set up at that time. The report mode, IR
+    // sensitivity, LEDs and rumble are kept; the IR mode follows from the report mode.
+    // Until the answers have arrived, the reports lack calibration and extension data:
+    // about five reports without the accelerometer calibration and ten without a Nunchuk's
+    // data. Skip them if every report must be calibrated (see AccelData::CalibrationData).
+    // Returns false if the transport can not seek.
+    WIIAPI bool Seek(double time);
+
     // Properly shutdown this Wiimote
     WIIAPI bool Shutdown();
 
@@ -384,4 +487,9 @@ public:
     WIIAPI State const& GetState() const;
 };
 
+// Limit the output reports written to all Wiimotes together to 'rate' reports per second,
+// with bursts of up to 'burst' reports. Applies in addition to the per-Wiimote limit.
+// A rate of 0 disables the limit (the default).
+WIIAPI void SetGlobalOutputPacing(double rate, unsigned burst = 1);
+
 } // namespace wii
@@ -3,6 +3,12 @@ if _ACTION == "clean" then
     os.rmdir("build")
 end
 
+----------------------------------------------------------------------------------------------------
+newoption {
+    trigger     = "benchmarks",
+    description = "Also build the benchmarks (test/Benchmark)",
+}
+
 ----------------------------------------------------------------------------------------------------
 solution "Wiimote"
 
@@ -71,6 +77,11 @@ project "Test"
         "test/**",
     }
 
+    excludes {
+        "test/Benchmark/**",
+        "test/Unit/**",
+    }
+
     links { "Wiimote" }
 
     configuration { "Debug" }
@@ -92,3 +103,65 @@ project "Test"
 
     configuration { "not vs*" }
         links { "boost_thread", "boost_system" }
+
+----------------------------------------------------------------------------------------------------
+project "UnitTest"
+
+    kind "ConsoleApp"
+
+    language "C++"
+
+    -- The tests use the library's internals, too
+    defines {
+        "WIIMOTE_EXPORTS=1",
+    }
+
+    includedirs {
+        "include/",
+        "src/",
+    }
+
+    files {
+        "include/**",
+        "src/**",
+        "test/Unit/**",
+    }
+
+    configuration { "windows" }
+        links { "winmm", "hid", "setupapi" }
+
+    configuration { "not windows" }
+        links { "pthread" }
+
+----------------------------------------------------------------------------------------------------
+if _OPTIONS["benchmarks"] then
+
+project "Benchmark"
+
+    kind "ConsoleApp"
+
+    language "C++"
+
+    -- The benchmarks use the library's internals, too
+    defines {
+        "WIIMOTE_EXPORTS=1",
+    }
+
+    includedirs {
+        "include/",
+        "src/",
+    }
+
+    files {
+        "include/**",
+        "src/**",
+        "test/Benchmark/**",
+    }
+
+    configuration { "windows" }
+        links { "winmm", "hid", "setupapi" }
+
+    configuration { "not windows" }
+        links { "pthread" }
+
+end
@@ -0,0 +1,472 @@
+// This file is distributed under the MIT license.
+// See the LICENSE file for details.
+
+#include "Wiimote/Batch.h"
+
+#include "IR.h"
+#include "MotionPlus.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+using namespace wii;
+
+// Length of an input report
+#define WII_BATCH_REPORT_LENGTH 22
+
+//
+// Number of reports decoded at once.
+// A block of raw reports (plus its columns) fits into the L2 cache.
+//
+#define WII_BATCH_BLOCK_SIZE 1024
+
+//--------------------------------------------------------------------------------------------------
+//
+//--------------------------------------------------------------------------------------------------
+
+//
+// The decoders below unpack the same bits as the Parse* functions in Data.cpp, but one column
+// at a time: each loop reads a few bytes at a fixed offset of every report and writes a
+// single contiguous column, which keeps the loops simple enough for the compiler to unroll
+// and vectorize.
+//
+
+namespace
+{
+
+// Where the data is located in a report of a given report mode
+struct Layout
+{
+    // Whether the report contains accelerometer data
+    bool accel;
+    // Offset of the IR data (including the report id) or 0
+    unsigned ir;
+    // IR mode which is set for the report mode
+    IRData::Mode irMode;
+    // Offset of the extension data (including the report id) or 0
+    unsigned ext;
+};
+
+bool GetLayout(Wiimote::ReportMode mode, Layout& layout)
+{
+    switch (mode)
+    {
+    case Wiimote::ReportMode::Buttons:
+        layout = { false,  0, IRData::Mode::Off,       0 };
+        return true;
+    case Wiimote::ReportMode::ButtonsAccel:
+        layout = { true,   0, IRData::Mode::Off,       0 };
+        return true;
+    case Wiimote::ReportMode::ButtonsExt:
+        layout = { false,  0, IRData::Mode::Off,       3 };
+        return true;
+    case Wiimote::ReportMode::ButtonsAccelIR:
+        layout = { true,   6, IRData::Mode::Extended,  0 };
+        return true;
+    case Wiimote::ReportMode::ButtonsAccelExt:
+        layout = { true,   0, IRData::Mode::Off,       6 };
+        return true;
+    case Wiimote::ReportMode::ButtonsIRExt:
+        layout = { false,  3, IRData::Mode::Basic,    13 };
+        return true;
+    case Wiimote::ReportMode::ButtonsAccelIRExt:
+        layout = { true,   6, IRData::Mode::Basic,    16 };
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Clear all columns, keeping their memory
+void Clear(ReportBatch& batch)
+{
+    batch.count = 0;
+
+    batch.data.clear();
+    batch.buttons.clear();
+    batch.accelX.clear();
+    batch.accelY.clear();
+    batch.accelZ.clear();
+
+    for (unsigned n = 0; n < 4; ++n)
+    {
+        batch.irX[n].clear();
+        batch.irY[n].clear();
+        batch.irSize[n].clear();
+        batch.irNormalizedX[n].clear();
+        batch.irNormalizedY[n].clear();
+    }
+
+    batch.irVisible.clear();
+
+    batch.mpX.clear();
+    batch.mpY.clear();
+    batch.mpZ.clear();
+    batch.mpFlags.clear();
+    batch.mpNormalizedX.clear();
+    batch.mpNormalizedY.clear();
+    batch.mpNormalizedZ.clear();
+    batch.nunchukStickX.clear();
+    batch.nunchukStickY.clear();
+    batch.nunchukAccelX.clear();
+    batch.nunchukAccelY.clear();
+    batch.nunchukAccelZ.clear();
+    batch.nunchukButtons.clear();
+    batch.classicButtons.clear();
+    batch.classicStickLX.clear();
+    batch.classicStickLY.clear();
+    batch.classicStickRX.clear();
+    batch.classicStickRY.clear();
+}
+
+// Append count elements to the column and return a pointer to the first new element
+template <class T>
+T* Column(std::vector<T>& column, size_t count)
+{
+    size_t first = column.size();
+
+    column.resize(first + count);
+
+    return column.data() + first;
+}
+
+// Returns all bits set if the extension data of a pass-through report contains motion-plus
+// data, and 0 otherwise
+inline unsigned MotionPlusMask(uint8_t const* buf)
+{
+    return 0u - ((buf[5] >> 1) & 1u);
+}
+
+void DecodeButtons(ReportBatch& batch, uint8_t const* p, size_t count, size_t stride)
+{
+    uint16_t* buttons = Column(batch.buttons, count);
+
+    for (size_t i = 0; i < count; ++i, p += stride)
+        buttons[i] = static_cast<uint16_t>((p[1] | (p[2] << 8)) & State::ButtonMask);
+}
+
+void DecodeAccel(ReportBatch& batch, uint8_t const* p, size_t count, size_t stride)
+{
+    uint16_t* x = Column(batch.accelX, count);
+    uint16_t* y = Column(batch.accelY, count);
+    uint16_t* z = Column(batch.accelZ, count);
+
+    for (size_t i = 0; i < count; ++i, p += stride)
+    {
+        x[i] = static_cast<uint16_t>((p[3] << 2) | ((p[1] & 0x60) >> 5));
+        y[i] = static_cast<uint16_t>((p[4] << 2) | ((p[2] & 0x20) >> 4));
+        z[i] = static_cast<uint16_t>((p[5] << 2) | ((p[2] & 0x40) >> 5));
+    }
+}
+
+void DecodeBasicIR(ReportBatch& batch, uint8_t const* p, size_t count, size_t stride)
+{
+    uint16_t* x0 = Column(batch.irX[0], count);
+    uint16_t* y0 = Column(batch.irY[0], count);
+    uint16_t* x1 = Column(batch.irX[1], count);
+    uint16_t* y1 = Column(batch.irY[1], count);
+    uint16_t* x2 = Column(batch.irX[2], count);
+    uint16_t* y2 = Column(batch.irY[2], count);
+    uint16_t* x3 = Column(batch.irX[3], count);
+    uint16_t* y3 = Column(batch.irY[3], count);
+
+    for (size_t i = 0; i < count; ++i, p += stride)
+    {
+        x0[i] = static_cast<uint16_t>(p[0] | ((p[2] & 0x30) << 4));
+        y0[i] = static_cast<uint16_t>(p[1] | ((p[2] & 0xC0) << 2));
+        x1[i] = static_cast<uint16_t>(p[3] | ((p[2] & 0x03) << 8));
+        y1[i] = static_cast<uint16_t>(p[4] | ((p[2] & 0x0C) << 6));
+        x2[i] = static_cast<uint16_t>(p[5] | ((p[5] & 0x30) << 4));
+        y2[i] = static_cast<uint16_t>(p[6] | ((p[5] & 0xC0) << 2));
+        x3[i] = static_cast<uint16_t>(p[8] | ((p[5] & 0x03) << 8));
+        y3[i] = static_cast<uint16_t>(p[9] | ((p[5] & 0x0C) << 6));
+    }
+}
+
+void DecodeExtendedIR(ReportBatch& batch, uint8_t const* p, size_t count, size_t stride)
+{
+    uint16_t* x[4];
+    uint16_t* y[4];
+    uint8_t* size[4];
+
+    for (unsigned n = 0; n < 4; ++n)
+    {
+        x[n] = Column(batch.irX[n], count);
+        y[n] = Column(batch.irY[n], count);
+        size[n] = Column(batch.irSize[n], count);
+    }
+
+    for (size_t i = 0; i < count; ++i, p += stride)
+    {
+        for (unsigned n = 0; n < 4; ++n)
+        {
+            uint8_t const* q = p + 3 * n;
+
+            x[n][i] = static_cast<uint16_t>(q[0] | ((q[2] & 0x30) << 4));
+            y[n][i] = static_cast<uint16_t>(q[1] | ((q[2] & 0xC0) << 2));
+            size[n][i] = static_cast<uint8_t>(q[2] & 0x0F);
+        }
+    }
+}
+
+// Normalize the count IR dots decoded last
+void NormalizeIRColumns(ReportBatch& batch, size_t count)
+{
+    uint16_t const* x[4];
+    uint16_t const* y[4];
+    float* nx[4];
+    float* ny[4];
+
+    for (unsigned n = 0; n < 4; ++n)
+    {
+        x[n] = batch.irX[n].data() + batch.irX[n].size() - count;
+        y[n] = batch.irY[n].data() + batch.irY[n].size() - count;
+        nx[n] = Column(batch.irNormalizedX[n], count);
+        ny[n] = Column(batch.irNormalizedY[n], count);
+    }
+
+    wii::NormalizeIR(x, y, nx, ny, Column(batch.irVisible, count), count);
+}
+
+// In pass-through mode, the reports holding extension data have all motion-plus columns set
+// to 0 -- and vice versa.
+template <bool Passthrough>
+void DecodeMotionPlus(ReportBatch& batch, uint8_t const* p, size_t count, size_t stride)
+{
+    uint16_t* x = Column(batch.mpX, count);
+    uint16_t* y = Column(batch.mpY, count);
+    uint16_t* z = Column(batch.mpZ, count);
+    uint8_t* flags = Column(batch.mpFlags, count);
+    uint16_t* data = batch.data.data() + batch.data.size() - count;
+
+    for (size_t i = 0; i < count; ++i, p += stride)
+    {
+        unsigned keep = Passthrough ? MotionPlusMask(p) : ~0u;
+
+        // See MotionPlusFlags
+        unsigned fast = ((~p[3] & 0x01) >> 0)   // x
+                      | ((~p[4] & 0x02) >> 0)   // y
+                      | ((~p[3] & 0x02) << 1)   // z
+                      | (( p[4] & 0x01) << 3);  // ext
+
+        x[i] = static_cast<uint16_t>((p[2] | ((p[5] & 0xFC) << 6)) & keep);
+        y[i] = static_cast<uint16_t>((p[1] | ((p[4] & 0xFC) << 6)) & keep);
+        z[i] = static_cast<uint16_t>((p[0] | ((p[3] & 0xFC) << 6)) & keep);
+
+        flags[i] = static_cast<uint8_t>(fast & keep);
+
+        data[i] = static_cast<uint16_t>(data[i] | (State::MotionPlus & keep));
+    }
+}
+
+template <bool Passthrough>
+void DecodeNunchuk(ReportBatch& batch, uint8_t const* p, size_t count, size_t stride)
+{
+    uint8_t* sx = Column(batch.nunchukStickX, count);
+    uint8_t* sy = Column(batch.nunchukStickY, count);
+    uint16_t* ax = Column(batch.nunchukAccelX, count);
+    uint16_t* ay = Column(batch.nunchukAccelY, count);
+    uint16_t* az = Column(batch.nunchukAccelZ, count);
+    uint8_t* buttons = Column(batch.nunchukButtons, count);
+    uint16_t* data = batch.data.data() + batch.data.size() - count;
+
+    for (size_t i = 0; i < count; ++i, p += stride)
+    {
+        unsigned keep = Passthrough ? ~MotionPlusMask(p) : ~0u;
+
+        unsigned x, y, z, b;
+
+        if (Passthrough)
+        {
+            x = ((p[2]       ) << 2) | ((p[5] & 0x10) >> 4);
+            y = ((p[3]       ) << 2) | ((p[5] & 0x20) >> 5);
+            z = ((p[4] & 0xFE) << 2) | ((p[5] & 0xC0) >> 5);
+            b = ((~p[5]) >> 2) & 0x03;
+        }
+        else
+        {
+            x = (p[2] << 2) | ((p[5] & 0x0C) >> 2);
+            y = (p[3] << 2) | ((p[5] & 0x30) >> 4);
+            z = (p[4] << 2) | ((p[5] & 0xC0) >> 6);
+            b = (~p[5]) & 0x03;
+        }
+
+        sx[i] = static_cast<uint8_t>(p[0] & keep);
+        sy[i] = static_cast<uint8_t>(p[1] & keep);
+        ax[i] = static_cast<uint16_t>(x & keep);
+        ay[i] = static_cast<uint16_t>(y & keep);
+        az[i] = static_cast<uint16_t>(z & keep);
+        buttons[i] = static_cast<uint8_t>(b & keep);
+
+        data[i] = static_cast<uint16_t>(data[i] | (State::Nunchuk & keep));
+    }
+}
+
+template <bool Passthrough>
+void DecodeClassicController(ReportBatch& batch, uint8_t const* p, size_t count, size_t stride)
+{
+    uint16_t* buttons = Column(batch.classicButtons, count);
+    uint8_t* lx = Column(batch.classicStickLX, count);
+    uint8_t* ly = Column(batch.classicStickLY, count);
+    uint8_t* rx = Column(batch.classicStickRX, count);
+    uint8_t* ry = Column(batch.classicStickRY, count);
+    uint16_t* data = batch.data.data() + batch.data.size() - count;
+
+    for (size_t i = 0; i < count; ++i, p += stride)
+    {
+        unsigned keep = Passthrough ? ~MotionPlusMask(p) : ~0u;
+
+        unsigned b;
+
+        if (Passthrough)
+            b = ((~p[4] & 0xFE) << 0) | ((~p[5] & 0xFC) << 8) | ((~p[0] & 0x01) << 8) | ((~p[1] & 0x01) << 9);
+        else
+            b = ((~p[4] & 0xFE) << 0) | ((~p[5] & 0xFF) << 8);
+
+        unsigned mask = Passthrough ? 0x3E : 0x3F;
+
+        buttons[i] = static_cast<uint16_t>(b & keep);
+
+        lx[i] = static_cast<uint8_t>(((p[0] & mask) << 2) & keep);
+        ly[i] = static_cast<uint8_t>(((p[1] & mask) << 2) & keep);
+        rx[i] = static_cast<uint8_t>(((((p[2] & 0x80) >> 7) | ((p[1] & 0xC0) >> 5) | ((p[0] & 0xC0) >> 3)) << 3) & keep);
+        ry[i] = static_cast<uint8_t>(((p[2] & 0x1F) << 3) & keep);
+
+        data[i] = static_cast<uint16_t>(data[i] | (State::ClassicController & keep));
+    }
+}
+
+void DecodeExtension(ReportBatch& batch, uint8_t const* p, size_t count, size_t stride, unsigned extension)
+{
+    switch (extension)
+    {
+    case Extension::Nunchuk:
+        DecodeNunchuk<false>(batch, p, count, stride);
+        break;
+    case Extension::ClassicController:
+        DecodeClassicController<false>(batch, p, count, stride);
+        break;
+    case Extension::MotionPlus:
+        DecodeMotionPlus<false>(batch, p, count, stride);
+        break;
+    case Extension::MotionPlus | Extension::Nunchuk:
+        DecodeMotionPlus<true>(batch, p, count, stride);
+        DecodeNunchuk<true>(batch, p, count, stride);
+        break;
+    case Extension::MotionPlus | Extension::ClassicController:
+        DecodeMotionPlus<true>(batch, p, count, stride);
+        DecodeClassicController<true>(batch, p, count, stride);
+        break;
+    default:
+        // No (known) extension: the extension data is ignored
+        break;
+    }
+}
+
+} // namespace
+
+//--------------------------------------------------------------------------------------------------
+//
+//--------------------------------------------------------------------------------------------------
+
+size_t wii::DecodeReports(ReportBatch& batch, uint8_t const* reports, size_t count, Wiimote::ReportMode mode, unsigned extension, size_t stride)
+{
+    Clear(batch);
+
+    Layout layout;
+
+    if (!GetLayout(mode, layout))
+        return 0;
+
+    assert(stride >= WII_BATCH_REPORT_LENGTH);
+
+    uint8_t const id = static_cast<uint8_t>(mode);
+
+    unsigned data = State::Buttons;
+
+    if (layout.accel)
+        data |= State::Accel;
+    if (layout.ir)
+        data |= State::IR;
+
+    //
+    // Decode block by block, so that the reports stay in the cache while the columns are
+    // decoded one after another.
+    // The column decoders require the reports to be evenly spaced. If there are reports of
+    // other kinds in between, the matching reports of the block are copied into a dense
+    // buffer first.
+    //
+
+    std::vector<uint8_t> dense;
+
+    for (size_t begin = 0; begin < count; begin += WII_BATCH_BLOCK_SIZE)
+    {
+        size_t size = std::min(count - begin, static_cast<size_t>(WII_BATCH_BLOCK_SIZE));
+
+        uint8_t const* block = reports + begin * stride;
+        size_t blockStride = stride;
+
+        size_t matching = 0;
+
+        for (size_t i = 0; i < size; ++i)
+            matching += block[i * stride] == id;
+
+        if (matching == 0)
+            continue;
+
+        if (matching != size)
+        {
+            dense.resize(matching * WII_BATCH_REPORT_LENGTH);
+
+            uint8_t* out = dense.data();
+
+            for (size_t i = 0; i < size; ++i)
+            {
+                if (block[i * stride] == id)
+                {
+                    std::memcpy(out, block + i * stride, WII_BATCH_REPORT_LENGTH);
+                    out += WII_BATCH_REPORT_LENGTH;
+                }
+            }
+
+            block = dense.data();
+            blockStride = WII_BATCH_REPORT_LENGTH;
+        }
+
+        batch.data.resize(batch.count + matching, static_cast<uint16_t>(data));
+
+        DecodeButtons(batch, block, matching, blockStride);
+
+        if (layout.accel)
+            DecodeAccel(batch, block, matching, blockStride);
+
+        if (layout.irMode == IRData::Mode::Basic)
+            DecodeBasicIR(batch, block + layout.ir, matching, blockStride);
+        else if (layout.irMode == IRData::Mode::Extended)
+            DecodeExtendedIR(batch, block + layout.ir, matching, blockStride);
+
+        if (layout.ir)
+            NormalizeIRColumns(batch, matching);
+
+        if (layout.ext)
+            DecodeExtension(batch, block + layout.ext, matching, blockStride, extension);
+
+        batch.count += matching;
+    }
+
+    return batch.count;
+}
+
+void wii::NormalizeMotionPlus(ReportBatch& batch, MotionPlusData::CalibrationData const& cal)
+{
+    size_t count = batch.mpX.size();
+
+    batch.mpNormalizedX.resize(count);
+    batch.mpNormalizedY.resize(count);
+    batch.mpNormalizedZ.resize(count);
+
+    NormalizeMotionPlus(cal,
+                        batch.mpX.data(), batch.mpY.data(), batch.mpZ.data(), batch.mpFlags.data(),
+                        batch.mpNormalizedX.data(), batch.mpNormalizedY.data(), batch.mpNormalizedZ.data(), count);
+}
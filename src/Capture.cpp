@@ -0,0 +1,1340 @@
+// This file is distributed under the MIT license.
+// See the LICENSE file for details.
+
+#include "Wiimote/Capture.h"
+#include "Wiimote/Transport.h"
+
+#include "Capture.h"
+#include "Log.h"
+#include "Utils.h"
+#include "Wiimpl.h"
+
+#include <algorithm>
+#include <cstdio>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+using namespace wii;
+
+//
+// The writer thread writes the buffered records once this many bytes have accumulated,
+// or after WII_CAPTURE_FLUSH_INTERVAL ms.
+//
+#define WII_CAPTURE_FLUSH_SIZE      (64 * 1024)
+#define WII_CAPTURE_FLUSH_INTERVAL  100
+
+//--------------------------------------------------------------------------------------------------
+//
+//--------------------------------------------------------------------------------------------------
+
+namespace
+{
+
+// Write a varint. Returns the number of bytes written (at most 10).
+inline size_t WriteVarint(uint8_t* p, uint64_t n)
+{
+    size_t len = 0;
+
+    while (n >= 0x80)
+    {
+        p[len++] = static_cast<uint8_t>(n | 0x80);
+        n >>= 7;
+    }
+
+    p[len++] = static_cast<uint8_t>(n);
+
+    return len;
+}
+
+// Read a varint from [p, end). Returns the number of bytes read, or 0 if the varint is broken.
+inline size_t ReadVarint(uint8_t const* p, uint8_t const* end, uint64_t& n)
+{
+    n = 0;
+
+    for (size_t len = 0; len < 10 && p + len < end; ++len)
+    {
+        n |= static_cast<uint64_t>(p[len] & 0x7F) << (7 * len);
+
+        if ((p[len] & 0x80) == 0)
+            return len + 1;
+    }
+
+    return 0;
+}
+
+inline uint64_t ZigZag(int64_t n)
+{
+    return (static_cast<uint64_t>(n) << 1) ^ static_cast<uint64_t>(n >> 63);
+}
+
+inline int64_t UnZigZag(uint64_t n)
+{
+    return static_cast<int64_t>(n >> 1) ^ -static_cast<int64_t>(n & 1);
+}
+
+// Index of the lowest set bit
+inline unsigned LowestBit(uint32_t n)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, n);
+    return index;
+#else
+    return static_cast<unsigned>(__builtin_ctz(n));
+#endif
+}
+
+// Set the position of a file; offsets may exceed the range of long (32 bits on Windows)
+inline bool SeekFile(FILE* file, uint64_t offset, int origin)
+{
+#ifdef _WIN32
+    return _fseeki64(file, static_cast<__int64>(offset), origin) == 0;
+#else
+    return fseeko(file, static_cast<off_t>(offset), origin) == 0;
+#endif
+}
+
+// Returns the position of a file, or -1 on failure
+inline int64_t TellFile(FILE* file)
+{
+#ifdef _WIN32
+    return _ftelli64(file);
+#else
+    return ftello(file);
+#endif
+}
+
+// Cut a file off at the given size
+inline bool TruncateFile(FILE* file, uint64_t size)
+{
+    if (fflush(file) != 0)
+        return false;
+
+#ifdef _WIN32
+    return _chsize_s(_fileno(file), static_cast<__int64>(size)) == 0;
+#else
+    return ftruncate(fileno(file), static_cast<off_t>(size)) == 0;
+#endif
+}
+
+} // namespace
+
+//--------------------------------------------------------------------------------------------------
+//
+//--------------------------------------------------------------------------------------------------
+
+CapturePreviousReports::CapturePreviousReports()
+    : slots()
+    , devices()
+    , reports()
+{
+}
+
+void CapturePreviousReports::Clear()
+{
+    for (unsigned device : devices)
+        slots[device] = 0;
+
+    devices.clear();
+    reports.clear();
+}
+
+uint8_t* CapturePreviousReports::Add(unsigned device, unsigned direction, unsigned id)
+{
+    assert(device <= WII_CAPTURE_MAX_DEVICE);
+
+    if (devices.size() == WII_CAPTURE_MAX_SESSION_DEVICES)
+        return nullptr;
+
+    if (device >= slots.size())
+        slots.resize(device + 1);
+
+    devices.push_back(device);
+    slots[device] = static_cast<uint8_t>(devices.size());
+
+    // Two directions of 256 report ids each, zero
+    reports.resize(devices.size() << 9);
+
+    return Get(device, direction, id);
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+//--------------------------------------------------------------------------------------------------
+
+CaptureReader::CaptureReader()
+    : data(nullptr)
+    , size(0)
+    , offset(0)
+    , version(0)
+    , recordSize(0)
+    , time(0)
+    , previous()
+    , entries()
+    , checkpoints()
+    , block(nullptr)
+{
+}
+
+bool CaptureReader::Open(uint8_t const* data_, size_t size_)
+{
+    data = data_;
+    size = size_;
+    offset = WII_CAPTURE_HEADER_SIZE;
+    time = 0;
+
+    previous.Clear();
+    entries.clear();
+    checkpoints.clear();
+    block = nullptr;
+
+    if (data == nullptr || size < WII_CAPTURE_HEADER_SIZE || memcmp(data, WII_CAPTURE_MAGIC, 4) != 0)
+        return false;
+
+    version = ReadLE16(data + 4);
+    recordSize = ReadLE16(data + 6);
+
+    ReadIndex();
+
+    if (version == WII_CAPTURE_VERSION)
+    {
+        // Allow for records which have been extended by newer versions
+        return recordSize >= WII_CAPTURE_RECORD_SIZE;
+    }
+
+    return version == WII_CAPTURE_VERSION_COMPRESSED;
+}
+
+bool CaptureReader::Next(CaptureRecord& record)
+{
+    if (version == WII_CAPTURE_VERSION_COMPRESSED)
+        return Decode(record);
+
+    if (offset + recordSize > size)
+        return false;
+
+    uint8_t const* p = data + offset;
+
+    record.time = ReadLE64(p + WII_CAPTURE_OFFSET_TIME);
+    record.device = ReadLE16(p + WII_CAPTURE_OFFSET_DEVICE);
+    record.direction = p[WII_CAPTURE_OFFSET_DIR];
+    record.length = p[WII_CAPTURE_OFFSET_LENGTH];
+    record.report = p + WII_CAPTURE_OFFSET_REPORT;
+
+    offset += recordSize;
+
+    return true;
+}
+
+void CaptureReader::ReadIndex()
+{
+    if (size < WII_CAPTURE_HEADER_SIZE + WII_CAPTURE_TRAILER_SIZE)
+        return;
+
+    uint8_t const* trailer = data + size - WII_CAPTURE_TRAILER_SIZE;
+
+    if (memcmp(trailer + 12, WII_CAPTURE_TRAILER_MAGIC, 4) != 0)
+        return;
+
+    uint64_t blockOffset = ReadLE64(trailer);
+
+    if (blockOffset < WII_CAPTURE_HEADER_SIZE || blockOffset > size - WII_CAPTURE_TRAILER_SIZE)
+        return;
+
+    size_t end = static_cast<size_t>(blockOffset);
+
+    if (!ParseCaptureIndex(data + end, size - WII_CAPTURE_TRAILER_SIZE - end, entries, checkpoints))
+    {
+        //
+        // The trailer might be part of a record by chance, or the index is damaged.
+        // Read the file as if it had no index.
+        //
+
+        WII_LOG(IO, "Broken capture index.\n");
+
+        entries.clear();
+        checkpoints.clear();
+
+        return;
+    }
+
+    // The records end at the index
+    block = data + end;
+    size = end;
+}
+
+CaptureCheckpoint CaptureReader::Seek(uint64_t t)
+{
+    assert(!entries.empty());
+
+    auto it = std::upper_bound(entries.begin(), entries.end(), t,
+        [](uint64_t value, CaptureIndexEntry const& entry) { return value < entry.time; });
+
+    if (it != entries.begin())
+        --it;
+
+    // In compressed files, the entry points to a reset
+    offset = static_cast<size_t>(it->offset);
+
+    return checkpoints[it->checkpoint];
+}
+
+bool CaptureReader::Decode(CaptureRecord& record)
+{
+    uint8_t const* p = data + offset;
+    uint8_t const* end = data + size;
+
+    for (;;)
+    {
+        uint64_t header;
+        uint64_t delta;
+
+        size_t len = ReadVarint(p, end, header);
+
+        if (len == 0)
+            return false;
+
+        p += len;
+
+        if (header & 1)
+        {
+            //
+            // Reset
+            //
+
+            if (header != 1)
+                return false;
+
+            time = 0;
+
+            previous.Clear();
+
+            offset = p - data;
+            continue;
+        }
+
+        len = ReadVarint(p, end, delta);
+
+        if (len == 0 || end - (p + len) < 2)
+            return false;
+
+        p += len;
+
+        unsigned length = p[0];
+        unsigned id = p[1];
+
+        p += 2;
+
+        if (length == 0 || length > WII_REPORT_LENGTH)
+            return false;
+
+        unsigned maskBytes = (length + 6) / 8;
+
+        if (static_cast<size_t>(end - p) < maskBytes)
+            return false;
+
+        uint32_t mask = 0;
+
+        for (unsigned i = 0; i < maskBytes; ++i)
+            mask |= static_cast<uint32_t>(p[i]) << (8 * i);
+
+        p += maskBytes;
+
+        // Only bytes 1 to length - 1 can change; anything else is a broken record
+        if ((mask >> (length - 1)) != 0)
+            return false;
+
+        // The writer never stores larger device ids
+        if ((header >> 2) > WII_CAPTURE_MAX_DEVICE)
+            return false;
+
+        unsigned device = static_cast<unsigned>(header >> 2);
+        unsigned direction = static_cast<unsigned>(header >> 1) & 1;
+
+        uint8_t* report = previous.Get(device, direction, id);
+
+        // The writer starts a new session before a session has too many devices
+        if (report == nullptr)
+            return false;
+
+        //
+        // Apply the changed bytes
+        //
+
+        report[0] = static_cast<uint8_t>(id);
+
+        while (mask != 0)
+        {
+            if (p == end)
+                return false;
+
+            report[1 + LowestBit(mask)] ^= *p++;
+
+            mask &= mask - 1;
+        }
+
+        memset(report + length, 0, WII_REPORT_LENGTH - length);
+
+        time += static_cast<uint64_t>(UnZigZag(delta));
+
+        record.time = time;
+        record.device = device;
+        record.direction = direction;
+        record.length = length;
+        record.report = report;
+
+        offset = p - data;
+
+        return true;
+    }
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+//--------------------------------------------------------------------------------------------------
+
+bool wii::ParseCaptureIndex(uint8_t const* block, size_t size, std::vector<CaptureIndexEntry>& entries, std::vector<CaptureCheckpoint>& checkpoints)
+{
+    entries.clear();
+    checkpoints.clear();
+
+    if (size < 12 || memcmp(block, WII_CAPTURE_INDEX_MAGIC, 4) != 0)
+        return false;
+
+    size_t offset = 4;
+
+    uint32_t count = ReadLE32(block + offset);
+
+    offset += 4;
+
+    for (uint32_t n = 0; n < count; ++n)
+    {
+        if (size - offset < 4)
+            return false;
+
+        CaptureCheckpoint checkpoint;
+
+        checkpoint.size = ReadLE32(block + offset);
+        checkpoint.offset = offset + 4;
+
+        if (size - checkpoint.offset < checkpoint.size)
+            return false;
+
+        checkpoints.push_back(checkpoint);
+
+        offset = checkpoint.offset + checkpoint.size;
+    }
+
+    if (size - offset < 4)
+        return false;
+
+    count = ReadLE32(block + offset);
+
+    offset += 4;
+
+    if ((size - offset) / 20 < count)
+        return false;
+
+    for (uint32_t n = 0; n < count; ++n, offset += 20)
+    {
+        CaptureIndexEntry entry;
+
+        entry.time = ReadLE64(block + offset);
+        entry.offset = ReadLE64(block + offset + 8);
+        entry.checkpoint = ReadLE32(block + offset + 16);
+
+        if (entry.checkpoint >= checkpoints.size())
+            return false;
+
+        entries.push_back(entry);
+    }
+
+    return true;
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+//--------------------------------------------------------------------------------------------------
+
+namespace
+{
+
+// Address of a read or write request; ignores the rumble bit
+inline unsigned RequestAddress(uint8_t const* report)
+{
+    return Read32(report + 1) & 0xFEFFFFFF;
+}
+
+inline void SaveReport(std::vector<uint8_t>& out, CaptureReport const& report)
+{
+    out.insert(out.end(), report.data, report.data + WII_REPORT_LENGTH);
+}
+
+inline void SaveLE16(std::vector<uint8_t>& out, unsigned n)
+{
+    uint8_t buf[2];
+    WriteLE16(buf, n);
+    out.insert(out.end(), buf, buf + 2);
+}
+
+inline void SaveLE32(std::vector<uint8_t>& out, uint32_t n)
+{
+    uint8_t buf[4];
+    WriteLE32(buf, n);
+    out.insert(out.end(), buf, buf + 4);
+}
+
+// Reads the parts of a checkpoint
+struct CheckpointParser
+{
+    uint8_t const* p;
+    uint8_t const* end;
+
+    bool Has(size_t n) const { return static_cast<size_t>(end - p) >= n; }
+
+    unsigned LE16() { unsigned n = ReadLE16(p); p += 2; return n; }
+    uint32_t LE32() { uint32_t n = ReadLE32(p); p += 4; return n; }
+
+    bool Report(CaptureReport& report)
+    {
+        if (!Has(WII_REPORT_LENGTH))
+            return false;
+
+        memcpy(report.data, p, WII_REPORT_LENGTH);
+        p += WII_REPORT_LENGTH;
+
+        return true;
+    }
+};
+
+} // namespace
+
+CaptureResponses::CaptureResponses(bool keepLatest)
+    : keepLatest(keepLatest)
+    , statusPending(false)
+    , writePending(false)
+    , writeAddress(0)
+    , readPending(0)
+    , readAddress(0)
+    , reading()
+    , statusReports()
+    , nextStatus(0)
+    , readReports()
+    , writeReports()
+{
+}
+
+bool CaptureResponses::Add(CaptureRecord const& record)
+{
+    uint8_t const* report = record.report;
+
+    if (record.direction == static_cast<unsigned>(CaptureWriter::Direction::Output))
+    {
+        switch (report[0])
+        {
+        case WII_OUTPUT_STATUS:
+            statusPending = true;
+            break;
+
+        case WII_OUTPUT_WRITE_MEMORY:
+            writePending = true;
+            writeAddress = RequestAddress(report);
+            break;
+
+        case WII_OUTPUT_READ_MEMORY:
+            readAddress = RequestAddress(report);
+            readPending = Read16(report + 5);
+            reading.clear();
+            break;
+
+        default:
+            break;
+        }
+
+        return false;
+    }
+
+    CaptureReport r;
+
+    memcpy(r.data, report, WII_REPORT_LENGTH);
+
+    switch (report[0])
+    {
+    case 0x20: // Status
+        // Unrequested status reports (eg. extension plugged in) are not responses
+        if (!statusPending)
+            return false;
+
+        if (keepLatest)
+            statusReports.clear();
+
+        statusReports.push_back(r);
+        statusPending = false;
+        return true;
+
+    case 0x21: // Read memory data
+        if (readPending == 0)
+            return false;
+
+        reading.push_back(r);
+
+        {
+            unsigned size = (report[3] >> 4) + 1;
+            unsigned error = report[3] & 0x0F;
+
+            readPending = (error != 0 || size >= readPending) ? 0 : readPending - size;
+        }
+
+        if (readPending == 0 && (keepLatest || readReports.count(readAddress) == 0))
+            readReports[readAddress].swap(reading);
+
+        return true;
+
+    case 0x22: // Acknowledge
+        if (!writePending || report[3] != WII_OUTPUT_WRITE_MEMORY)
+            return false;
+
+        if (keepLatest || writeReports.count(writeAddress) == 0)
+            writeReports[writeAddress] = r;
+
+        writePending = false;
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+void CaptureResponses::Answer(uint8_t const* report, unsigned len, std::deque<CaptureReport>& out)
+{
+    switch (report[0])
+    {
+    case WII_OUTPUT_STATUS:
+        {
+            CaptureReport r = {{ 0x20 }};
+
+            if (!statusReports.empty())
+                r = statusReports[nextStatus++ % statusReports.size()];
+
+            out.push_back(r);
+        }
+        break;
+
+    case WII_OUTPUT_READ_MEMORY:
+        if (len >= 7)
+        {
+            unsigned address = RequestAddress(report);
+
+            auto it = readReports.find(address);
+
+            if (it != readReports.end() && !it->second.empty())
+            {
+                out.insert(out.end(), it->second.begin(), it->second.end());
+            }
+            else
+            {
+                // Never read in the recording. Fail like an unmapped address.
+                CaptureReport r = {{ 0x21 }};
+
+                r.data[3] = 0x07;
+                r.data[4] = B1(address);
+                r.data[5] = B0(address);
+
+                out.push_back(r);
+            }
+        }
+        break;
+
+    case WII_OUTPUT_WRITE_MEMORY:
+        if (len >= 7)
+        {
+            auto it = writeReports.find(RequestAddress(report));
+
+            CaptureReport r = {{ 0x22 }};
+
+            r.data[3] = WII_OUTPUT_WRITE_MEMORY;
+
+            if (it != writeReports.end())
+                r = it->second;
+
+            out.push_back(r);
+        }
+        break;
+
+    default:
+        break;
+    }
+}
+
+void CaptureResponses::Save(std::vector<uint8_t>& out) const
+{
+    SaveLE16(out, static_cast<unsigned>(statusReports.size()));
+
+    for (auto const& r : statusReports)
+        SaveReport(out, r);
+
+    SaveLE16(out, static_cast<unsigned>(readReports.size()));
+
+    for (auto const& read : readReports)
+    {
+        SaveLE32(out, read.first);
+        SaveLE16(out, static_cast<unsigned>(read.second.size()));
+
+        for (auto const& r : read.second)
+            SaveReport(out, r);
+    }
+
+    SaveLE16(out, static_cast<unsigned>(writeReports.size()));
+
+    for (auto const& write : writeReports)
+    {
+        SaveLE32(out, write.first);
+        SaveReport(out, write.second);
+    }
+}
+
+bool CaptureResponses::Load(uint8_t const* checkpoint, size_t size, unsigned device)
+{
+    *this = CaptureResponses(keepLatest);
+
+    CheckpointParser in = { checkpoint, checkpoint + size };
+
+    if (!in.Has(2))
+        return false;
+
+    //
+    // Find the device
+    //
+
+    for (unsigned devices = in.LE16(); ; --devices)
+    {
+        if (devices == 0)
+            return true; // Nothing recorded yet
+
+        if (!in.Has(6))
+            return false;
+
+        unsigned id = in.LE16();
+        uint32_t length = in.LE32();
+
+        if (!in.Has(length))
+            return false;
+
+        if (id == device)
+        {
+            in.end = in.p + length;
+            break;
+        }
+
+        in.p += length;
+    }
+
+    if (!in.Has(2))
+        return false;
+
+    for (unsigned n = in.LE16(); n > 0; --n)
+    {
+        CaptureReport r;
+
+        if (!in.Report(r))
+            return false;
+
+        statusReports.push_back(r);
+    }
+
+    if (!in.Has(2))
+        return false;
+
+    for (unsigned n = in.LE16(); n > 0; --n)
+    {
+        if (!in.Has(6))
+            return false;
+
+        std::vector<CaptureReport>& reports = readReports[in.LE32()];
+
+        for (unsigned count = in.LE16(); count > 0; --count)
+        {
+            CaptureReport r;
+
+            if (!in.Report(r))
+                return false;
+
+            reports.push_back(r);
+        }
+    }
+
+    if (!in.Has(2))
+        return false;
+
+    for (unsigned n = in.LE16(); n > 0; --n)
+    {
+        if (!in.Has(4))
+            return false;
+
+        unsigned address = in.LE32();
+
+        if (!in.Report(writeReports[address]))
+            return false;
+    }
+
+    return true;
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+//--------------------------------------------------------------------------------------------------
+
+CaptureEncoder::CaptureEncoder()
+    : reset(true)
+    , time(0)
+    , previous()
+{
+}
+
+size_t CaptureEncoder::Encode(uint8_t const* record, uint8_t* out)
+{
+    size_t n = 0;
+
+    uint64_t t = ReadLE64(record + WII_CAPTURE_OFFSET_TIME);
+    unsigned device = ReadLE16(record + WII_CAPTURE_OFFSET_DEVICE);
+    unsigned direction = record[WII_CAPTURE_OFFSET_DIR] & 1;
+    unsigned length = record[WII_CAPTURE_OFFSET_LENGTH];
+
+    uint8_t const* report = record + WII_CAPTURE_OFFSET_REPORT;
+
+    assert(0 < length && length <= WII_REPORT_LENGTH);
+
+    uint8_t* prev = reset ? nullptr : previous.Get(device, direction, report[0]);
+
+    // Start a new session after Reset() or once this one has too many devices
+    if (prev == nullptr)
+    {
+        out[n++] = 1;
+
+        time = 0;
+        reset = false;
+
+        previous.Clear();
+
+        prev = previous.Get(device, direction, report[0]);
+    }
+
+    n += WriteVarint(out + n, static_cast<uint64_t>(device) << 2 | direction << 1);
+    n += WriteVarint(out + n, ZigZag(static_cast<int64_t>(t - time)));
+
+    time = t;
+
+    out[n++] = static_cast<uint8_t>(length);
+    out[n++] = report[0];
+
+    //
+    // Store the bytes which differ from the previous report of the same kind
+    //
+
+    unsigned maskBytes = (length + 6) / 8;
+
+    uint8_t* maskOut = out + n;
+
+    n += maskBytes;
+
+    uint32_t mask = 0;
+
+    for (unsigned i = 1; i < length; ++i)
+    {
+        uint8_t x = report[i] ^ prev[i];
+
+        if (x != 0)
+        {
+            mask |= 1u << (i - 1);
+            out[n++] = x;
+        }
+    }
+
+    for (unsigned i = 0; i < maskBytes; ++i)
+        maskOut[i] = static_cast<uint8_t>(mask >> (8 * i));
+
+    // Records are zero padded
+    memcpy(prev, report, WII_REPORT_LENGTH);
+
+    return n;
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+//--------------------------------------------------------------------------------------------------
+
+struct CaptureWriter::Impl
+{
+    // The capture file
+    FILE* file;
+    // Whether the records are compressed
+    bool compressed;
+    // Compresses the records -- if compressed
+    CaptureEncoder encoder;
+    // Records waiting to be written; protected by lock
+    std::vector<uint8_t> pending;
+    // Whether the writer thread should keep running; protected by lock
+    bool running;
+    // Number of records written
+    std::atomic<unsigned long long> written;
+    // Number of records which have been dropped instead
+    std::atomic<unsigned long long> dropped;
+    // File offset of the next record
+    uint64_t offset;
+    // Number of records recorded since the file has been opened
+    uint64_t count;
+    // Responses of each device for the checkpoints
+    std::map<unsigned, CaptureResponses> devices;
+    // The index
+    std::vector<CaptureIndexEntry> entries;
+    std::vector<std::vector<uint8_t>> checkpoints;
+    // The writer thread
+    std::thread writer;
+    // Protects the pending records and wakes up the writer thread
+    std::mutex lock;
+    std::condition_variable signal;
+
+    Impl()
+        : file(nullptr)
+        , compressed(false)
+        , encoder()
+        , pending()
+        , running(false)
+        , written(0)
+        , dropped(0)
+        , offset(0)
+        , count(0)
+        , devices()
+        , entries()
+        , checkpoints()
+        , writer()
+        , lock()
+        , signal()
+    {
+    }
+
+    // The writer thread's main loop
+    void Run();
+
+    // Add an index entry for the given record, which will be written at the given offset
+    void AddIndexEntry(uint8_t const* record, uint64_t at);
+
+    // Follow the requests and responses of the record's device
+    void Follow(uint8_t const* record);
+
+    // Load the index of an existing file.
+    // Stores the offset of the index block, where the new records go, in 'at'.
+    // Returns false if the index is broken: where its records end is unknown.
+    bool LoadIndex(FILE* existing, uint64_t size, uint64_t& at);
+
+    // Write the index block and the trailer
+    bool WriteIndex();
+};
+
+void CaptureWriter::Impl::Run()
+{
+    std::vector<uint8_t> buffer;
+    std::vector<uint8_t> encoded;
+
+    for (;;)
+    {
+        bool stop;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+
+            if (running && pending.size() < WII_CAPTURE_FLUSH_SIZE)
+                signal.wait_for(guard, std::chrono::milliseconds(WII_CAPTURE_FLUSH_INTERVAL));
+
+            // Take over the pending records; the recording threads continue with an empty buffer
+            buffer.swap(pending);
+
+            stop = !running;
+        }
+
+        if (!buffer.empty())
+        {
+            size_t records = buffer.size() / WII_CAPTURE_RECORD_SIZE;
+
+            encoded.resize(records * (compressed ? WII_CAPTURE_MAX_COMPRESSED_SIZE + 1 : WII_CAPTURE_RECORD_SIZE));
+
+            size_t size = 0;
+
+            for (size_t n = 0; n < records; ++n)
+            {
+                uint8_t const* record = &buffer[n * WII_CAPTURE_RECORD_SIZE];
+
+                if (count++ % WII_CAPTURE_INDEX_INTERVAL == 0)
+                    AddIndexEntry(record, offset + size);
+
+                Follow(record);
+
+                if (compressed)
+                {
+                    size += encoder.Encode(record, &encoded[size]);
+                }
+                else
+                {
+                    memcpy(&encoded[size], record, WII_CAPTURE_RECORD_SIZE);
+                    size += WII_CAPTURE_RECORD_SIZE;
+                }
+            }
+
+            // Buffered records are not written until they have been flushed
+            if (fwrite(encoded.data(), 1, size, file) == size && fflush(file) == 0)
+            {
+                written += records;
+            }
+            else
+            {
+                WII_LOG(IO, "Failed to write capture.\n");
+
+                dropped += records;
+            }
+
+            offset += size;
+
+            buffer.clear();
+        }
+
+        if (stop)
+            break;
+    }
+}
+
+void CaptureWriter::Impl::AddIndexEntry(uint8_t const* record, uint64_t at)
+{
+    //
+    // Checkpoint the responses of all devices
+    //
+
+    std::vector<uint8_t> checkpoint;
+
+    SaveLE16(checkpoint, static_cast<unsigned>(devices.size()));
+
+    for (auto const& device : devices)
+    {
+        SaveLE16(checkpoint, device.first);
+
+        size_t sizeOffset = checkpoint.size();
+
+        SaveLE32(checkpoint, 0);
+
+        device.second.Save(checkpoint);
+
+        WriteLE32(&checkpoint[sizeOffset], static_cast<uint32_t>(checkpoint.size() - sizeOffset - 4));
+    }
+
+    // The responses rarely change
+    if (checkpoints.empty() || checkpoints.back() != checkpoint)
+        checkpoints.push_back(std::move(checkpoint));
+
+    CaptureIndexEntry entry;
+
+    entry.time = ReadLE64(record + WII_CAPTURE_OFFSET_TIME);
+    entry.offset = at;
+    entry.checkpoint = static_cast<unsigned>(checkpoints.size() - 1);
+
+    entries.push_back(entry);
+
+    // Decoding must be able to start here
+    encoder.Reset();
+}
+
+void CaptureWriter::Impl::Follow(uint8_t const* record)
+{
+    CaptureRecord r;
+
+    r.time = ReadLE64(record + WII_CAPTURE_OFFSET_TIME);
+    r.device = ReadLE16(record + WII_CAPTURE_OFFSET_DEVICE);
+    r.direction = record[WII_CAPTURE_OFFSET_DIR];
+    r.length = record[WII_CAPTURE_OFFSET_LENGTH];
+    r.report = record + WII_CAPTURE_OFFSET_REPORT;
+
+    auto it = devices.find(r.device);
+
+    if (it == devices.end())
+        it = devices.insert(std::make_pair(r.device, CaptureResponses(true))).first;
+
+    it->second.Add(r);
+}
+
+bool CaptureWriter::Impl::LoadIndex(FILE* existing, uint64_t size, uint64_t& at)
+{
+    uint8_t trailer[WII_CAPTURE_TRAILER_SIZE];
+
+    at = size;
+
+    if (size < WII_CAPTURE_HEADER_SIZE + WII_CAPTURE_TRAILER_SIZE
+        || !SeekFile(existing, size - WII_CAPTURE_TRAILER_SIZE, SEEK_SET)
+        || fread(trailer, 1, sizeof(trailer), existing) != sizeof(trailer)
+        || memcmp(trailer + 12, WII_CAPTURE_TRAILER_MAGIC, 4) != 0)
+    {
+        return true; // No index
+    }
+
+    uint64_t blockOffset = ReadLE64(trailer);
+
+    if (blockOffset < WII_CAPTURE_HEADER_SIZE || blockOffset > size - WII_CAPTURE_TRAILER_SIZE)
+        return true;
+
+    //
+    // The new records replace the index block; the index is written again when the file is closed
+    //
+
+    std::vector<uint8_t> block(static_cast<size_t>(size - WII_CAPTURE_TRAILER_SIZE - blockOffset));
+
+    std::vector<CaptureIndexEntry> loaded;
+    std::vector<CaptureCheckpoint> loadedCheckpoints;
+
+    if (!SeekFile(existing, blockOffset, SEEK_SET)
+        || fread(block.data(), 1, block.size(), existing) != block.size()
+        || !ParseCaptureIndex(block.data(), block.size(), loaded, loadedCheckpoints))
+    {
+        //
+        // CaptureReader reads such a file as if it had no index, so the trailer might point
+        // into the records. Neither appending at its offset nor behind it gives a file which
+        // reads back.
+        //
+
+        WII_LOG(IO, "Broken capture index.\n");
+        return false;
+    }
+
+    entries = loaded;
+
+    for (auto const& checkpoint : loadedCheckpoints)
+        checkpoints.push_back(std::vector<uint8_t>(&block[checkpoint.offset], &block[checkpoint.offset] + checkpoint.size));
+
+    at = blockOffset;
+
+    return true;
+}
+
+bool CaptureWriter::Impl::WriteIndex()
+{
+    std::vector<uint8_t> block(WII_CAPTURE_INDEX_MAGIC, WII_CAPTURE_INDEX_MAGIC + 4);
+
+    SaveLE32(block, static_cast<uint32_t>(checkpoints.size()));
+
+    for (auto const& checkpoint : checkpoints)
+    {
+        SaveLE32(block, static_cast<uint32_t>(checkpoint.size()));
+
+        block.insert(block.end(), checkpoint.begin(), checkpoint.end());
+    }
+
+    SaveLE32(block, static_cast<uint32_t>(entries.size()));
+
+    for (auto const& entry : entries)
+    {
+        uint8_t buf[20];
+
+        WriteLE64(buf, entry.time);
+        WriteLE64(buf + 8, entry.offset);
+        WriteLE32(buf + 16, entry.checkpoint);
+
+        block.insert(block.end(), buf, buf + sizeof(buf));
+    }
+
+    uint8_t trailer[WII_CAPTURE_TRAILER_SIZE] = { 0 };
+
+    WriteLE64(trailer, offset);
+    memcpy(trailer + 12, WII_CAPTURE_TRAILER_MAGIC, 4);
+
+    block.insert(block.end(), trailer, trailer + sizeof(trailer));
+
+    return fwrite(block.data(), 1, block.size(), file) == block.size();
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+//--------------------------------------------------------------------------------------------------
+
+CaptureWriter::CaptureWriter()
+    : impl(new Impl)
+{
+}
+
+CaptureWriter::~CaptureWriter()
+{
+    Close();
+}
+
+bool CaptureWriter::Open(char const* path, Format format)
+{
+    Close();
+
+    bool compressed = format == Format::Compressed;
+
+    uint8_t header[WII_CAPTURE_HEADER_SIZE];
+
+    memcpy(header, WII_CAPTURE_MAGIC, 4);
+    WriteLE16(header + 4, compressed ? WII_CAPTURE_VERSION_COMPRESSED : WII_CAPTURE_VERSION);
+    WriteLE16(header + 6, compressed ? 0 : WII_CAPTURE_RECORD_SIZE);
+
+    //
+    // Records can only be appended to a capture of the same format
+    //
+
+    impl->offset = 0;
+    impl->count = 0;
+    impl->devices.clear();
+    impl->entries.clear();
+    impl->checkpoints.clear();
+
+    FILE* file = fopen(path, "r+b");
+
+    if (file)
+    {
+        uint8_t current[WII_CAPTURE_HEADER_SIZE];
+
+        size_t size = fread(current, 1, sizeof(current), file);
+
+        if (size != 0 && (size != sizeof(current) || memcmp(current, header, sizeof(header)) != 0))
+        {
+            WII_LOG(IO, "Capture format mismatch: %s\n", path);
+
+            fclose(file);
+            return false;
+        }
+
+        int64_t end = size != 0 && SeekFile(file, 0, SEEK_END) ? TellFile(file) : -1;
+
+        if (end >= 0)
+        {
+            //
+            // Drop the old index so that the new one ends the file.
+            // Otherwise a shorter index would leave a stale tail behind its trailer.
+            //
+
+            if (!impl->LoadIndex(file, static_cast<uint64_t>(end), impl->offset)
+                || !SeekFile(file, impl->offset, SEEK_SET)
+                || (impl->offset < static_cast<uint64_t>(end) && !TruncateFile(file, impl->offset)))
+            {
+                WII_LOG(IO, "Failed to append to capture: %s\n", path);
+
+                fclose(file);
+                return false;
+            }
+        }
+    }
+    else
+    {
+        file = fopen(path, "wb");
+
+        if (file == nullptr)
+            return false;
+    }
+
+    //
+    // Write the header to new files
+    //
+
+    if (impl->offset == 0)
+    {
+        if (!SeekFile(file, 0, SEEK_SET) || fwrite(header, 1, sizeof(header), file) != sizeof(header))
+        {
+            fclose(file);
+            return false;
+        }
+
+        impl->offset = sizeof(header);
+    }
+
+    impl->file = file;
+    impl->compressed = compressed;
+    impl->encoder = CaptureEncoder();
+    impl->written = 0;
+    impl->dropped = 0;
+    impl->running = true;
+    impl->writer = std::thread(&Impl::Run, impl.get());
+
+    return true;
+}
+
+void CaptureWriter::Close()
+{
+    {
+        std::lock_guard<std::mutex> guard(impl->lock);
+
+        if (!impl->running)
+            return;
+
+        impl->running = false;
+    }
+
+    impl->signal.notify_one();
+    impl->writer.join();
+
+    if (!impl->WriteIndex())
+        WII_LOG(IO, "Failed to write capture index.\n");
+
+    fclose(impl->file);
+    impl->file = nullptr;
+}
+
+bool CaptureWriter::IsOpen() const
+{
+    return impl->file != nullptr;
+}
+
+void CaptureWriter::Record(double time, unsigned device, Direction direction, uint8_t const* report, unsigned len)
+{
+    assert(len <= WII_REPORT_LENGTH);
+    assert(device <= WII_CAPTURE_MAX_DEVICE && "Capture device ids are 16 bit");
+
+    // Would be recorded as another device
+    if (device > WII_CAPTURE_MAX_DEVICE)
+    {
+        WII_LOG(IO, "Capture device id out of range: %u\n", device);
+
+        impl->dropped++;
+        return;
+    }
+
+    uint8_t record[WII_CAPTURE_RECORD_SIZE] = { 0 };
+
+    WriteLE64(record + WII_CAPTURE_OFFSET_TIME, static_cast<uint64_t>(time * 1000000000.0));
+    WriteLE16(record + WII_CAPTURE_OFFSET_DEVICE, device);
+
+    record[WII_CAPTURE_OFFSET_DIR] = static_cast<uint8_t>(direction);
+    record[WII_CAPTURE_OFFSET_LENGTH] = static_cast<uint8_t>(len);
+
+    memcpy(record + WII_CAPTURE_OFFSET_REPORT, report, len);
+
+    bool wake;
+    {
+        std::lock_guard<std::mutex> guard(impl->lock);
+
+        if (!impl->running)
+        {
+            impl->dropped++;
+            return;
+        }
+
+        impl->pending.insert(impl->pending.end(), record, record + sizeof(record));
+
+        wake = impl->pending.size() >= WII_CAPTURE_FLUSH_SIZE;
+    }
+
+    if (wake)
+        impl->signal.notify_one();
+}
+
+unsigned long long CaptureWriter::Written() const
+{
+    return impl->written;
+}
+
+unsigned long long CaptureWriter::Dropped() const
+{
+    return impl->dropped;
+}
@@ -0,0 +1,354 @@
+// This file is distributed under the MIT license.
+// See the LICENSE file for details.
+
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <vector>
+
+//--------------------------------------------------------------------------------------------------
+// Capture file format
+//--------------------------------------------------------------------------------------------------
+//
+// A capture file starts with an 8 byte header:
+//
+//      0   magic "WCAP"
+//      4   u16 format version
+//      6   u16 record size
+//
+// followed by fixed size records:
+//
+//      0   u64 time stamp in nanoseconds (see GetTime())
+//      8   u16 device id
+//     10   u8  direction (0 = input, 1 = output)
+//     11   u8  length of the report
+//     12   u8  report[22], zero padded
+//
+// All numbers are little-endian.
+//
+// Compressed capture files (format version 2, record size 0) store variable size records
+// instead:
+//
+//      varint  (device << 2) | (direction << 1), or 1 to reset the decoder
+//      varint  zig-zag encoded time stamp delta to the previous record in nanoseconds
+//      u8      length of the report
+//      u8      report id
+//      u8      mask[(length + 6) / 8], bit n set if byte n + 1 of the report has changed
+//      u8      changed bytes, XORed with the previous report of the same device, direction
+//              and report id
+//
+// Varints store 7 bits per byte, least significant bits first; the high bit marks that
+// more bytes follow. After a reset, the time stamp delta is relative to 0 and all previous
+// reports are zero. Every compressed session starts with a reset. A session has records of
+// at most WII_CAPTURE_MAX_SESSION_DEVICES devices; the writer starts a new one before the
+// next device.
+//
+// Files written by CaptureWriter end with an index block:
+//
+//      0   magic "WIDX"
+//      4   u32 number of checkpoints
+//          per checkpoint: u32 size, checkpoint
+//      *   u32 number of index entries
+//          per entry: u64 time stamp, u64 file offset of the record, u32 checkpoint number
+//
+// followed by a 16 byte trailer at the very end of the file:
+//
+//      0   u64 file offset of the index block
+//      8   u32 reserved, 0
+//     12   magic "WEND"
+//
+// There is an index entry for every WII_CAPTURE_INDEX_INTERVAL-th record. In compressed
+// files, the record of an entry follows a reset. A checkpoint holds the most recent
+// responses to status, read and write requests of each device before the record:
+//
+//      u16 number of devices
+//          per device: u16 device id, u32 size, responses (see CaptureResponses)
+//
+// Equal checkpoints are stored once. Files without a trailer have no index.
+//
+
+#define WII_CAPTURE_MAGIC           "WCAP"
+#define WII_CAPTURE_VERSION         1
+#define WII_CAPTURE_VERSION_COMPRESSED 2
+#define WII_CAPTURE_HEADER_SIZE     8
+#define WII_CAPTURE_RECORD_SIZE     34
+
+#define WII_CAPTURE_INDEX_MAGIC     "WIDX"
+#define WII_CAPTURE_TRAILER_MAGIC   "WEND"
+#define WII_CAPTURE_TRAILER_SIZE    16
+#define WII_CAPTURE_INDEX_INTERVAL  4096
+
+// Maximum size of a compressed record
+#define WII_CAPTURE_MAX_COMPRESSED_SIZE 48
+
+// Largest device id; device ids are stored as u16
+#define WII_CAPTURE_MAX_DEVICE      0xFFFF
+
+// Largest number of devices in a compressed session
+#define WII_CAPTURE_MAX_SESSION_DEVICES 64
+
+#define WII_CAPTURE_OFFSET_TIME     0
+#define WII_CAPTURE_OFFSET_DEVICE   8
+#define WII_CAPTURE_OFFSET_DIR      10
+#define WII_CAPTURE_OFFSET_LENGTH   11
+#define WII_CAPTURE_OFFSET_REPORT   12
+
+namespace wii
+{
+
+inline unsigned ReadLE16(uint8_t const* p)
+{
+    return p[0] | p[1] << 8;
+}
+
+inline uint32_t ReadLE32(uint8_t const* p)
+{
+    return static_cast<uint32_t>(p[0] | p[1] << 8 | p[2] << 16) | static_cast<uint32_t>(p[3]) << 24;
+}
+
+inline uint64_t ReadLE64(uint8_t const* p)
+{
+    uint64_t n = 0;
+
+    for (int i = 7; i >= 0; --i)
+        n = n << 8 | p[i];
+
+    return n;
+}
+
+inline void WriteLE16(uint8_t* p, unsigned n)
+{
+    p[0] = static_cast<uint8_t>(n & 0xFF);
+    p[1] = static_cast<uint8_t>((n >> 8) & 0xFF);
+}
+
+inline void WriteLE32(uint8_t* p, uint32_t n)
+{
+    for (int i = 0; i < 4; ++i)
+        p[i] = static_cast<uint8_t>((n >> (8 * i)) & 0xFF);
+}
+
+inline void WriteLE64(uint8_t* p, uint64_t n)
+{
+    for (int i = 0; i < 8; ++i)
+        p[i] = static_cast<uint8_t>((n >> (8 * i)) & 0xFF);
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+//--------------------------------------------------------------------------------------------------
+
+// A decoded capture record
+struct CaptureRecord
+{
+    // Time stamp in nanoseconds
+    uint64_t time;
+    // Device id
+    unsigned device;
+    // Direction (see CaptureWriter::Direction)
+    unsigned direction;
+    // Length of the report
+    unsigned length;
+    // The report, zero padded to 22 bytes
+    // Only valid until the next record is read.
+    uint8_t const* report;
+};
+
+// An entry of the index of a capture file
+struct CaptureIndexEntry
+{
+    // Time stamp of the record in nanoseconds
+    uint64_t time;
+    // File offset of the record
+    uint64_t offset;
+    // Checkpoint number
+    unsigned checkpoint;
+};
+
+// A checkpoint in the index block of a capture file
+struct CaptureCheckpoint
+{
+    // Offset into the index block
+    size_t offset;
+    // Size of the checkpoint
+    size_t size;
+};
+
+// Parse the index block of a capture file (without the trailer).
+// Returns false if the block is broken.
+bool ParseCaptureIndex(uint8_t const* block, size_t size, std::vector<CaptureIndexEntry>& entries, std::vector<CaptureCheckpoint>& checkpoints);
+
+// A recorded report
+struct CaptureReport
+{
+    uint8_t data[22];
+};
+
+//
+// The previous report of each device, direction and report id of a compressed session, in a
+// flat table. Devices get dense slots in the order they appear; there are at most
+// WII_CAPTURE_MAX_SESSION_DEVICES slots.
+//
+class CapturePreviousReports
+{
+    // Slot of each device id plus 1, or 0 if the device has no slot
+    std::vector<uint8_t> slots;
+    // Device id of each slot
+    std::vector<unsigned> devices;
+    // Reports by slot, direction and report id
+    std::vector<CaptureReport> reports;
+
+public:
+    CapturePreviousReports();
+
+    // Forget all devices; all reports are zero again
+    void Clear();
+
+    // Returns the previous report of the given device, direction and report id.
+    // Reports which have not been seen yet are zero.
+    // Returns nullptr if the device is new and all slots are taken.
+    uint8_t* Get(unsigned device, unsigned direction, unsigned id)
+    {
+        assert(direction <= 1 && id <= 0xFF);
+
+        if (device < slots.size() && slots[device] != 0)
+            return reports[(slots[device] - 1u) << 9 | direction << 8 | id].data;
+
+        return Add(device, direction, id);
+    }
+
+private:
+    // Give a new device a slot
+    uint8_t* Add(unsigned device, unsigned direction, unsigned id);
+};
+
+//
+// Follows the requests of one recorded device and collects the responses to status (0x15),
+// read (0x17) and write (0x16) requests.
+//
+// Either the first or the most recent response to each request is kept.
+//
+class CaptureResponses
+{
+    // Whether the most recent responses are kept
+    bool keepLatest;
+    // A status request is waiting for its response
+    bool statusPending;
+    // A write request is waiting for its acknowledgement
+    bool writePending;
+    unsigned writeAddress;
+    // Bytes still to be read by the current read request
+    unsigned readPending;
+    unsigned readAddress;
+    // Responses to the current read request
+    std::vector<CaptureReport> reading;
+    // Status reports
+    std::vector<CaptureReport> statusReports;
+    // Next status report to answer with
+    size_t nextStatus;
+    // Read responses by address
+    std::map<unsigned, std::vector<CaptureReport>> readReports;
+    // Write acknowledgements by address
+    std::map<unsigned, CaptureReport> writeReports;
+
+public:
+    explicit CaptureResponses(bool keepLatest);
+
+    // Follow a record of the device.
+    // Returns true if the record is a response to a recorded request.
+    bool Add(CaptureRecord const& record);
+
+    // Queue the responses to an output report the way the recorded device answered it.
+    // Requests which have not been recorded fail like requests for unmapped memory.
+    void Answer(uint8_t const* report, unsigned len, std::deque<CaptureReport>& out);
+
+    // Append the collected responses to a checkpoint
+    void Save(std::vector<uint8_t>& out) const;
+
+    // Load the responses of the given device from a checkpoint.
+    // Returns false if the checkpoint is broken.
+    bool Load(uint8_t const* checkpoint, size_t size, unsigned device);
+};
+
+//
+// Reads the records of a capture file in memory, in either format.
+//
+class CaptureReader
+{
+    // The capture file
+    uint8_t const* data;
+    size_t size;
+    // Offset of the next record
+    size_t offset;
+    // Format version
+    unsigned version;
+    // Size of a record (uncompressed only)
+    size_t recordSize;
+    // Time stamp of the previous record (compressed only)
+    uint64_t time;
+    // Previous report of each device, direction and report id (compressed only)
+    CapturePreviousReports previous;
+    // The index -- if any
+    std::vector<CaptureIndexEntry> entries;
+    std::vector<CaptureCheckpoint> checkpoints;
+    // Start of the index block
+    uint8_t const* block;
+
+public:
+    CaptureReader();
+
+    // Check the header of the capture file and start reading at the first record.
+    // The data must stay valid while reading.
+    bool Open(uint8_t const* data, size_t size);
+
+    // Read the next record.
+    // Returns false at the end of the file or if the record is broken.
+    bool Next(CaptureRecord& record);
+
+    // Whether the file has an index
+    bool HasIndex() const { return !entries.empty(); }
+
+    // Continue reading at the last index entry at or before the given time stamp, or at the
+    // first entry.
+    // Returns the checkpoint of the entry.
+    CaptureCheckpoint Seek(uint64_t time);
+
+    // Returns the data of a checkpoint
+    uint8_t const* CheckpointData(CaptureCheckpoint const& checkpoint) const { return block + checkpoint.offset; }
+
+private:
+    // Decode a compressed record
+    bool Decode(CaptureRecord& record);
+
+    // Read the index at the end of the file -- if any
+    void ReadIndex();
+};
+
+//
+// Compresses uncompressed capture records.
+//
+class CaptureEncoder
+{
+    // Whether the next record starts a new session
+    bool reset;
+    // Time stamp of the previous record
+    uint64_t time;
+    // Previous report of each device, direction and report id
+    CapturePreviousReports previous;
+
+public:
+    CaptureEncoder();
+
+    // Start the next record with a reset
+    void Reset() { reset = true; }
+
+    // Compress an uncompressed record into out[WII_CAPTURE_MAX_COMPRESSED_SIZE].
+    // Returns the size of the compressed record.
+    size_t Encode(uint8_t const* record, uint8_t* out);
+};
+
+} // namespace wii
@@ -2,6 +2,7 @@
 // See the LICENSE file for details.
 
 #include "Data.h"
+#include "IR.h"
 #include "Log.h"
 #include "Utils.h"
 
@@ -116,13 +117,30 @@ struct MotionPlusStatistics
 namespace
 {
 
-bool NormalizeAccel(AccelData& accel)
+inline float NormalizedAccel(int raw, int zero, int g)
 {
-    if (accel.cal.valid)
+    return (float)(raw - zero) / (float)(g - zero);
+}
+
+inline float NormalizedStick(int raw, int center, int min, int max)
+{
+    return 2.0f * (float)(raw - center) / (float)(max - min);
+}
+
+bool NormalizeAccel(AccelData& accel, CalibrationTables::Accel const* table)
+{
+    if (accel.cal.valid && table)
     {
-        accel.normalized.x = (float)(accel.raw.x - accel.cal.zero.x) / (float)(accel.cal.g.x - accel.cal.zero.x);
-        accel.normalized.y = (float)(accel.raw.y - accel.cal.zero.y) / (float)(accel.cal.g.y - accel.cal.zero.y);
-        accel.normalized.z = (float)(accel.raw.z - accel.cal.zero.z) / (float)(accel.cal.g.z - accel.cal.zero.z);
+        // Raw values are 10 bits (see ParseAccelCalibrationData)
+        accel.normalized.x = (*table)[0][accel.raw.x & 0x3FF];
+        accel.normalized.y = (*table)[1][accel.raw.y & 0x3FF];
+        accel.normalized.z = (*table)[2][accel.raw.z & 0x3FF];
+    }
+    else if (accel.cal.valid)
+    {
+        accel.normalized.x = NormalizedAccel(accel.raw.x, accel.cal.zero.x, accel.cal.g.x);
+        accel.normalized.y = NormalizedAccel(accel.raw.y, accel.cal.zero.y, accel.cal.g.y);
+        accel.normalized.z = NormalizedAccel(accel.raw.z, accel.cal.zero.z, accel.cal.g.z);
     }
     else
     {
@@ -134,12 +152,18 @@ bool NormalizeAccel(AccelData& accel)
     return accel.cal.valid;
 }
 
-bool NormalizeStick(JoystickData& stick)
+bool NormalizeStick(JoystickData& stick, CalibrationTables::Stick const* table)
 {
-    if (stick.cal.valid)
+    if (stick.cal.valid && table)
     {
-        stick.normalized.x = 2.0f * (float)(stick.raw.x - stick.cal.center.x) / (float)(stick.cal.max.x - stick.cal.min.x);
-        stick.normalized.y = 2.0f * (float)(stick.raw.y - stick.cal.center.y) / (float)(stick.cal.max.y - stick.cal.min.y);
+        // Raw values are 8 bits (see ParseStickCalibrationData)
+        stick.normalized.x = (*table)[0][stick.raw.x & 0xFF];
+        stick.normalized.y = (*table)[1][stick.raw.y & 0xFF];
+    }
+    else if (stick.cal.valid)
+    {
+        stick.normalized.x = NormalizedStick(stick.raw.x, stick.cal.center.x, stick.cal.min.x, stick.cal.max.x);
+        stick.normalized.y = NormalizedStick(stick.raw.y, stick.cal.center.y, stick.cal.min.y, stick.cal.max.y);
     }
     else
     {
@@ -192,7 +216,7 @@ bool NormalizeMotionPlus(MotionPlusData& mp)
 // Common
 //--------------------------------------------------------------------------------------------------
 
-bool wii::ParseAccelCalibrationData(AccelData::CalibrationData& cal, uint8_t const* buf)
+bool wii::ParseAccelCalibrationData(AccelData::CalibrationData& cal, uint8_t const* buf, CalibrationTables::Accel* table)
 {
     //
     // The four bytes starting at 0x0016 and 0x0020 store the calibrated zero offsets for the
@@ -213,10 +237,25 @@ bool wii::ParseAccelCalibrationData(AccelData::CalibrationData& cal, uint8_t con
                   cal.zero.y != cal.g.y &&
                   cal.zero.z != cal.g.z;
 
+    //
+    // Raw values are only 10 bits: precompute the normalized value of each one, so that
+    // NormalizeAccel is a table lookup per axis
+    //
+
+    if (cal.valid && table)
+    {
+        for (int raw = 0; raw < 1024; ++raw)
+        {
+            (*table)[0][raw] = NormalizedAccel(raw, cal.zero.x, cal.g.x);
+            (*table)[1][raw] = NormalizedAccel(raw, cal.zero.y, cal.g.y);
+            (*table)[2][raw] = NormalizedAccel(raw, cal.zero.z, cal.g.z);
+        }
+    }
+
     return cal.valid;
 }
 
-bool wii::ParseStickCalibrationData(JoystickData::CalibrationData& cal, uint8_t const* buf)
+bool wii::ParseStickCalibrationData(JoystickData::CalibrationData& cal, uint8_t const* buf, CalibrationTables::Stick* table)
 {
     cal.max.x       = buf[0];
     cal.min.x       = buf[1];
@@ -240,6 +279,19 @@ bool wii::ParseStickCalibrationData(JoystickData::CalibrationData& cal, uint8_t
     }
 #endif
 
+    //
+    // Same for the 8 bit joystick values
+    //
+
+    if (cal.valid && table)
+    {
+        for (int raw = 0; raw < 256; ++raw)
+        {
+            (*table)[0][raw] = NormalizedStick(raw, cal.center.x, cal.min.x, cal.max.x);
+            (*table)[1][raw] = NormalizedStick(raw, cal.center.y, cal.min.y, cal.max.y);
+        }
+    }
+
     return cal.valid;
 }
 
@@ -261,7 +313,7 @@ bool wii::ParseButtons(State& state, uint8_t const* buf)
     return true;
 }
 
-bool wii::ParseAccel(State& state, uint8_t const* buf)
+bool wii::ParseAccel(State& state, uint8_t const* buf, CalibrationTables const* tables)
 {
     AccelData& acc = state.accel;
 
@@ -269,99 +321,72 @@ bool wii::ParseAccel(State& state, uint8_t const* buf)
     acc.raw.y = (buf[3] << 2) | ((buf[1] & 0x20) >> 4);
     acc.raw.z = (buf[4] << 2) | ((buf[1] & 0x40) >> 5);
 
-    NormalizeAccel(acc);
+    NormalizeAccel(acc, tables ? &tables->accel : nullptr);
 
     state.data |= State::Accel;
 
     return true;
 }
 
-bool wii::ParseIR(State& state, uint8_t const* buf)
+namespace
 {
-    IRData& ir = state.ir;
 
-    switch (ir.mode)
+//
+// Decodes the IR data of an IR mode (see UnpackIR())
+//
+template <IRData::Mode Mode>
+struct IRDecoder;
+
+template <>
+struct IRDecoder<IRData::Mode::Off>
+{
+    static bool Parse(State& /*state*/, uint8_t const* /*buf*/)
     {
-    case IRData::Mode::Off:
         //
         // This function should not be called if the IR sensor is disabled
         //
         return false;
+    }
+};
 
-    case IRData::Mode::Basic:
-        //
-        // In Basic Mode, the IR Camera returns 10 bytes of data corresponding to the X and
-        // Y locations of each of the four dots. Each location is encoded in 10 bits and has
-        // a range of 0-1023 for the X dimension, and 0-767 for the Y dimension. Each pair
-        // of dots is packed into 5 bytes, and two of these are transmitted for a total of
-        // 4 dots and 10 bytes.
-        //
-
-        ir.dots[0].raw.x = buf[0] | ((buf[2] & 0x30) << 4);
-        ir.dots[0].raw.y = buf[1] | ((buf[2] & 0xC0) << 2);
-        ir.dots[1].raw.x = buf[3] | ((buf[2] & 0x03) << 8);
-        ir.dots[1].raw.y = buf[4] | ((buf[2] & 0x0C) << 6);
-        ir.dots[2].raw.x = buf[5] | ((buf[5] & 0x30) << 4);
-        ir.dots[2].raw.y = buf[6] | ((buf[5] & 0xC0) << 2);
-        ir.dots[3].raw.x = buf[8] | ((buf[5] & 0x03) << 8);
-        ir.dots[3].raw.y = buf[9] | ((buf[5] & 0x0C) << 6);
-
-        ir.dots[0].size = 0;
-        ir.dots[1].size = 0;
-        ir.dots[2].size = 0;
-        ir.dots[3].size = 0;
-        break;
-
-    case IRData::Mode::Extended:
-        //
-        // In Extended Mode, the IR Camera returns the same data as it does in Basic Mode,
-        // plus a rough size value for each object. The data is returned as 12 bytes, three
-        // bytes per object. Size has a range of 0-15.
-        //
+template <IRData::Mode Mode>
+struct IRDecoder
+{
+    static bool Parse(State& state, uint8_t const* buf)
+    {
+        UnpackIR<Mode>(state.ir, buf);
 
-        ir.dots[0].raw.x = buf[ 0] | ((buf[ 2] & 0x30) << 4);
-        ir.dots[0].raw.y = buf[ 1] | ((buf[ 2] & 0xC0) << 2);
-        ir.dots[1].raw.x = buf[ 3] | ((buf[ 5] & 0x30) << 4);
-        ir.dots[1].raw.y = buf[ 4] | ((buf[ 5] & 0xC0) << 2);
-        ir.dots[2].raw.x = buf[ 6] | ((buf[ 8] & 0x30) << 4);
-        ir.dots[2].raw.y = buf[ 7] | ((buf[ 8] & 0xC0) << 2);
-        ir.dots[3].raw.x = buf[ 9] | ((buf[11] & 0x30) << 4);
-        ir.dots[3].raw.y = buf[10] | ((buf[11] & 0xC0) << 2);
-
-        ir.dots[0].size = buf[ 2] & 0x0F;
-        ir.dots[1].size = buf[ 5] & 0x0F;
-        ir.dots[2].size = buf[ 8] & 0x0F;
-        ir.dots[3].size = buf[11] & 0x0F;
-        break;
+        state.data |= State::IR;
 
-    default:
-        return false;
+        return true;
     }
+};
 
-    // Normalize IR data
-    for (auto& dot : ir.dots)
-    {
-        // Compute normalized position
-        dot.normalized.x = dot.raw.x / 1023.0f;
-        dot.normalized.y = dot.raw.y /  767.0f;
+} // namespace
 
-        // And check whether this IR dot is visible
-        dot.visible = dot.raw.x != 0x3FF && dot.raw.y != 0x3FF;
+bool wii::ParseIR(State& state, uint8_t const* buf)
+{
+    switch (state.ir.mode)
+    {
+    case IRData::Mode::Off:
+        return IRDecoder<IRData::Mode::Off>::Parse(state, buf);
+    case IRData::Mode::Basic:
+        return IRDecoder<IRData::Mode::Basic>::Parse(state, buf);
+    case IRData::Mode::Extended:
+        return IRDecoder<IRData::Mode::Extended>::Parse(state, buf);
     }
 
-    state.data |= State::IR;
-
-    return true;
+    return false;
 }
 
-bool wii::ParseCalibrationData(State& state, uint8_t const* buf, unsigned /*len*/, unsigned /*error*/)
+bool wii::ParseCalibrationData(State& state, uint8_t const* buf, unsigned /*len*/, unsigned /*error*/, CalibrationTables* tables)
 {
     //
     // TODO:
     // Use backup data on failure
     //
 
-    ParseAccelCalibrationData(state.accel.cal, buf);
+    ParseAccelCalibrationData(state.accel.cal, buf, tables ? &tables->accel : nullptr);
 
     return true;
 }
@@ -370,7 +395,7 @@ bool wii::ParseCalibrationData(State& state, uint8_t const* buf, unsigned /*len*
 // Extensions
 //--------------------------------------------------------------------------------------------------
 
-bool wii::ParseNunchuk(State& state, uint8_t const* buf, bool passthrough)
+bool wii::ParseNunchuk(State& state, uint8_t const* buf, bool passthrough, CalibrationTables const* tables)
 {
     NunchukData& nc = state.extension.nunchuk;
 
@@ -398,8 +423,8 @@ bool wii::ParseNunchuk(State& state, uint8_t const* buf, bool passthrough)
         nc.buttons = (~buf[5]) & 0x03;
     }
 
-    NormalizeAccel(nc.accel);
-    NormalizeStick(nc.stick);
+    NormalizeAccel(nc.accel, tables ? &tables->nunchukAccel : nullptr);
+    NormalizeStick(nc.stick, tables ? &tables->nunchukStick : nullptr);
 
     nc.buttonsPressed = RecentlySet(buttons, nc.buttons);
     nc.buttonsReleased = RecentlyCleared(buttons, nc.buttons);
@@ -409,7 +434,7 @@ bool wii::ParseNunchuk(State& state, uint8_t const* buf, bool passthrough)
     return true;
 }
 
-bool wii::ParseClassicController(State& state, uint8_t const* buf, bool passthrough)
+bool wii::ParseClassicController(State& state, uint8_t const* buf, bool passthrough, CalibrationTables const* tables)
 {
     ClassicControllerData& cc = state.extension.classic;
 
@@ -446,8 +471,8 @@ bool wii::ParseClassicController(State& state, uint8_t const* buf, bool passthro
     //
     // Normalize:
     //
-    NormalizeStick(cc.stickL);
-    NormalizeStick(cc.stickR);
+    NormalizeStick(cc.stickL, tables ? &tables->classicStickL : nullptr);
+    NormalizeStick(cc.stickR, tables ? &tables->classicStickR : nullptr);
 
     cc.buttonsPressed = RecentlySet(buttons, cc.buttons);
     cc.buttonsReleased = RecentlyCleared(buttons, cc.buttons);
@@ -495,63 +520,126 @@ bool wii::ParseMotionPlus(State& state, uint8_t const* buf)
     return true;
 }
 
-bool wii::ParseExtension(State& state, uint8_t const* buf)
+namespace
+{
+
+//
+// Decodes the extension data of an extension type
+//
+template <unsigned Type>
+struct ExtensionDecoder;
+
+template <>
+struct ExtensionDecoder<0>
 {
-    if (state.extension.type == 0)
+    static bool Parse(State& /*state*/, uint8_t const* /*buf*/, CalibrationTables const* /*tables*/)
+    {
         return true;
+    }
+};
 
-    unsigned motionPlus = state.extension.type &  Extension::MotionPlus;
-    unsigned other      = state.extension.type & ~Extension::MotionPlus;
+template <>
+struct ExtensionDecoder<Extension::Nunchuk>
+{
+    static bool Parse(State& state, uint8_t const* buf, CalibrationTables const* tables)
+    {
+        return ParseNunchuk(state, buf, false, tables);
+    }
+};
 
-    bool passthrough = motionPlus && other;
+template <>
+struct ExtensionDecoder<Extension::ClassicController>
+{
+    static bool Parse(State& state, uint8_t const* buf, CalibrationTables const* tables)
+    {
+        return ParseClassicController(state, buf, false, tables);
+    }
+};
 
-    if ((motionPlus && !other) || (passthrough && (buf[5] & 0x02)))
+template <>
+struct ExtensionDecoder<Extension::MotionPlus>
+{
+    static bool Parse(State& state, uint8_t const* buf, CalibrationTables const* /*tables*/)
     {
-        // This report contains motion-plus data
         return ParseMotionPlus(state, buf);
     }
-    else
+};
+
+// In pass-through mode, the reports alternate between motion-plus and extension data
+template <>
+struct ExtensionDecoder<Extension::MotionPlus | Extension::Nunchuk>
+{
+    static bool Parse(State& state, uint8_t const* buf, CalibrationTables const* tables)
     {
-        // This report contains extension data
-        switch (other)
-        {
-        case Extension::Nunchuk:
-            return ParseNunchuk(state, buf, passthrough);
-        case Extension::ClassicController:
-            return ParseClassicController(state, buf, passthrough);
-        }
+        if (buf[5] & 0x02)
+            return ParseMotionPlus(state, buf);
+        else
+            return ParseNunchuk(state, buf, true, tables);
+    }
+};
+
+template <>
+struct ExtensionDecoder<Extension::MotionPlus | Extension::ClassicController>
+{
+    static bool Parse(State& state, uint8_t const* buf, CalibrationTables const* tables)
+    {
+        if (buf[5] & 0x02)
+            return ParseMotionPlus(state, buf);
+        else
+            return ParseClassicController(state, buf, true, tables);
+    }
+};
+
+} // namespace
+
+bool wii::ParseExtension(State& state, uint8_t const* buf, CalibrationTables const* tables)
+{
+    switch (state.extension.type)
+    {
+    case 0:
+        return ExtensionDecoder<0>::Parse(state, buf, tables);
+    case Extension::Nunchuk:
+        return ExtensionDecoder<Extension::Nunchuk>::Parse(state, buf, tables);
+    case Extension::ClassicController:
+        return ExtensionDecoder<Extension::ClassicController>::Parse(state, buf, tables);
+    case Extension::MotionPlus:
+        return ExtensionDecoder<Extension::MotionPlus>::Parse(state, buf, tables);
+    case Extension::MotionPlus | Extension::Nunchuk:
+        return ExtensionDecoder<Extension::MotionPlus | Extension::Nunchuk>::Parse(state, buf, tables);
+    case Extension::MotionPlus | Extension::ClassicController:
+        return ExtensionDecoder<Extension::MotionPlus | Extension::ClassicController>::Parse(state, buf, tables);
     }
 
     return false;
 }
 
-bool wii::ParseNunchukCalibrationData(State& state, uint8_t const* buf, unsigned /*len*/, unsigned /*error*/)
+bool wii::ParseNunchukCalibrationData(State& state, uint8_t const* buf, unsigned /*len*/, unsigned /*error*/, CalibrationTables* tables)
 {
     //
     // TODO:
     // Use backup data on failure
     //
 
-    ParseAccelCalibrationData(state.extension.nunchuk.accel.cal, buf + 0);
-    ParseStickCalibrationData(state.extension.nunchuk.stick.cal, buf + 8);
+    ParseAccelCalibrationData(state.extension.nunchuk.accel.cal, buf + 0, tables ? &tables->nunchukAccel : nullptr);
+    ParseStickCalibrationData(state.extension.nunchuk.stick.cal, buf + 8, tables ? &tables->nunchukStick : nullptr);
 
     return true;
 }
 
-bool wii::ParseClassicControllerCalibrationData(State& state, uint8_t const* buf, unsigned /*len*/, unsigned /*error*/)
+bool wii::ParseClassicControllerCalibrationData(State& state, uint8_t const* buf, unsigned /*len*/, unsigned /*error*/, CalibrationTables* tables)
 {
     //
     // TODO:
     // Use backup data on failure
     //
 
-    ParseStickCalibrationData(state.extension.classic.stickL.cal, buf + 0);
-    ParseStickCalibrationData(state.extension.classic.stickR.cal, buf + 6);
+    ParseStickCalibrationData(state.extension.classic.stickL.cal, buf + 0, tables ? &tables->classicStickL : nullptr);
+    ParseStickCalibrationData(state.extension.classic.stickR.cal, buf + 6, tables ? &tables->classicStickR : nullptr);
 
     return 0;
 }
 
-bool wii::ParseExtensionCalibrationData(State& state, uint8_t const* buf, unsigned len, unsigned error)
+bool wii::ParseExtensionCalibrationData(State& state, uint8_t const* buf, unsigned len, unsigned error, CalibrationTables* tables)
 {
     // Get the extension type
     unsigned ext = state.extension.type & ~Extension::MotionPlus;
@@ -559,9 +647,9 @@ bool wii::ParseExtensionCalibrationData(State& state, uint8_t const* buf, unsign
     switch (ext)
     {
     case Extension::Nunchuk:
-        return ParseNunchukCalibrationData(state, buf, len, error);
+        return ParseNunchukCalibrationData(state, buf, len, error, tables);
     case Extension::ClassicController:
-        return ParseClassicControllerCalibrationData(state, buf, len, error);
+        return ParseClassicControllerCalibrationData(state, buf, len, error, tables);
     case 0:
         return true;
     }
@@ -611,3 +699,158 @@ bool wii::ParseMotionPlusCalibrationData(State& state, uint8_t const* buf, unsig
 
     return true;
 }
+
+//--------------------------------------------------------------------------------------------------
+// Data reports
+//--------------------------------------------------------------------------------------------------
+
+namespace
+{
+
+//
+// Decodes a data report with the given report id.
+// Mode and Type are the IR mode and the extension type.
+//
+template <unsigned Id>
+struct DataReport;
+
+template <>
+struct DataReport<0x30> // Buttons
+{
+    template <IRData::Mode Mode, unsigned Type>
+    static void Decode(State& state, uint8_t const* buf, CalibrationTables const* /*tables*/)
+    {
+        ParseButtons(state, buf + 1);
+    }
+};
+
+template <>
+struct DataReport<0x31> // ButtonsAccel
+{
+    template <IRData::Mode Mode, unsigned Type>
+    static void Decode(State& state, uint8_t const* buf, CalibrationTables const* tables)
+    {
+        ParseButtons(state, buf + 1);
+        ParseAccel(state, buf + 1, tables);
+    }
+};
+
+template <>
+struct DataReport<0x32> // ButtonsExt
+{
+    template <IRData::Mode Mode, unsigned Type>
+    static void Decode(State& state, uint8_t const* buf, CalibrationTables const* tables)
+    {
+        ParseButtons(state, buf + 1);
+        ExtensionDecoder<Type>::Parse(state, buf + 3, tables);
+    }
+};
+
+template <>
+struct DataReport<0x33> // ButtonsAccelIR (12 IR bytes)
+{
+    template <IRData::Mode Mode, unsigned Type>
+    static void Decode(State& state, uint8_t const* buf, CalibrationTables const* tables)
+    {
+        ParseButtons(state, buf + 1);
+        ParseAccel(state, buf + 1, tables);
+        IRDecoder<Mode>::Parse(state, buf + 6);
+    }
+};
+
+template <>
+struct DataReport<0x35> // ButtonsAccelExt
+{
+    template <IRData::Mode Mode, unsigned Type>
+    static void Decode(State& state, uint8_t const* buf, CalibrationTables const* tables)
+    {
+        ParseButtons(state, buf + 1);
+        ParseAccel(state, buf + 1, tables);
+        ExtensionDecoder<Type>::Parse(state, buf + 6, tables);
+    }
+};
+
+template <>
+struct DataReport<0x36> // ButtonsIRExt (10 IR bytes)
+{
+    template <IRData::Mode Mode, unsigned Type>
+    static void Decode(State& state, uint8_t const* buf, CalibrationTables const* tables)
+    {
+        ParseButtons(state, buf + 1);
+        IRDecoder<Mode>::Parse(state, buf + 3);
+        ExtensionDecoder<Type>::Parse(state, buf + 13, tables);
+    }
+};
+
+template <>
+struct DataReport<0x37> // ButtonsAccelIRExt (10 IR bytes)
+{
+    template <IRData::Mode Mode, unsigned Type>
+    static void Decode(State& state, uint8_t const* buf, CalibrationTables const* tables)
+    {
+        ParseButtons(state, buf + 1);
+        ParseAccel(state, buf + 1, tables);
+        IRDecoder<Mode>::Parse(state, buf + 6);
+        ExtensionDecoder<Type>::Parse(state, buf + 16, tables);
+    }
+};
+
+template <unsigned Id, IRData::Mode Mode>
+ReportDecoder SelectDecoder(unsigned extension)
+{
+    switch (extension)
+    {
+    case Extension::Nunchuk:
+        return &DataReport<Id>::template Decode<Mode, Extension::Nunchuk>;
+    case Extension::ClassicController:
+        return &DataReport<Id>::template Decode<Mode, Extension::ClassicController>;
+    case Extension::MotionPlus:
+        return &DataReport<Id>::template Decode<Mode, Extension::MotionPlus>;
+    case Extension::MotionPlus | Extension::Nunchuk:
+        return &DataReport<Id>::template Decode<Mode, Extension::MotionPlus | Extension::Nunchuk>;
+    case Extension::MotionPlus | Extension::ClassicController:
+        return &DataReport<Id>::template Decode<Mode, Extension::MotionPlus | Extension::ClassicController>;
+    default:
+        // No (known) extension: the extension data is ignored
+        return &DataReport<Id>::template Decode<Mode, 0>;
+    }
+}
+
+template <unsigned Id>
+ReportDecoder SelectDecoder(IRData::Mode mode, unsigned extension)
+{
+    switch (mode)
+    {
+    case IRData::Mode::Basic:
+        return SelectDecoder<Id, IRData::Mode::Basic>(extension);
+    case IRData::Mode::Extended:
+        return SelectDecoder<Id, IRData::Mode::Extended>(extension);
+    default:
+        return SelectDecoder<Id, IRData::Mode::Off>(extension);
+    }
+}
+
+} // namespace
+
+ReportDecoder wii::GetReportDecoder(unsigned id, IRData::Mode mode, unsigned extension)
+{
+    switch (id)
+    {
+    case 0x30:
+        return SelectDecoder<0x30>(mode, extension);
+    case 0x31:
+        return SelectDecoder<0x31>(mode, extension);
+    case 0x32:
+        return SelectDecoder<0x32>(mode, extension);
+    case 0x33:
+        return SelectDecoder<0x33>(mode, extension);
+    case 0x35:
+        return SelectDecoder<0x35>(mode, extension);
+    case 0x36:
+        return SelectDecoder<0x36>(mode, extension);
+    case 0x37:
+        return SelectDecoder<0x37>(mode, extension);
+    }
+
+    return nullptr;
+}
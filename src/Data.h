@@ -12,9 +12,33 @@ namespace wii
 // Common
 //--------------------------------------------------------------------------------------------------
 
-bool ParseAccelCalibrationData(AccelData::CalibrationData& cal, uint8_t const* buf);
+//
+// Normalized value of every raw accelerometer (10 bits) and joystick (8 bits) value of each
+// axis, computed from the calibration data whenever it is read. Normalizing a value is then a
+// table lookup.
+//
+// The tables belong to the Wiimote (see Wiimote::Impl); the parse functions below which take
+// them fill or use them. Without tables, the values are normalized with the calibration data
+// in State, with the same results.
+//
+struct CalibrationTables
+{
+    typedef float Accel[3][1024];
+    typedef float Stick[2][256];
+
+    // Wiimote accelerometer
+    Accel accel;
+    // Nunchuk accelerometer and joystick
+    Accel nunchukAccel;
+    Stick nunchukStick;
+    // Classic controller joysticks
+    Stick classicStickL;
+    Stick classicStickR;
+};
 
-bool ParseStickCalibrationData(JoystickData::CalibrationData& cal, uint8_t const* buf);
+bool ParseAccelCalibrationData(AccelData::CalibrationData& cal, uint8_t const* buf, CalibrationTables::Accel* table = nullptr);
+
+bool ParseStickCalibrationData(JoystickData::CalibrationData& cal, uint8_t const* buf, CalibrationTables::Stick* table = nullptr);
 
 //--------------------------------------------------------------------------------------------------
 // Wiimote
@@ -22,30 +46,44 @@ bool ParseStickCalibrationData(JoystickData::CalibrationData& cal, uint8_t const
 
 bool ParseButtons(State& state, uint8_t const* buf);
 
-bool ParseAccel(State& state, uint8_t const* buf);
+bool ParseAccel(State& state, uint8_t const* buf, CalibrationTables const* tables = nullptr);
 
 bool ParseIR(State& state, uint8_t const* buf);
 
-bool ParseCalibrationData(State& state, uint8_t const* buf, unsigned len, unsigned error);
+bool ParseCalibrationData(State& state, uint8_t const* buf, unsigned len, unsigned error, CalibrationTables* tables = nullptr);
 
 //--------------------------------------------------------------------------------------------------
 // Extensions
 //--------------------------------------------------------------------------------------------------
 
-bool ParseNunchuk(State& state, uint8_t const* buf, bool passthrough = false);
+bool ParseNunchuk(State& state, uint8_t const* buf, bool passthrough = false, CalibrationTables const* tables = nullptr);
 
-bool ParseClassicController(State& state, uint8_t const* buf, bool passthrough = false);
+bool ParseClassicController(State& state, uint8_t const* buf, bool passthrough = false, CalibrationTables const* tables = nullptr);
 
 bool ParseMotionPlus(State& state, uint8_t const* buf);
 
-bool ParseExtension(State& state, uint8_t const* buf);
+bool ParseExtension(State& state, uint8_t const* buf, CalibrationTables const* tables = nullptr);
 
-bool ParseNunchukCalibrationData(State& state, uint8_t const* buf, unsigned len, unsigned error);
+bool ParseNunchukCalibrationData(State& state, uint8_t const* buf, unsigned len, unsigned error, CalibrationTables* tables = nullptr);
 
-bool ParseClassicControllerCalibrationData(State& state, uint8_t const* buf, unsigned len, unsigned error);
+bool ParseClassicControllerCalibrationData(State& state, uint8_t const* buf, unsigned len, unsigned error, CalibrationTables* tables = nullptr);
 
-bool ParseExtensionCalibrationData(State& state, uint8_t const* buf, unsigned len, unsigned error);
+bool ParseExtensionCalibrationData(State& state, uint8_t const* buf, unsigned len, unsigned error, CalibrationTables* tables = nullptr);
 
 bool ParseMotionPlusCalibrationData(State& state, uint8_t const* buf, unsigned len, unsigned error);
 
+//--------------------------------------------------------------------------------------------------
+// Data reports
+//--------------------------------------------------------------------------------------------------
+
+// Decodes a data report (0x30-0x37, including the report id) into the state.
+// 'tables' may be null (see CalibrationTables).
+typedef void (*ReportDecoder)(State& state, uint8_t const* buf, CalibrationTables const* tables);
+
+// Returns a decoder specialized for the given report id, IR mode and extension type,
+// or null if the report id is not a data report.
+// The decoder has the same effect as ParseButtons/ParseAccel/ParseIR/ParseExtension
+// for the report, with the report layout, IR mode and extension type known in advance.
+ReportDecoder GetReportDecoder(unsigned id, IRData::Mode mode, unsigned extension);
+
 } // namespace wii
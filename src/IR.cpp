@@ -0,0 +1,286 @@
+// This file is distributed under the MIT license.
+// See the LICENSE file for details.
+
+#include "IR.h"
+#include "Simd.h"
+
+#include <cstring>
+
+using namespace wii;
+
+//--------------------------------------------------------------------------------------------------
+//
+//--------------------------------------------------------------------------------------------------
+
+namespace
+{
+
+//
+// In Basic Mode, the IR Camera returns 10 bytes of data corresponding to the X and Y
+// locations of each of the four dots. Each location is encoded in 10 bits and has a range of
+// 0-1023 for the X dimension, and 0-767 for the Y dimension. Each pair of dots is packed into
+// 5 bytes, and two of these are transmitted for a total of 4 dots and 10 bytes.
+//
+// In Extended Mode, the IR Camera returns the same data as it does in Basic Mode, plus a
+// rough size value for each object. The data is returned as 12 bytes, three bytes per
+// object. Size has a range of 0-15.
+//
+
+// Raw coordinates 0x3FF mark dots which are not visible
+#define WII_IR_INVISIBLE 0x3FF
+
+//
+// Per report, the vectorized code needs byte shuffles (SSSE3) to beat the scalar code: with
+// SSE2 alone, gathering the bytes into the lanes costs more than the vector operations save.
+//
+
+#if WII_HAVE_SSSE3
+
+//
+// The IR data of both modes is unpacked into eight 16-bit lanes -- the x coordinates of the
+// four dots followed by their y coordinates -- as
+//
+//      raw[k] = buf[lo[k]] | (buf[hi[k]] & mask[k]) * scale[k]
+//
+struct Layout
+{
+    uint8_t lo[8];
+    uint8_t hi[8];
+    uint16_t mask[8];
+    uint16_t scale[8];
+    // lo and hi as byte shuffles into 16-bit lanes (0x80 clears the high byte of a lane)
+    uint8_t shuffleLo[16];
+    uint8_t shuffleHi[16];
+};
+
+// NOTE: The high bits of dot 2 and 3 are taken from byte 5, just like ParseIR always did.
+const Layout kBasic = {
+    {    0,     3,     5,     8,      1,     4,     6,     9 },
+    {    2,     2,     5,     5,      2,     2,     5,     5 },
+    { 0x30,  0x03,  0x30,  0x03,   0xC0,  0x0C,  0xC0,  0x0C },
+    {   16,   256,    16,   256,      4,    64,     4,    64 },
+    { 0, 0x80, 3, 0x80, 5, 0x80, 8, 0x80,   1, 0x80, 4, 0x80, 6, 0x80, 9, 0x80 },
+    { 2, 0x80, 2, 0x80, 5, 0x80, 5, 0x80,   2, 0x80, 2, 0x80, 5, 0x80, 5, 0x80 },
+};
+
+const Layout kExtended = {
+    {    0,     3,     6,     9,      1,     4,     7,    10 },
+    {    2,     5,     8,    11,      2,     5,     8,    11 },
+    { 0x30,  0x30,  0x30,  0x30,   0xC0,  0xC0,  0xC0,  0xC0 },
+    {   16,    16,    16,    16,      4,     4,     4,     4 },
+    { 0, 0x80, 3, 0x80, 6, 0x80, 9, 0x80,   1, 0x80, 4, 0x80, 7, 0x80, 10, 0x80 },
+    { 2, 0x80, 5, 0x80, 8, 0x80, 11, 0x80,  2, 0x80, 5, 0x80, 8, 0x80, 11, 0x80 },
+};
+
+// Unpack the raw coordinates of the four dots into eight 16-bit lanes
+inline __m128i UnpackRaw(Layout const& layout, uint8_t const* buf, unsigned len)
+{
+    //
+    // Move the bytes into place with a single shuffle each.
+    //
+    // NOTE: The bytes are loaded straight from the report; copying them into a 16 byte buffer
+    // first stalls the load until the copy has been written.
+    //
+
+    uint32_t tail = buf[8] | (buf[9] << 8);
+
+    if (len > 10)
+        tail |= (buf[10] << 16) | (buf[11] << 24);
+
+    __m128i data = _mm_unpacklo_epi64(_mm_loadl_epi64(reinterpret_cast<__m128i const*>(buf)),
+                                      _mm_cvtsi32_si128(static_cast<int>(tail)));
+
+    __m128i lo = _mm_shuffle_epi8(data, _mm_loadu_si128(reinterpret_cast<__m128i const*>(layout.shuffleLo)));
+    __m128i hi = _mm_shuffle_epi8(data, _mm_loadu_si128(reinterpret_cast<__m128i const*>(layout.shuffleHi)));
+
+    __m128i mask = _mm_loadu_si128(reinterpret_cast<__m128i const*>(layout.mask));
+    __m128i scale = _mm_loadu_si128(reinterpret_cast<__m128i const*>(layout.scale));
+
+    return _mm_or_si128(lo, _mm_mullo_epi16(_mm_and_si128(hi, mask), scale));
+}
+
+// Unpack, normalize and store the four dots
+inline void Unpack(IRData& ir, Layout const& layout, uint8_t const* buf, unsigned len)
+{
+    __m128i raw = UnpackRaw(layout, buf, len);
+
+    __m128i x = _mm_unpacklo_epi16(raw, _mm_setzero_si128());
+    __m128i y = _mm_unpackhi_epi16(raw, _mm_setzero_si128());
+
+    __m128 nx = _mm_div_ps(_mm_cvtepi32_ps(x), _mm_set1_ps(1023.0f));
+    __m128 ny = _mm_div_ps(_mm_cvtepi32_ps(y), _mm_set1_ps( 767.0f));
+
+    //
+    // A dot is invisible if either of its coordinates is 0x3FF.
+    // Fold the y lanes onto the x lanes and collect one bit per dot.
+    //
+
+    __m128i hidden = _mm_cmpeq_epi16(raw, _mm_set1_epi16(WII_IR_INVISIBLE));
+
+    hidden = _mm_or_si128(hidden, _mm_srli_si128(hidden, 8));
+
+    unsigned visible = ~_mm_movemask_epi8(_mm_packs_epi16(hidden, hidden)) & 0x0F;
+
+    int32_t rx[4];
+    int32_t ry[4];
+    float fx[4];
+    float fy[4];
+
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(rx), x);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(ry), y);
+    _mm_storeu_ps(fx, nx);
+    _mm_storeu_ps(fy, ny);
+
+    for (unsigned n = 0; n < 4; ++n)
+    {
+        IRData::Dot& dot = ir.dots[n];
+
+        dot.raw.x = rx[n];
+        dot.raw.y = ry[n];
+        dot.normalized.x = fx[n];
+        dot.normalized.y = fy[n];
+        dot.visible = ((visible >> n) & 1) != 0;
+    }
+}
+
+#else
+
+//
+// Without byte shuffles, the scalar code ParseIR always used is faster than reading the
+// layout tables: the shifts are compiled into the code.
+//
+
+// Normalize the dot positions and check which dots are visible
+inline void Normalize(IRData& ir)
+{
+    for (auto& dot : ir.dots)
+    {
+        // Compute normalized position
+        dot.normalized.x = dot.raw.x / 1023.0f;
+        dot.normalized.y = dot.raw.y /  767.0f;
+
+        // And check whether this IR dot is visible
+        dot.visible = dot.raw.x != WII_IR_INVISIBLE && dot.raw.y != WII_IR_INVISIBLE;
+    }
+}
+
+// NOTE: The high bits of dot 2 and 3 are taken from byte 5, just like ParseIR always did.
+inline void UnpackBasic(IRData& ir, uint8_t const* buf)
+{
+    ir.dots[0].raw.x = buf[0] | ((buf[2] & 0x30) << 4);
+    ir.dots[0].raw.y = buf[1] | ((buf[2] & 0xC0) << 2);
+    ir.dots[1].raw.x = buf[3] | ((buf[2] & 0x03) << 8);
+    ir.dots[1].raw.y = buf[4] | ((buf[2] & 0x0C) << 6);
+    ir.dots[2].raw.x = buf[5] | ((buf[5] & 0x30) << 4);
+    ir.dots[2].raw.y = buf[6] | ((buf[5] & 0xC0) << 2);
+    ir.dots[3].raw.x = buf[8] | ((buf[5] & 0x03) << 8);
+    ir.dots[3].raw.y = buf[9] | ((buf[5] & 0x0C) << 6);
+
+    Normalize(ir);
+}
+
+inline void UnpackExtended(IRData& ir, uint8_t const* buf)
+{
+    for (unsigned n = 0; n < 4; ++n, buf += 3)
+    {
+        ir.dots[n].raw.x = buf[0] | ((buf[2] & 0x30) << 4);
+        ir.dots[n].raw.y = buf[1] | ((buf[2] & 0xC0) << 2);
+    }
+
+    Normalize(ir);
+}
+
+#endif
+
+} // namespace
+
+//--------------------------------------------------------------------------------------------------
+//
+//--------------------------------------------------------------------------------------------------
+
+template <>
+void wii::UnpackIR<IRData::Mode::Basic>(IRData& ir, uint8_t const* buf)
+{
+#if WII_HAVE_SSSE3
+    Unpack(ir, kBasic, buf, 10);
+#else
+    UnpackBasic(ir, buf);
+#endif
+
+    ir.dots[0].size = 0;
+    ir.dots[1].size = 0;
+    ir.dots[2].size = 0;
+    ir.dots[3].size = 0;
+}
+
+template <>
+void wii::UnpackIR<IRData::Mode::Extended>(IRData& ir, uint8_t const* buf)
+{
+#if WII_HAVE_SSSE3
+    Unpack(ir, kExtended, buf, 12);
+#else
+    UnpackExtended(ir, buf);
+#endif
+
+    ir.dots[0].size = buf[ 2] & 0x0F;
+    ir.dots[1].size = buf[ 5] & 0x0F;
+    ir.dots[2].size = buf[ 8] & 0x0F;
+    ir.dots[3].size = buf[11] & 0x0F;
+}
+
+void wii::NormalizeIR(uint16_t const* const x[4], uint16_t const* const y[4], float* const nx[4], float* const ny[4], uint8_t* visible, size_t count)
+{
+    size_t i = 0;
+
+#if WII_HAVE_SSE2
+    //
+    // Eight reports at a time
+    //
+
+    for (; i + 8 <= count; i += 8)
+    {
+        __m128i bits = _mm_setzero_si128();
+
+        for (unsigned n = 0; n < 4; ++n)
+        {
+            __m128i rx = _mm_loadu_si128(reinterpret_cast<__m128i const*>(x[n] + i));
+            __m128i ry = _mm_loadu_si128(reinterpret_cast<__m128i const*>(y[n] + i));
+
+#if WII_HAVE_AVX2
+            _mm256_storeu_ps(nx[n] + i, _mm256_div_ps(_mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(rx)), _mm256_set1_ps(1023.0f)));
+            _mm256_storeu_ps(ny[n] + i, _mm256_div_ps(_mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(ry)), _mm256_set1_ps( 767.0f)));
+#else
+            __m128i zero = _mm_setzero_si128();
+
+            _mm_storeu_ps(nx[n] + i,     _mm_div_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(rx, zero)), _mm_set1_ps(1023.0f)));
+            _mm_storeu_ps(nx[n] + i + 4, _mm_div_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(rx, zero)), _mm_set1_ps(1023.0f)));
+            _mm_storeu_ps(ny[n] + i,     _mm_div_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(ry, zero)), _mm_set1_ps( 767.0f)));
+            _mm_storeu_ps(ny[n] + i + 4, _mm_div_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(ry, zero)), _mm_set1_ps( 767.0f)));
+#endif
+
+            __m128i hidden = _mm_or_si128(_mm_cmpeq_epi16(rx, _mm_set1_epi16(WII_IR_INVISIBLE)),
+                                          _mm_cmpeq_epi16(ry, _mm_set1_epi16(WII_IR_INVISIBLE)));
+
+            bits = _mm_or_si128(bits, _mm_andnot_si128(hidden, _mm_set1_epi16(static_cast<short>(1 << n))));
+        }
+
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(visible + i), _mm_packus_epi16(bits, bits));
+    }
+#endif
+
+    for (; i < count; ++i)
+    {
+        unsigned bits = 0;
+
+        for (unsigned n = 0; n < 4; ++n)
+        {
+            nx[n][i] = x[n][i] / 1023.0f;
+            ny[n][i] = y[n][i] /  767.0f;
+
+            if (x[n][i] != WII_IR_INVISIBLE && y[n][i] != WII_IR_INVISIBLE)
+                bits |= 1u << n;
+        }
+
+        visible[i] = static_cast<uint8_t>(bits);
+    }
+}
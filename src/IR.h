@@ -0,0 +1,30 @@
+// This file is distributed under the MIT license.
+// See the LICENSE file for details.
+
+#pragma once
+
+#include "Wiimote/Wiimote.h"
+
+#include <cstddef>
+#include <cstdint>
+
+namespace wii
+{
+
+// Unpack the raw IR data of a single report, normalize the dot positions and determine
+// which dots are visible.
+// 'buf' points to the 10 (Basic) or 12 (Extended) bytes of IR data.
+template <IRData::Mode Mode>
+void UnpackIR(IRData& ir, uint8_t const* buf);
+
+template <>
+void UnpackIR<IRData::Mode::Basic>(IRData& ir, uint8_t const* buf);
+
+template <>
+void UnpackIR<IRData::Mode::Extended>(IRData& ir, uint8_t const* buf);
+
+// Normalize 'count' raw dot positions of each of the four dots (columns x[n] and y[n]) into
+// nx[n] and ny[n]. Sets bit n of visible[i] if dot n of report i is visible.
+void NormalizeIR(uint16_t const* const x[4], uint16_t const* const y[4], float* const nx[4], float* const ny[4], uint8_t* visible, size_t count);
+
+} // namespace wii
@@ -0,0 +1,801 @@
+// This file is distributed under the MIT license.
+// See the LICENSE file for details.
+
+#include "Wiimote/Capture.h"
+
+#include "Capture.h"
+#include "Log.h"
+#include "Utils.h"
+#include "Wiimpl.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <map>
+#include <set>
+#include <thread>
+#include <vector>
+
+using namespace wii;
+
+//
+// Maximum number of imported records which may wait for the capture's writer thread.
+// The import waits for the writer beyond that, so that a trace never piles up in memory.
+//
+#define WII_IMPORT_MAX_PENDING          (1024 * 1024)
+
+// Largest packet or block accepted from a trace
+#define WII_IMPORT_MAX_PACKET           (256 * 1024)
+
+// HCI packet types (H4)
+#define WII_HCI_COMMAND                 0x01
+#define WII_HCI_ACL                     0x02
+#define WII_HCI_EVENT                   0x04
+
+// HCI events
+#define WII_HCI_CONNECTION_COMPLETE     0x03
+#define WII_HCI_DISCONNECTION_COMPLETE  0x05
+
+// L2CAP signaling channel and commands
+#define WII_L2CAP_SIGNALING             0x0001
+#define WII_L2CAP_CONNECTION_REQUEST    0x02
+#define WII_L2CAP_CONNECTION_RESPONSE   0x03
+#define WII_L2CAP_FIRST_DYNAMIC_CID     0x0040
+
+// PSM of the HID interrupt channel
+#define WII_PSM_HID_INTERRUPT           0x13
+
+// HID transaction headers of input and output reports
+#define WII_HID_INPUT                   0xA1
+#define WII_HID_OUTPUT                  0xA2
+
+// Microseconds from 0 AD to 1970 (btsnoop time stamps)
+#define WII_BTSNOOP_EPOCH               0x00DCDDB30F2F8000ull
+
+// Packet types of the Linux monitor (btmon)
+#define WII_MONITOR_EVENT               3
+#define WII_MONITOR_ACL_TX              4
+#define WII_MONITOR_ACL_RX              5
+
+// pcap link types
+#define WII_LINKTYPE_H4                 187
+#define WII_LINKTYPE_H4_WITH_PHDR       201
+#define WII_LINKTYPE_MONITOR            254
+
+// pcapng block types
+#define WII_PCAPNG_SECTION              0x0A0D0D0A
+#define WII_PCAPNG_INTERFACE            1
+#define WII_PCAPNG_ENHANCED_PACKET      6
+
+//--------------------------------------------------------------------------------------------------
+//
+//--------------------------------------------------------------------------------------------------
+
+namespace
+{
+
+// Direction of a packet as seen by the host
+enum Direction : unsigned {
+    Sent        = 0,
+    Received    = 1,
+    Unknown     = 2,
+};
+
+inline uint32_t ReadU32(uint8_t const* p, bool bigEndian)
+{
+    return bigEndian ? static_cast<uint32_t>(Read32(p)) : ReadLE32(p);
+}
+
+inline unsigned ReadU16(uint8_t const* p, bool bigEndian)
+{
+    return bigEndian ? Read16(p) : ReadLE16(p);
+}
+
+// Whether the report id belongs to a Wiimote report with the given HID header
+inline bool IsWiimoteReport(unsigned header, unsigned id)
+{
+    if (header == WII_HID_INPUT)
+        return (id >= 0x20 && id <= 0x22) || (id >= 0x30 && id <= 0x3F);
+
+    return id >= 0x10 && id <= 0x1A;
+}
+
+//
+// Follows the HCI traffic of a trace and records the Wiimote reports.
+//
+// The HID interrupt channels are found from the L2CAP connection requests. Connections
+// which have been set up before the trace started are recognized by their reports.
+//
+class TraceImporter
+{
+    // The capture
+    CaptureWriter& capture;
+    // Statistics
+    ImportStats& stats;
+    // Number of records the capture had written and dropped before the import
+    unsigned long long written;
+    unsigned long long dropped;
+    // Whether the capture has dropped imported records
+    bool failed;
+    // Bluetooth address by connection -- if the connection has been set up in the trace
+    std::map<unsigned, uint64_t> links;
+    // Device id by connection
+    std::map<unsigned, unsigned> devices;
+    // Device id by Bluetooth address
+    std::map<uint64_t, unsigned> addresses;
+    // Connections whose L2CAP channels have been set up in the trace
+    std::set<unsigned> signaled;
+    // PSM of pending L2CAP connection requests by connection, direction and source CID
+    std::map<uint64_t, unsigned> requests;
+    // HID interrupt channels by connection, direction and destination CID
+    std::set<uint64_t> channels;
+    // Incomplete L2CAP frames by connection and direction
+    std::map<uint64_t, std::vector<uint8_t>> fragments;
+
+public:
+    TraceImporter(CaptureWriter& capture, ImportStats& stats)
+        : capture(capture)
+        , stats(stats)
+        , written(capture.Written())
+        , dropped(capture.Dropped())
+        , failed(false)
+        , links()
+        , devices()
+        , addresses()
+        , signaled()
+        , requests()
+        , channels()
+        , fragments()
+    {
+    }
+
+    // Process an HCI packet (without the H4 packet type).
+    // Connections of different adapters are told apart by 'adapter'.
+    void Packet(double time, unsigned adapter, unsigned type, unsigned direction, uint8_t const* data, size_t size);
+
+    // Process a packet of the Linux monitor
+    void MonitorPacket(double time, unsigned adapter, unsigned opcode, uint8_t const* data, size_t size);
+
+    // Process a packet of the given pcap link type
+    void LinkPacket(double time, unsigned linkType, uint8_t const* data, size_t size);
+
+    // Whether the capture has dropped records; the import must stop
+    bool Failed() const { return failed; }
+
+    // Wait until at most 'pending' imported records wait for the capture's writer thread.
+    // Returns false once the capture has dropped records; they are never written.
+    bool Wait(unsigned long long pending);
+
+private:
+    // Process an HCI event
+    void Event(unsigned adapter, uint8_t const* data, size_t size);
+
+    // Process an ACL packet; reassembles the L2CAP frames
+    void Acl(double time, unsigned adapter, unsigned direction, uint8_t const* data, size_t size);
+
+    // Process a complete L2CAP frame
+    void Frame(double time, unsigned connection, unsigned direction, uint8_t const* data, size_t size);
+
+    // Process the commands on the L2CAP signaling channel
+    void Signaling(unsigned connection, unsigned direction, uint8_t const* data, size_t size);
+
+    // Record a HID report, including the transaction header.
+    // Waits for the capture's writer thread if too many records are pending.
+    void Report(double time, unsigned connection, uint8_t const* data, size_t size);
+
+    // Forget a closed connection
+    void Close(unsigned connection);
+
+    static uint64_t Key(unsigned connection, unsigned direction, unsigned cid)
+    {
+        return static_cast<uint64_t>(connection) << 20 | static_cast<uint64_t>(direction) << 16 | cid;
+    }
+};
+
+void TraceImporter::Packet(double time, unsigned adapter, unsigned type, unsigned direction, uint8_t const* data, size_t size)
+{
+    switch (type)
+    {
+    case WII_HCI_EVENT:
+        Event(adapter, data, size);
+        break;
+
+    case WII_HCI_ACL:
+        Acl(time, adapter, direction, data, size);
+        break;
+
+    default:
+        break;
+    }
+}
+
+void TraceImporter::MonitorPacket(double time, unsigned adapter, unsigned opcode, uint8_t const* data, size_t size)
+{
+    switch (opcode)
+    {
+    case WII_MONITOR_EVENT:
+        Packet(time, adapter, WII_HCI_EVENT, Received, data, size);
+        break;
+
+    case WII_MONITOR_ACL_TX:
+        Packet(time, adapter, WII_HCI_ACL, Sent, data, size);
+        break;
+
+    case WII_MONITOR_ACL_RX:
+        Packet(time, adapter, WII_HCI_ACL, Received, data, size);
+        break;
+
+    default:
+        break;
+    }
+}
+
+void TraceImporter::LinkPacket(double time, unsigned linkType, uint8_t const* data, size_t size)
+{
+    switch (linkType)
+    {
+    case WII_LINKTYPE_H4:
+        if (size >= 1)
+            Packet(time, 0, data[0], Unknown, data + 1, size - 1);
+        break;
+
+    case WII_LINKTYPE_H4_WITH_PHDR:
+        if (size >= 5)
+            Packet(time, 0, data[4], Read32(data) == 0 ? Sent : Received, data + 5, size - 5);
+        break;
+
+    case WII_LINKTYPE_MONITOR:
+        if (size >= 4)
+            MonitorPacket(time, Read16(data), Read16(data + 2), data + 4, size - 4);
+        break;
+
+    default:
+        break;
+    }
+}
+
+void TraceImporter::Event(unsigned adapter, uint8_t const* data, size_t size)
+{
+    if (size < 2 || size - 2 < data[1])
+        return;
+
+    uint8_t const* params = data + 2;
+
+    switch (data[0])
+    {
+    case WII_HCI_CONNECTION_COMPLETE:
+        if (data[1] >= 9 && params[0] == 0)
+        {
+            unsigned connection = adapter << 12 | (ReadLE16(params + 1) & 0x0FFF);
+
+            uint64_t address = 0;
+
+            for (int i = 5; i >= 0; --i)
+                address = address << 8 | params[3 + i];
+
+            Close(connection);
+
+            links[connection] = address;
+        }
+        break;
+
+    case WII_HCI_DISCONNECTION_COMPLETE:
+        if (data[1] >= 3 && params[0] == 0)
+            Close(adapter << 12 | (ReadLE16(params + 1) & 0x0FFF));
+        break;
+
+    default:
+        break;
+    }
+}
+
+void TraceImporter::Acl(double time, unsigned adapter, unsigned direction, uint8_t const* data, size_t size)
+{
+    if (size < 4)
+        return;
+
+    unsigned header = ReadLE16(data);
+    unsigned connection = adapter << 12 | (header & 0x0FFF);
+    unsigned boundary = (header >> 12) & 0x03;
+
+    size_t length = std::min<size_t>(ReadLE16(data + 2), size - 4);
+
+    uint8_t const* payload = data + 4;
+
+    uint64_t key = Key(connection, direction, 0);
+
+    if (boundary == 0x01)
+    {
+        //
+        // Continuation of a fragmented frame
+        //
+
+        auto it = fragments.find(key);
+
+        if (it == fragments.end())
+            return;
+
+        std::vector<uint8_t>& frame = it->second;
+
+        frame.insert(frame.end(), payload, payload + length);
+
+        if (frame.size() >= 4 && frame.size() >= ReadLE16(frame.data()) + 4u)
+        {
+            Frame(time, connection, direction, frame.data(), frame.size());
+
+            fragments.erase(it);
+        }
+        else if (frame.size() > WII_IMPORT_MAX_PACKET)
+        {
+            fragments.erase(it);
+        }
+
+        return;
+    }
+
+    fragments.erase(key);
+
+    // Wiimote reports always fit into a single packet
+    if (length >= 4 && length >= ReadLE16(payload) + 4u)
+        Frame(time, connection, direction, payload, length);
+    else
+        fragments[key].assign(payload, payload + length);
+}
+
+void TraceImporter::Frame(double time, unsigned connection, unsigned direction, uint8_t const* data, size_t /*size*/)
+{
+    unsigned length = ReadLE16(data);
+    unsigned cid = ReadLE16(data + 2);
+
+    uint8_t const* payload = data + 4;
+
+    if (cid == WII_L2CAP_SIGNALING)
+    {
+        Signaling(connection, direction, payload, length);
+        return;
+    }
+
+    if (cid < WII_L2CAP_FIRST_DYNAMIC_CID)
+        return;
+
+    if (signaled.count(connection) != 0 && channels.count(Key(connection, direction, cid)) == 0)
+        return;
+
+    Report(time, connection, payload, length);
+}
+
+void TraceImporter::Signaling(unsigned connection, unsigned direction, uint8_t const* data, size_t size)
+{
+    // The channels can only be told apart if the direction is known
+    if (direction == Unknown)
+        return;
+
+    while (size >= 4)
+    {
+        unsigned code = data[0];
+        unsigned length = ReadLE16(data + 2);
+
+        if (size - 4 < length)
+            break;
+
+        uint8_t const* params = data + 4;
+
+        if (code == WII_L2CAP_CONNECTION_REQUEST && length >= 4)
+        {
+            unsigned psm = ReadLE16(params);
+            unsigned scid = ReadLE16(params + 2);
+
+            requests[Key(connection, direction, scid)] = psm;
+
+            signaled.insert(connection);
+        }
+        else if (code == WII_L2CAP_CONNECTION_RESPONSE && length >= 8)
+        {
+            unsigned dcid = ReadLE16(params);
+            unsigned scid = ReadLE16(params + 2);
+            unsigned result = ReadLE16(params + 4);
+
+            // The request went the other way
+            unsigned requester = direction == Sent ? Received : Sent;
+
+            auto it = requests.find(Key(connection, requester, scid));
+
+            // Result 1: pending
+            if (it != requests.end() && result != 1)
+            {
+                if (result == 0 && it->second == WII_PSM_HID_INTERRUPT)
+                {
+                    // Frames are addressed to the CID of the receiving side
+                    channels.insert(Key(connection, requester, dcid));
+                    channels.insert(Key(connection, direction, scid));
+                }
+
+                requests.erase(it);
+            }
+        }
+
+        data += 4 + length;
+        size -= 4 + length;
+    }
+}
+
+void TraceImporter::Report(double time, unsigned connection, uint8_t const* data, size_t size)
+{
+    if (size < 2 || size - 1 > WII_REPORT_LENGTH)
+        return;
+
+    unsigned header = data[0];
+
+    if (header != WII_HID_INPUT && header != WII_HID_OUTPUT)
+        return;
+
+    if (failed || !IsWiimoteReport(header, data[1]))
+        return;
+
+    //
+    // Every Wiimote gets its own device id. A Wiimote keeps its id when it reconnects.
+    //
+
+    auto it = devices.find(connection);
+
+    if (it == devices.end())
+    {
+        unsigned device = stats.devices;
+
+        auto link = links.find(connection);
+
+        if (link != links.end())
+        {
+            auto address = addresses.insert(std::make_pair(link->second, device));
+
+            device = address.first->second;
+        }
+
+        if (device == stats.devices)
+            stats.devices++;
+
+        it = devices.insert(std::make_pair(connection, device)).first;
+    }
+
+    auto direction = header == WII_HID_INPUT ? CaptureWriter::Direction::Input : CaptureWriter::Direction::Output;
+
+    capture.Record(time, it->second, direction, data + 1, static_cast<unsigned>(size - 1));
+
+    stats.reports++;
+
+    // Give the writer thread a chance to catch up
+    Wait(WII_IMPORT_MAX_PENDING);
+}
+
+bool TraceImporter::Wait(unsigned long long pending)
+{
+    while (!failed)
+    {
+        if (capture.Dropped() != dropped)
+        {
+            WII_LOG(IO, "Capture dropped imported records.\n");
+
+            failed = true;
+        }
+        else if (stats.reports <= capture.Written() - written + pending)
+        {
+            break;
+        }
+        else
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    return !failed;
+}
+
+void TraceImporter::Close(unsigned connection)
+{
+    links.erase(connection);
+    devices.erase(connection);
+    signaled.erase(connection);
+
+    uint64_t first = Key(connection, 0, 0);
+    uint64_t last = Key(connection + 1, 0, 0);
+
+    requests.erase(requests.lower_bound(first), requests.lower_bound(last));
+    channels.erase(channels.lower_bound(first), channels.lower_bound(last));
+    fragments.erase(fragments.lower_bound(first), fragments.lower_bound(last));
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+//--------------------------------------------------------------------------------------------------
+
+// Read exactly size bytes
+inline bool ReadBytes(FILE* file, uint8_t* data, size_t size)
+{
+    return fread(data, 1, size, file) == size;
+}
+
+// Read a packet of the given size into buffer
+inline bool ReadPacket(FILE* file, std::vector<uint8_t>& buffer, size_t size)
+{
+    if (size > WII_IMPORT_MAX_PACKET)
+    {
+        WII_LOG(IO, "Trace packet too large: %u bytes.\n", static_cast<unsigned>(size));
+        return false;
+    }
+
+    buffer.resize(size);
+
+    return size == 0 || ReadBytes(file, buffer.data(), size);
+}
+
+bool ReadBtsnoop(FILE* file, TraceImporter& importer, ImportStats& stats)
+{
+    uint8_t header[16];
+
+    if (!ReadBytes(file, header, sizeof(header)) || memcmp(header, "btsnoop\0", 8) != 0)
+        return false;
+
+    unsigned datalink = Read32(header + 12);
+
+    if (datalink != 1001 && datalink != 1002 && datalink != 2001)
+    {
+        WII_LOG(IO, "Unsupported btsnoop datalink type %u.\n", datalink);
+        return false;
+    }
+
+    std::vector<uint8_t> buffer;
+
+    uint8_t record[24];
+
+    while (!importer.Failed() && ReadBytes(file, record, sizeof(record)))
+    {
+        unsigned length = Read32(record + 4);
+        unsigned flags = Read32(record + 8);
+
+        uint64_t timestamp = static_cast<uint64_t>(Read32(record + 16)) << 32 | static_cast<uint32_t>(Read32(record + 20));
+
+        if (!ReadPacket(file, buffer, length))
+            break; // Truncated trace
+
+        stats.packets++;
+
+        double time = (static_cast<int64_t>(timestamp - WII_BTSNOOP_EPOCH)) / 1000000.0;
+
+        uint8_t const* data = buffer.data();
+
+        switch (datalink)
+        {
+        case 1001: // HCI H1: the flags tell commands and events from data
+            {
+                unsigned direction = (flags & 1) ? Received : Sent;
+                unsigned type = (flags & 2) ? ((flags & 1) ? WII_HCI_EVENT : WII_HCI_COMMAND) : WII_HCI_ACL;
+
+                importer.Packet(time, 0, type, direction, data, length);
+            }
+            break;
+
+        case 1002: // HCI H4
+            if (length >= 1)
+                importer.Packet(time, 0, data[0], (flags & 1) ? Received : Sent, data + 1, length - 1);
+            break;
+
+        case 2001: // Linux monitor
+            importer.MonitorPacket(time, flags >> 16, flags & 0xFFFF, data, length);
+            break;
+        }
+    }
+
+    return true;
+}
+
+bool ReadPcap(FILE* file, TraceImporter& importer, ImportStats& stats)
+{
+    uint8_t header[24];
+
+    if (!ReadBytes(file, header, sizeof(header)))
+        return false;
+
+    bool bigEndian;
+    double resolution;
+
+    switch (ReadLE32(header))
+    {
+    case 0xA1B2C3D4: bigEndian = false; resolution = 1000000.0; break;
+    case 0xD4C3B2A1: bigEndian = true; resolution = 1000000.0; break;
+    case 0xA1B23C4D: bigEndian = false; resolution = 1000000000.0; break;
+    case 0x4D3CB2A1: bigEndian = true; resolution = 1000000000.0; break;
+    default:
+        return false;
+    }
+
+    unsigned linkType = ReadU32(header + 20, bigEndian) & 0xFFFF;
+
+    std::vector<uint8_t> buffer;
+
+    uint8_t record[16];
+
+    while (!importer.Failed() && ReadBytes(file, record, sizeof(record)))
+    {
+        uint32_t seconds = ReadU32(record, bigEndian);
+        uint32_t fraction = ReadU32(record + 4, bigEndian);
+        uint32_t length = ReadU32(record + 8, bigEndian);
+
+        if (!ReadPacket(file, buffer, length))
+            break; // Truncated trace
+
+        stats.packets++;
+
+        importer.LinkPacket(seconds + fraction / resolution, linkType, buffer.data(), length);
+    }
+
+    return true;
+}
+
+bool ReadPcapng(FILE* file, TraceImporter& importer, ImportStats& stats)
+{
+    struct Interface
+    {
+        unsigned linkType;
+        // Time stamp units per second
+        double resolution;
+    };
+
+    std::vector<Interface> interfaces;
+    std::vector<uint8_t> block;
+
+    bool bigEndian = false;
+
+    uint8_t header[8];
+
+    while (!importer.Failed() && ReadBytes(file, header, sizeof(header)))
+    {
+        uint32_t type = ReadLE32(header);
+        uint32_t length;
+
+        if (type == WII_PCAPNG_SECTION)
+        {
+            //
+            // A new section; its byte order follows
+            //
+
+            uint8_t magic[4];
+
+            if (!ReadBytes(file, magic, sizeof(magic)))
+                break;
+
+            if (ReadLE32(magic) == 0x1A2B3C4D)
+                bigEndian = false;
+            else if (Read32(magic) == 0x1A2B3C4D)
+                bigEndian = true;
+            else
+                return false;
+
+            length = ReadU32(header + 4, bigEndian);
+
+            if (length < 28 || !ReadPacket(file, block, length - 12))
+                return false;
+
+            interfaces.clear();
+            continue;
+        }
+
+        type = ReadU32(header, bigEndian);
+        length = ReadU32(header + 4, bigEndian);
+
+        // The body ends with a copy of the length
+        if (length < 12 || !ReadPacket(file, block, length - 8))
+            break; // Truncated trace
+
+        uint8_t const* body = block.data();
+        size_t size = block.size() - 4;
+
+        if (type == WII_PCAPNG_INTERFACE && size >= 8)
+        {
+            Interface iface = { ReadU16(body, bigEndian), 1000000.0 };
+
+            //
+            // Look for the time stamp resolution (if_tsresol)
+            //
+
+            for (size_t offset = 8; offset + 4 <= size; )
+            {
+                unsigned code = ReadU16(body + offset, bigEndian);
+                unsigned optionLength = ReadU16(body + offset + 2, bigEndian);
+
+                if (code == 0 || offset + 4 + optionLength > size)
+                    break;
+
+                if (code == 9 && optionLength >= 1)
+                {
+                    unsigned value = body[offset + 4];
+
+                    if (value & 0x80)
+                        iface.resolution = static_cast<double>(1ull << std::min(value & 0x7Fu, 63u));
+                    else
+                        iface.resolution = std::pow(10.0, static_cast<double>(value));
+                }
+
+                offset += 4 + ((optionLength + 3) & ~3u);
+            }
+
+            interfaces.push_back(iface);
+        }
+        else if (type == WII_PCAPNG_ENHANCED_PACKET && size >= 20)
+        {
+            stats.packets++;
+
+            uint32_t index = ReadU32(body, bigEndian);
+            uint64_t timestamp = static_cast<uint64_t>(ReadU32(body + 4, bigEndian)) << 32 | ReadU32(body + 8, bigEndian);
+            uint32_t captured = ReadU32(body + 12, bigEndian);
+
+            if (index >= interfaces.size() || captured > size - 20)
+                continue;
+
+            Interface const& iface = interfaces[index];
+
+            importer.LinkPacket(timestamp / iface.resolution, iface.linkType, body + 20, captured);
+        }
+    }
+
+    return true;
+}
+
+} // namespace
+
+//--------------------------------------------------------------------------------------------------
+//
+//--------------------------------------------------------------------------------------------------
+
+bool wii::ImportTrace(char const* path, CaptureWriter& capture, ImportStats* stats)
+{
+    assert(path);
+
+    if (!capture.IsOpen())
+        return false;
+
+    FILE* file = fopen(path, "rb");
+
+    if (file == nullptr)
+        return false;
+
+    // Traces are read front to back
+    setvbuf(file, nullptr, _IOFBF, 1 << 20);
+
+    ImportStats result = { 0, 0, 0 };
+
+    TraceImporter importer(capture, result);
+
+    //
+    // Tell the formats apart by their magic number
+    //
+
+    uint8_t magic[4] = { 0 };
+
+    bool ok = ReadBytes(file, magic, sizeof(magic)) && fseek(file, 0, SEEK_SET) == 0;
+
+    if (ok)
+    {
+        uint32_t n = ReadLE32(magic);
+
+        if (memcmp(magic, "btsn", 4) == 0)
+            ok = ReadBtsnoop(file, importer, result);
+        else if (n == WII_PCAPNG_SECTION)
+            ok = ReadPcapng(file, importer, result);
+        else
+            ok = ReadPcap(file, importer, result);
+    }
+
+    // Records which have been dropped are missing from the capture
+    ok = ok && importer.Wait(0);
+
+    if (!ok)
+        WII_LOG(IO, "Failed to import trace: %s\n", path);
+
+    fclose(file);
+
+    if (stats)
+        *stats = result;
+
+    return ok;
+}
@@ -0,0 +1,349 @@
+// This file is distributed under the MIT license.
+// See the LICENSE file for details.
+
+#include "Wiimote/Transport.h"
+
+#include "Wiimpl.h"
+#include "Utils.h"
+
+#include <algorithm>
+#include <deque>
+#include <mutex>
+
+using namespace wii;
+
+//--------------------------------------------------------------------------------------------------
+//
+//--------------------------------------------------------------------------------------------------
+
+namespace
+{
+
+//
+// An emulated Wiimote.
+//
+// Answers status (0x15), read (0x17) and write (0x16) requests like a real Wiimote and
+// otherwise sends data reports in the current report mode. The data reports are generated
+// from a running counter, so that successive reports differ.
+//
+class LoopbackTransport : public Transport
+{
+    struct Report
+    {
+        uint8_t data[WII_REPORT_LENGTH];
+    };
+
+    // Protects the emulated device state; Read and Write might be called concurrently
+    std::mutex lock;
+    // Pending responses to output reports
+    std::deque<Report> responses;
+    // EEPROM (Wiimote calibration data)
+    uint8_t eeprom[0x100];
+    // Extension registers at 0x(4)A400xx
+    uint8_t registers[0x100];
+    // Connected extension
+    unsigned extension;
+    // Current report mode
+    uint8_t reportMode;
+    // LED and rumble state
+    uint8_t leds;
+    // IR camera state
+    bool irEnabled;
+    // Counter to vary the generated data reports
+    unsigned counter;
+
+public:
+    LoopbackTransport(unsigned extension);
+
+    virtual Result Read(uint8_t* report, double& time, int64_t timeout) override;
+
+    virtual bool Write(uint8_t const* report, unsigned len) override;
+
+private:
+    // Queue a status report
+    void PushStatusReport();
+
+    // Queue a read memory data report for each 16 byte block
+    void PushReadReports(unsigned address, unsigned size);
+
+    // Queue an acknowledge report
+    void PushAcknowledgeReport(uint8_t reg, uint8_t error);
+
+    // Write memory
+    void WriteMemory(unsigned address, unsigned size, uint8_t const* data);
+
+    // Generate a data report in the current report mode
+    void GenerateDataReport(uint8_t* report);
+};
+
+LoopbackTransport::LoopbackTransport(unsigned extension)
+    : lock()
+    , responses()
+    , extension(extension)
+    , reportMode(0x30)
+    , leds(0)
+    , irEnabled(false)
+    , counter(0)
+{
+    std::memset(eeprom, 0, sizeof(eeprom));
+    std::memset(registers, 0, sizeof(registers));
+
+    //
+    // Accelerometer calibration at 0x0016: zero = 512, g = 616
+    //
+
+    static const uint8_t accelCal[] = { 0x80, 0x80, 0x80, 0x00, 0x9A, 0x9A, 0x9A, 0x00 };
+
+    std::memcpy(eeprom + 0x16, accelCal, sizeof(accelCal));
+    std::memcpy(eeprom + 0x20, accelCal, sizeof(accelCal));
+
+    //
+    // Extension identifier at 0x(4)A400FA and calibration data at 0x(4)A40020
+    //
+
+    switch (extension)
+    {
+    case Extension::Nunchuk:
+        {
+            static const uint8_t id[] = { 0x00, 0x00, 0xA4, 0x20, 0x00, 0x00 };
+            static const uint8_t cal[] = { 0x80, 0x80, 0x80, 0x00, 0x9A, 0x9A, 0x9A, 0x00,
+                                           0xE0, 0x20, 0x80, 0xE0, 0x20, 0x80, 0x00, 0x00 };
+
+            std::memcpy(registers + 0xFA, id, sizeof(id));
+            std::memcpy(registers + 0x20, cal, sizeof(cal));
+        }
+        break;
+
+    case Extension::ClassicController:
+        {
+            static const uint8_t id[] = { 0x00, 0x00, 0xA4, 0x20, 0x01, 0x01 };
+            static const uint8_t cal[] = { 0xFC, 0x04, 0x80, 0xFC, 0x04, 0x80,
+                                           0xF8, 0x08, 0x80, 0xF8, 0x08, 0x80, 0x00, 0x00, 0x00, 0x00 };
+
+            std::memcpy(registers + 0xFA, id, sizeof(id));
+            std::memcpy(registers + 0x20, cal, sizeof(cal));
+        }
+        break;
+
+    default:
+        this->extension = 0;
+        break;
+    }
+}
+
+Transport::Result LoopbackTransport::Read(uint8_t* report, double& time, int64_t /*timeout*/)
+{
+    std::lock_guard<std::mutex> guard(lock);
+
+    time = GetTime();
+
+    if (!responses.empty())
+    {
+        std::memcpy(report, responses.front().data, WII_REPORT_LENGTH);
+
+        responses.pop_front();
+
+        return Result::OK;
+    }
+
+    GenerateDataReport(report);
+
+    return Result::OK;
+}
+
+bool LoopbackTransport::Write(uint8_t const* report, unsigned len)
+{
+    if (len < 2)
+        return false;
+
+    std::lock_guard<std::mutex> guard(lock);
+
+    switch (report[0])
+    {
+    case WII_OUTPUT_LEDS:
+        leds = report[1] & 0xF0;
+        break;
+
+    case WII_OUTPUT_REPORT_MODE:
+        if (len >= 3)
+            reportMode = report[2];
+        break;
+
+    case WII_OUTPUT_ENABLE_IR_1:
+        irEnabled = (report[1] & 0x04) != 0;
+        break;
+
+    case WII_OUTPUT_STATUS:
+        PushStatusReport();
+        break;
+
+    case WII_OUTPUT_WRITE_MEMORY:
+        if (len >= 7)
+        {
+            unsigned address = Read32(report + 1);
+            unsigned size = std::min(report[5] & 0x1Fu, 16u);
+
+            WriteMemory(address, size, report + 6);
+
+            PushAcknowledgeReport(WII_OUTPUT_WRITE_MEMORY, 0x00);
+        }
+        break;
+
+    case WII_OUTPUT_READ_MEMORY:
+        if (len >= 7)
+        {
+            PushReadReports(Read32(report + 1), Read16(report + 5));
+        }
+        break;
+
+    default:
+        break;
+    }
+
+    return true;
+}
+
+void LoopbackTransport::PushStatusReport()
+{
+    Report r = {{ 0 }};
+
+    r.data[0] = 0x20;
+    r.data[3] = leds | (irEnabled ? 0x08 : 0x00) | (extension ? 0x02 : 0x00);
+    r.data[6] = 0xC0; // Battery
+
+    responses.push_back(r);
+}
+
+void LoopbackTransport::PushReadReports(unsigned address, unsigned size)
+{
+    //
+    // Only the EEPROM and the extension registers are emulated.
+    // Reading anything else -- in particular the motion-plus identifier at 0x(4)A600FE --
+    // fails with error 7, just like a real Wiimote without motion-plus.
+    //
+
+    uint8_t const* memory = nullptr;
+
+    // NOTE: The lowest bit of the address space byte is the rumble bit.
+    if ((address & 0x04000000) == 0 && (address & 0xFFFF) + size <= sizeof(eeprom))
+        memory = eeprom + (address & 0xFF);
+    else if ((address & 0x00FFFF00) == 0x00A40000 && extension != 0 && (address & 0xFF) + size <= sizeof(registers))
+        memory = registers + (address & 0xFF);
+
+    unsigned done = 0;
+
+    do
+    {
+        unsigned count = std::min(size - done, 16u);
+
+        Report r = {{ 0 }};
+
+        r.data[0] = 0x21;
+        r.data[3] = static_cast<uint8_t>(((count - 1) << 4) | (memory ? 0x00 : 0x07));
+        r.data[4] = B1(address + done);
+        r.data[5] = B0(address + done);
+
+        if (memory)
+            std::memcpy(r.data + 6, memory + done, count);
+
+        responses.push_back(r);
+
+        if (!memory)
+            break;
+
+        done += count;
+    }
+    while (done < size);
+}
+
+void LoopbackTransport::PushAcknowledgeReport(uint8_t reg, uint8_t error)
+{
+    Report r = {{ 0 }};
+
+    r.data[0] = 0x22;
+    r.data[3] = reg;
+    r.data[4] = error;
+
+    responses.push_back(r);
+}
+
+void LoopbackTransport::WriteMemory(unsigned address, unsigned size, uint8_t const* data)
+{
+    if ((address & 0x00FFFF00) == 0x00A40000 && (address & 0xFF) + size <= sizeof(registers))
+        std::memcpy(registers + (address & 0xFF), data, size);
+}
+
+void LoopbackTransport::GenerateDataReport(uint8_t* report)
+{
+    unsigned n = counter++;
+
+    std::memset(report, 0, WII_REPORT_LENGTH);
+
+    report[0] = reportMode;
+
+    // Buttons: toggle A every 64 reports
+    report[2] = (n & 0x40) ? 0x08 : 0x00;
+
+    unsigned offset = 3;
+
+    bool accel = reportMode == 0x31 || reportMode == 0x33 || reportMode == 0x35 || reportMode == 0x37;
+
+    if (accel)
+    {
+        // Accelerometer: wiggle around the zero point
+        report[3] = static_cast<uint8_t>(0x80 + (n & 0x0F));
+        report[4] = static_cast<uint8_t>(0x80 - (n & 0x0F));
+        report[5] = static_cast<uint8_t>(0x9A);
+
+        offset += 3;
+    }
+
+    unsigned irBytes = 0;
+
+    if (reportMode == 0x33)
+        irBytes = 12;
+    else if (reportMode == 0x36 || reportMode == 0x37)
+        irBytes = 10;
+
+    // No IR dots visible
+    std::memset(report + offset, 0xFF, irBytes);
+
+    offset += irBytes;
+
+    bool ext = reportMode == 0x32 || reportMode == 0x35 || reportMode == 0x36 || reportMode == 0x37;
+
+    if (ext && extension != 0)
+    {
+        uint8_t* buf = report + offset;
+
+        if (extension == Extension::Nunchuk)
+        {
+            buf[0] = static_cast<uint8_t>(0x80 + (n & 0x1F));
+            buf[1] = 0x80;
+            buf[2] = 0x80;
+            buf[3] = 0x80;
+            buf[4] = 0x9A;
+            buf[5] = (n & 0x80) ? 0x02 : 0x03; // Z released/pressed
+        }
+        else
+        {
+            buf[0] = 0x20;
+            buf[1] = 0x20;
+            buf[2] = 0x10;
+            buf[3] = 0x00;
+            buf[4] = 0xFF;
+            buf[5] = (n & 0x80) ? 0xEF : 0xFF; // A released/pressed
+        }
+    }
+}
+
+} // namespace
+
+//--------------------------------------------------------------------------------------------------
+//
+//--------------------------------------------------------------------------------------------------
+
+std::unique_ptr<Transport> wii::CreateLoopbackTransport(unsigned extension)
+{
+    return std::unique_ptr<Transport>(new LoopbackTransport(extension));
+}
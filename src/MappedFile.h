@@ -0,0 +1,50 @@
+// This file is distributed under the MIT license.
+// See the LICENSE file for details.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace wii
+{
+
+//
+// A read-only memory mapped file.
+// Implemented in Wiimote-?.inl
+//
+class MappedFile
+{
+    // Start of the mapping, or null
+    uint8_t const* data;
+    // Size of the file
+    size_t size;
+#ifdef _WIN32
+    // File mapping object
+    void* mapping;
+#endif
+
+public:
+    MappedFile();
+
+    ~MappedFile();
+
+    // Map the given file.
+    // Returns false if the file could not be opened or mapped.
+    bool Open(char const* path);
+
+    // Unmap the file
+    void Close();
+
+    // Returns the contents of the file
+    uint8_t const* Data() const { return data; }
+
+    // Returns the size of the file
+    size_t Size() const { return size; }
+
+private:
+    MappedFile(MappedFile const&);
+    MappedFile& operator =(MappedFile const&);
+};
+
+} // namespace wii
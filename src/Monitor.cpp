@@ -0,0 +1,424 @@
+// This file is distributed under the MIT license.
+// See the LICENSE file for details.
+
+#include "Wiimote/Monitor.h"
+
+#ifndef _WIN32
+
+#include "Wiimpl.h"
+#include "Log.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace wii;
+
+//--------------------------------------------------------------------------------------------------
+//
+//--------------------------------------------------------------------------------------------------
+
+namespace
+{
+
+//
+// Identifies the device behind a node, whatever its name: the device number of a character
+// device, or the inode of anything else standing in for one.
+//
+struct NodeId
+{
+    dev_t device;
+    ino_t inode;
+
+    bool operator==(NodeId const& rhs) const
+    {
+        return device == rhs.device && inode == rhs.inode;
+    }
+};
+
+NodeId GetNodeId(struct stat const& st)
+{
+    NodeId id;
+
+    if (S_ISCHR(st.st_mode))
+    {
+        id.device = st.st_rdev;
+        id.inode = 0;
+    }
+    else
+    {
+        id.device = st.st_dev;
+        id.inode = st.st_ino;
+    }
+
+    return id;
+}
+
+struct Slot
+{
+    // Whether a device is attached
+    bool occupied;
+    // Name of the attached hidraw node -- if any
+    std::string node;
+    // The attached device -- if known
+    bool hasId;
+    NodeId id;
+    // Time the link has been lost, or 0
+    double lostTime;
+    // Time from losing the link until reconnecting
+    double latency;
+};
+
+} // namespace
+
+struct WiimoteMonitor::Impl
+{
+    // The Wiimotes
+    Wiimote* wiimotes;
+    // State of each Wiimote
+    std::vector<Slot> slots;
+    // Directory containing the hidraw nodes
+    std::string devRoot;
+    // Directory containing the sysfs hidraw entries
+    std::string sysRoot;
+    // Inotify instance watching devRoot
+    int inotify;
+    // Nodes which have been created (or changed) but are not attached yet
+    std::set<std::string> candidates;
+
+    Impl(Wiimote* wiimotes, unsigned count, char const* devRoot, char const* sysRoot);
+
+    ~Impl()
+    {
+        if (inotify >= 0)
+            close(inotify);
+    }
+
+    // Whether the given Wiimote is still alive
+    static bool IsActive(Wiimote::Impl const& w)
+    {
+        return w.transport
+            && w.status != WII_STATUS_ERROR
+            && w.status != WII_STATUS_SHUTDOWN_COMPLETE
+            && w.status != WII_STATUS_DISCONNECTED;
+    }
+
+    // Add all existing hidraw nodes to the candidates
+    void Scan();
+
+    // Process all pending inotify events
+    void ReadEvents();
+
+    // Mark the given slot as lost
+    void Lose(Slot& slot, double now);
+
+    // Returns the free slot which has been lost first, or -1
+    int FindFreeSlot() const;
+
+    // Whether the given node is attached to a slot already -- under this or another name
+    bool IsAttached(std::string const& node) const;
+
+    // Whether the given node belongs to a Wiimote
+    bool IsWiimote(std::string const& node) const;
+
+    // Attach the given node to the given slot
+    bool Attach(std::string const& node, size_t index);
+};
+
+WiimoteMonitor::Impl::Impl(Wiimote* wiimotes, unsigned count, char const* devRoot, char const* sysRoot)
+    : wiimotes(wiimotes)
+    , slots(count)
+    , devRoot(devRoot)
+    , sysRoot(sysRoot)
+    , inotify(inotify_init1(IN_NONBLOCK | IN_CLOEXEC))
+    , candidates()
+{
+    for (unsigned n = 0; n < count; ++n)
+    {
+        Wiimote::Impl const& w = *wiimotes[n].impl;
+
+        slots[n].occupied = IsActive(w);
+        slots[n].hasId = false;
+        slots[n].lostTime = 0.0;
+        slots[n].latency = 0.0;
+
+        //
+        // Wiimotes connected before the monitor has been created are attached to one of
+        // the nodes found by the scan below. Remember which one, so that it is not attached
+        // to another slot a second time.
+        //
+
+        struct stat st;
+
+        if (slots[n].occupied && w.transport->Descriptor() >= 0 && fstat(w.transport->Descriptor(), &st) == 0)
+        {
+            slots[n].hasId = true;
+            slots[n].id = GetNodeId(st);
+        }
+    }
+
+    //
+    // Start watching before scanning, so that no node gets lost in between
+    //
+
+    if (inotify < 0 || inotify_add_watch(inotify, devRoot, IN_CREATE | IN_ATTRIB | IN_MOVED_TO | IN_DELETE | IN_MOVED_FROM) < 0)
+    {
+        WII_LOG(IO, "Failed to watch %s: %d\n", devRoot, errno);
+    }
+
+    Scan();
+}
+
+void WiimoteMonitor::Impl::Scan()
+{
+    DIR* dir = opendir(devRoot.c_str());
+
+    if (dir == nullptr)
+        return;
+
+    while (dirent* entry = readdir(dir))
+    {
+        if (strncmp(entry->d_name, "hidraw", 6) == 0)
+            candidates.insert(entry->d_name);
+    }
+
+    closedir(dir);
+}
+
+void WiimoteMonitor::Impl::ReadEvents()
+{
+    double now = GetTime();
+
+    alignas(inotify_event) char buf[4096];
+
+    for (;;)
+    {
+        ssize_t len = read(inotify, buf, sizeof(buf));
+
+        if (len <= 0)
+            break;
+
+        for (char* p = buf; p < buf + len; )
+        {
+            inotify_event const* ev = reinterpret_cast<inotify_event const*>(p);
+
+            p += sizeof(inotify_event) + ev->len;
+
+            if (ev->len == 0 || strncmp(ev->name, "hidraw", 6) != 0)
+                continue;
+
+            std::string node(ev->name);
+
+            if (ev->mask & (IN_DELETE | IN_MOVED_FROM))
+            {
+                candidates.erase(node);
+
+                for (auto& slot : slots)
+                {
+                    if (slot.node == node)
+                        Lose(slot, now);
+                }
+            }
+            else
+            {
+                // Permissions are usually fixed up (IN_ATTRIB) after the node has been created
+                candidates.insert(node);
+            }
+        }
+    }
+}
+
+void WiimoteMonitor::Impl::Lose(Slot& slot, double now)
+{
+    WII_LOG(STATUS, "Lost %s\n", slot.node.empty() ? "Wiimote" : slot.node.c_str());
+
+    slot.occupied = false;
+    slot.node.clear();
+    slot.hasId = false;
+
+    if (slot.lostTime == 0.0)
+        slot.lostTime = now;
+}
+
+bool WiimoteMonitor::Impl::IsAttached(std::string const& node) const
+{
+    struct stat st;
+
+    bool hasId = stat((devRoot + "/" + node).c_str(), &st) == 0;
+
+    NodeId id = hasId ? GetNodeId(st) : NodeId();
+
+    return std::any_of(slots.begin(), slots.end(), [&](Slot const& slot) {
+        return slot.node == node || (hasId && slot.occupied && slot.hasId && slot.id == id);
+    });
+}
+
+bool WiimoteMonitor::Impl::IsWiimote(std::string const& node) const
+{
+    return Wiimote::Impl::IsWiimoteUevent((sysRoot + "/" + node + "/device/uevent").c_str());
+}
+
+int WiimoteMonitor::Impl::FindFreeSlot() const
+{
+    //
+    // Prefer the slot which has been lost first
+    //
+
+    int index = -1;
+
+    for (size_t n = 0; n < slots.size(); ++n)
+    {
+        if (slots[n].occupied)
+            continue;
+
+        if (index < 0)
+        {
+            index = static_cast<int>(n);
+            continue;
+        }
+
+        double lost = slots[n].lostTime;
+        double best = slots[index].lostTime;
+
+        if (lost != 0.0 && (best == 0.0 || lost < best))
+            index = static_cast<int>(n);
+    }
+
+    return index;
+}
+
+bool WiimoteMonitor::Impl::Attach(std::string const& node, size_t index)
+{
+    Slot* free = &slots[index];
+
+    int fd = open((devRoot + "/" + node).c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+
+    if (fd < 0)
+    {
+        WII_LOG(IO, "Failed to open %s: %d\n", node.c_str(), errno);
+        return false;
+    }
+
+    struct stat st;
+
+    free->hasId = fstat(fd, &st) == 0;
+
+    if (free->hasId)
+        free->id = GetNodeId(st);
+
+    Wiimote::Impl& w = *wiimotes[index].impl;
+
+    if (!w.Reattach(CreateHidrawTransport(fd)))
+        return false;
+
+    double now = GetTime();
+
+    if (free->lostTime != 0.0)
+    {
+        free->latency = now - free->lostTime;
+
+        WII_LOG(STATUS, "Reconnected %s after %.1f ms\n", node.c_str(), free->latency * 1000.0);
+    }
+
+    free->occupied = true;
+    free->node = node;
+    free->lostTime = 0.0;
+
+    return true;
+}
+
+//--------------------------------------------------------------------------------------------------
+//
+//--------------------------------------------------------------------------------------------------
+
+WiimoteMonitor::WiimoteMonitor(Wiimote* wiimotes, unsigned count, char const* devRoot, char const* sysRoot)
+    : impl(new Impl(wiimotes, count, devRoot, sysRoot))
+{
+}
+
+WiimoteMonitor::~WiimoteMonitor()
+{
+}
+
+unsigned WiimoteMonitor::Update(int timeout)
+{
+    double now = GetTime();
+
+    //
+    // Check for lost links
+    //
+
+    for (size_t n = 0; n < impl->slots.size(); ++n)
+    {
+        Slot& slot = impl->slots[n];
+
+        if (slot.occupied && !Impl::IsActive(*impl->wiimotes[n].impl))
+            impl->Lose(slot, now);
+    }
+
+    //
+    // Wait for device changes -- unless there is work left
+    //
+
+    bool pending = !impl->candidates.empty() && impl->FindFreeSlot() >= 0;
+
+    if (impl->inotify >= 0)
+    {
+        pollfd pfd;
+
+        pfd.fd = impl->inotify;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+
+        if (poll(&pfd, 1, pending ? 0 : timeout) > 0)
+            impl->ReadEvents();
+    }
+
+    //
+    // Attach new Wiimotes
+    //
+    // Candidates are kept while all slots are occupied. Nodes which can not be opened are
+    // dropped; they show up again once their permissions change.
+    //
+
+    unsigned attached = 0;
+
+    for (auto it = impl->candidates.begin(); it != impl->candidates.end(); )
+    {
+        int index = impl->FindFreeSlot();
+
+        if (index < 0)
+            break;
+
+        if (!impl->IsAttached(*it) && impl->IsWiimote(*it) && impl->Attach(*it, static_cast<size_t>(index)))
+            attached++;
+
+        it = impl->candidates.erase(it);
+    }
+
+    return attached;
+}
+
+int WiimoteMonitor::Descriptor() const
+{
+    return impl->inotify;
+}
+
+double WiimoteMonitor::GetReconnectLatency(unsigned slot) const
+{
+    assert(slot < impl->slots.size());
+
+    return impl->slots[slot].latency;
+}
+
+#endif
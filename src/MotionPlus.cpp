@@ -0,0 +1,168 @@
+// This file is distributed under the MIT license.
+// See the LICENSE file for details.
+
+#include "MotionPlus.h"
+#include "Simd.h"
+
+#include <cstring>
+
+using namespace wii;
+
+//--------------------------------------------------------------------------------------------------
+//
+//--------------------------------------------------------------------------------------------------
+
+namespace
+{
+
+// Bias and scale of a single axis
+struct Axis
+{
+    int biasSlow;
+    int biasFast;
+    float scaleSlow;
+    float scaleFast;
+};
+
+void GetAxes(MotionPlusData::CalibrationData const& cal, Axis (&axes)[3])
+{
+    if (cal.valid)
+    {
+        axes[0] = { cal.biasSlow.x, cal.biasFast.x, cal.scaleSlow.x, cal.scaleFast.x };
+        axes[1] = { cal.biasSlow.y, cal.biasFast.y, cal.scaleSlow.y, cal.scaleFast.y };
+        axes[2] = { cal.biasSlow.z, cal.biasFast.z, cal.scaleSlow.z, cal.scaleFast.z };
+    }
+    else
+    {
+        // Same defaults as ParseMotionPlus
+        float scaleSlow = 0.05f;
+        float scaleFast = scaleSlow * 4.54f;
+
+        axes[0] = { 8063, 8063, scaleSlow, scaleFast };
+        axes[1] = { 8063, 8063, scaleSlow, scaleFast };
+        axes[2] = { 8063, 8063, scaleSlow, scaleFast };
+    }
+}
+
+#if WII_HAVE_AVX2
+
+// Normalize eight samples of one axis. 'fast' has all bits set in the lanes of samples in fast
+// units.
+inline __m256 Normalize(Axis const& axis, __m128i raw, __m256i fast)
+{
+    __m256i bias = _mm256_blendv_epi8(_mm256_set1_epi32(axis.biasSlow), _mm256_set1_epi32(axis.biasFast), fast);
+    __m256 scale = _mm256_blendv_ps(_mm256_set1_ps(axis.scaleSlow), _mm256_set1_ps(axis.scaleFast), _mm256_castsi256_ps(fast));
+
+    __m256i value = _mm256_sub_epi32(_mm256_cvtepu16_epi32(raw), bias);
+
+    return _mm256_mul_ps(_mm256_cvtepi32_ps(value), scale);
+}
+
+inline __m256i FastMask(__m256i flags, unsigned bit)
+{
+    __m256i b = _mm256_set1_epi32(static_cast<int>(bit));
+
+    return _mm256_cmpeq_epi32(_mm256_and_si256(flags, b), b);
+}
+
+#elif WII_HAVE_SSE2
+
+// Select a where mask is set and b elsewhere
+inline __m128i Select(__m128i mask, __m128i a, __m128i b)
+{
+    return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+// Normalize four samples of one axis. 'fast' has all bits set in the lanes of samples in fast
+// units.
+inline __m128 Normalize(Axis const& axis, __m128i raw, __m128i fast)
+{
+    __m128i bias = Select(fast, _mm_set1_epi32(axis.biasFast), _mm_set1_epi32(axis.biasSlow));
+    __m128i scale = Select(fast, _mm_castps_si128(_mm_set1_ps(axis.scaleFast)), _mm_castps_si128(_mm_set1_ps(axis.scaleSlow)));
+
+    __m128i value = _mm_sub_epi32(_mm_unpacklo_epi16(raw, _mm_setzero_si128()), bias);
+
+    return _mm_mul_ps(_mm_cvtepi32_ps(value), _mm_castsi128_ps(scale));
+}
+
+inline __m128i FastMask(__m128i flags, unsigned bit)
+{
+    __m128i b = _mm_set1_epi32(static_cast<int>(bit));
+
+    return _mm_cmpeq_epi32(_mm_and_si128(flags, b), b);
+}
+
+#endif
+
+} // namespace
+
+//--------------------------------------------------------------------------------------------------
+//
+//--------------------------------------------------------------------------------------------------
+
+void wii::NormalizeMotionPlus(MotionPlusData::CalibrationData const& cal,
+                              uint16_t const* x, uint16_t const* y, uint16_t const* z, uint8_t const* flags,
+                              float* nx, float* ny, float* nz, size_t count)
+{
+    Axis axes[3];
+
+    GetAxes(cal, axes);
+
+    size_t i = 0;
+
+#if WII_HAVE_AVX2
+    //
+    // Eight samples at a time
+    //
+
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256i f = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<__m128i const*>(flags + i)));
+
+        __m128i rx = _mm_loadu_si128(reinterpret_cast<__m128i const*>(x + i));
+        __m128i ry = _mm_loadu_si128(reinterpret_cast<__m128i const*>(y + i));
+        __m128i rz = _mm_loadu_si128(reinterpret_cast<__m128i const*>(z + i));
+
+        _mm256_storeu_ps(nx + i, Normalize(axes[0], rx, FastMask(f, MotionPlusFastX)));
+        _mm256_storeu_ps(ny + i, Normalize(axes[1], ry, FastMask(f, MotionPlusFastY)));
+        _mm256_storeu_ps(nz + i, Normalize(axes[2], rz, FastMask(f, MotionPlusFastZ)));
+    }
+#elif WII_HAVE_SSE2
+    //
+    // Four samples at a time
+    //
+
+    for (; i + 4 <= count; i += 4)
+    {
+        uint32_t bytes;
+
+        std::memcpy(&bytes, flags + i, sizeof(bytes));
+
+        __m128i f = _mm_cvtsi32_si128(static_cast<int>(bytes));
+
+        f = _mm_unpacklo_epi8(f, _mm_setzero_si128());
+        f = _mm_unpacklo_epi16(f, _mm_setzero_si128());
+
+        __m128i rx = _mm_loadl_epi64(reinterpret_cast<__m128i const*>(x + i));
+        __m128i ry = _mm_loadl_epi64(reinterpret_cast<__m128i const*>(y + i));
+        __m128i rz = _mm_loadl_epi64(reinterpret_cast<__m128i const*>(z + i));
+
+        _mm_storeu_ps(nx + i, Normalize(axes[0], rx, FastMask(f, MotionPlusFastX)));
+        _mm_storeu_ps(ny + i, Normalize(axes[1], ry, FastMask(f, MotionPlusFastY)));
+        _mm_storeu_ps(nz + i, Normalize(axes[2], rz, FastMask(f, MotionPlusFastZ)));
+    }
+#endif
+
+    for (; i < count; ++i)
+    {
+        unsigned f = flags[i];
+
+        Axis const& ax = axes[0];
+        Axis const& ay = axes[1];
+        Axis const& az = axes[2];
+
+        nx[i] = (x[i] - ((f & MotionPlusFastX) ? ax.biasFast : ax.biasSlow)) * ((f & MotionPlusFastX) ? ax.scaleFast : ax.scaleSlow);
+        ny[i] = (y[i] - ((f & MotionPlusFastY) ? ay.biasFast : ay.biasSlow)) * ((f & MotionPlusFastY) ? ay.scaleFast : ay.scaleSlow);
+        nz[i] = (z[i] - ((f & MotionPlusFastZ) ? az.biasFast : az.biasSlow)) * ((f & MotionPlusFastZ) ? az.scaleFast : az.scaleSlow);
+    }
+}
@@ -0,0 +1,29 @@
+// This file is distributed under the MIT license.
+// See the LICENSE file for details.
+
+#pragma once
+
+#include "Wiimote/Wiimote.h"
+
+#include <cstddef>
+#include <cstdint>
+
+namespace wii
+{
+
+// Motion-plus flags (see ReportBatch::mpFlags)
+enum MotionPlusFlags : unsigned {
+    MotionPlusFastX = 0x01,
+    MotionPlusFastY = 0x02,
+    MotionPlusFastZ = 0x04,
+    MotionPlusExt   = 0x08,
+};
+
+// Normalize 'count' motion-plus samples with the given calibration data, exactly like
+// ParseMotionPlus does for a single sample: (raw - bias) * scale, with the fast or slow bias
+// and scale of each axis selected by the flags.
+void NormalizeMotionPlus(MotionPlusData::CalibrationData const& cal,
+                         uint16_t const* x, uint16_t const* y, uint16_t const* z, uint8_t const* flags,
+                         float* nx, float* ny, float* nz, size_t count);
+
+} // namespace wii
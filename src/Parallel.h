@@ -0,0 +1,40 @@
+// This file is distributed under the MIT license.
+// See the LICENSE file for details.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+namespace wii
+{
+
+// Invoke func(index) for each index in [0, count) on at most maxThreads threads.
+// The calling thread takes part. Returns once all invocations have completed.
+template <class Func>
+void ParallelFor(size_t count, unsigned maxThreads, Func const& func)
+{
+    size_t threads = std::min(static_cast<size_t>(maxThreads), count);
+
+    std::atomic<size_t> next(0);
+
+    auto worker = [&]() {
+        for (size_t index = next++; index < count; index = next++)
+            func(index);
+    };
+
+    std::vector<std::thread> pool;
+
+    for (size_t n = 1; n < threads; ++n)
+        pool.emplace_back(worker);
+
+    worker();
+
+    for (auto& thread : pool)
+        thread.join();
+}
+
+} // namespace wii
@@ -0,0 +1,669 @@
+// This file is distributed under the MIT license.
+// See the LICENSE file for details.
+
+#include "Wiimote/Reactor.h"
+
+#include "Wiimpl.h"
+#include "Log.h"
+
+#include <cerrno>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/epoll.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define WII_HAVE_IO_URING 1
+#endif
+#endif
+
+#ifndef WII_HAVE_IO_URING
+#define WII_HAVE_IO_URING 0
+#endif
+
+using namespace wii;
+
+#if WII_HAVE_IO_URING
+#include "Unix/Uring.inl"
+#endif
+
+//
+// Maximum number of reports processed per Wiimote and Run().
+// Keeps a single chatty Wiimote from starving the others.
+//
+#define WII_REACTOR_MAX_REPORTS 32
+
+//--------------------------------------------------------------------------------------------------
+//
+//--------------------------------------------------------------------------------------------------
+
+namespace
+{
+
+struct Device
+{
+    // The Wiimote
+    std::unique_ptr<Wiimote> wiimote;
+    // Descriptor to wait on, or -1 if the transport can not be waited on
+    int fd;
+    // Buffer for the outstanding read (io_uring only).
+    // Null if the transport does not allow raw reads: the ring only polls its descriptor,
+    // and the reports are read through the transport.
+    std::unique_ptr<uint8_t[]> buffer;
+    // Whether a read or poll is outstanding -- and the kernel still owns the buffer
+    // (io_uring only)
+    bool reading;
+};
+
+} // namespace
+
+struct WiimoteReactor::Impl
+{
+    // All Wiimotes
+    std::vector<Device> devices;
+    // Number of devices which can not be waited on
+    unsigned unwaitable;
+#ifndef _WIN32
+    // Epoll instance watching all waitable devices
+    int epoll;
+    // Buffer for ready events
+    std::vector<epoll_event> events;
+#endif
+#if WII_HAVE_IO_URING
+    // The io_uring instance, if the io_uring backend is in use
+    std::unique_ptr<Uring> uring;
+    // Number of devices with an outstanding read
+    unsigned outstanding;
+    // Timeout for the current Run()
+    __kernel_timespec ts;
+    // A read completion reaped while cancelling another read (see CancelRead())
+    struct Completion
+    {
+        size_t index;
+        int result;
+        double time;
+    };
+    // Completions to be processed by the next RunUring()
+    std::vector<Completion> deferred;
+#endif
+
+    Impl()
+        : devices()
+        , unwaitable(0)
+#ifndef _WIN32
+        , epoll(epoll_create1(EPOLL_CLOEXEC))
+        , events()
+#endif
+#if WII_HAVE_IO_URING
+        , uring()
+        , outstanding(0)
+        , ts()
+        , deferred()
+#endif
+    {
+    }
+
+    ~Impl()
+    {
+#if WII_HAVE_IO_URING
+        //
+        // Closing the ring does not wait for the outstanding reads, which could still write
+        // into the buffers. Cancel them and wait until they have completed.
+        //
+
+        if (uring)
+        {
+            for (size_t index = 0; index < devices.size(); ++index)
+                CancelRead(index);
+        }
+#endif
+
+        for (auto& dev : devices)
+            dev.wiimote->impl->Disconnect();
+
+#ifndef _WIN32
+        if (epoll >= 0)
+            close(epoll);
+#endif
+    }
+
+    // Whether the given Wiimote is still alive
+    static bool IsActive(Wiimote::Impl const& w)
+    {
+        return w.transport
+            && w.status != WII_STATUS_ERROR
+            && w.status != WII_STATUS_SHUTDOWN_COMPLETE
+            && w.status != WII_STATUS_DISCONNECTED;
+    }
+
+    // Process the reports which are ready for the given device.
+    // Returns the number of reports processed.
+    unsigned Service(Device& dev);
+
+    // Stop watching the given device
+    void Remove(Device& dev);
+
+#if WII_HAVE_IO_URING
+    // Queue a read for the given device -- or only a poll if it has no buffer.
+    // Without afterPoll, the read is expected to find a report right away.
+    void PostRead(size_t index, bool afterPoll);
+
+    // Cancel the outstanding read of the given device -- if any -- and wait until the kernel
+    // is done with its buffer
+    void CancelRead(size_t index);
+
+    // Bookkeeping for a reaped completion.
+    // Returns whether it is the completion of a read.
+    bool Reap(io_uring_cqe const& cqe);
+
+    // Process a completed read or poll of the given device.
+    // Returns the number of reports processed.
+    unsigned Complete(size_t index, int result, double time);
+
+    // Submit the outstanding reads, wait for completions and process them
+    unsigned RunUring(int timeout);
+#endif
+};
+
+unsigned WiimoteReactor::Impl::Service(Device& dev)
+{
+    Wiimote::Impl& w = *dev.wiimote->impl;
+
+    unsigned processed = 0;
+
+    while (processed < WII_REACTOR_MAX_REPORTS)
+    {
+        Transport::Result result;
+
+        if (w.reportMode == Wiimote::ReportMode::Undefined)
+        {
+            //
+            // Reports are only processed once the report mode has been set.
+            // Throw away anything which arrives before.
+            //
+
+            uint8_t report[WII_REPORT_LENGTH];
+            double time;
+
+            result = w.GetInputReport(report, time, 0);
+        }
+        else
+        {
+            result = w.Poll(0);
+        }
+
+        if (result != Transport::Result::OK)
+        {
+            if (!IsActive(w))
+                Remove(dev);
+            break;
+        }
+
+        processed++;
+    }
+
+    return processed;
+}
+
+void WiimoteReactor::Impl::Remove(Device& dev)
+{
+    if (dev.fd >= 0)
+    {
+#if WII_HAVE_IO_URING
+        // The posted read targets the buffer of the device
+        if (uring)
+            CancelRead(static_cast<size_t>(&dev - devices.data()));
+        else
+#endif
+#ifndef _WIN32
+        epoll_ctl(epoll, EPOLL_CTL_DEL, dev.fd, nullptr);
+#endif
+        dev.fd = -1;
+    }
+    else
+    {
+        unwaitable--;
+    }
+}
+
+#if WII_HAVE_IO_URING
+
+void WiimoteReactor::Impl::PostRead(size_t index, bool afterPoll)
+{
+    Device& dev = devices[index];
+
+    bool queued;
+
+    // user_data 0 is reserved for timeouts and cancellations
+    if (dev.buffer)
+    {
+        // Input reports might be shorter than WII_REPORT_LENGTH
+        memset(dev.buffer.get(), 0, WII_REPORT_LENGTH);
+
+        queued = uring->PrepareRead(dev.fd, dev.buffer.get(), WII_REPORT_LENGTH, index + 1, afterPoll);
+    }
+    else
+    {
+        queued = uring->PreparePoll(dev.fd, index + 1);
+    }
+
+    if (!queued)
+    {
+        WII_LOG(IO, "io_uring submission queue full.\n");
+
+        dev.wiimote->impl->status = WII_STATUS_ERROR;
+        Remove(dev);
+        return;
+    }
+
+    dev.reading = true;
+    outstanding++;
+}
+
+void WiimoteReactor::Impl::CancelRead(size_t index)
+{
+    Device& dev = devices[index];
+
+    if (!dev.reading)
+        return;
+
+    // Cancelling the poll cancels the read linked to it; the read itself can only be
+    // cancelled once the poll has fired
+    bool cancelled = uring->PrepareCancel((index + 1) | Uring::PollTag) && uring->PrepareCancel(index + 1);
+
+    while (cancelled && dev.reading)
+    {
+        if (!uring->Submit(1))
+        {
+            cancelled = false;
+            break;
+        }
+
+        double time = Wiimote::Impl::Time();
+
+        io_uring_cqe cqe;
+
+        while (uring->PopCqe(cqe))
+        {
+            // Keep the reports of the other devices for the next RunUring()
+            if (Reap(cqe) && cqe.user_data != index + 1)
+            {
+                Completion completion = { static_cast<size_t>(cqe.user_data - 1), cqe.res, time };
+
+                deferred.push_back(completion);
+            }
+        }
+    }
+
+    if (!cancelled)
+    {
+        //
+        // The kernel might still write into the buffer.
+        // Leak it rather than let the kernel write into freed memory.
+        //
+
+        WII_LOG(IO, "io_uring failed to cancel a read: %d\n", errno);
+
+        dev.buffer.release();
+        dev.reading = false;
+        outstanding--;
+    }
+}
+
+bool WiimoteReactor::Impl::Reap(io_uring_cqe const& cqe)
+{
+    // Timeouts, cancellations and polls; a failed poll fails the read linked to it, too
+    if (cqe.user_data == 0 || (cqe.user_data & Uring::PollTag) != 0)
+        return false;
+
+    Device& dev = devices[static_cast<size_t>(cqe.user_data - 1)];
+
+    dev.reading = false;
+    outstanding--;
+
+    return true;
+}
+
+unsigned WiimoteReactor::Impl::Complete(size_t index, int result, double time)
+{
+    Device& dev = devices[index];
+    Wiimote::Impl& w = *dev.wiimote->impl;
+
+    // Removed while the read was outstanding
+    if (dev.fd < 0)
+        return 0;
+
+    if (!dev.buffer)
+    {
+        //
+        // The poll of a transport which reads its reports itself: it strips their framing
+        // and stamps them with their receive time, and notices a failed writer
+        //
+
+        if (result < 0)
+        {
+            WII_LOG(STATUS, "Connection lost\n");
+
+            w.status = WII_STATUS_ERROR;
+            Remove(dev);
+            return 0;
+        }
+
+        if (!IsActive(w))
+        {
+            Remove(dev);
+            return 0;
+        }
+
+        // Service() removes the device if it fails
+        unsigned processed = Service(dev);
+
+        if (dev.fd >= 0)
+            PostRead(index, true);
+
+        return processed;
+    }
+
+    unsigned processed = 0;
+
+    if (result > 0 && IsActive(w))
+    {
+        w.Capture(CaptureWriter::Direction::Input, time, dev.buffer.get(), WII_REPORT_LENGTH);
+
+        if (w.reportMode != Wiimote::ReportMode::Undefined)
+        {
+            w.Dispatch(dev.buffer.get(), time);
+
+            // Keep the request queue going
+            w.SendNextRequest();
+
+            processed++;
+        }
+    }
+
+    //
+    // Like Wiimote::Impl::Poll(), a failed write loses the connection -- after the report
+    // which has already been read has been processed
+    //
+
+    if ((result <= 0 && result != -EAGAIN) || w.writerError)
+    {
+        WII_LOG(STATUS, "Connection lost\n");
+
+        w.status = WII_STATUS_ERROR;
+        Remove(dev);
+        return processed;
+    }
+
+    if (!IsActive(w))
+    {
+        Remove(dev);
+        return processed;
+    }
+
+    // No report available (yet) -- or reports tend to come in bursts; try the next one
+    // right away
+    PostRead(index, result == -EAGAIN);
+
+    return processed;
+}
+
+unsigned WiimoteReactor::Impl::RunUring(int timeout)
+{
+    unsigned processed = 0;
+
+    //
+    // Process the completions reaped while cancelling reads first
+    //
+
+    if (!deferred.empty())
+    {
+        std::vector<Completion> completions;
+
+        completions.swap(deferred);
+
+        for (auto const& c : completions)
+            processed += Complete(c.index, c.result, c.time);
+
+        timeout = 0;
+    }
+
+    if (outstanding == 0)
+        return processed;
+
+    if (timeout > 0)
+    {
+        ts.tv_sec = timeout / 1000;
+        ts.tv_nsec = (timeout % 1000) * 1000000;
+
+        uring->PrepareTimeout(&ts);
+    }
+
+    // Submit all reads queued since the last call and wait for the first completion
+    uring->Submit(timeout == 0 ? 0 : 1);
+
+    //
+    // Reap all completions in one batch
+    //
+
+    io_uring_cqe cqe;
+
+    // All reads in this batch completed after the last wait returned
+    double time = Wiimote::Impl::Time();
+
+    while (uring->PopCqe(cqe))
+    {
+        if (Reap(cqe))
+            processed += Complete(static_cast<size_t>(cqe.user_data - 1), cqe.res, time);
+    }
+
+    // Hand the new reads to the kernel
+    uring->Submit(0);
+
+    return processed;
+}
+
+#endif
+
+//--------------------------------------------------------------------------------------------------
+//
+//--------------------------------------------------------------------------------------------------
+
+WiimoteReactor::WiimoteReactor(Backend backend)
+    : impl(new Impl)
+{
+#if WII_HAVE_IO_URING
+    if (backend == Backend::Uring)
+    {
+        // Falls back to epoll if io_uring is not available
+        impl->uring = Uring::Create(1024);
+    }
+#else
+    static_cast<void>(backend);
+#endif
+}
+
+WiimoteReactor::~WiimoteReactor()
+{
+}
+
+unsigned WiimoteReactor::Connect(unsigned count)
+{
+    if (count == 0)
+        return 0;
+
+    std::unique_ptr<Wiimote[]> wiimotes(new Wiimote[count]);
+
+    if (!Wiimote::Impl::Connect(wiimotes.get(), count))
+        return 0;
+
+    unsigned added = 0;
+
+    for (unsigned n = 0; n < count; ++n)
+    {
+        if (Add(std::move(wiimotes[n].impl->transport)))
+            added++;
+
+        wiimotes[n].impl->status = WII_STATUS_DISCONNECTED;
+    }
+
+    return added;
+}
+
+Wiimote* WiimoteReactor::Add(std::unique_ptr<Transport> transport)
+{
+    if (!transport)
+        return nullptr;
+
+    Device dev;
+
+    dev.wiimote.reset(new Wiimote);
+    dev.fd = -1;
+    dev.reading = false;
+
+#if WII_HAVE_IO_URING
+    if (impl->uring && transport->Descriptor() >= 0)
+    {
+        dev.fd = transport->Descriptor();
+
+        // A raw descriptor is only read through the ring from now on; any other is only
+        // polled through it
+        if (transport->RawDescriptor())
+            dev.buffer.reset(new uint8_t[WII_REPORT_LENGTH]);
+    }
+    else
+#endif
+#ifndef _WIN32
+    if (transport->Descriptor() >= 0)
+    {
+        int fd = transport->Descriptor();
+
+        epoll_event ev;
+
+        memset(&ev, 0, sizeof(ev));
+
+        ev.events = EPOLLIN;
+        ev.data.u64 = impl->devices.size();
+
+        if (epoll_ctl(impl->epoll, EPOLL_CTL_ADD, fd, &ev) < 0)
+            return nullptr;
+
+        dev.fd = fd;
+    }
+#endif
+
+    if (dev.fd < 0)
+        impl->unwaitable++;
+
+    dev.wiimote->impl->Attach(std::move(transport));
+
+    impl->devices.push_back(std::move(dev));
+
+#if WII_HAVE_IO_URING
+    if (impl->uring && impl->devices.back().fd >= 0)
+        impl->PostRead(impl->devices.size() - 1, true);
+#endif
+
+    return impl->devices.back().wiimote.get();
+}
+
+unsigned WiimoteReactor::Run(int timeout)
+{
+    unsigned processed = 0;
+
+    //
+    // Send the next pending request of every Wiimote.
+    // A Wiimote in non-continuous mode might not send any report until it has received
+    // the request.
+    //
+
+    for (auto& dev : impl->devices)
+    {
+        Wiimote::Impl& w = *dev.wiimote->impl;
+
+        if (Impl::IsActive(w) && w.reportMode != Wiimote::ReportMode::Undefined)
+            w.SendNextRequest();
+    }
+
+    //
+    // Transports which can not be waited on are polled
+    //
+
+    if (impl->unwaitable > 0)
+    {
+        for (auto& dev : impl->devices)
+        {
+            if (dev.fd < 0 && Impl::IsActive(*dev.wiimote->impl))
+                processed += impl->Service(dev);
+        }
+
+        timeout = 0;
+    }
+
+#if WII_HAVE_IO_URING
+    if (impl->uring)
+        return processed + impl->RunUring(timeout);
+#endif
+
+#ifndef _WIN32
+    //
+    // Wait for all other Wiimotes at once
+    //
+
+    impl->events.resize(impl->devices.size() > 0 ? impl->devices.size() : 1);
+
+    //
+    // Interrupted waits continue for the time remaining until the deadline -- signals and
+    // io_uring task work end the wait early
+    //
+
+    double deadline = Wiimote::Impl::Time() + timeout / 1000.0;
+
+    int count;
+
+    while ((count = epoll_wait(impl->epoll, impl->events.data(), static_cast<int>(impl->events.size()), timeout)) < 0 && errno == EINTR)
+    {
+        if (timeout > 0)
+        {
+            double remaining = deadline - Wiimote::Impl::Time();
+
+            timeout = remaining > 0.0 ? static_cast<int>(remaining * 1000.0 + 0.999) : 0;
+        }
+    }
+
+    for (int n = 0; n < count; ++n)
+    {
+        Device& dev = impl->devices[impl->events[n].data.u64];
+
+        if (dev.fd >= 0)
+            processed += impl->Service(dev);
+    }
+#endif
+
+    return processed;
+}
+
+WiimoteReactor::Backend WiimoteReactor::GetBackend() const
+{
+#if WII_HAVE_IO_URING
+    if (impl->uring)
+        return Backend::Uring;
+#endif
+
+    return Backend::Epoll;
+}
+
+size_t WiimoteReactor::Size() const
+{
+    return impl->devices.size();
+}
+
+Wiimote& WiimoteReactor::operator [](size_t index)
+{
+    assert(index < impl->devices.size());
+
+    return *impl->devices[index].wiimote;
+}
@@ -0,0 +1,370 @@
+// This file is distributed under the MIT license.
+// See the LICENSE file for details.
+
+#include "Wiimote/Transport.h"
+
+#include "Capture.h"
+#include "MappedFile.h"
+#include "Utils.h"
+#include "Wiimpl.h"
+
+#include <deque>
+#include <mutex>
+#include <vector>
+
+using namespace wii;
+
+//--------------------------------------------------------------------------------------------------
+//
+//--------------------------------------------------------------------------------------------------
+
+namespace
+{
+
+//
+// Plays back recorded input reports
+//
+class ReplayTransport : public Transport
+{
+    // The recorded reports
+    std::vector<uint8_t> reports;
+    // Offset of the next report
+    size_t offset;
+
+public:
+    ReplayTransport(uint8_t const* data, size_t count)
+        : reports(data, data + count * WII_REPORT_LENGTH)
+        , offset(0)
+    {
+    }
+
+    virtual Result Read(uint8_t* report, double& time, int64_t /*timeout*/) override
+    {
+        if (offset >= reports.size())
+            return Result::Error; // End of recording
+
+        time = GetTime();
+
+        std::memcpy(report, &reports[offset], WII_REPORT_LENGTH);
+
+        offset += WII_REPORT_LENGTH;
+
+        return Result::OK;
+    }
+
+    virtual bool Write(uint8_t const* /*report*/, unsigned /*len*/) override
+    {
+        return true;
+    }
+};
+
+//
+// Plays back the input reports of one device from a capture file
+//
+// The file is memory mapped and decoded while it is played back. If speed is 0, the reports are delivered as fast as they are
+// read, with their recorded time stamps, and output reports are ignored.
+//
+// Otherwise the reports are delivered at the recorded pace, scaled by speed, and stamped
+// with the playback time. The recorded responses to status, read and write requests are
+// held back and sent in answer to the application's own requests instead.
+//
+// After a seek, requests are answered in either mode, from the checkpoint of the index and
+// the responses recorded since.
+//
+class CaptureTransport : public Transport
+{
+    // The capture file
+    MappedFile file;
+    // Reads the records
+    CaptureReader reader;
+    // Index of the next record read
+    size_t index;
+    // The next record to deliver
+    CaptureRecord next;
+    // Whether 'next' is valid
+    bool hasNext;
+    // The device to play back
+    unsigned device;
+    // Playback speed; 0 plays back as fast as possible
+    double speed;
+    // Whether the transport has seeked. Responses are then found while reading.
+    bool seeked;
+    // Protects the responses; Read and Write might be called concurrently
+    std::mutex lock;
+    // Pending responses to output reports
+    std::deque<CaptureReport> responses;
+    // Records which are responses to requests, by record index
+    std::vector<bool> recorded;
+    // The recorded responses to the device's requests
+    CaptureResponses answers;
+    // Time stamp of the last report
+    double lastTime;
+    // Recorded time of the first report
+    double firstTime;
+    // Playback time of the first report
+    double startTime;
+
+public:
+    CaptureTransport(unsigned device, double speed)
+        : file()
+        , reader()
+        , index(0)
+        , next()
+        , hasNext(false)
+        , device(device)
+        , speed(speed)
+        , seeked(false)
+        , lock()
+        , responses()
+        , recorded()
+        , answers(false)
+        , lastTime(0.0)
+        , firstTime(-1.0)
+        , startTime(0.0)
+    {
+    }
+
+    // Map the capture file and check its header
+    bool Open(char const* path);
+
+    virtual Result Read(uint8_t* report, double& time, int64_t timeout) override;
+
+    virtual bool Write(uint8_t const* report, unsigned len) override;
+
+    virtual bool Seek(double time) override;
+
+private:
+    // Returns the next input record of the device which is not a recorded response -- if any
+    // The record is consumed by clearing hasNext.
+    CaptureRecord const* NextRecord();
+
+    // Collect the recorded responses to status, read and write requests
+    void CollectResponses();
+};
+
+bool CaptureTransport::Open(char const* path)
+{
+    if (!file.Open(path))
+        return false;
+
+    if (!reader.Open(file.Data(), file.Size()))
+        return false;
+
+    if (speed > 0.0)
+        CollectResponses();
+
+    return true;
+}
+
+void CaptureTransport::CollectResponses()
+{
+    CaptureReader records;
+
+    records.Open(file.Data(), file.Size());
+
+    //
+    // Follow the requests of the recording and remember which input reports answered them.
+    // Only the first answer to each request is kept.
+    //
+
+    CaptureRecord record;
+
+    while (records.Next(record))
+        recorded.push_back(record.device == device && answers.Add(record));
+}
+
+CaptureRecord const* CaptureTransport::NextRecord()
+{
+    while (!hasNext)
+    {
+        if (!reader.Next(next))
+            return nullptr;
+
+        size_t n = index++;
+
+        if (next.device != device)
+            continue;
+
+        if (seeked)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+
+            if (answers.Add(next))
+                continue;
+        }
+        else if (n < recorded.size() && recorded[n])
+        {
+            continue;
+        }
+
+        if (next.direction != static_cast<unsigned>(CaptureWriter::Direction::Input))
+            continue;
+
+        hasNext = true;
+    }
+
+    return &next;
+}
+
+Transport::Result CaptureTransport::Read(uint8_t* report, double& time, int64_t timeout)
+{
+    //
+    // Responses to the application's requests go first
+    //
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+
+        if (!responses.empty())
+        {
+            std::memcpy(report, responses.front().data, WII_REPORT_LENGTH);
+
+            responses.pop_front();
+
+            time = speed > 0.0 ? GetTime() : lastTime;
+
+            return Result::OK;
+        }
+    }
+
+    if (speed <= 0.0)
+    {
+        CaptureRecord const* record = NextRecord();
+
+        if (record == nullptr)
+            return Result::Error; // End of recording
+
+        std::memcpy(report, record->report, WII_REPORT_LENGTH);
+
+        time = lastTime = record->time / 1000000000.0;
+
+        hasNext = false;
+
+        return Result::OK;
+    }
+
+    CaptureRecord const* record = NextRecord();
+
+    if (record == nullptr)
+        return Result::Error; // End of recording
+
+    //
+    // Wait until the report is due
+    //
+
+    double recordTime = record->time / 1000000000.0;
+
+    if (firstTime < 0.0)
+    {
+        firstTime = recordTime;
+        startTime = GetTime();
+    }
+
+    double due = startTime + (recordTime - firstTime) / speed;
+    double wait = due - GetTime();
+
+    if (wait > 0.0)
+    {
+        if (timeout >= 0 && wait * 1000000.0 > timeout)
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(timeout));
+            return Result::Timeout;
+        }
+
+        std::this_thread::sleep_for(std::chrono::duration<double>(wait));
+    }
+
+    std::memcpy(report, record->report, WII_REPORT_LENGTH);
+
+    time = due;
+
+    hasNext = false;
+
+    return Result::OK;
+}
+
+bool CaptureTransport::Write(uint8_t const* report, unsigned len)
+{
+    if (len < 2)
+        return true;
+
+    std::lock_guard<std::mutex> guard(lock);
+
+    if (speed > 0.0 || seeked)
+        answers.Answer(report, len, responses);
+
+    return true;
+}
+
+bool CaptureTransport::Seek(double time)
+{
+    if (!reader.HasIndex())
+        return false;
+
+    uint64_t t = static_cast<uint64_t>(time > 0.0 ? time * 1000000000.0 : 0.0);
+
+    //
+    // Start at the closest index entry with the responses recorded up to there
+    //
+
+    CaptureCheckpoint checkpoint = reader.Seek(t);
+
+    CaptureResponses latest(true);
+
+    if (!latest.Load(reader.CheckpointData(checkpoint), checkpoint.size, device))
+        return false;
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+
+        answers = latest;
+        responses.clear();
+    }
+
+    seeked = true;
+    hasNext = false;
+
+    recorded.clear();
+
+    //
+    // Skip to the time, following the requests
+    //
+
+    while (CaptureRecord const* record = NextRecord())
+    {
+        if (record->time >= t)
+            break;
+
+        hasNext = false;
+    }
+
+    lastTime = time;
+    firstTime = -1.0;
+
+    return true;
+}
+
+} // namespace
+
+//--------------------------------------------------------------------------------------------------
+//
+//--------------------------------------------------------------------------------------------------
+
+std::unique_ptr<Transport> wii::CreateReplayTransport(uint8_t const* reports, size_t count)
+{
+    assert(reports || count == 0);
+
+    return std::unique_ptr<Transport>(new ReplayTransport(reports, count));
+}
+
+std::unique_ptr<Transport> wii::CreateCaptureTransport(char const* path, unsigned device, double speed)
+{
+    assert(path);
+
+    std::unique_ptr<CaptureTransport> transport(new CaptureTransport(device, speed));
+
+    if (!transport->Open(path))
+        return nullptr;
+
+    return std::unique_ptr<Transport>(transport.release());
+}
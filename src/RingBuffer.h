@@ -0,0 +1,92 @@
+// This file is distributed under the MIT license.
+// See the LICENSE file for details.
+
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <vector>
+
+namespace wii
+{
+
+//
+// Wait-free single-producer/single-consumer ring buffer.
+//
+// Push() must only be called from one thread and Pop() must only be called from one
+// (other) thread. Neither ever blocks.
+//
+template <class T>
+class RingBuffer
+{
+    // Keep the indices on separate cache lines to avoid false sharing
+    struct Index
+    {
+        std::atomic<size_t> value;
+        char padding[64 - sizeof(std::atomic<size_t>)];
+    };
+
+    // Storage
+    std::vector<T> buffer;
+    // Capacity - 1. Capacity is a power of 2.
+    size_t mask;
+    // Next element to read; written by the consumer only
+    Index head;
+    // Next element to write; written by the producer only
+    Index tail;
+
+public:
+    // Creates a ring buffer for 'capacity' elements.
+    // 'capacity' must be a power of 2.
+    explicit RingBuffer(size_t capacity)
+        : buffer(capacity)
+        , mask(capacity - 1)
+    {
+        assert(capacity > 0 && (capacity & (capacity - 1)) == 0);
+
+        head.value.store(0, std::memory_order_relaxed);
+        tail.value.store(0, std::memory_order_relaxed);
+    }
+
+    // Add an element.
+    // Returns false if the buffer is full.
+    bool Push(T const& value)
+    {
+        size_t t = tail.value.load(std::memory_order_relaxed);
+
+        if (t - head.value.load(std::memory_order_acquire) > mask)
+            return false;
+
+        buffer[t & mask] = value;
+
+        tail.value.store(t + 1, std::memory_order_release);
+
+        return true;
+    }
+
+    // Remove the oldest element.
+    // Returns false if the buffer is empty.
+    bool Pop(T& value)
+    {
+        size_t h = head.value.load(std::memory_order_relaxed);
+
+        if (h == tail.value.load(std::memory_order_acquire))
+            return false;
+
+        value = buffer[h & mask];
+
+        head.value.store(h + 1, std::memory_order_release);
+
+        return true;
+    }
+
+    // Returns whether the buffer is empty.
+    // Only meaningful on the consumer's thread.
+    bool Empty() const
+    {
+        return head.value.load(std::memory_order_relaxed) == tail.value.load(std::memory_order_acquire);
+    }
+};
+
+} // namespace wii
@@ -0,0 +1,44 @@
+// This file is distributed under the MIT license.
+// See the LICENSE file for details.
+
+#pragma once
+
+//
+// Instruction sets the vectorized kernels may use.
+//
+// The instruction set is chosen at compile time from the target options of the compiler
+// (eg. -mssse3, -mavx2 or /arch:AVX2). Any of the WII_HAVE_* macros may be defined to 0 to
+// force the next smaller instruction set, or the scalar code.
+//
+
+#ifndef WII_HAVE_SSE2
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define WII_HAVE_SSE2 1
+#else
+#define WII_HAVE_SSE2 0
+#endif
+#endif
+
+#ifndef WII_HAVE_SSSE3
+#if WII_HAVE_SSE2 && (defined(__SSSE3__) || defined(__AVX__))
+#define WII_HAVE_SSSE3 1
+#else
+#define WII_HAVE_SSSE3 0
+#endif
+#endif
+
+#ifndef WII_HAVE_AVX2
+#if WII_HAVE_SSSE3 && defined(__AVX2__)
+#define WII_HAVE_AVX2 1
+#else
+#define WII_HAVE_AVX2 0
+#endif
+#endif
+
+#if WII_HAVE_AVX2
+#include <immintrin.h>
+#elif WII_HAVE_SSSE3
+#include <tmmintrin.h>
+#elif WII_HAVE_SSE2
+#include <emmintrin.h>
+#endif
@@ -0,0 +1,74 @@
+// This file is distributed under the MIT license.
+// See the LICENSE file for details.
+
+#pragma once
+
+#include <algorithm>
+#include <mutex>
+
+namespace wii
+{
+
+//
+// Token bucket rate limiter.
+//
+// Tokens are added at 'rate' tokens per second, up to 'burst' tokens. Each reservation takes
+// one token; if there is none left, the reservation is granted in the future and the caller
+// has to wait. Thread-safe.
+//
+class TokenBucket
+{
+    // Protects the bucket
+    std::mutex lock;
+    // Tokens per second; 0 disables the limit
+    double rate;
+    // Maximum number of tokens
+    double burst;
+    // Current number of tokens; negative if reservations are pending
+    double tokens;
+    // Time of the last update
+    double last;
+
+public:
+    TokenBucket()
+        : lock()
+        , rate(0.0)
+        , burst(1.0)
+        , tokens(1.0)
+        , last(0.0)
+    {
+    }
+
+    // Set the rate (tokens per second) and the burst size.
+    // A rate of 0 disables the limit.
+    void Configure(double rate_, unsigned burst_)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+
+        rate = rate_ > 0.0 ? rate_ : 0.0;
+        burst = burst_ > 0 ? static_cast<double>(burst_) : 1.0;
+        tokens = burst;
+        last = 0.0;
+    }
+
+    // Take a token at time 'now' (in seconds).
+    // Returns how long the caller has to wait before the token may be used.
+    double Reserve(double now)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+
+        if (rate <= 0.0)
+            return 0.0;
+
+        if (last > 0.0)
+            tokens = std::min(burst, tokens + (now - last) * rate);
+
+        last = now;
+
+        tokens -= 1.0;
+
+        return tokens >= 0.0 ? 0.0 : -tokens / rate;
+    }
+};
+
+} // namespace wii
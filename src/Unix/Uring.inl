@@ -0,0 +1,331 @@
+// This file is distributed under the MIT license.
+// See the LICENSE file for details.
+
+#include <cerrno>
+
+#include <poll.h>
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <linux/io_uring.h>
+
+namespace
+{
+
+//
+// A minimal io_uring instance.
+//
+// Talks to the kernel through the raw system calls, so there is no dependency on liburing.
+// Only used from a single thread.
+//
+class Uring
+{
+public:
+    // Set in the user data of the poll which guards a read (see PrepareRead())
+    static uint64_t const PollTag = 1ull << 63;
+
+private:
+    // The io_uring file descriptor
+    int fd;
+    // Submission queue ring
+    void* sqRing;
+    size_t sqRingSize;
+    unsigned* sqHead;
+    unsigned* sqTail;
+    unsigned sqMask;
+    unsigned sqEntries;
+    unsigned* sqArray;
+    // Submission queue entries
+    io_uring_sqe* sqes;
+    size_t sqesSize;
+    // Completion queue ring
+    void* cqRing;
+    size_t cqRingSize;
+    unsigned* cqHead;
+    unsigned* cqTail;
+    unsigned cqMask;
+    io_uring_cqe* cqes;
+    // Number of entries queued but not yet submitted
+    unsigned pending;
+
+    Uring()
+        : fd(-1)
+        , sqRing(MAP_FAILED)
+        , sqRingSize(0)
+        , sqes(static_cast<io_uring_sqe*>(MAP_FAILED))
+        , sqesSize(0)
+        , cqRing(MAP_FAILED)
+        , cqRingSize(0)
+        , pending(0)
+    {
+    }
+
+public:
+    ~Uring()
+    {
+        if (cqRing != MAP_FAILED)
+            munmap(cqRing, cqRingSize);
+        if (sqes != MAP_FAILED)
+            munmap(sqes, sqesSize);
+        if (sqRing != MAP_FAILED)
+            munmap(sqRing, sqRingSize);
+        if (fd >= 0)
+            close(fd);
+    }
+
+    // Create a new io_uring instance.
+    // Returns null if io_uring is not available.
+    static std::unique_ptr<Uring> Create(unsigned entries)
+    {
+        std::unique_ptr<Uring> ring(new Uring);
+
+        io_uring_params params;
+
+        memset(&params, 0, sizeof(params));
+
+        ring->fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+
+        if (ring->fd < 0)
+        {
+            WII_LOG(IO, "io_uring not available: %d\n", errno);
+            return nullptr;
+        }
+
+        ring->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        ring->sqRing = mmap(0, ring->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+
+        if (ring->sqRing == MAP_FAILED)
+            return nullptr;
+
+        ring->sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+        ring->sqes = static_cast<io_uring_sqe*>(mmap(0, ring->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES));
+
+        if (ring->sqes == MAP_FAILED)
+            return nullptr;
+
+        ring->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        ring->cqRing = mmap(0, ring->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+
+        if (ring->cqRing == MAP_FAILED)
+            return nullptr;
+
+        uint8_t* sq = static_cast<uint8_t*>(ring->sqRing);
+        uint8_t* cq = static_cast<uint8_t*>(ring->cqRing);
+
+        ring->sqHead    = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+        ring->sqTail    = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        ring->sqMask    = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        ring->sqEntries = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_entries);
+        ring->sqArray   = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        ring->cqHead    = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        ring->cqTail    = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        ring->cqMask    = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        ring->cqes      = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+        //
+        // io_uring_setup exists since Linux 5.1, but IORING_OP_READ only since 5.6.
+        // Check for all the operations used here.
+        //
+
+        if (!ring->Supports(IORING_OP_READ)
+            || !ring->Supports(IORING_OP_POLL_ADD)
+            || !ring->Supports(IORING_OP_TIMEOUT)
+            || !ring->Supports(IORING_OP_ASYNC_CANCEL))
+        {
+            WII_LOG(IO, "io_uring does not support all required operations\n");
+            return nullptr;
+        }
+
+        return ring;
+    }
+
+    // Returns whether the kernel supports the given operation.
+    // Fails on kernels older than 5.6, which do not know IORING_REGISTER_PROBE.
+    bool Supports(unsigned opcode) const
+    {
+        // io_uring_probe is followed by one io_uring_probe_op per operation
+        union
+        {
+            io_uring_probe probe;
+            uint8_t buf[sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op)];
+        } u;
+
+        memset(&u, 0, sizeof(u));
+
+        if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, &u.probe, 256) < 0)
+            return false;
+
+        return opcode <= u.probe.last_op && (u.probe.ops[opcode].flags & IO_URING_OP_SUPPORTED) != 0;
+    }
+
+    // Make room for count submission queue entries.
+    // Flushes the submission queue if it is too full.
+    bool Reserve(unsigned count)
+    {
+        unsigned tail = *sqTail;
+
+        if (tail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) + count > sqEntries)
+        {
+            Submit(0);
+
+            if (tail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) + count > sqEntries)
+                return false;
+        }
+
+        return true;
+    }
+
+    // Returns a cleared submission queue entry.
+    // Flushes the submission queue if it is full.
+    io_uring_sqe* GetSqe()
+    {
+        if (!Reserve(1))
+            return nullptr;
+
+        unsigned tail = *sqTail;
+        unsigned index = tail & sqMask;
+
+        io_uring_sqe* sqe = &sqes[index];
+
+        memset(sqe, 0, sizeof(*sqe));
+
+        sqArray[index] = index;
+
+        __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+
+        pending++;
+
+        return sqe;
+    }
+
+    //
+    // Queue a read of len bytes into buf.
+    //
+    // The device is in non-blocking mode: a plain read completes with -EAGAIN at once if
+    // there is no data, and a read on a blocking descriptor would hold a kernel worker thread
+    // until the data arrives. With afterPoll, a poll linked in front of the read waits for
+    // the data without a thread.
+    // The poll completes with userData | PollTag, the read with userData. Every read
+    // completes, even if the poll in front of it fails.
+    //
+    bool PrepareRead(int device, uint8_t* buf, unsigned len, uint64_t userData, bool afterPoll)
+    {
+        // Queue both or none; a dangling link would attach to the next request
+        if (!Reserve(afterPoll ? 2 : 1))
+            return false;
+
+        if (afterPoll)
+        {
+            io_uring_sqe* poll = GetSqe();
+
+            poll->opcode = IORING_OP_POLL_ADD;
+            poll->fd = device;
+            poll->poll_events = POLLIN;
+            poll->flags = IOSQE_IO_LINK;
+            poll->user_data = userData | PollTag;
+        }
+
+        io_uring_sqe* sqe = GetSqe();
+
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = device;
+        sqe->addr = reinterpret_cast<uintptr_t>(buf);
+        sqe->len = len;
+        sqe->off = static_cast<uint64_t>(-1); // Current file position
+        sqe->user_data = userData;
+
+        return true;
+    }
+
+    // Queue a poll which completes with userData once the device has data to read (or has
+    // failed)
+    bool PreparePoll(int device, uint64_t userData)
+    {
+        io_uring_sqe* sqe = GetSqe();
+
+        if (sqe == nullptr)
+            return false;
+
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = device;
+        sqe->poll_events = POLLIN;
+        sqe->user_data = userData;
+
+        return true;
+    }
+
+    // Queue the cancellation of the request with the given user data.
+    // The cancelled request completes with -ECANCELED, or as usual if it is already running.
+    bool PrepareCancel(uint64_t userData)
+    {
+        io_uring_sqe* sqe = GetSqe();
+
+        if (sqe == nullptr)
+            return false;
+
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = userData;
+        sqe->user_data = 0;
+
+        return true;
+    }
+
+    // Queue a timeout which fires after the given time or as soon as any other request completes
+    bool PrepareTimeout(__kernel_timespec const* ts)
+    {
+        io_uring_sqe* sqe = GetSqe();
+
+        if (sqe == nullptr)
+            return false;
+
+        sqe->opcode = IORING_OP_TIMEOUT;
+        sqe->addr = reinterpret_cast<uintptr_t>(ts);
+        sqe->len = 1;
+        sqe->off = 1; // Number of completions
+        sqe->user_data = 0;
+
+        return true;
+    }
+
+    // Submit all queued entries and wait for waitFor completions
+    bool Submit(unsigned waitFor)
+    {
+        if (pending == 0 && waitFor == 0)
+            return true;
+
+        unsigned flags = waitFor > 0 ? IORING_ENTER_GETEVENTS : 0;
+
+        for (;;)
+        {
+            long result = syscall(__NR_io_uring_enter, fd, pending, waitFor, flags, nullptr, 0);
+
+            if (result >= 0)
+            {
+                pending -= static_cast<unsigned>(result) < pending ? static_cast<unsigned>(result) : pending;
+                return true;
+            }
+
+            if (errno != EINTR)
+                return false;
+        }
+    }
+
+    // Get the next completion -- if any
+    bool PopCqe(io_uring_cqe& cqe)
+    {
+        unsigned head = *cqHead;
+
+        if (head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE))
+            return false;
+
+        cqe = cqes[head & cqMask];
+
+        __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+
+        return true;
+    }
+};
+
+} // namespace
@@ -1,2 +1,713 @@
 // This file is distributed under the MIT license.
 // See the LICENSE file for details.
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <string>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/hidraw.h>
+
+namespace
+{
+
+//
+// Transport for hidraw devices
+//
+class HidrawTransport : public Transport
+{
+    // Device (hidraw) file descriptor
+    int device;
+    // Epoll instance used to wait for input reports
+    int epoll;
+    // Whether the device is a socket which delivers receive time stamps
+    bool timestamps;
+
+public:
+    HidrawTransport(int device, int epoll, bool timestamps)
+        : device(device)
+        , epoll(epoll)
+        , timestamps(timestamps)
+    {
+    }
+
+    virtual ~HidrawTransport()
+    {
+        close(device);
+        close(epoll);
+    }
+
+    virtual Result Read(uint8_t* report, double& time, int64_t timeout) override;
+
+    virtual bool Write(uint8_t const* report, unsigned len) override;
+
+    virtual int Descriptor() const override
+    {
+        return device;
+    }
+
+    virtual bool RawDescriptor() const override
+    {
+        // A socket stand-in's receive time stamps are only available through Receive()
+        return !timestamps;
+    }
+
+protected:
+    // Read a single packet of at most size bytes
+    Result ReadPacket(uint8_t* packet, unsigned size, double& time, int64_t timeout);
+
+    // Write a single packet
+    bool WritePacket(uint8_t const* packet, unsigned len);
+
+private:
+    // Wait at most timeout us for an event
+    int Wait(epoll_event& ev, int64_t timeout);
+
+    // Read a packet and its receive time stamp from a socket
+    ssize_t Receive(uint8_t* packet, unsigned size, double& time);
+};
+
+ssize_t HidrawTransport::Receive(uint8_t* packet, unsigned size, double& time)
+{
+    iovec iov;
+
+    iov.iov_base = packet;
+    iov.iov_len = size;
+
+    union
+    {
+        cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(timespec))];
+    } control;
+
+    msghdr msg;
+
+    memset(&msg, 0, sizeof(msg));
+
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    ssize_t n = recvmsg(device, &msg, 0);
+
+    if (n <= 0)
+        return n;
+
+    time = GetTime();
+
+    for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS)
+        {
+            //
+            // The kernel time stamp is taken from the realtime clock.
+            // Convert into the monotonic clock by subtracting the report's age.
+            //
+
+            timespec received;
+            timespec now;
+
+            memcpy(&received, CMSG_DATA(cmsg), sizeof(received));
+
+            clock_gettime(CLOCK_REALTIME, &now);
+
+            double age = (now.tv_sec - received.tv_sec) + (now.tv_nsec - received.tv_nsec) / 1000000000.0;
+
+            if (age > 0.0)
+                time -= age;
+        }
+    }
+
+    return n;
+}
+
+int HidrawTransport::Wait(epoll_event& ev, int64_t timeout)
+{
+#ifdef SYS_epoll_pwait2
+    //
+    // epoll_pwait2 (Linux 5.11) takes a timespec.
+    // Fall back to epoll_wait if it is not available.
+    //
+
+    static std::atomic<bool> hasPwait2(true);
+
+    if (hasPwait2)
+    {
+        timespec ts;
+
+        ts.tv_sec = static_cast<time_t>(timeout / 1000000);
+        ts.tv_nsec = static_cast<long>(timeout % 1000000) * 1000;
+
+        long result = syscall(SYS_epoll_pwait2, epoll, &ev, 1, timeout < 0 ? nullptr : &ts, nullptr, 0);
+
+        if (result >= 0 || errno != ENOSYS)
+            return static_cast<int>(result);
+
+        hasPwait2 = false;
+    }
+#endif
+
+    // Round up to full milliseconds
+    return epoll_wait(epoll, &ev, 1, timeout < 0 ? -1 : static_cast<int>((timeout + 999) / 1000));
+}
+
+Transport::Result HidrawTransport::Read(uint8_t* report, double& time, int64_t timeout)
+{
+    return ReadPacket(report, WII_REPORT_LENGTH, time, timeout);
+}
+
+bool HidrawTransport::Write(uint8_t const* report, unsigned len)
+{
+    return WritePacket(report, len);
+}
+
+Transport::Result HidrawTransport::ReadPacket(uint8_t* packet, unsigned size, double& time, int64_t timeout)
+{
+    //
+    // NOTE:
+    //
+    // The device is opened in non-blocking mode and registered with this transport's epoll
+    // instance. A read which would block waits for the device to become readable.
+    //
+    // Interrupted and spurious wakeups must not extend the wait: every retry only waits for
+    // the time remaining until the deadline.
+    //
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(timeout < 0 ? 0 : timeout);
+
+    for (;;)
+    {
+        ssize_t n = timestamps ? Receive(packet, size, time) : read(device, packet, size);
+
+        if (n > 0)
+        {
+            //
+            // hidraw delivers exactly one report per read, which might be shorter than
+            // the buffer. The remaining bytes are left as they are (zero).
+            //
+            // hidraw does not provide time stamps, so the report is stamped as soon as the
+            // read returns.
+            //
+
+            if (!timestamps)
+                time = GetTime();
+
+            return Result::OK;
+        }
+
+        if (n == 0)
+        {
+            //
+            // End of file.
+            // The device has been removed or the writing end of a stand-in has been closed.
+            //
+            break;
+        }
+
+        if (errno == EINTR)
+            continue;
+
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+            break;
+
+        if (timeout > 0)
+        {
+            auto remaining = std::chrono::duration_cast<std::chrono::microseconds>(deadline - std::chrono::steady_clock::now());
+
+            timeout = remaining.count() > 0 ? remaining.count() : 0;
+        }
+
+        if (timeout == 0)
+            return Result::Timeout;
+
+        //
+        // No report available.
+        // Wait for the device to become readable
+        //
+
+        epoll_event ev;
+
+        int result = Wait(ev, timeout);
+
+        if (result < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            break;
+        }
+
+        if (result == 0)
+        {
+            return Result::Timeout;
+        }
+
+        if ((ev.events & EPOLLIN) == 0 && (ev.events & (EPOLLERR | EPOLLHUP)) != 0)
+        {
+            break;
+        }
+    }
+
+    WII_LOG(IO, "Read failed.\n");
+
+    return Result::Error;
+}
+
+bool HidrawTransport::WritePacket(uint8_t const* packet, unsigned len)
+{
+    for (unsigned n = 0; n < 10; ++n)
+    {
+        //
+        // Writing to a socket whose other end has been closed must not raise SIGPIPE.
+        // Fall back to write if the device is not a socket.
+        //
+
+        ssize_t written = send(device, packet, len, MSG_NOSIGNAL);
+
+        if (written < 0 && errno == ENOTSOCK)
+            written = write(device, packet, len);
+
+        if (written == static_cast<ssize_t>(len))
+        {
+            return true;
+        }
+
+        if (written < 0 && errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK)
+        {
+            break;
+        }
+
+        //
+        // The device is busy.
+        // Wait (a little) until it accepts more data
+        //
+
+        pollfd pfd;
+
+        pfd.fd = device;
+        pfd.events = POLLOUT;
+        pfd.revents = 0;
+
+        poll(&pfd, 1, 10);
+    }
+
+    WII_LOG(IO, "Write failed.\n");
+
+    return false;
+}
+
+//
+// Transport for the Wiimote's raw HID-over-L2CAP channels
+//
+// Input reports arrive on the interrupt channel as DATA|Input transactions, ie. prefixed
+// by 0xA1. Output reports are sent on the interrupt channel as DATA|Output transactions,
+// prefixed by 0xA2. The control channel is only kept open; the Wiimote disconnects if it
+// is closed.
+//
+class L2capTransport : public HidrawTransport
+{
+    // Control channel socket -- if any
+    int control;
+
+public:
+    L2capTransport(int interrupt, int control, int epoll, bool timestamps)
+        : HidrawTransport(interrupt, epoll, timestamps)
+        , control(control)
+    {
+    }
+
+    virtual ~L2capTransport()
+    {
+        if (control >= 0)
+            close(control);
+    }
+
+    virtual Result Read(uint8_t* report, double& time, int64_t timeout) override;
+
+    virtual bool Write(uint8_t const* report, unsigned len) override;
+
+    virtual bool RawDescriptor() const override
+    {
+        // Every packet starts with a HID transaction header
+        return false;
+    }
+};
+
+// HID transaction header: DATA | Input
+#define WII_L2CAP_INPUT  0xA1
+// HID transaction header: DATA | Output
+#define WII_L2CAP_OUTPUT 0xA2
+
+Transport::Result L2capTransport::Read(uint8_t* report, double& time, int64_t timeout)
+{
+    uint8_t packet[1 + WII_REPORT_LENGTH];
+
+    //
+    // Skipped packets must not extend the wait: every retry only waits for the time
+    // remaining until the deadline.
+    //
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(timeout < 0 ? 0 : timeout);
+
+    for (;;)
+    {
+        memset(packet, 0, sizeof(packet));
+
+        Result result = ReadPacket(packet, sizeof(packet), time, timeout);
+
+        if (result != Result::OK)
+            return result;
+
+        if (packet[0] == WII_L2CAP_INPUT)
+        {
+            memcpy(report, packet + 1, WII_REPORT_LENGTH);
+            return Result::OK;
+        }
+
+        // Not an input report. Skip.
+        WII_LOG(IO, "Unexpected HID transaction 0x%02X\n", packet[0]);
+
+        if (timeout > 0)
+        {
+            auto remaining = std::chrono::duration_cast<std::chrono::microseconds>(deadline - std::chrono::steady_clock::now());
+
+            timeout = remaining.count() > 0 ? remaining.count() : 0;
+        }
+    }
+}
+
+bool L2capTransport::Write(uint8_t const* report, unsigned len)
+{
+    assert(0 < len && len <= WII_REPORT_LENGTH);
+
+    uint8_t packet[1 + WII_REPORT_LENGTH];
+
+    packet[0] = WII_L2CAP_OUTPUT;
+
+    memcpy(packet + 1, report, len);
+
+    return WritePacket(packet, len + 1);
+}
+
+// Switch the descriptor to non-blocking mode and register it with a new epoll instance.
+// Returns the epoll instance or -1 on failure.
+int PrepareDescriptor(int fd, bool& timestamps)
+{
+    int flags = fcntl(fd, F_GETFL);
+
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+        return -1;
+
+    int epoll = epoll_create1(EPOLL_CLOEXEC);
+
+    if (epoll < 0)
+        return -1;
+
+    epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+
+    if (epoll_ctl(epoll, EPOLL_CTL_ADD, fd, &ev) < 0)
+    {
+        close(epoll);
+        return -1;
+    }
+
+    //
+    // If the descriptor is a socket, let the kernel time stamp the reports
+    //
+
+    int on = 1;
+
+    timestamps = setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on)) == 0;
+
+    return epoll;
+}
+
+} // namespace
+
+std::unique_ptr<Transport> wii::CreateHidrawTransport(int fd)
+{
+    assert( fd >= 0 );
+
+    bool timestamps = false;
+
+    int epoll = PrepareDescriptor(fd, timestamps);
+
+    if (epoll < 0)
+    {
+        close(fd);
+        return nullptr;
+    }
+
+    return std::unique_ptr<Transport>(new HidrawTransport(fd, epoll, timestamps));
+}
+
+std::unique_ptr<Transport> wii::CreateL2capTransport(int interrupt, int control)
+{
+    assert( interrupt >= 0 );
+
+    bool timestamps = false;
+
+    int epoll = PrepareDescriptor(interrupt, timestamps);
+
+    if (epoll < 0)
+    {
+        close(interrupt);
+        if (control >= 0)
+            close(control);
+        return nullptr;
+    }
+
+    return std::unique_ptr<Transport>(new L2capTransport(interrupt, control, epoll, timestamps));
+}
+
+MappedFile::MappedFile()
+    : data(nullptr)
+    , size(0)
+{
+}
+
+MappedFile::~MappedFile()
+{
+    Close();
+}
+
+bool MappedFile::Open(char const* path)
+{
+    Close();
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+
+    if (fstat(fd, &st) < 0 || st.st_size == 0)
+    {
+        close(fd);
+        return false;
+    }
+
+    // The mapping keeps the file open
+    void* addr = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+
+    close(fd);
+
+    if (addr == MAP_FAILED)
+        return false;
+
+    // Files are read front to back
+    madvise(addr, static_cast<size_t>(st.st_size), MADV_SEQUENTIAL);
+
+    data = static_cast<uint8_t const*>(addr);
+    size = static_cast<size_t>(st.st_size);
+
+    return true;
+}
+
+void MappedFile::Close()
+{
+    if (data)
+        munmap(const_cast<uint8_t*>(data), size);
+
+    data = nullptr;
+    size = 0;
+}
+
+void Wiimote::Impl::Init()
+{
+}
+
+void Wiimote::Impl::Finish()
+{
+}
+
+double wii::GetTime()
+{
+    timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+bool Wiimote::Impl::IsWiimoteUevent(char const* ueventPath)
+{
+    //
+    // The uevent file contains a line like "HID_ID=0005:0000057E:00000306"
+    // (bus, vendor, product)
+    //
+
+    FILE* file = fopen(ueventPath, "r");
+
+    if (file == nullptr)
+        return false;
+
+    bool match = false;
+
+    char line[256];
+
+    while (fgets(line, sizeof(line), file))
+    {
+        unsigned bus = 0;
+        unsigned vendor = 0;
+        unsigned product = 0;
+
+        if (sscanf(line, "HID_ID=%x:%x:%x", &bus, &vendor, &product) == 3)
+        {
+            match = vendor == WII_VENDOR_ID && (product == WII_PRODUCT_ID || product == WII_PRODUCT_ID_2);
+            break;
+        }
+    }
+
+    fclose(file);
+
+    return match;
+}
+
+int Wiimote::Impl::OpenDeviceHandle(char const* devicePath, char const* ueventPath)
+{
+    //
+    // Open a read/write handle to our device
+    //
+
+    int fd = open(devicePath, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+
+    if (fd >= 0)
+    {
+        //
+        // Get the attributes of the current device
+        // If the vendor and product IDs match up it's a Wiimote
+        //
+
+        hidraw_devinfo info;
+
+        memset(&info, 0, sizeof(info));
+
+        if (ioctl(fd, HIDIOCGRAWINFO, &info) == 0)
+        {
+            unsigned vendor = static_cast<uint16_t>(info.vendor);
+            unsigned product = static_cast<uint16_t>(info.product);
+
+            bool vendorOK = vendor == WII_VENDOR_ID;
+            bool productOK = product == WII_PRODUCT_ID || product == WII_PRODUCT_ID_2;
+
+            if (vendorOK && productOK)
+            {
+                return fd;
+            }
+        }
+        else if (ueventPath && (errno == ENOTTY || errno == EINVAL) && IsWiimoteUevent(ueventPath))
+        {
+            // Not a hidraw device, but something standing in for a Wiimote
+            return fd;
+        }
+
+        close(fd);
+    }
+
+    return -1;
+}
+
+bool Wiimote::Impl::Connect(Wiimote* wiimotes, unsigned& count)
+{
+    // Only hidraw devices
+    return Connect(wiimotes, count, "/dev", nullptr);
+}
+
+bool Wiimote::Impl::Connect(Wiimote* wiimotes, unsigned& count, char const* devRoot, char const* sysRoot)
+{
+    // Parameter validation
+    assert( wiimotes && count > 0 );
+
+    //
+    // Get a list of all hidraw devices
+    //
+
+    DIR* dir = opendir(devRoot);
+
+    if (dir == nullptr)
+    {
+        return false;
+    }
+
+    std::vector<std::string> deviceNames;
+
+    while (dirent* entry = readdir(dir))
+    {
+        if (strncmp(entry->d_name, "hidraw", 6) == 0)
+        {
+            deviceNames.push_back(entry->d_name);
+        }
+    }
+
+    closedir(dir);
+
+    // Connect in a stable order: hidraw0, hidraw1, ...
+    std::sort(deviceNames.begin(), deviceNames.end(), [](std::string const& lhs, std::string const& rhs) {
+        return lhs.size() != rhs.size() ? lhs.size() < rhs.size() : lhs < rhs;
+    });
+
+    //
+    // Probe all devices concurrently; opening a device might take a while
+    //
+
+    std::vector<int> handles(deviceNames.size(), -1);
+
+    ParallelFor(deviceNames.size(), WII_MAX_PROBE_THREADS, [&](size_t index) {
+        std::string devicePath = std::string(devRoot) + "/" + deviceNames[index];
+
+        if (sysRoot)
+        {
+            std::string ueventPath = std::string(sysRoot) + "/" + deviceNames[index] + "/device/uevent";
+
+            handles[index] = OpenDeviceHandle(devicePath.c_str(), ueventPath.c_str());
+        }
+        else
+        {
+            handles[index] = OpenDeviceHandle(devicePath.c_str());
+        }
+    });
+
+    //
+    // Connect the Wiimotes in order
+    //
+
+    unsigned connected = 0;
+
+    for (size_t index = 0; index < handles.size(); index++)
+    {
+        int fd = handles[index];
+
+        if (fd < 0)
+            continue;
+
+        if (connected < count && wiimotes[connected].impl->Attach(CreateHidrawTransport(fd)))
+            connected++;
+        else if (connected >= count)
+            close(fd);
+    }
+
+    count = connected;
+
+    return true;
+}
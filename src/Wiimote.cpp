@@ -23,6 +23,21 @@ bool Wiimote::Connect()
     return impl->Connect(this, count) && count == 1;
 }
 
+bool Wiimote::Connect(std::unique_ptr<Transport> transport)
+{
+    return impl->Attach(std::move(transport));
+}
+
+#ifndef _WIN32
+bool Wiimote::Connect(Wiimote* wiimotes, unsigned& count, char const* devRoot, char const* sysRoot)
+{
+    if (devRoot == nullptr)
+        return Impl::Connect(wiimotes, count);
+
+    return Impl::Connect(wiimotes, count, devRoot, sysRoot);
+}
+#endif
+
 bool Wiimote::SetReportMode(ReportMode mode, bool continous)
 {
     return SetReportMode(mode, IRData::Sensitivity::Level3, continous);
@@ -64,6 +79,81 @@ bool Wiimote::Poll()
     return impl->Poll();
 }
 
+Wiimote::PollResult Wiimote::Poll(std::chrono::microseconds timeout)
+{
+    switch (impl->Poll(timeout.count()))
+    {
+    case Transport::Result::OK:
+        return PollResult::Report;
+    case Transport::Result::Timeout:
+        return PollResult::NoData;
+    case Transport::Result::Error:
+        break;
+    }
+
+    return PollResult::Error;
+}
+
+Wiimote::PollResult Wiimote::TryPoll()
+{
+    return Poll(std::chrono::microseconds(0));
+}
+
+Wiimote::PollResult Wiimote::PollAll(unsigned& count, std::function<void (State const&)> const& callback, unsigned maxReports)
+{
+    if (impl->PollAll(count, callback, maxReports) == Transport::Result::Error)
+        return PollResult::Error;
+
+    return count > 0 ? PollResult::Report : PollResult::NoData;
+}
+
+bool Wiimote::EnableReaderThread(bool enable)
+{
+    if (enable)
+        return impl->StartReader();
+
+    impl->StopReader();
+    return true;
+}
+
+bool Wiimote::EnableWriterThread(bool enable)
+{
+    if (enable)
+        return impl->StartWriter();
+
+    impl->StopWriter();
+    return true;
+}
+
+void Wiimote::SetOutputPacing(double rate, unsigned burst)
+{
+    impl->pacing.Configure(rate, burst);
+}
+
+OutputStats Wiimote::GetOutputStats() const
+{
+    OutputStats stats;
+
+    stats.reports = impl->outputReports;
+    stats.delayed = impl->outputDelayed;
+    stats.waitTime = impl->outputWait / 1000000.0;
+    stats.maxWaitTime = impl->outputMaxWait / 1000000.0;
+
+    return stats;
+}
+
+void Wiimote::SetCapture(CaptureWriter* capture, unsigned device)
+{
+    assert(device <= 0xFFFF && "Capture device ids are 16 bit");
+
+    impl->SetCapture(capture, device);
+}
+
+bool Wiimote::Seek(double time)
+{
+    return impl->Seek(time);
+}
+
 bool Wiimote::Shutdown()
 {
     return impl->Shutdown();
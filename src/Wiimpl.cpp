@@ -4,22 +4,70 @@
 #include "Wiimpl.h"
 #include "Data.h"
 #include "Log.h"
+#include "MappedFile.h"
+#include "Parallel.h"
 #include "Utils.h"
 
 using namespace wii;
 
+//--------------------------------------------------------------------------------------------------
+//
+//--------------------------------------------------------------------------------------------------
+
+namespace
+{
+
+// Output report pacing across all Wiimotes
+TokenBucket& GlobalPacing()
+{
+    static TokenBucket bucket;
+    return bucket;
+}
+
+} // namespace
+
+void wii::SetGlobalOutputPacing(double rate, unsigned burst)
+{
+    GlobalPacing().Configure(rate, burst);
+}
+
 //--------------------------------------------------------------------------------------------------
 // Common
 //--------------------------------------------------------------------------------------------------
 
 Wiimote::Impl::Impl()
     : state()
+    , calibration()
     , reportMode(ReportMode::Undefined)
     , continous(true)
+    , decoder(nullptr)
+    , decoderId(0)
+    , decoderMode(IRData::Mode::Off)
+    , decoderExtension(0)
     , requests()
     , status(WII_STATUS_UNKNOWN)
-    , device(INVALID_HANDLE_VALUE)
-    , overlapped()
+    , transport()
+    , queue()
+    , reader()
+    , readerRunning(false)
+    , readerError(false)
+    , readerWaiting(false)
+    , readerLock()
+    , readerSignal()
+    , outputs()
+    , writer()
+    , writerRunning(false)
+    , writerError(false)
+    , writerLock()
+    , writerSignal()
+    , pacing()
+    , outputReports(0)
+    , outputDelayed(0)
+    , outputWait(0)
+    , outputMaxWait(0)
+    , capture(nullptr)
+    , captureDevice(0)
+    , captureLock()
 {
     // Clear the state!
     memset(&state, 0, sizeof(state));
@@ -32,9 +80,444 @@ Wiimote::Impl::~Impl()
     assert( (status == WII_STATUS_UNKNOWN || status == WII_STATUS_DISCONNECTED || status == WII_STATUS_ERROR)
         && "Wiimote not properly disconnected" );
 
+    StopReader();
+    StopWriter();
+
     Finish();
 }
 
+double Wiimote::Impl::Time()
+{
+    return GetTime();
+}
+
+bool Wiimote::Impl::Attach(std::unique_ptr<Transport> transport_)
+{
+    if (!transport_)
+        return false;
+
+    transport = std::move(transport_);
+    status = WII_STATUS_CONNECTED;
+
+    return true;
+}
+
+void Wiimote::Impl::Disconnect()
+{
+    StopReader();
+    StopWriter();
+
+    transport.reset();
+
+    status = WII_STATUS_DISCONNECTED;
+}
+
+bool Wiimote::Impl::Reattach(std::unique_ptr<Transport> transport_)
+{
+    if (!transport_)
+        return false;
+
+    //
+    // Remember the application's settings of the lost link
+    //
+
+    ReportMode mode = reportMode;
+    IRData::Sensitivity sensitivity = state.ir.sensitivity;
+    unsigned leds = state.leds;
+    bool rumble = state.rumble;
+    bool hasReader = queue != nullptr;
+    bool hasWriter;
+    {
+        std::lock_guard<std::mutex> lock(writerLock);
+        hasWriter = writerRunning;
+    }
+
+    Disconnect();
+
+    Attach(std::move(transport_));
+
+    if (hasReader)
+        StartReader();
+    if (hasWriter)
+        StartWriter();
+
+    Restart(mode, sensitivity, leds, rumble);
+
+    return true;
+}
+
+void Wiimote::Impl::Restart(ReportMode mode, IRData::Sensitivity sensitivity, unsigned leds, bool rumble)
+{
+    memset(&state, 0, sizeof(state));
+
+    requests.clear();
+    reportMode = ReportMode::Undefined;
+    motionPlusStatus = WII_STATUS_MP_UNKNOWN;
+    status = WII_STATUS_CONNECTED;
+
+    if (mode != ReportMode::Undefined)
+        SetReportMode(mode, sensitivity, continous);
+
+    state.rumble = rumble;
+
+    SetLEDs(leds);
+}
+
+bool Wiimote::Impl::Seek(double time)
+{
+    if (!transport)
+        return false;
+
+    ReportMode mode = reportMode;
+    IRData::Sensitivity sensitivity = state.ir.sensitivity;
+    unsigned leds = state.leds;
+    bool rumble = state.rumble;
+    bool hasReader = queue != nullptr;
+
+    //
+    // Reports already read and requests not yet written belong to the old position
+    //
+
+    StopReader();
+
+    {
+        std::lock_guard<std::mutex> lock(writerLock);
+        outputs.clear();
+    }
+
+    bool seeked = transport->Seek(time);
+
+    //
+    // The capture's checkpoints only hold the device's responses, not the state derived
+    // from them; the startup requests derive it again from those responses
+    //
+
+    if (seeked)
+        Restart(mode, sensitivity, leds, rumble);
+
+    if (hasReader)
+        StartReader();
+
+    return seeked;
+}
+
+Transport::Result Wiimote::Impl::GetInputReport(uint8_t* report, double& time, int64_t timeout)
+{
+    assert(transport);
+
+    if (!queue)
+    {
+        Transport::Result result = transport->Read(report, time, timeout);
+
+        if (result == Transport::Result::OK)
+            Capture(CaptureWriter::Direction::Input, time, report, WII_REPORT_LENGTH);
+
+        return result;
+    }
+
+    InputReport input;
+
+    if (!queue->Pop(input))
+    {
+        if (timeout == 0)
+        {
+            // The reader pushes all reports before it flags an error
+            bool error = readerError;
+
+            if (!queue->Pop(input))
+                return error ? Transport::Result::Error : Transport::Result::Timeout;
+        }
+        else
+        {
+
+            //
+            // Nothing there.
+            // Wait for the reader thread to push the next report.
+            //
+
+            auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(timeout < 0 ? 0 : timeout);
+
+            std::unique_lock<std::mutex> lock(readerLock);
+
+            readerWaiting = true;
+
+            // Pairs with the fence in RunReader()
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+
+            for (;;)
+            {
+                bool error = readerError;
+
+                if (queue->Pop(input))
+                    break;
+
+                if (error)
+                {
+                    readerWaiting = false;
+                    return Transport::Result::Error;
+                }
+
+                if (timeout < 0)
+                {
+                    readerSignal.wait(lock);
+                }
+                else if (readerSignal.wait_until(lock, deadline) == std::cv_status::timeout && queue->Empty())
+                {
+                    readerWaiting = false;
+                    return Transport::Result::Timeout;
+                }
+            }
+
+            readerWaiting = false;
+        }
+    }
+
+    std::memcpy(report, input.data, WII_REPORT_LENGTH);
+
+    time = input.time;
+
+    Capture(CaptureWriter::Direction::Input, time, report, WII_REPORT_LENGTH);
+
+    return Transport::Result::OK;
+}
+
+bool Wiimote::Impl::StartReader()
+{
+    if (!transport)
+        return false;
+
+    if (queue)
+        return true;
+
+    queue.reset(new InputQueue(WII_INPUT_QUEUE_SIZE));
+
+    readerRunning = true;
+    readerError = false;
+
+    reader = std::thread(&Impl::RunReader, this);
+
+    return true;
+}
+
+void Wiimote::Impl::StopReader()
+{
+    if (!queue)
+        return;
+
+    readerRunning = false;
+
+    reader.join();
+
+    //
+    // NOTE:
+    // Reports still in the queue are lost.
+    //
+
+    queue.reset();
+}
+
+void Wiimote::Impl::RunReader()
+{
+    InputReport input;
+
+    while (readerRunning)
+    {
+        std::memset(input.data, 0, sizeof(input.data));
+
+        // Wake up regularly to check whether to stop
+        Transport::Result result = transport->Read(input.data, input.time, 100000);
+
+        if (result == Transport::Result::Timeout)
+            continue;
+
+        if (result == Transport::Result::Error)
+        {
+            readerError = true;
+        }
+        else
+        {
+            //
+            // If the consumer falls behind by more than the queue can hold, stop reading.
+            // The reports then queue up in the OS.
+            //
+
+            while (!queue->Push(input) && readerRunning)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+
+        // Pairs with the fence in GetInputReport()
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        if (readerWaiting)
+        {
+            std::lock_guard<std::mutex> lock(readerLock);
+            readerSignal.notify_one();
+        }
+
+        if (readerError)
+            break;
+    }
+}
+
+bool Wiimote::Impl::StartWriter()
+{
+    if (!transport)
+        return false;
+
+    std::lock_guard<std::mutex> lock(writerLock);
+
+    if (writerRunning)
+        return true;
+
+    writerRunning = true;
+    writerError = false;
+
+    writer = std::thread(&Impl::RunWriter, this);
+
+    return true;
+}
+
+void Wiimote::Impl::StopWriter()
+{
+    {
+        std::lock_guard<std::mutex> lock(writerLock);
+
+        if (!writerRunning)
+            return;
+
+        writerRunning = false;
+    }
+
+    writerSignal.notify_one();
+
+    writer.join();
+}
+
+void Wiimote::Impl::RunWriter()
+{
+    OutputReport output;
+
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(writerLock);
+
+            while (outputs.empty() && writerRunning)
+                writerSignal.wait(lock);
+
+            // Flush the queue before exiting
+            if (outputs.empty())
+                break;
+
+            output = outputs.front();
+            outputs.pop_front();
+        }
+
+        if (!WriteOutputReport(output.data, output.len))
+        {
+            WII_LOG(IO, "Failed to write output report 0x%02X\n", output.data[0]);
+
+            writerError = true;
+
+            std::lock_guard<std::mutex> lock(writerLock);
+            outputs.clear();
+        }
+    }
+}
+
+bool Wiimote::Impl::WriteOutputReport(uint8_t const* report, unsigned len)
+{
+    double now = Time();
+
+    double wait = std::max(pacing.Reserve(now), GlobalPacing().Reserve(now));
+
+    if (wait > 0.0)
+    {
+        std::this_thread::sleep_for(std::chrono::duration<double>(wait));
+
+        unsigned long long us = static_cast<unsigned long long>(wait * 1000000.0);
+
+        outputDelayed++;
+        outputWait += us;
+
+        unsigned long long maxWait = outputMaxWait;
+        while (us > maxWait && !outputMaxWait.compare_exchange_weak(maxWait, us))
+        {
+        }
+    }
+
+    outputReports++;
+
+    if (!transport->Write(report, len))
+        return false;
+
+    // Merged and superseded reports never make it here; the capture only holds what went out
+    Capture(CaptureWriter::Direction::Output, Time(), report, len);
+
+    return true;
+}
+
+bool Wiimote::Impl::SetOutputReport(uint8_t const* report, unsigned len)
+{
+    assert(transport);
+    assert(0 < len && len <= WII_REPORT_LENGTH);
+
+    std::unique_lock<std::mutex> lock(writerLock);
+
+    if (!writerRunning)
+    {
+        lock.unlock();
+        return WriteOutputReport(report, len);
+    }
+
+    if (writerError)
+        return false;
+
+    //
+    // Merge reports which are superseded by this one:
+    //
+    // The LED report (which also carries the rumble bit) only sets state, so a queued
+    // LED report can simply be replaced.
+    // The report mode must not overtake the reports queued after it (IR initialization,
+    // memory writes), so it only replaces the last queued report.
+    //
+
+    OutputReport* merge = nullptr;
+
+    if (report[0] == WII_OUTPUT_LEDS)
+    {
+        for (auto& output : outputs)
+        {
+            if (output.data[0] == WII_OUTPUT_LEDS)
+                merge = &output;
+        }
+    }
+    else if (report[0] == WII_OUTPUT_REPORT_MODE)
+    {
+        if (!outputs.empty() && outputs.back().data[0] == WII_OUTPUT_REPORT_MODE)
+            merge = &outputs.back();
+    }
+
+    if (merge == nullptr)
+    {
+        outputs.push_back(OutputReport());
+        merge = &outputs.back();
+    }
+
+    std::memset(merge->data, 0, sizeof(merge->data));
+    std::memcpy(merge->data, report, len);
+
+    merge->len = len;
+
+    lock.unlock();
+
+    writerSignal.notify_one();
+
+    return true;
+}
+
 bool Wiimote::Impl::SendReport(uint8_t type, uint8_t const* data, unsigned size)
 {
     assert(data);
@@ -160,11 +643,40 @@ bool Wiimote::Impl::SetReportMode(ReportMode mode, IRData::Sensitivity sensitivi
 }
 
 bool Wiimote::Impl::Poll()
+{
+    //
+    // In continuous mode, the Wiimote sends a report every 10 ms; give up after 1000 ms.
+    // In non-continuous mode, the Wiimote only sends reports if the data has changed.
+    //
+    // NOTE:
+    // A timeout does not mean the connection has been lost. The transport reports broken
+    // links as errors.
+    //
+
+    return Poll(continous ? 1000000 : -1) == Transport::Result::OK;
+}
+
+Transport::Result Wiimote::Impl::Poll(int64_t timeout)
 {
     assert(reportMode != ReportMode::Undefined);
 
     if (status == WII_STATUS_ERROR || status == WII_STATUS_SHUTDOWN_COMPLETE)
-        return false;
+        return Transport::Result::Error;
+
+    //
+    // The writer thread failed to write an output report.
+    // If that happened while the last report was being read, the report has been processed
+    // first; report the error now.
+    //
+
+    if (writerError)
+    {
+        WII_LOG(STATUS, "Connection lost\n");
+
+        status = WII_STATUS_ERROR;
+
+        return Transport::Result::Error;
+    }
 
     // Send the next request
     SendNextRequest();
@@ -172,20 +684,60 @@ bool Wiimote::Impl::Poll()
     unsigned char report[WII_REPORT_LENGTH] = { 0 };
 
     // Read a report from the wiimote
-    if (!GetInputReport(report))
+    double time = 0.0;
+
+    Transport::Result result = GetInputReport(report, time, timeout);
+
+    // The writer thread failed to write an output report; don't wait for the next call
+    // unless there is a report to process
+    if (result != Transport::Result::OK && writerError)
+        result = Transport::Result::Error;
+
+    if (result == Transport::Result::Error)
     {
         WII_LOG(STATUS, "Connection lost\n");
 
         status = WII_STATUS_ERROR; // Connection lost   .
-        return false;
     }
 
+    if (result == Transport::Result::OK)
+    {
+        Dispatch(report, time);
+    }
+
+    return result;
+}
+
+Transport::Result Wiimote::Impl::PollAll(unsigned& count, std::function<void (State const&)> const& callback, unsigned maxReports)
+{
+    count = 0;
+
+    //
+    // Process the reports in order. Each Poll() also sends the next pending request, so
+    // read requests make progress while catching up.
+    //
+
+    Transport::Result result = Transport::Result::Timeout;
+
+    while (count < maxReports && (result = Poll(0)) == Transport::Result::OK)
+    {
+        count++;
+
+        if (callback)
+            callback(state);
+    }
+
+    return result;
+}
+
+void Wiimote::Impl::Dispatch(uint8_t const* report, double time)
+{
     // Process the report
-    if (!ProcessReport(report))
+    if (!ProcessReport(report, time))
     {
 #if 0
         status = WII_STATUS_ERROR;
-        return false;
+        return;
 #endif
     }
 
@@ -244,8 +796,6 @@ bool Wiimote::Impl::Poll()
             }
         }
     }
-
-    return true;
 }
 
 bool Wiimote::Impl::Shutdown()
@@ -304,10 +854,23 @@ void Wiimote::Impl::WriteData(unsigned address, uint8_t data)
     WriteData(address, &data, 1);
 }
 
-bool Wiimote::Impl::ProcessReport(uint8_t const* buf /*[22]*/)
+bool Wiimote::Impl::ProcessReport(uint8_t const* buf /*[22]*/, double time)
 {
     state.data = 0; // Mark everything as invalid
-    state.time = Time();
+    state.time = time;
+    state.processTime = Time();
+
+    //
+    // Data reports make up almost all of the traffic. Decode them with a decoder specialized
+    // for the report layout, the IR mode and the extension type, which is only looked up
+    // again if one of these changes.
+    //
+
+    if (decoder && buf[0] == decoderId && state.ir.mode == decoderMode && state.extension.type == decoderExtension)
+    {
+        decoder(state, buf, &calibration);
+        return 0;
+    }
 
     switch (buf[0])
     {
@@ -326,47 +889,20 @@ bool Wiimote::Impl::ProcessReport(uint8_t const* buf /*[22]*/)
         ProcessAcknowledgeReport(buf + 3);
         break;
 
-    case 0x30: // Buttons
-        ParseButtons(state, buf + 1);
-        break;
-
-    case 0x31: // ButtonsAccel
-        ParseButtons(state, buf + 1);
-        ParseAccel(state, buf + 1);
-        break;
-
-    case 0x32: // ButtonsExt
-        ParseButtons(state, buf + 1);
-        ParseExtension(state, buf + 3);
-        break;
-
-    case 0x33: // ButtonsAccelIR (12 IR bytes)
-        ParseButtons(state, buf + 1);
-        ParseAccel(state, buf + 1);
-        ParseIR(state, buf + 6);
-        break;
-
-    case 0x35: // ButtonsAccelExt
-        ParseButtons(state, buf + 1);
-        ParseAccel(state, buf + 1);
-        ParseExtension(state, buf + 6);
-        break;
+    default:
+        decoder = GetReportDecoder(buf[0], state.ir.mode, state.extension.type);
 
-    case 0x36: // ButtonsIRExt (10 IR bytes)
-        ParseButtons(state, buf + 1);
-        ParseIR(state, buf + 3);
-        ParseExtension(state, buf + 13);
-        break;
+        if (decoder == nullptr)
+        {
+            assert(0); // Not implemented
+            break;
+        }
 
-    case 0x37: // ButtonsAccelIRExt (10 IR bytes)
-        ParseButtons(state, buf + 1);
-        ParseAccel(state, buf + 1);
-        ParseIR(state, buf + 6);
-        ParseExtension(state, buf + 16);
-        break;
+        decoderId = buf[0];
+        decoderMode = state.ir.mode;
+        decoderExtension = state.extension.type;
 
-    default:
-        assert(0); // Not implemented
+        decoder(state, buf, &calibration);
         break;
     }
 
@@ -482,8 +1018,6 @@ bool Wiimote::Impl::ProcessStatusReport(uint8_t const* buf)
 
 bool Wiimote::Impl::ProcessDataReport(uint8_t const* buf)
 {
-    assert(!requests.empty());
-
     // buf = SE AA AA DD DD DD DD DD DD DD DD DD DD DD DD DD DD DD DD
 
     unsigned count      = 1 + (buf[0] >> 4);
@@ -492,9 +1026,15 @@ bool Wiimote::Impl::ProcessDataReport(uint8_t const* buf)
 
     static_cast<void>(address); // unused in release builds...
 
+    // Unrequested data (eg. when playing back a capture). Ignore.
+    if (requests.empty() || requests.front().type != Request::Type::Read)
+    {
+        WII_LOG(READ, "Unexpected read data: %04x\n", address);
+        return false;
+    }
+
     Request& req = requests.front();
 
-    assert(req.type == Request::Type::Read);
     assert(count <= req.pending);
     assert(address == ((req.address + req.done) & 0xFFFF));
 
@@ -535,13 +1075,18 @@ bool Wiimote::Impl::ProcessDataReport(uint8_t const* buf)
 bool Wiimote::Impl::ProcessAcknowledgeReport(uint8_t const* buf)
 {
 #if 1
-    assert(!requests.empty());
-
     // buf = RR EE
 
     unsigned reg    = buf[0];
     unsigned error  = buf[1];
 
+    // Unrequested acknowledge (eg. when playing back a capture). Ignore.
+    if (requests.empty())
+    {
+        WII_LOG(WRITE, "Unexpected ack: reg: %02x error: %02x\n", reg, error);
+        return false;
+    }
+
     Request& req = requests.front();
 
     req.error = error;
@@ -861,14 +1406,14 @@ void Wiimote::Impl::ReadCalibrationData()
 {
     using namespace std::placeholders;
 
-    ReadData(0x00000016, 8, std::bind(&ParseCalibrationData, std::ref(state), _1, _2, _3));
+    ReadData(0x00000016, 8, std::bind(&ParseCalibrationData, std::ref(state), _1, _2, _3, &calibration));
 }
 
 void Wiimote::Impl::ReadExtensionCalibrationData()
 {
     using namespace std::placeholders;
 
-    ReadData(0x04A40020, 16, std::bind(&ParseExtensionCalibrationData, std::ref(state), _1, _2, _3));
+    ReadData(0x04A40020, 16, std::bind(&ParseExtensionCalibrationData, std::ref(state), _1, _2, _3, &calibration));
 }
 
 void Wiimote::Impl::ReadMotionPlusCalibrationData()
@@ -946,11 +1491,53 @@ bool Wiimote::Impl::SetLEDs(unsigned leds)
 
 bool Wiimote::Impl::SetRumble(bool enable)
 {
+    if (state.rumble == enable)
+        return true;
+
     state.rumble = enable;
 
+    //
+    // Every output report carries the rumble bit.
+    // If a report is about to be sent anyway, let it carry the new rumble state and only
+    // send a dedicated report if the link is idle.
+    //
+
+    //
+    // The next request goes out with the next Poll() -- unless the Wiimote is no longer
+    // polled because the link is lost or the Wiimote has been shut down.
+    //
+
+    bool polled = status != WII_STATUS_ERROR
+               && status != WII_STATUS_SHUTDOWN_COMPLETE
+               && status != WII_STATUS_DISCONNECTED;
+
+    if (polled && !requests.empty() && !requests.front().sent)
+        return true;
+
+    if (!transport)
+        return false;
+
+    if (SetQueuedRumble(enable))
+        return true;
+
     return SetLEDs(state.leds); // LED report also handles rumble
 }
 
+bool Wiimote::Impl::SetQueuedRumble(bool enable)
+{
+    std::lock_guard<std::mutex> lock(writerLock);
+
+    if (!writerRunning || writerError || outputs.empty())
+        return false;
+
+    for (auto& output : outputs)
+    {
+        output.data[1] = static_cast<uint8_t>((output.data[1] & ~0x01) | (enable ? 0x01 : 0x00));
+    }
+
+    return true;
+}
+
 //--------------------------------------------------------------------------------------------------
 // OS-specific implementation
 //--------------------------------------------------------------------------------------------------
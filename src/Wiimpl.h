@@ -4,12 +4,23 @@
 #pragma once
 
 #include "Wiimote/Wiimote.h"
+#include "Wiimote/Capture.h"
+#include "Wiimote/Transport.h"
 
+#include "Data.h"
+#include "RingBuffer.h"
+#include "TokenBucket.h"
+
+#include <atomic>
 #include <cassert>
+#include <chrono>
+#include <condition_variable>
 #include <cstdint>
 #include <cstring>
 #include <deque>
 #include <functional>
+#include <memory>
+#include <mutex>
 #include <thread>
 #include <vector>
 
@@ -117,27 +128,103 @@ using Requests = std::deque<Request>;
 //
 //--------------------------------------------------------------------------------------------------
 
+// A raw input report
+struct InputReport
+{
+    // Time the report has been read
+    double time;
+    // The report
+    uint8_t data[WII_REPORT_LENGTH];
+};
+
+// Reports read by the reader thread
+using InputQueue = RingBuffer<InputReport>;
+
+// Maximum number of devices probed concurrently by Connect()
+#define WII_MAX_PROBE_THREADS 8
+
+// Capacity of the reader thread's queue (about 10 seconds of reports)
+#define WII_INPUT_QUEUE_SIZE 1024
+
+// A raw output report
+struct OutputReport
+{
+    // Length of the report, including the report id
+    unsigned len;
+    // The report
+    uint8_t data[WII_REPORT_LENGTH];
+};
+
+// Reports waiting to be written by the writer thread
+using OutputQueue = std::deque<OutputReport>;
+
+//--------------------------------------------------------------------------------------------------
+//
+//--------------------------------------------------------------------------------------------------
+
 struct Wiimote::Impl
 {
     // The current state of the wiimote and expansions
     State state;
+    // Lookup tables for the calibration data in 'state' (see CalibrationTables)
+    CalibrationTables calibration;
     // Current report mode
     ReportMode reportMode;
     // Whether the Wiimote should operate in continuous mode, ie. send reports even
     // if the data hasn't changed.
     bool continous;
+    // Decoder for data reports, specialized for the report id, IR mode and extension type
+    // it has been selected for (see ProcessReport())
+    ReportDecoder decoder;
+    unsigned decoderId;
+    IRData::Mode decoderMode;
+    unsigned decoderExtension;
     // List of pending read/write requests
     Requests requests;
     // Internal status
     unsigned status;
     // Current motion-plus status
     unsigned motionPlusStatus;
-#ifdef _WIN32
-    // Wiimote device handle
-    HANDLE device;
-    // Overlapped data structure for asynchronuous reads
-    OVERLAPPED overlapped;
-#endif
+    // The link to the device
+    std::unique_ptr<Transport> transport;
+    // Reports read by the reader thread -- if any
+    std::unique_ptr<InputQueue> queue;
+    // The reader thread
+    std::thread reader;
+    // Whether the reader thread should keep running
+    std::atomic<bool> readerRunning;
+    // Set by the reader thread when the link is broken
+    std::atomic<bool> readerError;
+    // Whether Poll() is waiting for the reader thread
+    std::atomic<bool> readerWaiting;
+    // Used to wake up Poll() if it is waiting for the reader thread
+    std::mutex readerLock;
+    std::condition_variable readerSignal;
+    // Reports waiting for the writer thread
+    OutputQueue outputs;
+    // The writer thread -- if any
+    std::thread writer;
+    // Whether the writer thread is running; protected by writerLock
+    bool writerRunning;
+    // Set by the writer thread when the link is broken
+    std::atomic<bool> writerError;
+    // Protects the output queue and wakes up the writer thread
+    std::mutex writerLock;
+    std::condition_variable writerSignal;
+    // Output report pacing
+    TokenBucket pacing;
+    // Output report statistics
+    std::atomic<unsigned long long> outputReports;
+    std::atomic<unsigned long long> outputDelayed;
+    // Total and longest time output reports waited for the pacing limit in us
+    std::atomic<unsigned long long> outputWait;
+    std::atomic<unsigned long long> outputMaxWait;
+    // Records all reports -- if set; only changed while holding captureLock
+    std::atomic<CaptureWriter*> capture;
+    // Device id used for the records; protected by captureLock
+    unsigned captureDevice;
+    // Keeps the capture from being replaced while a report is recorded
+    std::mutex captureLock;
 
 public:
     //--------------------------------------------------------------------------
@@ -150,6 +237,81 @@ public:
     // Destructor
     ~Impl();
 
+    // Attach a transport to this Wiimote
+    bool Attach(std::unique_ptr<Transport> transport_);
+
+    // Disconnect this Wiimote
+    void Disconnect();
+
+    // Replace a lost link with a new transport
+    // Restores the report mode, LEDs and rumble and restarts the reader and writer threads.
+    bool Reattach(std::unique_ptr<Transport> transport_);
+
+    // Start over with a fresh Wiimote on the current transport
+    // Restores the given report mode, LEDs and rumble.
+    void Restart(ReportMode mode, IRData::Sensitivity sensitivity, unsigned leds, bool rumble);
+
+    // Continue a playback at the given recorded time
+    bool Seek(double time);
+
+    // Read a report from the wiimote
+    // Stores the time the report has been received in 'time'.
+    // Waits at most timeout us; a negative timeout waits forever.
+    // If the reader thread is running, the report is taken from its queue.
+    Transport::Result GetInputReport(uint8_t* report, double& time, int64_t timeout);
+
+    // Record a report -- if capturing
+    // May be called from the reader and writer threads.
+    void Capture(CaptureWriter::Direction direction, double time, uint8_t const* report, unsigned len)
+    {
+        if (capture.load(std::memory_order_relaxed) == nullptr)
+            return;
+
+        std::lock_guard<std::mutex> lock(captureLock);
+
+        if (CaptureWriter* writer = capture)
+            writer->Record(time, captureDevice, direction, report, len);
+    }
+
+    // Record all reports into the given capture -- or stop recording
+    // Once this returns, the previous capture is no longer used.
+    void SetCapture(CaptureWriter* capture_, unsigned device)
+    {
+        std::lock_guard<std::mutex> lock(captureLock);
+
+        capture = capture_;
+        captureDevice = device;
+    }
+
+    // Start the reader thread
+    bool StartReader();
+
+    // Stop the reader thread
+    void StopReader();
+
+    // The reader thread's main loop
+    void RunReader();
+
+    // Start the writer thread
+    bool StartWriter();
+
+    // Stop the writer thread
+    // Reports which are still queued are written before the thread exits.
+    void StopWriter();
+
+    // The writer thread's main loop
+    void RunWriter();
+
+    // Write a report to the transport
+    // Waits for the per-Wiimote and the global pacing limit first. Records the report once
+    // it has been written -- if capturing.
+    bool WriteOutputReport(uint8_t const* report, unsigned len);
+
+    // Write a report to the wiimote
+    // If the writer thread is running, the report is queued and possibly merged with a
+    // queued report which it supersedes.
+    bool SetOutputReport(uint8_t const* report, unsigned len);
+
     // Write a report to the wiimote
     bool SendReport(uint8_t type, uint8_t const* data, unsigned size);
 
@@ -180,6 +342,19 @@ public:
     // Poll a report from the Wiimote
     bool Poll();
 
+    // Poll a report from the Wiimote
+    // Waits at most timeout us for the report to arrive; a negative timeout waits forever.
+    Transport::Result Poll(int64_t timeout);
+
+    // Poll all reports which are already available, but at most maxReports
+    // Stores the number of reports processed in 'count'. Returns the result of the last
+    // Poll(); Error if the link is broken.
+    Transport::Result PollAll(unsigned& count, std::function<void (State const&)> const& callback, unsigned maxReports);
+
+    // Process a report and advance the startup and shutdown state machine
+    // 'time' is the time the report has been received.
+    void Dispatch(uint8_t const* report, double time);
+
     // Initialize the shutdown process
     bool Shutdown();
 
@@ -199,7 +374,8 @@ public:
     void WriteData(unsigned address, uint8_t data);
 
     // Parse an input report
-    bool ProcessReport(uint8_t const* buf);
+    // 'time' is the time the report has been received.
+    bool ProcessReport(uint8_t const* buf, double time);
 
     // Parse a status report
     bool ProcessStatusReport(uint8_t const* buf);
@@ -259,11 +435,17 @@ public:
     bool SetLEDs(unsigned leds);
 
     // Enable/Disable rumble
+    // The rumble bit is sent along with the next pending output report -- if any.
     bool SetRumble(bool enable);
 
+    // Update the rumble bit of all reports queued for the writer thread
+    // Returns false if there are no queued reports.
+    bool SetQueuedRumble(bool enable);
+
     //--------------------------------------------------------------------------
     // OS-specifc
     // Implemented in Wiimote-?.inl
+    // (along with wii::GetTime())
     //
 
     // Initialize
@@ -272,26 +454,31 @@ public:
     // Clean-up
     void Finish();
 
-    // Disconnect this Wiimote
-    void Disconnect();
-
-    // Read a report from the wiimote
-    bool GetInputReport(uint8_t* report);
-
-    // Write a report to the wiimote
-    bool SetOutputReport(uint8_t const* report, unsigned len);
-
     // Returns current time
-    double Time();
+    static double Time();
 
 #ifdef _WIN32
     // Open a device handle for the specified device and check if it's a wiimote
     // Returns INVALID_HANDLE_VALUE on failure
     static HANDLE OpenDeviceHandle(LPCTSTR devicePath);
+#else
+    // Open a file descriptor for the specified device and check if it's a wiimote
+    // If a uevent file is given, devices which are no hidraw devices are checked by its HID_ID.
+    // Returns -1 on failure
+    static int OpenDeviceHandle(char const* devicePath, char const* ueventPath = nullptr);
+
+    // Check the HID_ID in the given sysfs uevent file for a wiimote
+    static bool IsWiimoteUevent(char const* ueventPath);
 #endif
 
     // Connect all Wiimotes
     static bool Connect(Wiimote* wiimotes, unsigned& count);
+
+#ifndef _WIN32
+    // Connect all Wiimotes found in devRoot (see Wiimote::Connect()).
+    // Nodes which are no hidraw devices are only checked if sysRoot is given.
+    static bool Connect(Wiimote* wiimotes, unsigned& count, char const* devRoot, char const* sysRoot);
+#endif
 };
 
 } // namespace wii
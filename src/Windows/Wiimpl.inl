@@ -2,6 +2,7 @@
 // See the LICENSE file for details.
 
 #include <cstdio>
+#include <string>
 
 #include <mmsystem.h>
 
@@ -13,128 +14,195 @@ extern "C"
 
 #ifdef __MINGW32__
 extern "C" BOOLEAN __stdcall HidD_SetOutputReport(HANDLE HidDeviceObject, PVOID ReportBuffer, ULONG ReportBufferLength);
+#if _WIN32_WINNT < 0x0600
+extern "C" WINBASEAPI BOOL WINAPI CancelIoEx(HANDLE hFile, LPOVERLAPPED lpOverlapped);
+#endif
 #endif
 
-void Wiimote::Impl::Init()
+#if 0
+#define WII_RESET_EVENT() do { ResetEvent(overlapped.hEvent); } while (::wii::details::false_())
+#else
+#define WII_RESET_EVENT() do { } while (::wii::details::false_())
+#endif
+
+namespace
+{
+
+//
+// Transport for HID devices
+//
+class HidTransport : public Transport
 {
-    overlapped.Internal     = 0;
-    overlapped.InternalHigh = 0;
-    overlapped.Offset       = 0;
-    overlapped.OffsetHigh   = 0;
-    overlapped.Pointer      = 0;
-    overlapped.hEvent       = CreateEvent(0, TRUE, FALSE, TEXT(""));
-
-    if (overlapped.hEvent == NULL)
+    // Wiimote device handle
+    HANDLE device;
+    // Overlapped data structure for asynchronuous reads
+    OVERLAPPED overlapped;
+    // Buffer of the outstanding read
+    uint8_t buffer[WII_REPORT_LENGTH];
+    // Whether a read is outstanding
+    bool pending;
+
+public:
+    HidTransport(HANDLE device)
+        : device(device)
+        , overlapped()
+        , pending(false)
     {
+        overlapped.Internal     = 0;
+        overlapped.InternalHigh = 0;
+        overlapped.Offset       = 0;
+        overlapped.OffsetHigh   = 0;
+        overlapped.Pointer      = 0;
+        overlapped.hEvent       = CreateEvent(0, TRUE, FALSE, TEXT(""));
+
+        if (overlapped.hEvent == NULL)
+        {
+        }
+
+        std::memset(buffer, 0, sizeof(buffer));
     }
 
-    timeBeginPeriod(1);
-}
+    virtual ~HidTransport()
+    {
+        // The outstanding read must not complete into a released buffer
+        if (pending)
+            Cancel();
 
-void Wiimote::Impl::Finish()
-{
-    timeEndPeriod(1);
+        CloseHandle(device);
+        CloseHandle(overlapped.hEvent);
+    }
 
-    CloseHandle(overlapped.hEvent);
-}
+    virtual Result Read(uint8_t* report, double& time, int64_t timeout) override;
+
+    virtual bool Write(uint8_t const* report, unsigned len) override;
+
+private:
+    // Cancel the outstanding read and wait until it is done.
+    // Returns true if the read has completed before it could be cancelled.
+    bool Cancel();
+};
 
-void Wiimote::Impl::Disconnect()
+bool HidTransport::Cancel()
 {
-    if (device != INVALID_HANDLE_VALUE)
-    {
-        CloseHandle(device);
+    assert(pending);
 
-        device = INVALID_HANDLE_VALUE;
-    }
+    // The read might have been issued by another thread
+    CancelIoEx(device, &overlapped);
 
-    status = WII_STATUS_DISCONNECTED;
-}
+    DWORD transferred = 0;
 
-#if 0
-#define WII_RESET_EVENT() do { ResetEvent(overlapped.hEvent); } while (::wii::details::false_())
-#else
-#define WII_RESET_EVENT() do { } while (::wii::details::false_())
-#endif
+    BOOL completed = GetOverlappedResult(device, &overlapped, &transferred, TRUE);
 
-bool Wiimote::Impl::GetInputReport(uint8_t* report)
+    pending = false;
+
+    return completed != FALSE;
+}
+
+Transport::Result HidTransport::Read(uint8_t* report, double& time, int64_t timeout)
 {
     assert( device != INVALID_HANDLE_VALUE );
 
     //
     // NOTE:
     //
-    // This does actually NOT perform an async read
-    // The overlapped read is only used for performance reasons and this routine waits
-    // for the read to complete.
-    // If the read does not finish within TIMEOUT ms, it's assumed the read failed
+    // A read is kept outstanding across calls. If no report arrives within timeout us,
+    // the read is left running and the next call continues to wait for it. So a zero
+    // timeout (TryPoll) does not have to issue and cancel a read each time, and no report
+    // is lost between the wait and a cancellation.
+    // Timeouts are rounded up to full milliseconds.
     //
 
-    if (ReadFile(device, report, WII_REPORT_LENGTH, 0, &overlapped))
+    for (;;)
     {
-        WII_RESET_EVENT();
-        return true;
-    }
+        if (!pending)
+        {
+            // Reports might be shorter than WII_REPORT_LENGTH
+            std::memset(buffer, 0, sizeof(buffer));
 
-    //
-    // Error occured or read incomplete.
-    // Figure out
-    //
+            if (ReadFile(device, buffer, WII_REPORT_LENGTH, 0, &overlapped))
+            {
+                time = GetTime();
 
-    if (GetLastError() != ERROR_IO_PENDING)
-    {
-        WII_RESET_EVENT();
-        return false;
-    }
+                std::memcpy(report, buffer, WII_REPORT_LENGTH);
 
-    //
-    // Incomplete read.
-    // Wait for read operation to finish
-    //
+                WII_RESET_EVENT();
+                return Result::OK;
+            }
 
-    DWORD waitResult = WaitForSingleObject(overlapped.hEvent, continous ? 1000 : INFINITE);
-    DWORD transferred = 0;
+            if (GetLastError() != ERROR_IO_PENDING)
+                break;
+
+            pending = true;
+        }
+
+        //
+        // Wait for the outstanding read to finish
+        //
+
+        DWORD waitResult = WaitForSingleObject(overlapped.hEvent, timeout < 0 ? INFINITE : static_cast<DWORD>((timeout + 999) / 1000));
+
+        if (waitResult == WAIT_TIMEOUT)
+        {
+            //
+            // No report yet. Keep the read outstanding.
+            //
+            return Result::Timeout;
+        }
+
+        if (waitResult != WAIT_OBJECT_0)
+        {
+            //
+            // Wait failed
+            // This should never happen as it indicates a severe Windows internal error
+            //
+
+            if (Cancel())
+            {
+                // The report arrived in the meantime
+                time = GetTime();
+
+                std::memcpy(report, buffer, WII_REPORT_LENGTH);
+
+                WII_RESET_EVENT();
+                return Result::OK;
+            }
+
+            break;
+        }
+
+        DWORD transferred = 0;
+
+        pending = false;
 
-    switch (waitResult)
-    {
-    case WAIT_OBJECT_0:
         if (GetOverlappedResult(device, &overlapped, &transferred, FALSE))
         {
             assert(transferred == WII_REPORT_LENGTH);
 
+            time = GetTime();
+
+            std::memcpy(report, buffer, WII_REPORT_LENGTH);
+
             WII_RESET_EVENT();
-            return true;
+            return Result::OK;
         }
-        break;
 
-    case WAIT_TIMEOUT:
         //
-        // Wait timed-out
-        // Connection lost!
+        // Outstanding reads are cancelled when the thread which issued them exits (eg. the
+        // reader thread). Issue a new one.
         //
-        break;
 
-    case WAIT_FAILED:
-    default:
-        //
-        // Wait failed
-        // This should never happen as it indicates a severe Windows internal error
-        //
-        break;
+        if (GetLastError() != ERROR_OPERATION_ABORTED)
+            break;
     }
 
     WII_LOG(IO, "Read failed.\n");
 
-    //
-    // Cancel read request
-    //
-    CancelIo(device);
-
     WII_RESET_EVENT();
 
-    return false;
+    return Result::Error;
 }
 
-bool Wiimote::Impl::SetOutputReport(uint8_t const* report, unsigned len)
+bool HidTransport::Write(uint8_t const* report, unsigned len)
 {
     assert( device != INVALID_HANDLE_VALUE );
 
@@ -151,7 +219,82 @@ bool Wiimote::Impl::SetOutputReport(uint8_t const* report, unsigned len)
     return false;
 }
 
-double Wiimote::Impl::Time()
+} // namespace
+
+MappedFile::MappedFile()
+    : data(nullptr)
+    , size(0)
+    , mapping(nullptr)
+{
+}
+
+MappedFile::~MappedFile()
+{
+    Close();
+}
+
+bool MappedFile::Open(char const* path)
+{
+    Close();
+
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, 0, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, 0);
+
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER fileSize;
+
+    if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+    {
+        CloseHandle(file);
+        return false;
+    }
+
+    // The mapping keeps the file open
+    mapping = CreateFileMappingA(file, 0, PAGE_READONLY, 0, 0, 0);
+
+    CloseHandle(file);
+
+    if (mapping == nullptr)
+        return false;
+
+    data = static_cast<uint8_t const*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+
+    if (data == nullptr)
+    {
+        CloseHandle(mapping);
+        mapping = nullptr;
+        return false;
+    }
+
+    size = static_cast<size_t>(fileSize.QuadPart);
+
+    return true;
+}
+
+void MappedFile::Close()
+{
+    if (data)
+        UnmapViewOfFile(data);
+    if (mapping)
+        CloseHandle(mapping);
+
+    data = nullptr;
+    size = 0;
+    mapping = nullptr;
+}
+
+void Wiimote::Impl::Init()
+{
+    timeBeginPeriod(1);
+}
+
+void Wiimote::Impl::Finish()
+{
+    timeEndPeriod(1);
+}
+
+double wii::GetTime()
 {
     return timeGetTime() / 1000.0;
 }
@@ -230,9 +373,9 @@ bool Wiimote::Impl::Connect(Wiimote* wiimotes, unsigned& count)
     // Enumerate all devices
     //
 
-    unsigned connected = 0;
+    std::vector<std::basic_string<TCHAR>> devicePaths;
 
-    for (DWORD index = 0; connected < count; index++)
+    for (DWORD index = 0; ; index++)
     {
         if (!SetupDiEnumDeviceInterfaces(hDevInfo, 0, &guid, index, &diData))
         {
@@ -264,20 +407,48 @@ bool Wiimote::Impl::Connect(Wiimote* wiimotes, unsigned& count)
 
         if (SetupDiGetDeviceInterfaceDetail(hDevInfo, &diData, pdiDetail, cbSize, &cbSize, 0))
         {
-            HANDLE handle = OpenDeviceHandle(pdiDetail->DevicePath);
-
-            if (handle != INVALID_HANDLE_VALUE)
-            {
-                wiimotes[connected].impl->device = handle;
-                wiimotes[connected].impl->status = WII_STATUS_CONNECTED;
-
-                connected++;
-            }
+            devicePaths.push_back(pdiDetail->DevicePath);
         }
     }
 
     SetupDiDestroyDeviceInfoList(hDevInfo);
 
+    //
+    // Probe all devices concurrently; opening a device and reading its attributes might
+    // take a while
+    //
+
+    std::vector<HANDLE> handles(devicePaths.size(), INVALID_HANDLE_VALUE);
+
+    ParallelFor(devicePaths.size(), WII_MAX_PROBE_THREADS, [&](size_t index) {
+        handles[index] = OpenDeviceHandle(devicePaths[index].c_str());
+    });
+
+    //
+    // Connect the Wiimotes in enumeration order
+    //
+
+    unsigned connected = 0;
+
+    for (size_t index = 0; index < handles.size(); index++)
+    {
+        HANDLE handle = handles[index];
+
+        if (handle == INVALID_HANDLE_VALUE)
+            continue;
+
+        if (connected < count)
+        {
+            wiimotes[connected].impl->Attach(std::unique_ptr<Transport>(new HidTransport(handle)));
+
+            connected++;
+        }
+        else
+        {
+            CloseHandle(handle);
+        }
+    }
+
     count = connected;
 
     return true;
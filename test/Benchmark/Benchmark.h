@@ -0,0 +1,105 @@
+// This file is distributed under the MIT license.
+// See the LICENSE file for details.
+
+#pragma once
+
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+#ifndef _WIN32
+#include <time.h>
+#endif
+
+//--------------------------------------------------------------------------------------------------
+//
+//--------------------------------------------------------------------------------------------------
+
+namespace bench
+{
+
+// A benchmark
+struct Benchmark
+{
+    // Name of the benchmark
+    char const* name;
+    // The benchmark; prints its results
+    void (*func)();
+};
+
+// Returns all registered benchmarks
+inline std::vector<Benchmark>& Benchmarks()
+{
+    static std::vector<Benchmark> benchmarks;
+    return benchmarks;
+}
+
+// Registers a benchmark
+struct Register
+{
+    Register(char const* name, void (*func)())
+    {
+        Benchmark b = { name, func };
+        Benchmarks().push_back(b);
+    }
+};
+
+// Returns the wall clock time in seconds
+inline double Now()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+#ifndef _WIN32
+// Returns the CPU time consumed by the calling thread in seconds
+inline double ThreadTime()
+{
+    timespec ts;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+#endif
+
+// Keeps the compiler from optimizing away a result
+template <class T>
+inline void Use(T const& value)
+{
+    static T volatile sink;
+    sink = value;
+    static_cast<void>(sink);
+}
+
+// Returns the fastest of 'repeat' runs of func() in seconds
+template <class Func>
+double Fastest(unsigned repeat, Func const& func)
+{
+    double best = 1e30;
+
+    for (unsigned n = 0; n < repeat; ++n)
+    {
+        double start = Now();
+
+        func();
+
+        double elapsed = Now() - start;
+
+        if (elapsed < best)
+            best = elapsed;
+    }
+
+    return best;
+}
+
+} // namespace bench
+
+//--------------------------------------------------------------------------------------------------
+//
+//--------------------------------------------------------------------------------------------------
+
+// Define a benchmark
+#define BENCHMARK(NAME) \
+    static void NAME(); \
+    static ::bench::Register NAME##_register(#NAME, &NAME); \
+    static void NAME()
@@ -0,0 +1,206 @@
+// This file is distributed under the MIT license.
+// See the LICENSE file for details.
+
+#include "Benchmark.h"
+
+#include "Capture.h"
+#include "Wiimote/Transport.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <unistd.h>
+
+using namespace wii;
+
+//--------------------------------------------------------------------------------------------------
+// Compressed capture playback
+//--------------------------------------------------------------------------------------------------
+
+namespace
+{
+
+// Target throughput of the decoder on one core
+double const targetReportsPerSecond = 10e6;
+
+//
+// Uncompressed records of Wiimotes with a Nunchuk reporting buttons, accelerometer and
+// extension data (0x35) every 10 ms, taking turns. The accelerometers and sticks wander a
+// little from report to report; the buttons hardly change.
+//
+std::vector<uint8_t> MakeRecords(size_t count, unsigned devices)
+{
+    std::vector<uint8_t> records(count * WII_CAPTURE_RECORD_SIZE);
+    std::vector<uint8_t> reports(devices * 22);
+
+    std::srand(1);
+
+    for (unsigned device = 0; device < devices; ++device)
+    {
+        uint8_t* report = &reports[device * 22];
+
+        report[0] = 0x35;
+
+        for (unsigned i = 3; i < 22; ++i)
+            report[i] = 0x80;
+    }
+
+    for (size_t n = 0; n < count; ++n)
+    {
+        unsigned device = n % devices;
+
+        uint8_t* record = &records[n * WII_CAPTURE_RECORD_SIZE];
+        uint8_t* report = &reports[device * 22];
+
+        if (std::rand() % 64 == 0)
+            report[2] ^= 0x08;
+
+        // Accelerometer and Nunchuk stick and accelerometer
+        for (unsigned i = 3; i < 12; ++i)
+        {
+            if (std::rand() % 2 == 0)
+                report[i] = static_cast<uint8_t>(report[i] + std::rand() % 5 - 2);
+        }
+
+        WriteLE64(record + WII_CAPTURE_OFFSET_TIME, 10000000ull * (n / devices) + 1000 * device);
+        WriteLE16(record + WII_CAPTURE_OFFSET_DEVICE, device);
+        record[WII_CAPTURE_OFFSET_DIR] = 0;
+        record[WII_CAPTURE_OFFSET_LENGTH] = 22;
+        std::memcpy(record + WII_CAPTURE_OFFSET_REPORT, report, 22);
+    }
+
+    return records;
+}
+
+// Compress records into a capture file without an index, starting a new session every
+// WII_CAPTURE_INDEX_INTERVAL records like CaptureWriter
+std::vector<uint8_t> Compress(std::vector<uint8_t> const& records)
+{
+    std::vector<uint8_t> file(WII_CAPTURE_HEADER_SIZE);
+
+    std::memcpy(file.data(), WII_CAPTURE_MAGIC, 4);
+    WriteLE16(file.data() + 4, WII_CAPTURE_VERSION_COMPRESSED);
+    WriteLE16(file.data() + 6, 0);
+
+    CaptureEncoder encoder;
+
+    for (size_t n = 0; n * WII_CAPTURE_RECORD_SIZE < records.size(); ++n)
+    {
+        if (n % WII_CAPTURE_INDEX_INTERVAL == 0)
+            encoder.Reset();
+
+        uint8_t out[WII_CAPTURE_MAX_COMPRESSED_SIZE];
+
+        size_t len = encoder.Encode(&records[n * WII_CAPTURE_RECORD_SIZE], out);
+
+        file.insert(file.end(), out, out + len);
+    }
+
+    return file;
+}
+
+} // namespace
+
+//
+// Reports per second decoded from a compressed capture in memory by CaptureReader, for
+// sessions of 1 to 64 devices, and played back through CreateCaptureTransport() at full
+// speed from a file of one device.
+//
+BENCHMARK(CaptureReplay)
+{
+    size_t const count = 1 << 22;
+    unsigned const repeat = 5;
+
+    unsigned const devices[] = { 1, 4, 16, 64 };
+
+    std::printf("%-10s %8s %14s %14s\n", "playback", "devices", "bytes/report", "Mreports/s");
+
+    double slowest = 1e30;
+
+    for (unsigned d : devices)
+    {
+        std::vector<uint8_t> file = Compress(MakeRecords(count, d));
+
+        size_t decoded = 0;
+
+        double elapsed = bench::Fastest(repeat, [&]() {
+            CaptureReader reader;
+
+            if (!reader.Open(file.data(), file.size()))
+                return;
+
+            CaptureRecord record;
+            unsigned sum = 0;
+
+            decoded = 0;
+
+            while (reader.Next(record))
+            {
+                sum += record.report[3];
+                decoded++;
+            }
+
+            bench::Use(sum);
+        });
+
+        if (decoded != count)
+        {
+            std::printf("decoded %zu of %zu reports\n", decoded, count);
+            return;
+        }
+
+        double rate = count / elapsed;
+
+        if (rate < slowest)
+            slowest = rate;
+
+        std::printf("%-10s %8u %14.2f %14.1f\n", "decode", d, static_cast<double>(file.size() - WII_CAPTURE_HEADER_SIZE) / count, rate / 1e6);
+    }
+
+    //
+    // Through the transport
+    //
+
+    std::vector<uint8_t> file = Compress(MakeRecords(count, 1));
+
+    char path[] = "/tmp/wiimote-capture-XXXXXX";
+
+    int fd = mkstemp(path);
+
+    if (fd < 0)
+        return;
+
+    bool written = write(fd, file.data(), file.size()) == static_cast<ssize_t>(file.size());
+
+    close(fd);
+
+    if (written)
+    {
+        size_t played = 0;
+
+        double elapsed = bench::Fastest(repeat, [&]() {
+            std::unique_ptr<Transport> transport = CreateCaptureTransport(path);
+
+            if (transport == nullptr)
+                return;
+
+            uint8_t report[22];
+            double time = 0.0;
+
+            played = 0;
+
+            while (transport->Read(report, time, 0) == Transport::Result::OK)
+                played++;
+
+            bench::Use(time);
+        });
+
+        std::printf("%-10s %8u %14.2f %14.1f\n", "transport", 1u, static_cast<double>(file.size() - WII_CAPTURE_HEADER_SIZE) / count, played / elapsed / 1e6);
+    }
+
+    unlink(path);
+
+    std::printf("target %.0fM reports/s decoded on one core: %s\n", targetReportsPerSecond / 1e6, slowest >= targetReportsPerSecond ? "met" : "MISSED");
+}
@@ -0,0 +1,134 @@
+// This file is distributed under the MIT license.
+// See the LICENSE file for details.
+
+#include "Benchmark.h"
+
+#ifndef _WIN32
+
+#include "Wiimote/Wiimote.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace wii;
+
+//--------------------------------------------------------------------------------------------------
+// Probing the hidraw candidates during Connect()
+//--------------------------------------------------------------------------------------------------
+
+namespace
+{
+
+//
+// A fake /dev and /sys tree with 'count' Wiimote nodes.
+// The nodes are FIFOs, which do not answer the hidraw info query; Connect() then recognizes
+// them by their sysfs uevent file.
+//
+struct Tree
+{
+    std::string root;
+    unsigned count;
+
+    explicit Tree(unsigned count)
+        : root()
+        , count(count)
+    {
+        char path[] = "/tmp/wiimote-connect-XXXXXX";
+
+        if (mkdtemp(path) == nullptr)
+            return;
+
+        root = path;
+
+        mkdir((root + "/dev").c_str(), 0700);
+        mkdir((root + "/sys").c_str(), 0700);
+
+        for (unsigned n = 0; n < count; ++n)
+        {
+            std::string name = "hidraw" + std::to_string(n);
+            std::string dir = root + "/sys/" + name;
+
+            mkdir(dir.c_str(), 0700);
+            mkdir((dir + "/device").c_str(), 0700);
+
+            if (FILE* file = fopen((dir + "/device/uevent").c_str(), "w"))
+            {
+                fprintf(file, "DRIVER=wiimote\nHID_ID=0005:0000057E:00000306\n");
+                fclose(file);
+            }
+
+            mkfifo((root + "/dev/" + name).c_str(), 0600);
+        }
+    }
+
+    ~Tree()
+    {
+        if (root.empty())
+            return;
+
+        for (unsigned n = 0; n < count; ++n)
+        {
+            std::string name = "hidraw" + std::to_string(n);
+            std::string dir = root + "/sys/" + name;
+
+            unlink((root + "/dev/" + name).c_str());
+            unlink((dir + "/device/uevent").c_str());
+            rmdir((dir + "/device").c_str());
+            rmdir(dir.c_str());
+        }
+
+        rmdir((root + "/dev").c_str());
+        rmdir((root + "/sys").c_str());
+        rmdir(root.c_str());
+    }
+};
+
+} // namespace
+
+//
+// Connect() startup time with 1, 8 and 64 candidate nodes, all of them Wiimotes.
+// Each run connects all of them and disconnects them again.
+//
+BENCHMARK(ConnectProbe)
+{
+    unsigned const counts[] = { 1, 8, 64 };
+
+    std::printf("%8s %12s %14s\n", "nodes", "connect ms", "us per node");
+
+    for (unsigned count : counts)
+    {
+        Tree tree(count);
+
+        if (tree.root.empty())
+            return;
+
+        std::string dev = tree.root + "/dev";
+        std::string sys = tree.root + "/sys";
+
+        std::unique_ptr<Wiimote[]> wiimotes(new Wiimote[count]);
+
+        unsigned connected = 0;
+
+        double time = bench::Fastest(5, [&]() {
+            connected = count;
+
+            if (!Wiimote::Connect(wiimotes.get(), connected, dev.c_str(), sys.c_str()))
+                connected = 0;
+
+            for (unsigned n = 0; n < connected; ++n)
+                wiimotes[n].Disconnect();
+        });
+
+        if (connected != count)
+            std::printf("%8u connected only %u\n", count, connected);
+
+        std::printf("%8u %12.2f %14.1f\n", count, time * 1000.0, time * 1000000.0 / count);
+    }
+}
+
+#endif
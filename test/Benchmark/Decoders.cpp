@@ -0,0 +1,169 @@
+// This file is distributed under the MIT license.
+// See the LICENSE file for details.
+
+#include "Benchmark.h"
+
+#include "Data.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+using namespace wii;
+
+//--------------------------------------------------------------------------------------------------
+// Specialized report decoders against the switch chain
+//--------------------------------------------------------------------------------------------------
+
+namespace
+{
+
+// Decodes a data report the way ProcessReport did before the decoders were specialized
+void DecodeSwitch(State& state, uint8_t const* buf)
+{
+    switch (buf[0])
+    {
+    case 0x30: // Buttons
+        ParseButtons(state, buf + 1);
+        break;
+
+    case 0x31: // ButtonsAccel
+        ParseButtons(state, buf + 1);
+        ParseAccel(state, buf + 1);
+        break;
+
+    case 0x32: // ButtonsExt
+        ParseButtons(state, buf + 1);
+        ParseExtension(state, buf + 3);
+        break;
+
+    case 0x33: // ButtonsAccelIR (12 IR bytes)
+        ParseButtons(state, buf + 1);
+        ParseAccel(state, buf + 1);
+        ParseIR(state, buf + 6);
+        break;
+
+    case 0x35: // ButtonsAccelExt
+        ParseButtons(state, buf + 1);
+        ParseAccel(state, buf + 1);
+        ParseExtension(state, buf + 6);
+        break;
+
+    case 0x36: // ButtonsIRExt (10 IR bytes)
+        ParseButtons(state, buf + 1);
+        ParseIR(state, buf + 3);
+        ParseExtension(state, buf + 13);
+        break;
+
+    case 0x37: // ButtonsAccelIRExt (10 IR bytes)
+        ParseButtons(state, buf + 1);
+        ParseAccel(state, buf + 1);
+        ParseIR(state, buf + 6);
+        ParseExtension(state, buf + 16);
+        break;
+    }
+}
+
+// A state decoding reports in the given IR mode and with the given extension
+State MakeState(IRData::Mode mode, unsigned extension)
+{
+    State state;
+
+    std::memset(&state, 0, sizeof(state));
+
+    state.ir.mode = mode;
+    state.extension.type = extension;
+
+    return state;
+}
+
+} // namespace
+
+//
+// Time per report of the specialized decoders and of the switch chain for every report id,
+// IR mode (reports with IR data only) and extension type (reports with extension data only).
+// That both decode the reports to the same state is checked by the unit tests.
+//
+BENCHMARK(ReportDecoders)
+{
+    unsigned const ids[] = { 0x30, 0x31, 0x32, 0x33, 0x35, 0x36, 0x37 };
+    IRData::Mode const modes[] = { IRData::Mode::Off, IRData::Mode::Basic, IRData::Mode::Extended };
+    unsigned const extensions[] = {
+        0,
+        Extension::Nunchuk,
+        Extension::ClassicController,
+        Extension::MotionPlus,
+        Extension::MotionPlus | Extension::Nunchuk,
+        Extension::MotionPlus | Extension::ClassicController,
+    };
+
+    size_t const count = 4096;
+    unsigned const repeat = 50;
+
+    std::vector<uint8_t> reports(count * 22);
+
+    std::srand(1);
+
+    std::printf("%6s %14s %14s\n", "report", "switch ns", "decoder ns");
+
+    double totalSwitch = 0.0;
+    double totalDecoder = 0.0;
+    unsigned combinations = 0;
+
+    for (unsigned id : ids)
+    {
+        bool hasIR = id == 0x33 || id == 0x36 || id == 0x37;
+        bool hasExtension = id == 0x32 || id >= 0x35;
+
+        double timeSwitch = 0.0;
+        double timeDecoder = 0.0;
+        unsigned n = 0;
+
+        for (IRData::Mode mode : modes)
+        {
+            if (!hasIR && mode != IRData::Mode::Off)
+                continue;
+
+            for (unsigned extension : extensions)
+            {
+                if (!hasExtension && extension != 0)
+                    continue;
+
+                for (size_t i = 0; i < reports.size(); ++i)
+                    reports[i] = static_cast<uint8_t>(std::rand());
+
+                for (size_t i = 0; i < count; ++i)
+                    reports[i * 22] = static_cast<uint8_t>(id);
+
+                ReportDecoder decoder = GetReportDecoder(id, mode, extension);
+
+                State a = MakeState(mode, extension);
+                State b = MakeState(mode, extension);
+
+                timeSwitch += bench::Fastest(5, [&]() {
+                    for (unsigned r = 0; r < repeat; ++r)
+                        for (size_t i = 0; i < count; ++i)
+                            DecodeSwitch(a, &reports[i * 22]);
+                }) * 1e9 / (repeat * count);
+
+                timeDecoder += bench::Fastest(5, [&]() {
+                    for (unsigned r = 0; r < repeat; ++r)
+                        for (size_t i = 0; i < count; ++i)
+                            decoder(b, &reports[i * 22], nullptr);
+                }) * 1e9 / (repeat * count);
+
+                bench::Use(a.buttons + b.buttons);
+
+                n++;
+            }
+        }
+
+        std::printf("  0x%02X %14.1f %14.1f\n", id, timeSwitch / n, timeDecoder / n);
+
+        totalSwitch += timeSwitch;
+        totalDecoder += timeDecoder;
+        combinations += n;
+    }
+
+    std::printf("%6s %14.1f %14.1f\n", "all", totalSwitch / combinations, totalDecoder / combinations);
+}
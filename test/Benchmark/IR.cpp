@@ -0,0 +1,253 @@
+// This file is distributed under the MIT license.
+// See the LICENSE file for details.
+
+#include "Benchmark.h"
+
+#include "IR.h"
+#include "Simd.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+using namespace wii;
+
+//--------------------------------------------------------------------------------------------------
+// Vectorized IR unpacking against the scalar code it replaced
+//--------------------------------------------------------------------------------------------------
+
+namespace
+{
+
+// The scalar Basic mode unpacking ParseIR used before UnpackIR (including the byte 5 quirk)
+void UnpackBasicScalar(IRData& ir, uint8_t const* buf)
+{
+    ir.dots[0].raw.x = buf[0] | ((buf[2] & 0x30) << 4);
+    ir.dots[0].raw.y = buf[1] | ((buf[2] & 0xC0) << 2);
+    ir.dots[1].raw.x = buf[3] | ((buf[2] & 0x03) << 8);
+    ir.dots[1].raw.y = buf[4] | ((buf[2] & 0x0C) << 6);
+    ir.dots[2].raw.x = buf[5] | ((buf[5] & 0x30) << 4);
+    ir.dots[2].raw.y = buf[6] | ((buf[5] & 0xC0) << 2);
+    ir.dots[3].raw.x = buf[8] | ((buf[5] & 0x03) << 8);
+    ir.dots[3].raw.y = buf[9] | ((buf[5] & 0x0C) << 6);
+
+    ir.dots[0].size = 0;
+    ir.dots[1].size = 0;
+    ir.dots[2].size = 0;
+    ir.dots[3].size = 0;
+}
+
+// The scalar Extended mode unpacking ParseIR used before UnpackIR
+void UnpackExtendedScalar(IRData& ir, uint8_t const* buf)
+{
+    for (unsigned n = 0; n < 4; ++n, buf += 3)
+    {
+        ir.dots[n].raw.x = buf[0] | ((buf[2] & 0x30) << 4);
+        ir.dots[n].raw.y = buf[1] | ((buf[2] & 0xC0) << 2);
+        ir.dots[n].size = buf[2] & 0x0F;
+    }
+}
+
+// The scalar normalization ParseIR used before UnpackIR
+void NormalizeScalar(IRData& ir)
+{
+    for (auto& dot : ir.dots)
+    {
+        dot.normalized.x = dot.raw.x / 1023.0f;
+        dot.normalized.y = dot.raw.y /  767.0f;
+
+        dot.visible = dot.raw.x != 0x3FF && dot.raw.y != 0x3FF;
+    }
+}
+
+bool SameDots(IRData const& a, IRData const& b)
+{
+    for (unsigned n = 0; n < 4; ++n)
+    {
+        IRData::Dot const& p = a.dots[n];
+        IRData::Dot const& q = b.dots[n];
+
+        if (p.raw.x != q.raw.x || p.raw.y != q.raw.y || p.size != q.size || p.visible != q.visible
+            || std::memcmp(&p.normalized, &q.normalized, sizeof(p.normalized)) != 0)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Random IR bytes; about one in eight is 0xFF, so that many dots are invisible
+std::vector<uint8_t> RandomIR(size_t count)
+{
+    std::vector<uint8_t> bytes(count * 12);
+
+    for (auto& b : bytes)
+        b = (std::rand() & 7) == 0 ? 0xFF : static_cast<uint8_t>(std::rand());
+
+    return bytes;
+}
+
+template <IRData::Mode Mode>
+void RunUnpack(char const* name, void (*scalar)(IRData&, uint8_t const*))
+{
+    size_t const count = 4096;
+    unsigned const repeat = 100;
+
+    std::vector<uint8_t> bytes = RandomIR(count);
+
+    IRData a;
+    IRData b;
+
+    std::memset(&a, 0, sizeof(a));
+    std::memset(&b, 0, sizeof(b));
+
+    unsigned mismatches = 0;
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        scalar(a, &bytes[i * 12]);
+        NormalizeScalar(a);
+
+        UnpackIR<Mode>(b, &bytes[i * 12]);
+
+        if (!SameDots(a, b))
+            mismatches++;
+    }
+
+    double old = bench::Fastest(5, [&]() {
+        for (unsigned r = 0; r < repeat; ++r)
+        {
+            for (size_t i = 0; i < count; ++i)
+            {
+                scalar(a, &bytes[i * 12]);
+                NormalizeScalar(a);
+            }
+        }
+    }) * 1e9 / (repeat * count);
+
+    double now = bench::Fastest(5, [&]() {
+        for (unsigned r = 0; r < repeat; ++r)
+            for (size_t i = 0; i < count; ++i)
+                UnpackIR<Mode>(b, &bytes[i * 12]);
+    }) * 1e9 / (repeat * count);
+
+    bench::Use(a.dots[3].normalized.x + b.dots[3].normalized.x);
+
+    std::printf("%10s %12.1f %12.1f %10u\n", name, old, now, mismatches);
+}
+
+} // namespace
+
+//
+// Time per report to unpack and normalize the IR dots of a single report
+//
+BENCHMARK(IRUnpack)
+{
+    std::srand(1);
+
+    std::printf("SSE2 %d, SSSE3 %d, AVX2 %d\n", WII_HAVE_SSE2, WII_HAVE_SSSE3, WII_HAVE_AVX2);
+    std::printf("%10s %12s %12s %10s\n", "mode", "scalar ns", "UnpackIR ns", "mismatches");
+
+    RunUnpack<IRData::Mode::Basic>("Basic", &UnpackBasicScalar);
+    RunUnpack<IRData::Mode::Extended>("Extended", &UnpackExtendedScalar);
+}
+
+//
+// Time per report to normalize the IR columns of a batch
+//
+BENCHMARK(IRNormalizeBatch)
+{
+    size_t const counts[] = { 8, 61, 4096 };
+    unsigned const repeat = 20000;
+
+    std::srand(2);
+
+    std::printf("%10s %12s %12s %10s\n", "reports", "scalar ns", "batch ns", "mismatches");
+
+    for (size_t count : counts)
+    {
+        std::vector<uint16_t> x[4];
+        std::vector<uint16_t> y[4];
+        std::vector<float> nx[4];
+        std::vector<float> ny[4];
+        std::vector<float> sx[4];
+        std::vector<float> sy[4];
+        std::vector<uint8_t> visible(count);
+        std::vector<uint8_t> scalarVisible(count);
+
+        uint16_t const* px[4];
+        uint16_t const* py[4];
+        float* pnx[4];
+        float* pny[4];
+
+        for (unsigned n = 0; n < 4; ++n)
+        {
+            for (size_t i = 0; i < count; ++i)
+            {
+                x[n].push_back((std::rand() & 7) == 0 ? 0x3FF : static_cast<uint16_t>(std::rand() & 0x3FF));
+                y[n].push_back((std::rand() & 7) == 0 ? 0x3FF : static_cast<uint16_t>(std::rand() % 768));
+            }
+
+            nx[n].resize(count);
+            ny[n].resize(count);
+            sx[n].resize(count);
+            sy[n].resize(count);
+
+            px[n] = x[n].data();
+            py[n] = y[n].data();
+            pnx[n] = nx[n].data();
+            pny[n] = ny[n].data();
+        }
+
+        // The scalar loop, column by column
+        auto normalizeScalar = [&]() {
+            for (size_t i = 0; i < count; ++i)
+            {
+                unsigned mask = 0;
+
+                for (unsigned n = 0; n < 4; ++n)
+                {
+                    sx[n][i] = x[n][i] / 1023.0f;
+                    sy[n][i] = y[n][i] /  767.0f;
+
+                    if (x[n][i] != 0x3FF && y[n][i] != 0x3FF)
+                        mask |= 1u << n;
+                }
+
+                scalarVisible[i] = static_cast<uint8_t>(mask);
+            }
+        };
+
+        unsigned reps = static_cast<unsigned>(repeat * 8 / count) + 1;
+
+        double old = bench::Fastest(5, [&]() {
+            for (unsigned r = 0; r < reps; ++r)
+                normalizeScalar();
+        }) * 1e9 / (reps * count);
+
+        double now = bench::Fastest(5, [&]() {
+            for (unsigned r = 0; r < reps; ++r)
+                NormalizeIR(px, py, pnx, pny, visible.data(), count);
+        }) * 1e9 / (reps * count);
+
+        unsigned mismatches = 0;
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            bool same = visible[i] == scalarVisible[i];
+
+            for (unsigned n = 0; n < 4; ++n)
+            {
+                same = same
+                    && std::memcmp(&nx[n][i], &sx[n][i], sizeof(float)) == 0
+                    && std::memcmp(&ny[n][i], &sy[n][i], sizeof(float)) == 0;
+            }
+
+            if (!same)
+                mismatches++;
+        }
+
+        std::printf("%10zu %12.2f %12.2f %10u\n", count, old, now, mismatches);
+    }
+}
@@ -0,0 +1,28 @@
+// This file is distributed under the MIT license.
+// See the LICENSE file for details.
+
+#include "Benchmark.h"
+
+#include <cstring>
+
+//
+// Runs all benchmarks -- or the benchmarks whose names contain the first argument.
+//
+int main(int argc, char* argv[])
+{
+    char const* filter = argc > 1 ? argv[1] : "";
+
+    for (auto const& b : bench::Benchmarks())
+    {
+        if (std::strstr(b.name, filter) == nullptr)
+            continue;
+
+        std::printf("%s\n", b.name);
+
+        b.func();
+
+        std::printf("\n");
+    }
+
+    return 0;
+}
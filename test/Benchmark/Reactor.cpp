@@ -0,0 +1,195 @@
+// This file is distributed under the MIT license.
+// See the LICENSE file for details.
+
+#include "Benchmark.h"
+
+#ifndef _WIN32
+
+#include "Wiimote/Reactor.h"
+#include "Wiimote/Transport.h"
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace wii;
+
+//--------------------------------------------------------------------------------------------------
+// WiimoteReactor with socketpair stand-ins
+//--------------------------------------------------------------------------------------------------
+
+namespace
+{
+
+// Results of a reactor run
+struct ReactorStats
+{
+    // Number of reports processed
+    unsigned long long reports;
+    // CPU time of the reactor thread in seconds
+    double cpu;
+    // Wall clock time in seconds
+    double wall;
+};
+
+//
+// Run a reactor with 'count' stand-in devices for 'duration' seconds.
+// A feeder thread plays the devices: every 'interval' seconds, it hands the output reports
+// the Wiimotes wrote to an emulated Wiimote (see CreateLoopbackTransport()) and sends the
+// next 'burst' reports of the emulated Wiimote to the device.
+//
+ReactorStats RunReactor(WiimoteReactor::Backend backend, unsigned count, unsigned burst, double interval, double duration)
+{
+    WiimoteReactor reactor(backend);
+
+    std::vector<int> peers;
+    std::vector<std::unique_ptr<Transport>> emulated;
+
+    for (unsigned n = 0; n < count; ++n)
+    {
+        int fds[2];
+
+        if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK, 0, fds) < 0)
+            break;
+
+        Wiimote* wiimote = reactor.Add(CreateHidrawTransport(fds[0]));
+
+        if (wiimote)
+            wiimote->SetReportMode(Wiimote::ReportMode::ButtonsAccel);
+
+        peers.push_back(fds[1]);
+        emulated.push_back(CreateLoopbackTransport());
+    }
+
+    std::atomic<bool> feeding(true);
+
+    std::thread feeder([&]() {
+        uint8_t report[22];
+        uint8_t output[64];
+
+        for (double next = bench::Now(), end = next + duration; next < end; next += interval)
+        {
+            while (bench::Now() < next)
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+
+            for (size_t i = 0; i < peers.size(); ++i)
+            {
+                ssize_t len;
+
+                while ((len = recv(peers[i], output, sizeof(output), 0)) > 0)
+                    emulated[i]->Write(output, static_cast<unsigned>(len));
+
+                for (unsigned n = 0; n < burst; ++n)
+                {
+                    double time;
+
+                    emulated[i]->Read(report, time, 0);
+
+                    send(peers[i], report, sizeof(report), MSG_NOSIGNAL);
+                }
+            }
+        }
+
+        feeding = false;
+    });
+
+    ReactorStats stats = { 0, 0.0, 0.0 };
+
+    double cpu = bench::ThreadTime();
+    double wall = bench::Now();
+
+    // Run until the feeder is done and all reports have been processed
+    for (;;)
+    {
+        bool done = !feeding;
+
+        unsigned processed = reactor.Run(done ? 0 : 10);
+
+        stats.reports += processed;
+
+        if (done && processed == 0)
+            break;
+    }
+
+    stats.cpu = bench::ThreadTime() - cpu;
+    stats.wall = bench::Now() - wall;
+
+    feeder.join();
+
+    for (int fd : peers)
+        close(fd);
+
+    return stats;
+}
+
+} // namespace
+
+//
+// CPU time per device as the number of devices rises.
+// Every device sends 100 reports per second, like a Wiimote in continuous mode.
+//
+BENCHMARK(ReactorScaling)
+{
+    unsigned const counts[] = { 1, 4, 16, 64, 256 };
+    double const duration = 1.0;
+
+    ReactorStats stats[5];
+
+    for (unsigned n = 0; n < 5; ++n)
+        stats[n] = RunReactor(WiimoteReactor::Backend::Epoll, counts[n], 1, 0.010, duration);
+
+    // The Wiimotes log their startup; print the results afterwards
+    std::printf("%8s %10s %22s %12s\n", "devices", "reports", "CPU ms/device-second", "ns/report");
+
+    for (unsigned n = 0; n < 5; ++n)
+    {
+        std::printf("%8u %10llu %22.3f %12.0f\n",
+            counts[n],
+            stats[n].reports,
+            stats[n].cpu * 1000.0 / (counts[n] * duration),
+            stats[n].reports ? stats[n].cpu * 1e9 / stats[n].reports : 0.0);
+    }
+}
+
+//
+// io_uring against epoll under heavy load.
+// Every device sends 8 reports every 2 ms, so that every Run() finds many reports ready.
+//
+BENCHMARK(ReactorBackends)
+{
+    unsigned const counts[] = { 16, 64, 256 };
+    double const duration = 1.0;
+
+    ReactorStats epoll[3];
+    ReactorStats uring[3];
+
+    bool hasUring = WiimoteReactor(WiimoteReactor::Backend::Uring).GetBackend() == WiimoteReactor::Backend::Uring;
+
+    for (unsigned n = 0; n < 3; ++n)
+    {
+        epoll[n] = RunReactor(WiimoteReactor::Backend::Epoll, counts[n], 8, 0.002, duration);
+
+        if (hasUring)
+            uring[n] = RunReactor(WiimoteReactor::Backend::Uring, counts[n], 8, 0.002, duration);
+    }
+
+    if (!hasUring)
+        std::printf("io_uring is not available; showing epoll only\n");
+
+    std::printf("%8s %10s %16s %16s\n", "devices", "reports", "epoll ns/report", "uring ns/report");
+
+    for (unsigned n = 0; n < 3; ++n)
+    {
+        std::printf("%8u %10llu %16.0f %16.0f\n",
+            counts[n],
+            epoll[n].reports,
+            epoll[n].reports ? epoll[n].cpu * 1e9 / epoll[n].reports : 0.0,
+            hasUring && uring[n].reports ? uring[n].cpu * 1e9 / uring[n].reports : 0.0);
+    }
+}
+
+#endif
@@ -0,0 +1,127 @@
+// This file is distributed under the MIT license.
+// See the LICENSE file for details.
+
+#include "Benchmark.h"
+
+#include "Wiimpl.h"
+
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+using namespace wii;
+
+//--------------------------------------------------------------------------------------------------
+// The reader thread's SPSC ring against a mutex protected queue
+//--------------------------------------------------------------------------------------------------
+
+namespace
+{
+
+// A bounded queue protected by a mutex, with the same interface as RingBuffer
+class LockedQueue
+{
+    std::mutex lock;
+    std::deque<InputReport> queue;
+    size_t capacity;
+
+public:
+    explicit LockedQueue(size_t capacity)
+        : lock()
+        , queue()
+        , capacity(capacity)
+    {
+    }
+
+    bool Push(InputReport const& value)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+
+        if (queue.size() >= capacity)
+            return false;
+
+        queue.push_back(value);
+
+        return true;
+    }
+
+    bool Pop(InputReport& value)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+
+        if (queue.empty())
+            return false;
+
+        value = queue.front();
+        queue.pop_front();
+
+        return true;
+    }
+};
+
+//
+// Move 'count' reports from a producer thread to the calling thread through the queue.
+// Returns the time per report in ns.
+//
+template <class Queue>
+double Transfer(size_t count)
+{
+    Queue queue(WII_INPUT_QUEUE_SIZE);
+
+    double start = bench::Now();
+
+    std::thread producer([&]() {
+        InputReport input;
+
+        std::memset(&input, 0, sizeof(input));
+
+        for (size_t n = 0; n < count; ++n)
+        {
+            input.time = static_cast<double>(n);
+            input.data[0] = static_cast<uint8_t>(n);
+
+            while (!queue.Push(input))
+                std::this_thread::yield();
+        }
+    });
+
+    InputReport output;
+
+    unsigned sum = 0;
+
+    for (size_t n = 0; n < count; ++n)
+    {
+        while (!queue.Pop(output))
+            std::this_thread::yield();
+
+        sum += output.data[0];
+    }
+
+    producer.join();
+
+    bench::Use(sum);
+
+    return (bench::Now() - start) * 1e9 / count;
+}
+
+} // namespace
+
+BENCHMARK(ReaderQueue)
+{
+    size_t const count = 5000000;
+
+    double ring = 1e30;
+    double locked = 1e30;
+
+    for (unsigned n = 0; n < 3; ++n)
+    {
+        ring = std::min(ring, Transfer<InputQueue>(count));
+        locked = std::min(locked, Transfer<LockedQueue>(count));
+    }
+
+    std::printf("%12s %12s\n", "queue", "ns/report");
+    std::printf("%12s %12.1f\n", "SPSC ring", ring);
+    std::printf("%12s %12.1f\n", "mutex", locked);
+}
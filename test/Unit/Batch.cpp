@@ -0,0 +1,275 @@
+// This file is distributed under the MIT license.
+// See the LICENSE file for details.
+
+#include "Test.h"
+
+#include "Wiimote/Batch.h"
+
+#include "Capture.h"
+#include "Data.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+using namespace wii;
+
+//--------------------------------------------------------------------------------------------------
+// Column decoding of data reports (DecodeReports()) against the report decoders
+//--------------------------------------------------------------------------------------------------
+
+namespace
+{
+
+// The IR mode SetReportMode() selects for a report mode
+IRData::Mode IRMode(Wiimote::ReportMode mode)
+{
+    switch (mode)
+    {
+    case Wiimote::ReportMode::ButtonsAccelIR:
+        return IRData::Mode::Extended;
+    case Wiimote::ReportMode::ButtonsIRExt:
+    case Wiimote::ReportMode::ButtonsAccelIRExt:
+        return IRData::Mode::Basic;
+    default:
+        return IRData::Mode::Off;
+    }
+}
+
+//
+// Random reports, 'stride' bytes apart at 'offset': blocks of data reports in the given
+// report mode, followed by reports of all kinds -- status reports, memory reads and
+// acknowledgements, and data reports of another report mode -- which must be skipped.
+// Returns the number of data reports in the report mode.
+//
+size_t MakeReports(std::vector<uint8_t>& buffer, size_t count, Wiimote::ReportMode mode, size_t stride, size_t offset)
+{
+    uint8_t const others[] = { 0x20, 0x21, 0x22, 0x30, 0x37 };
+
+    buffer.assign(count * stride, 0);
+
+    size_t matching = 0;
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        uint8_t* report = &buffer[i * stride + offset];
+
+        for (unsigned n = 1; n < 22; ++n)
+            report[n] = static_cast<uint8_t>(std::rand());
+
+        // Every IR dot is invisible now and then
+        if (std::rand() % 4 == 0)
+            std::memset(report + 3, 0xFF, 13);
+
+        // The first block only holds data reports in the report mode
+        uint8_t other = others[std::rand() % sizeof(others)];
+
+        report[0] = i < 1024 || std::rand() % 3 != 0 || other == static_cast<uint8_t>(mode) ? static_cast<uint8_t>(mode) : other;
+
+        matching += report[0] == static_cast<uint8_t>(mode);
+    }
+
+    return matching;
+}
+
+// Check element i of the batch against the state decoded from the same report
+void CheckColumns(ReportBatch const& batch, size_t i, State const& state, Wiimote::ReportMode mode, unsigned extension)
+{
+    CHECK(batch.data[i] == state.data);
+    CHECK(batch.buttons[i] == state.buttons);
+
+    if (state.data & State::Accel)
+    {
+        CHECK(batch.accelX[i] == state.accel.raw.x);
+        CHECK(batch.accelY[i] == state.accel.raw.y);
+        CHECK(batch.accelZ[i] == state.accel.raw.z);
+    }
+
+    if (state.data & State::IR)
+    {
+        unsigned visible = 0;
+
+        for (unsigned n = 0; n < 4; ++n)
+        {
+            IRData::Dot const& dot = state.ir.dots[n];
+
+            CHECK(batch.irX[n][i] == dot.raw.x);
+            CHECK(batch.irY[n][i] == dot.raw.y);
+            CHECK(batch.irNormalizedX[n][i] == dot.normalized.x);
+            CHECK(batch.irNormalizedY[n][i] == dot.normalized.y);
+
+            if (IRMode(mode) == IRData::Mode::Extended)
+                CHECK(batch.irSize[n][i] == dot.size);
+
+            visible |= dot.visible ? 1u << n : 0u;
+        }
+
+        CHECK(batch.irVisible[i] == visible);
+    }
+
+    //
+    // In pass-through mode, the columns of the part which is not in the report are 0
+    //
+
+    if (extension & Extension::MotionPlus)
+    {
+        MotionPlusData const& mp = state.extension.motionPlus;
+
+        bool has = (state.data & State::MotionPlus) != 0;
+
+        unsigned flags = (mp.fast.x ? 1 : 0) | (mp.fast.y ? 2 : 0) | (mp.fast.z ? 4 : 0) | (mp.ext ? 8 : 0);
+
+        CHECK(batch.mpX[i] == (has ? mp.raw.x : 0));
+        CHECK(batch.mpY[i] == (has ? mp.raw.y : 0));
+        CHECK(batch.mpZ[i] == (has ? mp.raw.z : 0));
+        CHECK(batch.mpFlags[i] == (has ? flags : 0));
+    }
+
+    if (extension & Extension::Nunchuk)
+    {
+        NunchukData const& nc = state.extension.nunchuk;
+
+        bool has = (state.data & State::Nunchuk) != 0;
+
+        CHECK(batch.nunchukStickX[i] == (has ? nc.stick.raw.x : 0));
+        CHECK(batch.nunchukStickY[i] == (has ? nc.stick.raw.y : 0));
+        CHECK(batch.nunchukAccelX[i] == (has ? nc.accel.raw.x : 0));
+        CHECK(batch.nunchukAccelY[i] == (has ? nc.accel.raw.y : 0));
+        CHECK(batch.nunchukAccelZ[i] == (has ? nc.accel.raw.z : 0));
+        CHECK(batch.nunchukButtons[i] == (has ? nc.buttons : 0));
+    }
+
+    if (extension & Extension::ClassicController)
+    {
+        ClassicControllerData const& cc = state.extension.classic;
+
+        bool has = (state.data & State::ClassicController) != 0;
+
+        CHECK(batch.classicButtons[i] == (has ? cc.buttons : 0));
+        CHECK(batch.classicStickLX[i] == (has ? cc.stickL.raw.x : 0));
+        CHECK(batch.classicStickLY[i] == (has ? cc.stickL.raw.y : 0));
+        CHECK(batch.classicStickRX[i] == (has ? cc.stickR.raw.x : 0));
+        CHECK(batch.classicStickRY[i] == (has ? cc.stickR.raw.y : 0));
+    }
+}
+
+// Decode the reports column by column and check every decoded report against
+// GetReportDecoder()
+void CheckBatch(Wiimote::ReportMode mode, unsigned extension, size_t stride, size_t offset)
+{
+    size_t const count = 3000;
+
+    std::vector<uint8_t> buffer;
+
+    size_t matching = MakeReports(buffer, count, mode, stride, offset);
+
+    ReportBatch batch;
+
+    REQUIRE(DecodeReports(batch, buffer.data() + offset, count, mode, extension, stride) == matching);
+    REQUIRE(batch.count == matching);
+
+    //
+    // Only the columns the report provides are filled
+    //
+
+    uint8_t const id = static_cast<uint8_t>(mode);
+
+    bool hasAccel = id == 0x31 || id == 0x33 || id == 0x35 || id == 0x37;
+    bool hasIR = IRMode(mode) != IRData::Mode::Off;
+    bool hasExtension = id == 0x32 || id >= 0x35;
+
+    unsigned type = hasExtension ? extension : 0;
+
+    REQUIRE(batch.data.size() == matching);
+    REQUIRE(batch.buttons.size() == matching);
+    REQUIRE(batch.accelX.size() == (hasAccel ? matching : 0));
+    REQUIRE(batch.irX[3].size() == (hasIR ? matching : 0));
+    REQUIRE(batch.irSize[3].size() == (IRMode(mode) == IRData::Mode::Extended ? matching : 0));
+    REQUIRE(batch.irVisible.size() == (hasIR ? matching : 0));
+    REQUIRE(batch.mpX.size() == ((type & Extension::MotionPlus) ? matching : 0));
+    REQUIRE(batch.nunchukStickX.size() == ((type & Extension::Nunchuk) ? matching : 0));
+    REQUIRE(batch.classicStickLX.size() == ((type & Extension::ClassicController) ? matching : 0));
+
+    ReportDecoder decoder = GetReportDecoder(id, IRMode(mode), extension);
+
+    REQUIRE(decoder != nullptr);
+
+    size_t i = 0;
+
+    for (size_t n = 0; n < count; ++n)
+    {
+        uint8_t const* report = &buffer[n * stride + offset];
+
+        if (report[0] != id)
+            continue;
+
+        State state;
+
+        std::memset(&state, 0, sizeof(state));
+
+        state.ir.mode = IRMode(mode);
+        state.extension.type = extension;
+
+        decoder(state, report, nullptr);
+
+        CheckColumns(batch, i, state, mode, type);
+
+        i++;
+    }
+}
+
+} // namespace
+
+TEST(BatchMatchesReportDecoders)
+{
+    Wiimote::ReportMode const modes[] = {
+        Wiimote::ReportMode::Buttons,
+        Wiimote::ReportMode::ButtonsAccel,
+        Wiimote::ReportMode::ButtonsExt,
+        Wiimote::ReportMode::ButtonsAccelIR,
+        Wiimote::ReportMode::ButtonsAccelExt,
+        Wiimote::ReportMode::ButtonsIRExt,
+        Wiimote::ReportMode::ButtonsAccelIRExt,
+    };
+    unsigned const extensions[] = {
+        0,
+        Extension::Nunchuk,
+        Extension::ClassicController,
+        Extension::MotionPlus,
+        Extension::MotionPlus | Extension::Nunchuk,
+        Extension::MotionPlus | Extension::ClassicController,
+    };
+
+    std::srand(1);
+
+    for (Wiimote::ReportMode mode : modes)
+    {
+        for (unsigned extension : extensions)
+        {
+            // Reports packed one after another ...
+            CheckBatch(mode, extension, 22, 0);
+
+            // ... and in place in capture records
+            CheckBatch(mode, extension, WII_CAPTURE_RECORD_SIZE, WII_CAPTURE_OFFSET_REPORT);
+        }
+    }
+}
+
+TEST(BatchSkipsOtherReports)
+{
+    uint8_t reports[4 * 22] = { 0 };
+
+    reports[0 * 22] = 0x20; // Status
+    reports[1 * 22] = 0x21; // Read memory data
+    reports[2 * 22] = 0x22; // Acknowledge
+    reports[3 * 22] = 0x30; // Buttons
+
+    ReportBatch batch;
+
+    CHECK(DecodeReports(batch, reports, 4, Wiimote::ReportMode::ButtonsAccel) == 0);
+    CHECK(batch.count == 0);
+    CHECK(batch.buttons.empty());
+
+    // Not a report mode
+    CHECK(DecodeReports(batch, reports, 4, Wiimote::ReportMode::Undefined) == 0);
+}
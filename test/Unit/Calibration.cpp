@@ -0,0 +1,342 @@
+// This file is distributed under the MIT license.
+// See the LICENSE file for details.
+
+#include "Test.h"
+
+#include "Data.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <utility>
+
+using namespace wii;
+
+//--------------------------------------------------------------------------------------------------
+// Calibration tables (CalibrationTables) against the formulas they replace
+//--------------------------------------------------------------------------------------------------
+
+namespace
+{
+
+// The normalized accelerometer value NormalizeAccel computes without tables
+float NormalizedAccel(int raw, int zero, int g)
+{
+    return (float)(raw - zero) / (float)(g - zero);
+}
+
+// The normalized joystick value NormalizeStick computes without tables
+float NormalizedStick(int raw, int center, int min, int max)
+{
+    return 2.0f * (float)(raw - center) / (float)(max - min);
+}
+
+bool Same(float a, float b)
+{
+    return std::memcmp(&a, &b, sizeof(float)) == 0;
+}
+
+// Random accelerometer calibration data; about one in eight has zero == g on an axis
+void RandomAccelCalibration(uint8_t (&buf)[8])
+{
+    for (auto& b : buf)
+        b = static_cast<uint8_t>(std::rand());
+
+    if ((std::rand() & 7) == 0)
+    {
+        buf[4 + std::rand() % 3] = buf[0];
+        buf[7] = buf[3];
+    }
+}
+
+// Random joystick calibration data (max, min, center of x and y); about one in eight is not
+// ordered min < center < max on an axis
+void RandomStickCalibration(uint8_t (&buf)[6])
+{
+    for (unsigned axis = 0; axis < 2; ++axis)
+    {
+        uint8_t* v = buf + 3 * axis;
+
+        for (unsigned k = 0; k < 3; ++k)
+            v[k] = static_cast<uint8_t>(std::rand());
+
+        if ((std::rand() & 7) != 0)
+        {
+            if (v[0] < v[1]) std::swap(v[0], v[1]);
+            if (v[0] < v[2]) std::swap(v[0], v[2]);
+            if (v[1] > v[2]) std::swap(v[1], v[2]);
+        }
+    }
+}
+
+// Every entry of the table is the value of the formula
+void CheckTable(CalibrationTables::Accel const& table, AccelData::CalibrationData const& cal)
+{
+    unsigned mismatches = 0;
+
+    for (int raw = 0; raw < 1024; ++raw)
+    {
+        mismatches += !Same(table[0][raw], NormalizedAccel(raw, cal.zero.x, cal.g.x));
+        mismatches += !Same(table[1][raw], NormalizedAccel(raw, cal.zero.y, cal.g.y));
+        mismatches += !Same(table[2][raw], NormalizedAccel(raw, cal.zero.z, cal.g.z));
+    }
+
+    CHECK(mismatches == 0);
+}
+
+void CheckTable(CalibrationTables::Stick const& table, JoystickData::CalibrationData const& cal)
+{
+    unsigned mismatches = 0;
+
+    for (int raw = 0; raw < 256; ++raw)
+    {
+        mismatches += !Same(table[0][raw], NormalizedStick(raw, cal.center.x, cal.min.x, cal.max.x));
+        mismatches += !Same(table[1][raw], NormalizedStick(raw, cal.center.y, cal.min.y, cal.max.y));
+    }
+
+    CHECK(mismatches == 0);
+}
+
+//
+// Calibrate two states -- one with tables, one without -- with the same calibration data,
+// decode the same reports into both, and count the reports with different results
+//
+
+unsigned CompareAccel(CalibrationTables& tables, uint8_t const (&cal)[8])
+{
+    State a;
+    State b;
+
+    std::memset(&a, 0, sizeof(a));
+    std::memset(&b, 0, sizeof(b));
+
+    ParseCalibrationData(a, cal, sizeof(cal), 0, &tables);
+    ParseCalibrationData(b, cal, sizeof(cal), 0, nullptr);
+
+    if (a.accel.cal.valid)
+        CheckTable(tables.accel, a.accel.cal);
+
+    unsigned mismatches = 0;
+
+    // Every raw value the reports can carry
+    for (unsigned v = 0; v < 256; ++v)
+    {
+        for (unsigned low = 0; low < 16; ++low)
+        {
+            uint8_t buf[5] = {
+                static_cast<uint8_t>((low & 3) << 5),
+                static_cast<uint8_t>((low >> 2) << 5),
+                static_cast<uint8_t>(v),
+                static_cast<uint8_t>(v),
+                static_cast<uint8_t>(v),
+            };
+
+            ParseAccel(a, buf, &tables);
+            ParseAccel(b, buf, nullptr);
+
+            mismatches += std::memcmp(&a, &b, sizeof(State)) != 0;
+        }
+    }
+
+    return mismatches;
+}
+
+unsigned CompareNunchuk(CalibrationTables& tables, uint8_t const (&cal)[14])
+{
+    State a;
+    State b;
+
+    std::memset(&a, 0, sizeof(a));
+    std::memset(&b, 0, sizeof(b));
+
+    a.extension.type = Extension::Nunchuk;
+    b.extension.type = Extension::Nunchuk;
+
+    ParseNunchukCalibrationData(a, cal, sizeof(cal), 0, &tables);
+    ParseNunchukCalibrationData(b, cal, sizeof(cal), 0, nullptr);
+
+    if (a.extension.nunchuk.accel.cal.valid)
+        CheckTable(tables.nunchukAccel, a.extension.nunchuk.accel.cal);
+    if (a.extension.nunchuk.stick.cal.valid)
+        CheckTable(tables.nunchukStick, a.extension.nunchuk.stick.cal);
+
+    unsigned mismatches = 0;
+
+    // Every raw value, with and without MotionPlus pass-through
+    for (unsigned v = 0; v < 256; ++v)
+    {
+        for (unsigned low = 0; low < 256; ++low)
+        {
+            uint8_t buf[6] = {
+                static_cast<uint8_t>(v),
+                static_cast<uint8_t>(v ^ 0x5A),
+                static_cast<uint8_t>(v),
+                static_cast<uint8_t>(v),
+                static_cast<uint8_t>(v),
+                static_cast<uint8_t>(low),
+            };
+
+            for (int passthrough = 0; passthrough < 2; ++passthrough)
+            {
+                ParseNunchuk(a, buf, passthrough != 0, &tables);
+                ParseNunchuk(b, buf, passthrough != 0, nullptr);
+
+                mismatches += std::memcmp(&a, &b, sizeof(State)) != 0;
+            }
+        }
+    }
+
+    return mismatches;
+}
+
+unsigned CompareClassic(CalibrationTables& tables, uint8_t const (&cal)[12])
+{
+    State a;
+    State b;
+
+    std::memset(&a, 0, sizeof(a));
+    std::memset(&b, 0, sizeof(b));
+
+    a.extension.type = Extension::ClassicController;
+    b.extension.type = Extension::ClassicController;
+
+    ParseClassicControllerCalibrationData(a, cal, sizeof(cal), 0, &tables);
+    ParseClassicControllerCalibrationData(b, cal, sizeof(cal), 0, nullptr);
+
+    if (a.extension.classic.stickL.cal.valid)
+        CheckTable(tables.classicStickL, a.extension.classic.stickL.cal);
+    if (a.extension.classic.stickR.cal.valid)
+        CheckTable(tables.classicStickR, a.extension.classic.stickR.cal);
+
+    unsigned mismatches = 0;
+
+    // Every raw value of both sticks, with and without MotionPlus pass-through
+    for (unsigned v = 0; v < 256; ++v)
+    {
+        for (unsigned w = 0; w < 256; ++w)
+        {
+            uint8_t buf[6] = {
+                static_cast<uint8_t>(v),
+                static_cast<uint8_t>(w),
+                static_cast<uint8_t>((w >> 3) | ((v & 0x20) << 2)),
+                0,
+                0,
+                0,
+            };
+
+            for (int passthrough = 0; passthrough < 2; ++passthrough)
+            {
+                ParseClassicController(a, buf, passthrough != 0, &tables);
+                ParseClassicController(b, buf, passthrough != 0, nullptr);
+
+                mismatches += std::memcmp(&a, &b, sizeof(State)) != 0;
+            }
+        }
+    }
+
+    return mismatches;
+}
+
+} // namespace
+
+TEST(CalibrationTablesMatchFormulas)
+{
+    CalibrationTables tables;
+
+    std::srand(1);
+
+    //
+    // Random calibration data -- valid or not -- normalizes the same with tables as without.
+    // The tables are shared by all calibrations, so every calibration must rebuild them.
+    //
+
+    for (unsigned i = 0; i < 32; ++i)
+    {
+        uint8_t accel[8];
+        uint8_t nunchuk[14];
+        uint8_t classic[12];
+
+        RandomAccelCalibration(accel);
+
+        uint8_t nunchukAccel[8];
+        uint8_t nunchukStick[6];
+
+        RandomAccelCalibration(nunchukAccel);
+        RandomStickCalibration(nunchukStick);
+
+        std::memcpy(nunchuk + 0, nunchukAccel, 8);
+        std::memcpy(nunchuk + 8, nunchukStick, 6);
+
+        uint8_t classicL[6];
+        uint8_t classicR[6];
+
+        RandomStickCalibration(classicL);
+        RandomStickCalibration(classicR);
+
+        std::memcpy(classic + 0, classicL, 6);
+        std::memcpy(classic + 6, classicR, 6);
+
+        CHECK(CompareAccel(tables, accel) == 0);
+        CHECK(CompareNunchuk(tables, nunchuk) == 0);
+        CHECK(CompareClassic(tables, classic) == 0);
+    }
+}
+
+TEST(CalibrationTablesRebuilt)
+{
+    CalibrationTables tables;
+    CalibrationTables fresh;
+
+    //
+    // Calibrating again -- e.g. after another Nunchuk has been plugged in -- replaces every
+    // entry of the tables
+    //
+
+    uint8_t const first[14] = { 0x7D, 0x81, 0x7F, 0x2D, 0xB1, 0xB2, 0xB0, 0x1E, 0xE4, 0x1D, 0x7E, 0xE1, 0x20, 0x84 };
+    uint8_t const second[14] = { 0x84, 0x78, 0x80, 0x12, 0xB8, 0xAD, 0xB3, 0x39, 0xF0, 0x10, 0x82, 0xEE, 0x14, 0x7A };
+
+    State a;
+    State b;
+
+    std::memset(&a, 0, sizeof(a));
+    std::memset(&b, 0, sizeof(b));
+
+    std::memset(&tables, 0, sizeof(tables));
+    std::memset(&fresh, 0, sizeof(fresh));
+
+    ParseNunchukCalibrationData(a, first, sizeof(first), 0, &tables);
+    ParseNunchukCalibrationData(a, second, sizeof(second), 0, &tables);
+
+    ParseNunchukCalibrationData(b, second, sizeof(second), 0, &fresh);
+
+    REQUIRE(a.extension.nunchuk.accel.cal.valid);
+    REQUIRE(a.extension.nunchuk.stick.cal.valid);
+
+    CHECK(std::memcmp(&tables.nunchukAccel, &fresh.nunchukAccel, sizeof(fresh.nunchukAccel)) == 0);
+    CHECK(std::memcmp(&tables.nunchukStick, &fresh.nunchukStick, sizeof(fresh.nunchukStick)) == 0);
+
+    CheckTable(tables.nunchukAccel, b.extension.nunchuk.accel.cal);
+    CheckTable(tables.nunchukStick, b.extension.nunchuk.stick.cal);
+
+    //
+    // Invalid calibration data leaves the tables alone, but they are not used anymore: the
+    // values are normalized like without calibration data
+    //
+
+    uint8_t const invalid[14] = { 0 };
+
+    ParseNunchukCalibrationData(a, invalid, sizeof(invalid), 0, &tables);
+    ParseNunchukCalibrationData(b, invalid, sizeof(invalid), 0, nullptr);
+
+    CHECK(!a.extension.nunchuk.accel.cal.valid);
+    CHECK(!a.extension.nunchuk.stick.cal.valid);
+
+    uint8_t const report[6] = { 0x10, 0xF0, 0x80, 0x90, 0xA0, 0x5C };
+
+    ParseNunchuk(a, report, false, &tables);
+    ParseNunchuk(b, report, false, nullptr);
+
+    CHECK(Same(a.extension.nunchuk.accel.normalized.x, b.extension.nunchuk.accel.normalized.x));
+    CHECK(Same(a.extension.nunchuk.accel.normalized.z, b.extension.nunchuk.accel.normalized.z));
+    CHECK(Same(a.extension.nunchuk.stick.normalized.x, b.extension.nunchuk.stick.normalized.x));
+    CHECK(Same(a.extension.nunchuk.stick.normalized.y, b.extension.nunchuk.stick.normalized.y));
+}
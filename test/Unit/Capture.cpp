@@ -0,0 +1,364 @@
+// This file is distributed under the MIT license.
+// See the LICENSE file for details.
+
+#include "Test.h"
+
+#include "Capture.h"
+#include "Wiimpl.h"
+
+#include <cstring>
+#include <vector>
+
+using namespace wii;
+
+//--------------------------------------------------------------------------------------------------
+// Capture files
+//--------------------------------------------------------------------------------------------------
+
+namespace
+{
+
+// Compress the given uncompressed records into a capture file without an index
+std::vector<uint8_t> Compress(std::vector<uint8_t> const& records)
+{
+    std::vector<uint8_t> file(WII_CAPTURE_HEADER_SIZE);
+
+    std::memcpy(file.data(), WII_CAPTURE_MAGIC, 4);
+    WriteLE16(file.data() + 4, WII_CAPTURE_VERSION_COMPRESSED);
+    WriteLE16(file.data() + 6, 0);
+
+    CaptureEncoder encoder;
+
+    for (size_t offset = 0; offset < records.size(); offset += WII_CAPTURE_RECORD_SIZE)
+    {
+        uint8_t out[WII_CAPTURE_MAX_COMPRESSED_SIZE];
+
+        size_t len = encoder.Encode(records.data() + offset, out);
+
+        file.insert(file.end(), out, out + len);
+    }
+
+    return file;
+}
+
+// Append an uncompressed record
+void AddRecord(std::vector<uint8_t>& records, uint64_t time, unsigned device, uint8_t const* report, unsigned len)
+{
+    uint8_t record[WII_CAPTURE_RECORD_SIZE];
+
+    std::memset(record, 0, sizeof(record));
+
+    WriteLE64(record + WII_CAPTURE_OFFSET_TIME, time);
+    WriteLE16(record + WII_CAPTURE_OFFSET_DEVICE, device);
+    record[WII_CAPTURE_OFFSET_DIR] = 0;
+    record[WII_CAPTURE_OFFSET_LENGTH] = static_cast<uint8_t>(len);
+    std::memcpy(record + WII_CAPTURE_OFFSET_REPORT, report, len);
+
+    records.insert(records.end(), record, record + sizeof(record));
+}
+
+// Decode the first record of a compressed capture file with the given records
+bool DecodeRecord(std::vector<uint8_t> const& records)
+{
+    uint8_t const header[] = { 'W', 'C', 'A', 'P', WII_CAPTURE_VERSION_COMPRESSED, 0, 0, 0 };
+
+    std::vector<uint8_t> file(header, header + sizeof(header));
+
+    file.insert(file.end(), records.begin(), records.end());
+
+    CaptureReader reader;
+    CaptureRecord record;
+
+    return reader.Open(file.data(), file.size()) && reader.Next(record);
+}
+
+} // namespace
+
+TEST(CaptureRoundTripSparseDevices)
+{
+    std::vector<uint8_t> records;
+
+    uint8_t report[22] = { 0x31, 0x00, 0x08, 0x80, 0x81, 0x82 };
+
+    // Device ids far apart must not blow up the decoder
+    unsigned const devices[] = { 0, 0xFFFF, 7, 0xFFFF, 0 };
+
+    for (unsigned n = 0; n < 5; ++n)
+    {
+        report[3] = static_cast<uint8_t>(0x80 + n);
+
+        AddRecord(records, 1000 * (n + 1), devices[n], report, 6);
+    }
+
+    std::vector<uint8_t> file = Compress(records);
+
+    CaptureReader reader;
+
+    REQUIRE(reader.Open(file.data(), file.size()));
+
+    for (unsigned n = 0; n < 5; ++n)
+    {
+        CaptureRecord record;
+
+        REQUIRE(reader.Next(record));
+
+        uint8_t const* expected = records.data() + n * WII_CAPTURE_RECORD_SIZE;
+
+        CHECK(record.time == 1000 * (n + 1));
+        CHECK(record.device == devices[n]);
+        CHECK(record.length == 6);
+        CHECK(std::memcmp(record.report, expected + WII_CAPTURE_OFFSET_REPORT, 22) == 0);
+    }
+
+    CaptureRecord record;
+
+    CHECK(!reader.Next(record));
+}
+
+TEST(CaptureRoundTripManyDevices)
+{
+    std::vector<uint8_t> records;
+
+    uint8_t report[22] = { 0x31, 0x00, 0x08, 0x80, 0x81, 0x82 };
+
+    //
+    // More devices than a session can hold, twice each. The encoder starts new sessions;
+    // the second report of a device must still decode against the first one.
+    //
+
+    unsigned const count = 3 * WII_CAPTURE_MAX_SESSION_DEVICES;
+
+    for (unsigned n = 0; n < 2 * count; ++n)
+    {
+        report[3] = static_cast<uint8_t>(n);
+
+        AddRecord(records, 1000 * (n + 1), (n % count) * 100, report, 6);
+    }
+
+    std::vector<uint8_t> file = Compress(records);
+
+    CaptureReader reader;
+
+    REQUIRE(reader.Open(file.data(), file.size()));
+
+    for (unsigned n = 0; n < 2 * count; ++n)
+    {
+        CaptureRecord record;
+
+        REQUIRE(reader.Next(record));
+
+        uint8_t const* expected = records.data() + n * WII_CAPTURE_RECORD_SIZE;
+
+        CHECK(record.time == 1000 * (n + 1));
+        CHECK(record.device == (n % count) * 100);
+        CHECK(std::memcmp(record.report, expected + WII_CAPTURE_OFFSET_REPORT, 22) == 0);
+    }
+
+    CaptureRecord record;
+
+    CHECK(!reader.Next(record));
+
+    //
+    // A session with one device too many is broken
+    //
+
+    std::vector<uint8_t> broken(file.begin(), file.begin() + WII_CAPTURE_HEADER_SIZE);
+
+    broken.push_back(0x01);
+
+    for (unsigned n = 0; n <= WII_CAPTURE_MAX_SESSION_DEVICES; ++n)
+    {
+        // Device n (as a two byte varint), time stamp delta 0, length 1, report id 0x30
+        uint8_t const next[] = { static_cast<uint8_t>(0x80 | ((n << 2) & 0x7F)), static_cast<uint8_t>(n >> 5), 0x00, 0x01, 0x30 };
+
+        broken.insert(broken.end(), next, next + sizeof(next));
+    }
+
+    REQUIRE(reader.Open(broken.data(), broken.size()));
+
+    for (unsigned n = 0; n < WII_CAPTURE_MAX_SESSION_DEVICES; ++n)
+        REQUIRE(reader.Next(record));
+
+    CHECK(!reader.Next(record));
+}
+
+TEST(CaptureRejectsLargeDeviceId)
+{
+    uint8_t const header[] = { 'W', 'C', 'A', 'P', WII_CAPTURE_VERSION_COMPRESSED, 0, 0, 0 };
+
+    //
+    // A reset followed by a record of device 0x10000 (varint 0x80 0x80 0x10), time stamp
+    // delta 2, length 1, report id 0x30
+    //
+
+    uint8_t const broken[] = { 0x01, 0x80, 0x80, 0x10, 0x04, 0x01, 0x30, 0x00 };
+
+    std::vector<uint8_t> file(header, header + sizeof(header));
+
+    file.insert(file.end(), broken, broken + sizeof(broken));
+
+    CaptureReader reader;
+
+    REQUIRE(reader.Open(file.data(), file.size()));
+
+    CaptureRecord record;
+
+    CHECK(!reader.Next(record));
+
+    // The same record of device 0xFFFF (varint 0xFC 0xFF 0x0F) is fine
+    uint8_t const valid[] = { 0x01, 0xFC, 0xFF, 0x0F, 0x04, 0x01, 0x30, 0x00 };
+
+    file.resize(sizeof(header));
+    file.insert(file.end(), valid, valid + sizeof(valid));
+
+    REQUIRE(reader.Open(file.data(), file.size()));
+    REQUIRE(reader.Next(record));
+
+    CHECK(record.device == 0xFFFF);
+    CHECK(record.time == 2);
+    CHECK(record.report[0] == 0x30);
+}
+
+TEST(CaptureRejectsBrokenMask)
+{
+    //
+    // A reset followed by a record of device 0, time stamp delta 2, report id 0x30 and the
+    // given length, mask and changed bytes
+    //
+
+    // Bytes 1 and 2 of a report of 3 bytes changed
+    CHECK(DecodeRecord({ 0x01, 0x00, 0x04, 0x03, 0x30, 0x03, 0x11, 0x22 }));
+
+    // Bytes 3 and 8 are past the end of the report
+    CHECK(!DecodeRecord({ 0x01, 0x00, 0x04, 0x03, 0x30, 0x04, 0x11 }));
+    CHECK(!DecodeRecord({ 0x01, 0x00, 0x04, 0x03, 0x30, 0x80, 0x11 }));
+
+    // Byte 24 of a report of 22 bytes is past the end of any report
+    CHECK(!DecodeRecord({ 0x01, 0x00, 0x04, 0x16, 0x30, 0x00, 0x00, 0x80, 0x11 }));
+}
+
+TEST(CaptureBrokenIndex)
+{
+    std::vector<uint8_t> file(WII_CAPTURE_HEADER_SIZE);
+
+    std::memcpy(file.data(), WII_CAPTURE_MAGIC, 4);
+    WriteLE16(file.data() + 4, WII_CAPTURE_VERSION);
+    WriteLE16(file.data() + 6, WII_CAPTURE_RECORD_SIZE);
+
+    uint8_t report[22] = { 0x30, 0x00, 0x08 };
+
+    for (unsigned n = 0; n < 3; ++n)
+        AddRecord(file, 1000 * (n + 1), 0, report, 3);
+
+    //
+    // A trailer whose index block is the second record, which is not an index block.
+    // All records must be read as if there was no index.
+    //
+
+    uint8_t trailer[WII_CAPTURE_TRAILER_SIZE] = { 0 };
+
+    WriteLE64(trailer, WII_CAPTURE_HEADER_SIZE + WII_CAPTURE_RECORD_SIZE);
+    std::memcpy(trailer + 12, WII_CAPTURE_TRAILER_MAGIC, 4);
+
+    file.insert(file.end(), trailer, trailer + sizeof(trailer));
+
+    CaptureReader reader;
+
+    REQUIRE(reader.Open(file.data(), file.size()));
+
+    CHECK(!reader.HasIndex());
+
+    CaptureRecord record;
+
+    for (unsigned n = 0; n < 3; ++n)
+    {
+        REQUIRE(reader.Next(record));
+        CHECK(record.time == 1000 * (n + 1));
+    }
+
+    CHECK(!reader.Next(record));
+}
+
+TEST(CaptureAppend)
+{
+    TempFile file;
+
+    REQUIRE(file.Valid());
+
+    //
+    // Every session appends its records in place of the index and writes the index again
+    //
+
+    for (unsigned session = 0; session < 3; ++session)
+    {
+        CaptureWriter capture;
+
+        REQUIRE(capture.Open(file.path, CaptureWriter::Format::Compressed));
+
+        for (unsigned n = 0; n < 5; ++n)
+        {
+            uint8_t report[22];
+            MakeReport(report, static_cast<uint8_t>(5 * session + n));
+
+            capture.Record(100.0 + 5 * session + n, 0, CaptureWriter::Direction::Input, report, sizeof(report));
+        }
+    }
+
+    std::vector<uint8_t> data = file.Read();
+
+    CaptureReader reader;
+
+    REQUIRE(reader.Open(data.data(), data.size()));
+
+    CHECK(reader.HasIndex());
+
+    CaptureRecord record;
+
+    for (unsigned n = 0; n < 15; ++n)
+    {
+        REQUIRE(reader.Next(record));
+        CHECK(record.report[1] == static_cast<uint8_t>(n + 1));
+    }
+
+    CHECK(!reader.Next(record));
+}
+
+TEST(CaptureAppendBrokenIndex)
+{
+    TempFile file;
+
+    REQUIRE(file.Valid());
+
+    std::vector<uint8_t> data(WII_CAPTURE_HEADER_SIZE);
+
+    std::memcpy(data.data(), WII_CAPTURE_MAGIC, 4);
+    WriteLE16(data.data() + 4, WII_CAPTURE_VERSION);
+    WriteLE16(data.data() + 6, WII_CAPTURE_RECORD_SIZE);
+
+    uint8_t report[22] = { 0x30, 0x00, 0x08 };
+
+    for (unsigned n = 0; n < 3; ++n)
+        AddRecord(data, 1000 * (n + 1), 0, report, 3);
+
+    // A trailer pointing at the second record (see CaptureBrokenIndex)
+    uint8_t trailer[WII_CAPTURE_TRAILER_SIZE] = { 0 };
+
+    WriteLE64(trailer, WII_CAPTURE_HEADER_SIZE + WII_CAPTURE_RECORD_SIZE);
+    std::memcpy(trailer + 12, WII_CAPTURE_TRAILER_MAGIC, 4);
+
+    data.insert(data.end(), trailer, trailer + sizeof(trailer));
+
+    REQUIRE(file.Write(data));
+
+    //
+    // Appending in place of the index would overwrite records which can be read, and
+    // appending behind it would leave the trailer in the middle of the file
+    //
+
+    CaptureWriter capture;
+
+    CHECK(!capture.Open(file.path));
+    CHECK(!capture.IsOpen());
+
+    CHECK(file.Read() == data);
+}
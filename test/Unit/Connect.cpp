@@ -0,0 +1,124 @@
+// This file is distributed under the MIT license.
+// See the LICENSE file for details.
+
+#include "Test.h"
+#include "FakeTree.h"
+
+#ifndef _WIN32
+
+#include "Wiimote/Wiimote.h"
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace wii;
+
+//--------------------------------------------------------------------------------------------------
+// Connect() against a fake /dev and /sys tree
+//--------------------------------------------------------------------------------------------------
+
+TEST(ConnectKeepsNodeOrder)
+{
+    FakeTree tree;
+
+    REQUIRE(!tree.root.empty());
+
+    //
+    // Wiimotes and keyboards. hidraw10 comes after hidraw2.
+    //
+
+    char const* const wiimoteNodes[] = { "hidraw0", "hidraw2", "hidraw10", "hidraw11" };
+
+    for (auto node : wiimoteNodes)
+        REQUIRE(tree.AddNode(node, 0x057E, 0x0306));
+
+    REQUIRE(tree.AddNode("hidraw1", 0x046D, 0xC31C));
+    REQUIRE(tree.AddNode("hidraw3", 0x046D, 0xC31C));
+
+    //
+    // The first Wiimote answers last: its uevent is a FIFO which is only written after all
+    // other probes have completed.
+    //
+
+    std::string uevent = tree.sys + "/hidraw0/device/uevent";
+
+    REQUIRE(unlink(uevent.c_str()) == 0);
+    REQUIRE(mkfifo(uevent.c_str(), 0600) == 0);
+
+    std::thread slow([&]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+        int fd = open(uevent.c_str(), O_WRONLY);
+
+        if (fd < 0)
+            return;
+
+        char const text[] = "HID_ID=0005:0000057E:00000306\n";
+
+        ssize_t written = write(fd, text, sizeof(text) - 1);
+        static_cast<void>(written);
+
+        close(fd);
+    });
+
+    Wiimote wiimotes[3];
+
+    unsigned count = 3;
+
+    bool connected = Wiimote::Connect(wiimotes, count, tree.dev.c_str(), tree.sys.c_str());
+
+    slow.join();
+
+    REQUIRE(connected);
+    REQUIRE(count == 3);
+
+    //
+    // Tell the Wiimotes apart by what they write to their nodes
+    //
+
+    unsigned const leds[] = { State::LED1, State::LED2, State::LED3 };
+
+    for (unsigned n = 0; n < 3; ++n)
+        CHECK(wiimotes[n].SetLEDs(leds[n]));
+
+    for (unsigned n = 0; n < 3; ++n)
+    {
+        std::vector<uint8_t> written = tree.Written(wiimoteNodes[n]);
+
+        CHECK(written.size() == 2 && written[0] == 0x11 && written[1] == leds[n]);
+    }
+
+    // The fourth Wiimote has not been connected
+    CHECK(tree.Written(wiimoteNodes[3]).empty());
+
+    for (auto& wiimote : wiimotes)
+        wiimote.Disconnect();
+}
+
+TEST(ConnectIgnoresStandInsWithoutSysRoot)
+{
+    FakeTree tree;
+
+    REQUIRE(!tree.root.empty());
+    REQUIRE(tree.AddNode("hidraw0", 0x057E, 0x0306));
+
+    //
+    // Without a sysfs root, only real hidraw devices count -- the FIFO is no Wiimote
+    //
+
+    Wiimote wiimote;
+
+    unsigned count = 1;
+
+    REQUIRE(Wiimote::Connect(&wiimote, count, tree.dev.c_str(), nullptr));
+
+    CHECK(count == 0);
+    CHECK(tree.Written("hidraw0").empty());
+}
+
+#endif
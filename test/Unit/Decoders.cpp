@@ -0,0 +1,304 @@
+// This file is distributed under the MIT license.
+// See the LICENSE file for details.
+
+#include "Test.h"
+
+#include "Wiimote/Transport.h"
+
+#include "Data.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <vector>
+
+using namespace wii;
+
+//--------------------------------------------------------------------------------------------------
+// Specialized report decoders (GetReportDecoder())
+//--------------------------------------------------------------------------------------------------
+
+namespace
+{
+
+// Decodes a data report the way ProcessReport did before the decoders were specialized
+void DecodeSwitch(State& state, uint8_t const* buf, CalibrationTables const* tables)
+{
+    switch (buf[0])
+    {
+    case 0x30: // Buttons
+        ParseButtons(state, buf + 1);
+        break;
+
+    case 0x31: // ButtonsAccel
+        ParseButtons(state, buf + 1);
+        ParseAccel(state, buf + 1, tables);
+        break;
+
+    case 0x32: // ButtonsExt
+        ParseButtons(state, buf + 1);
+        ParseExtension(state, buf + 3, tables);
+        break;
+
+    case 0x33: // ButtonsAccelIR (12 IR bytes)
+        ParseButtons(state, buf + 1);
+        ParseAccel(state, buf + 1, tables);
+        ParseIR(state, buf + 6);
+        break;
+
+    case 0x35: // ButtonsAccelExt
+        ParseButtons(state, buf + 1);
+        ParseAccel(state, buf + 1, tables);
+        ParseExtension(state, buf + 6, tables);
+        break;
+
+    case 0x36: // ButtonsIRExt (10 IR bytes)
+        ParseButtons(state, buf + 1);
+        ParseIR(state, buf + 3);
+        ParseExtension(state, buf + 13, tables);
+        break;
+
+    case 0x37: // ButtonsAccelIRExt (10 IR bytes)
+        ParseButtons(state, buf + 1);
+        ParseAccel(state, buf + 1, tables);
+        ParseIR(state, buf + 6);
+        ParseExtension(state, buf + 16, tables);
+        break;
+    }
+}
+
+// Prepare a state for decoding reports in the given IR mode and with the given extension.
+// With tables, the Wiimote, Nunchuk and classic controller are calibrated.
+void InitState(State& state, IRData::Mode mode, unsigned extension, CalibrationTables* tables)
+{
+    std::memset(&state, 0, sizeof(state));
+
+    state.ir.mode = mode;
+    state.extension.type = extension;
+
+    if (tables == nullptr)
+        return;
+
+    uint8_t const accel[] = { 0x80, 0x7E, 0x82, 0x1B, 0x9A, 0x99, 0x9C, 0x26 };
+    uint8_t const nunchuk[] = { 0x7D, 0x81, 0x7F, 0x2D, 0xB1, 0xB2, 0xB0, 0x1E, 0xE4, 0x1D, 0x7E, 0xE1, 0x20, 0x84 };
+    uint8_t const classic[] = { 0xF8, 0x08, 0x80, 0xF4, 0x0C, 0x7E, 0xE0, 0x18, 0x81, 0xE6, 0x1A, 0x7F };
+
+    ParseCalibrationData(state, accel, sizeof(accel), 0, tables);
+
+    if ((extension & ~Extension::MotionPlus) == Extension::Nunchuk)
+        ParseNunchukCalibrationData(state, nunchuk, sizeof(nunchuk), 0, tables);
+    else if ((extension & ~Extension::MotionPlus) == Extension::ClassicController)
+        ParseClassicControllerCalibrationData(state, classic, sizeof(classic), 0, tables);
+}
+
+// Passes the reports of another transport through, after any injected reports
+class InjectingTransport : public Transport
+{
+    std::unique_ptr<Transport> inner;
+    std::deque<std::vector<uint8_t>> injected;
+
+public:
+    explicit InjectingTransport(std::unique_ptr<Transport> inner)
+        : inner(std::move(inner))
+        , injected()
+    {
+    }
+
+    // Inject a report with the given id and random data.
+    // Returns the report, which stays valid until it has been read.
+    uint8_t const* Inject(uint8_t id)
+    {
+        std::vector<uint8_t> report(22);
+
+        report[0] = id;
+
+        for (unsigned i = 1; i < 22; ++i)
+            report[i] = static_cast<uint8_t>(std::rand());
+
+        injected.push_back(report);
+
+        return injected.back().data();
+    }
+
+    virtual Result Read(uint8_t* report, double& time, int64_t timeout) override
+    {
+        if (injected.empty())
+            return inner->Read(report, time, timeout);
+
+        std::memcpy(report, injected.front().data(), 22);
+        injected.pop_front();
+
+        time = GetTime();
+
+        return Result::OK;
+    }
+
+    virtual bool Write(uint8_t const* report, unsigned len) override
+    {
+        return inner->Write(report, len);
+    }
+};
+
+} // namespace
+
+TEST(ReportDecodersMatchParse)
+{
+    unsigned const ids[] = { 0x30, 0x31, 0x32, 0x33, 0x35, 0x36, 0x37 };
+    IRData::Mode const modes[] = { IRData::Mode::Off, IRData::Mode::Basic, IRData::Mode::Extended };
+    unsigned const extensions[] = {
+        0,
+        Extension::Nunchuk,
+        Extension::ClassicController,
+        Extension::MotionPlus,
+        Extension::MotionPlus | Extension::Nunchuk,
+        Extension::MotionPlus | Extension::ClassicController,
+        0x0004, // Unknown: the extension data is ignored
+    };
+
+    size_t const count = 256;
+
+    std::vector<uint8_t> reports(count * 22);
+
+    std::srand(1);
+
+    //
+    // Every combination decodes the same random reports to the same state as the Parse*
+    // functions -- with and without calibration tables -- whether or not the report carries
+    // IR or extension data
+    //
+
+    CalibrationTables tables;
+
+    for (unsigned id : ids)
+    {
+        for (IRData::Mode mode : modes)
+        {
+            for (unsigned extension : extensions)
+            {
+                for (size_t i = 0; i < reports.size(); ++i)
+                    reports[i] = static_cast<uint8_t>(std::rand());
+
+                for (size_t i = 0; i < count; ++i)
+                    reports[i * 22] = static_cast<uint8_t>(id);
+
+                ReportDecoder decoder = GetReportDecoder(id, mode, extension);
+
+                REQUIRE(decoder != nullptr);
+
+                for (int calibrated = 0; calibrated < 2; ++calibrated)
+                {
+                    CalibrationTables* t = calibrated ? &tables : nullptr;
+
+                    State a;
+                    State b;
+
+                    InitState(a, mode, extension, t);
+                    InitState(b, mode, extension, t);
+
+                    unsigned mismatches = 0;
+
+                    for (size_t i = 0; i < count; ++i)
+                    {
+                        DecodeSwitch(a, &reports[i * 22], t);
+                        decoder(b, &reports[i * 22], t);
+
+                        if (std::memcmp(&a, &b, sizeof(State)) != 0)
+                            mismatches++;
+                    }
+
+                    CHECK(mismatches == 0);
+                }
+            }
+        }
+    }
+
+    // Only data reports have a decoder
+    CHECK(GetReportDecoder(0x20, IRData::Mode::Off, 0) == nullptr);
+    CHECK(GetReportDecoder(0x21, IRData::Mode::Off, 0) == nullptr);
+    CHECK(GetReportDecoder(0x22, IRData::Mode::Off, 0) == nullptr);
+    CHECK(GetReportDecoder(0x34, IRData::Mode::Off, 0) == nullptr);
+}
+
+TEST(ReportDecoderFollowsModeAndExtension)
+{
+    InjectingTransport* transport = new InjectingTransport(CreateLoopbackTransport(Extension::Nunchuk));
+
+    Wiimote wiimote;
+
+    REQUIRE(wiimote.Connect(std::unique_ptr<Transport>(transport)));
+    REQUIRE(wiimote.SetReportMode(Wiimote::ReportMode::ButtonsAccelIRExt));
+
+    std::srand(2);
+
+    //
+    // Data reports which arrive before the Nunchuk has been identified are decoded without
+    // extension data. The decoder cached for them must be looked up again once the
+    // extension is known.
+    //
+
+    for (unsigned n = 0; n < 3; ++n)
+        transport->Inject(0x37);
+
+    unsigned early = 0;
+    unsigned late = 0;
+
+    for (unsigned n = 0; n < 1000 && late < 10; ++n)
+    {
+        if (wiimote.Poll(std::chrono::microseconds(0)) != Wiimote::PollResult::Report)
+            continue;
+
+        State const& state = wiimote.GetState();
+
+        if ((state.data & State::Accel) == 0)
+            continue;
+
+        CHECK((state.data & State::IR) != 0);
+
+        if (state.extension.type == 0)
+        {
+            CHECK((state.data & State::Nunchuk) == 0);
+            early++;
+        }
+        else
+        {
+            CHECK(state.extension.type == Extension::Nunchuk);
+            CHECK((state.data & State::Nunchuk) != 0);
+            late++;
+        }
+    }
+
+    CHECK(early == 3);
+    CHECK(late == 10);
+
+    //
+    // A report of the old report mode which arrives after the IR mode has changed is
+    // decoded in the new IR mode
+    //
+
+    REQUIRE(wiimote.SetReportMode(Wiimote::ReportMode::ButtonsAccelIR));
+    REQUIRE(wiimote.GetState().ir.mode == IRData::Mode::Extended);
+
+    uint8_t const* report = transport->Inject(0x37);
+
+    State expected;
+
+    InitState(expected, IRData::Mode::Extended, 0, nullptr);
+    ParseIR(expected, report + 6);
+
+    REQUIRE(wiimote.Poll(std::chrono::microseconds(0)) == Wiimote::PollResult::Report);
+
+    State const& state = wiimote.GetState();
+
+    CHECK((state.data & State::Nunchuk) != 0);
+
+    for (unsigned n = 0; n < 4; ++n)
+    {
+        CHECK(state.ir.dots[n].visible == expected.ir.dots[n].visible);
+        CHECK(state.ir.dots[n].raw.x == expected.ir.dots[n].raw.x);
+        CHECK(state.ir.dots[n].raw.y == expected.ir.dots[n].raw.y);
+        CHECK(state.ir.dots[n].size == expected.ir.dots[n].size);
+    }
+
+    wiimote.Disconnect();
+}
@@ -0,0 +1,123 @@
+// This file is distributed under the MIT license.
+// See the LICENSE file for details.
+
+#pragma once
+
+#ifndef _WIN32
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <ftw.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+//--------------------------------------------------------------------------------------------------
+// A fake /dev and /sys tree
+//--------------------------------------------------------------------------------------------------
+
+//
+// A temporary directory with a dev/ and a sys/ subdirectory.
+// Device nodes are FIFOs, so that everything written to a node can be read back;
+// their sysfs attributes live in sys/<name>/device/uevent.
+//
+struct FakeTree
+{
+    std::string root;
+    std::string dev;
+    std::string sys;
+
+    FakeTree()
+        : root()
+        , dev()
+        , sys()
+    {
+        char path[] = "/tmp/wiimote-tree-XXXXXX";
+
+        if (mkdtemp(path) == nullptr)
+            return;
+
+        root = path;
+        dev = root + "/dev";
+        sys = root + "/sys";
+
+        mkdir(dev.c_str(), 0700);
+        mkdir(sys.c_str(), 0700);
+    }
+
+    ~FakeTree()
+    {
+        if (!root.empty())
+            nftw(root.c_str(), Remove, 16, FTW_DEPTH | FTW_PHYS);
+    }
+
+    static int Remove(char const* path, struct stat const*, int, FTW*)
+    {
+        remove(path);
+        return 0;
+    }
+
+    // Add a device node with the given vendor and product id
+    bool AddNode(char const* name, unsigned vendor, unsigned product)
+    {
+        return AddEntry(name, vendor, product) && mkfifo((dev + "/" + name).c_str(), 0600) == 0;
+    }
+
+    // Add another name for an existing device node
+    bool AddAlias(char const* name, char const* target, unsigned vendor, unsigned product)
+    {
+        return AddEntry(name, vendor, product) && link((dev + "/" + target).c_str(), (dev + "/" + name).c_str()) == 0;
+    }
+
+    // Add the sysfs entry of a device node
+    bool AddEntry(char const* name, unsigned vendor, unsigned product)
+    {
+        std::string dir = sys + "/" + name;
+
+        mkdir(dir.c_str(), 0700);
+        mkdir((dir + "/device").c_str(), 0700);
+
+        FILE* file = fopen((dir + "/device/uevent").c_str(), "w");
+
+        if (file == nullptr)
+            return false;
+
+        fprintf(file, "DRIVER=hid-generic\nHID_ID=0005:%08X:%08X\nHID_NAME=Fake\n", vendor, product);
+        fclose(file);
+
+        return true;
+    }
+
+    // Remove the device node -- the sysfs entry is left alone
+    bool RemoveNode(char const* name)
+    {
+        return unlink((dev + "/" + name).c_str()) == 0;
+    }
+
+    // Read back everything written to the given node
+    std::vector<uint8_t> Written(char const* name)
+    {
+        std::vector<uint8_t> data;
+
+        int fd = open((dev + "/" + name).c_str(), O_RDONLY | O_NONBLOCK);
+
+        if (fd < 0)
+            return data;
+
+        uint8_t buf[256];
+        ssize_t len;
+
+        while ((len = read(fd, buf, sizeof(buf))) > 0)
+            data.insert(data.end(), buf, buf + len);
+
+        close(fd);
+
+        return data;
+    }
+};
+
+#endif
@@ -0,0 +1,304 @@
+// This file is distributed under the MIT license.
+// See the LICENSE file for details.
+
+#include "Test.h"
+
+#ifndef _WIN32
+
+#include "Wiimote/Transport.h"
+
+#include <atomic>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+
+#include <pthread.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace wii;
+
+//--------------------------------------------------------------------------------------------------
+// The hidraw transport against socketpair and pipe stand-ins
+//--------------------------------------------------------------------------------------------------
+
+namespace
+{
+
+// A transport whose device is one end of a SOCK_SEQPACKET socketpair.
+// The other end plays the device.
+struct SocketDevice
+{
+    std::unique_ptr<Transport> transport;
+    int peer;
+
+    SocketDevice()
+        : transport()
+        , peer(-1)
+    {
+        int fds[2];
+
+        if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds) < 0)
+            return;
+
+        transport = CreateHidrawTransport(fds[0]);
+        peer = fds[1];
+    }
+
+    ~SocketDevice()
+    {
+        if (peer >= 0)
+            close(peer);
+    }
+};
+
+// Does nothing; interrupts system calls
+void Interrupt(int)
+{
+}
+
+} // namespace
+
+TEST(HidrawReadReport)
+{
+    SocketDevice dev;
+
+    REQUIRE(dev.transport != nullptr);
+
+    uint8_t sent[22];
+    MakeReport(sent, 7);
+
+    double before = GetTime();
+
+    REQUIRE(write(dev.peer, sent, sizeof(sent)) == static_cast<ssize_t>(sizeof(sent)));
+
+    uint8_t report[22] = {0};
+    double time = -1.0;
+
+    CHECK(dev.transport->Read(report, time, -1) == Transport::Result::OK);
+    CHECK(std::memcmp(report, sent, sizeof(sent)) == 0);
+
+    // The report is stamped with the receive time
+    CHECK(time >= before - 0.001 && time <= GetTime() + 0.001);
+}
+
+TEST(HidrawReadShortReport)
+{
+    SocketDevice dev;
+
+    REQUIRE(dev.transport != nullptr);
+
+    // A status request acknowledgement is shorter than 22 bytes
+    uint8_t sent[4] = { 0x22, 0x00, 0x00, 0x15 };
+
+    REQUIRE(write(dev.peer, sent, sizeof(sent)) == static_cast<ssize_t>(sizeof(sent)));
+
+    uint8_t report[22] = {0};
+    double time = 0.0;
+
+    CHECK(dev.transport->Read(report, time, 100000) == Transport::Result::OK);
+    CHECK(std::memcmp(report, sent, sizeof(sent)) == 0);
+    CHECK(report[4] == 0);
+}
+
+TEST(HidrawReadInOrder)
+{
+    SocketDevice dev;
+
+    REQUIRE(dev.transport != nullptr);
+
+    for (uint8_t n = 0; n < 16; ++n)
+    {
+        uint8_t sent[22];
+        MakeReport(sent, n);
+
+        REQUIRE(write(dev.peer, sent, sizeof(sent)) == static_cast<ssize_t>(sizeof(sent)));
+    }
+
+    for (uint8_t n = 0; n < 16; ++n)
+    {
+        uint8_t expected[22];
+        MakeReport(expected, n);
+
+        uint8_t report[22] = {0};
+        double time = 0.0;
+
+        CHECK(dev.transport->Read(report, time, 0) == Transport::Result::OK);
+        CHECK(std::memcmp(report, expected, sizeof(expected)) == 0);
+    }
+}
+
+TEST(HidrawReadTimeout)
+{
+    SocketDevice dev;
+
+    REQUIRE(dev.transport != nullptr);
+
+    uint8_t report[22];
+    double time = 0.0;
+
+    // A zero timeout never blocks
+    double start = GetTime();
+
+    CHECK(dev.transport->Read(report, time, 0) == Transport::Result::Timeout);
+    CHECK(GetTime() - start < 0.05);
+
+    // A finite timeout waits (about) that long
+    start = GetTime();
+
+    CHECK(dev.transport->Read(report, time, 20000) == Transport::Result::Timeout);
+
+    double elapsed = GetTime() - start;
+
+    CHECK(elapsed >= 0.019);
+    CHECK(elapsed < 0.5);
+}
+
+TEST(HidrawReadTimeoutInterrupted)
+{
+    SocketDevice dev;
+
+    REQUIRE(dev.transport != nullptr);
+
+    //
+    // Signals interrupt the wait every 10 ms -- well before the timeout. They must not
+    // start the timeout over.
+    //
+
+    struct sigaction action;
+    struct sigaction previous;
+
+    std::memset(&action, 0, sizeof(action));
+    action.sa_handler = &Interrupt;
+
+    REQUIRE(sigaction(SIGUSR1, &action, &previous) == 0);
+
+    pthread_t reader = pthread_self();
+    std::atomic<bool> done(false);
+
+    std::thread interrupter([&]() {
+        for (unsigned n = 0; n < 100 && !done; ++n)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            pthread_kill(reader, SIGUSR1);
+        }
+    });
+
+    uint8_t report[22];
+    double time = 0.0;
+
+    double start = GetTime();
+
+    CHECK(dev.transport->Read(report, time, 50000) == Transport::Result::Timeout);
+
+    double elapsed = GetTime() - start;
+
+    done = true;
+    interrupter.join();
+
+    sigaction(SIGUSR1, &previous, nullptr);
+
+    CHECK(elapsed >= 0.049);
+    CHECK(elapsed < 0.5);
+}
+
+TEST(HidrawReadWakesUp)
+{
+    SocketDevice dev;
+
+    REQUIRE(dev.transport != nullptr);
+
+    // Nothing there yet: time out
+    uint8_t report[22];
+    double time = 0.0;
+
+    CHECK(dev.transport->Read(report, time, 1000) == Transport::Result::Timeout);
+
+    // The next report ends a long wait right away
+    uint8_t sent[22];
+    MakeReport(sent, 3);
+
+    REQUIRE(write(dev.peer, sent, sizeof(sent)) == static_cast<ssize_t>(sizeof(sent)));
+
+    double start = GetTime();
+
+    CHECK(dev.transport->Read(report, time, 5000000) == Transport::Result::OK);
+    CHECK(GetTime() - start < 1.0);
+    CHECK(std::memcmp(report, sent, sizeof(sent)) == 0);
+}
+
+TEST(HidrawWrite)
+{
+    SocketDevice dev;
+
+    REQUIRE(dev.transport != nullptr);
+
+    uint8_t leds[2] = { 0x11, 0x10 };
+
+    CHECK(dev.transport->Write(leds, sizeof(leds)));
+
+    uint8_t packet[32];
+
+    CHECK(read(dev.peer, packet, sizeof(packet)) == 2);
+    CHECK(packet[0] == 0x11 && packet[1] == 0x10);
+}
+
+TEST(HidrawError)
+{
+    SocketDevice dev;
+
+    REQUIRE(dev.transport != nullptr);
+
+    // Reports sent before the device went away are still delivered
+    uint8_t sent[22];
+    MakeReport(sent, 1);
+
+    REQUIRE(write(dev.peer, sent, sizeof(sent)) == static_cast<ssize_t>(sizeof(sent)));
+
+    close(dev.peer);
+    dev.peer = -1;
+
+    uint8_t report[22];
+    double time = 0.0;
+
+    CHECK(dev.transport->Read(report, time, 0) == Transport::Result::OK);
+
+    // Then the link is broken -- whatever the timeout
+    CHECK(dev.transport->Read(report, time, 0) == Transport::Result::Error);
+    CHECK(dev.transport->Read(report, time, -1) == Transport::Result::Error);
+
+    uint8_t leds[2] = { 0x11, 0x10 };
+
+    CHECK(!dev.transport->Write(leds, sizeof(leds)));
+}
+
+TEST(HidrawPipe)
+{
+    int fds[2];
+
+    REQUIRE(pipe(fds) == 0);
+
+    std::unique_ptr<Transport> transport = CreateHidrawTransport(fds[0]);
+
+    REQUIRE(transport != nullptr);
+
+    uint8_t sent[22];
+    MakeReport(sent, 5);
+
+    REQUIRE(write(fds[1], sent, sizeof(sent)) == static_cast<ssize_t>(sizeof(sent)));
+
+    uint8_t report[22] = {0};
+    double time = 0.0;
+
+    CHECK(transport->Read(report, time, 100000) == Transport::Result::OK);
+    CHECK(std::memcmp(report, sent, sizeof(sent)) == 0);
+    CHECK(transport->Read(report, time, 1000) == Transport::Result::Timeout);
+
+    // Closing the writing end breaks the link
+    close(fds[1]);
+
+    CHECK(transport->Read(report, time, 100000) == Transport::Result::Error);
+}
+
+#endif
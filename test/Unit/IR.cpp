@@ -0,0 +1,259 @@
+// This file is distributed under the MIT license.
+// See the LICENSE file for details.
+
+#include "Test.h"
+
+#include "IR.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+using namespace wii;
+
+//--------------------------------------------------------------------------------------------------
+// IR unpacking (UnpackIR(), NormalizeIR()) against the scalar code ParseIR used before
+//--------------------------------------------------------------------------------------------------
+
+//
+// NOTE: There is no Full mode: ParseIR never decoded it (it needs two interleaved reports),
+// and IRData::Mode has no such mode.
+//
+
+namespace
+{
+
+// Normalizes the dots and checks their visibility the way ParseIR did
+void NormalizeReference(IRData& ir)
+{
+    for (auto& dot : ir.dots)
+    {
+        dot.normalized.x = dot.raw.x / 1023.0f;
+        dot.normalized.y = dot.raw.y /  767.0f;
+
+        dot.visible = dot.raw.x != 0x3FF && dot.raw.y != 0x3FF;
+    }
+}
+
+// Unpacks Basic mode IR data the way ParseIR did (including the byte 5 quirk)
+void UnpackBasicReference(IRData& ir, uint8_t const* buf)
+{
+    ir.dots[0].raw.x = buf[0] | ((buf[2] & 0x30) << 4);
+    ir.dots[0].raw.y = buf[1] | ((buf[2] & 0xC0) << 2);
+    ir.dots[1].raw.x = buf[3] | ((buf[2] & 0x03) << 8);
+    ir.dots[1].raw.y = buf[4] | ((buf[2] & 0x0C) << 6);
+    ir.dots[2].raw.x = buf[5] | ((buf[5] & 0x30) << 4);
+    ir.dots[2].raw.y = buf[6] | ((buf[5] & 0xC0) << 2);
+    ir.dots[3].raw.x = buf[8] | ((buf[5] & 0x03) << 8);
+    ir.dots[3].raw.y = buf[9] | ((buf[5] & 0x0C) << 6);
+
+    for (auto& dot : ir.dots)
+        dot.size = 0;
+
+    NormalizeReference(ir);
+}
+
+// Unpacks Extended mode IR data the way ParseIR did
+void UnpackExtendedReference(IRData& ir, uint8_t const* buf)
+{
+    for (unsigned n = 0; n < 4; ++n, buf += 3)
+    {
+        ir.dots[n].raw.x = buf[0] | ((buf[2] & 0x30) << 4);
+        ir.dots[n].raw.y = buf[1] | ((buf[2] & 0xC0) << 2);
+        ir.dots[n].size = buf[2] & 0x0F;
+    }
+
+    NormalizeReference(ir);
+}
+
+// Compare the dots -- the normalized positions bit for bit
+void CheckDots(IRData const& a, IRData const& b)
+{
+    for (unsigned n = 0; n < 4; ++n)
+    {
+        IRData::Dot const& p = a.dots[n];
+        IRData::Dot const& q = b.dots[n];
+
+        CHECK(p.raw.x == q.raw.x);
+        CHECK(p.raw.y == q.raw.y);
+        CHECK(p.size == q.size);
+        CHECK(p.visible == q.visible);
+        CHECK(std::memcmp(&p.normalized, &q.normalized, sizeof(p.normalized)) == 0);
+    }
+}
+
+// Unpack the 12 bytes of IR data with UnpackIR and the reference code
+template <IRData::Mode Mode>
+void CheckUnpack(uint8_t const (&buf)[12], void (*reference)(IRData&, uint8_t const*))
+{
+    IRData a;
+    IRData b;
+
+    std::memset(&a, 0, sizeof(a));
+    std::memset(&b, 0, sizeof(b));
+
+    reference(a, buf);
+    UnpackIR<Mode>(b, buf);
+
+    CheckDots(a, b);
+}
+
+// Check the IR data of both modes
+void CheckUnpack(uint8_t const (&buf)[12])
+{
+    CheckUnpack<IRData::Mode::Basic>(buf, &UnpackBasicReference);
+    CheckUnpack<IRData::Mode::Extended>(buf, &UnpackExtendedReference);
+}
+
+} // namespace
+
+TEST(UnpackIRMatchesParseIR)
+{
+    uint8_t buf[12];
+
+    //
+    // Random IR data
+    //
+
+    std::srand(1);
+
+    for (unsigned i = 0; i < 10000; ++i)
+    {
+        for (auto& b : buf)
+            b = static_cast<uint8_t>(std::rand());
+
+        CheckUnpack(buf);
+    }
+
+    //
+    // Off-screen dots: all bits set marks a dot which is not visible -- alone, in pairs and
+    // when only one of its coordinates is 0x3FF
+    //
+
+    std::memset(buf, 0xFF, sizeof(buf));
+    CheckUnpack(buf);
+
+    for (unsigned i = 0; i < 12; ++i)
+    {
+        std::memset(buf, 0xFF, sizeof(buf));
+        buf[i] = 0x00;
+        CheckUnpack(buf);
+
+        std::memset(buf, 0x00, sizeof(buf));
+        buf[i] = 0xFF;
+        CheckUnpack(buf);
+    }
+
+    // Dot 0 at x = 0x3FF, y = 0 in Basic mode: invisible
+    uint8_t const offscreenX[12] = { 0xFF, 0x00, 0x30, 0x10, 0x20, 0x00, 0x40, 0x00, 0x50, 0x60, 0x00, 0x00 };
+
+    CheckUnpack(offscreenX);
+
+    IRData ir;
+
+    UnpackIR<IRData::Mode::Basic>(ir, offscreenX);
+
+    CHECK(ir.dots[0].raw.x == 0x3FF);
+    CHECK(!ir.dots[0].visible);
+    CHECK(ir.dots[1].visible);
+
+    //
+    // The byte 5 quirk: in Basic mode, dots 2 and 3 take their high bits from byte 5 (the low
+    // x bits of dot 2), not from byte 7. Byte 7 never matters.
+    //
+
+    uint8_t quirk[12] = { 0x00, 0x00, 0x00, 0x00, 0x00, 0xA5, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
+
+    CheckUnpack(quirk);
+
+    UnpackIR<IRData::Mode::Basic>(ir, quirk);
+
+    CHECK(ir.dots[2].raw.x == (0xA5 | (0x20 << 4)));
+    CHECK(ir.dots[2].raw.y == (0x00 | (0x80 << 2)));
+    CHECK(ir.dots[3].raw.x == (0x00 | (0x01 << 8)));
+    CHECK(ir.dots[3].raw.y == (0x00 | (0x04 << 6)));
+
+    quirk[7] = 0xFF;
+
+    CheckUnpack(quirk);
+
+    IRData other;
+
+    UnpackIR<IRData::Mode::Basic>(other, quirk);
+
+    CheckDots(ir, other);
+}
+
+TEST(NormalizeIRMatchesParseIR)
+{
+    //
+    // Counts which are not a multiple of the vector width leave a scalar tail
+    //
+
+    size_t const counts[] = { 0, 1, 7, 8, 9, 61, 256 };
+
+    std::srand(2);
+
+    for (size_t count : counts)
+    {
+        std::vector<uint16_t> x[4];
+        std::vector<uint16_t> y[4];
+        std::vector<float> nx[4];
+        std::vector<float> ny[4];
+        std::vector<uint8_t> visible(count + 1, 0xEE);
+
+        uint16_t const* px[4];
+        uint16_t const* py[4];
+        float* pnx[4];
+        float* pny[4];
+
+        for (unsigned n = 0; n < 4; ++n)
+        {
+            for (size_t i = 0; i < count; ++i)
+            {
+                x[n].push_back((std::rand() & 7) == 0 ? 0x3FF : static_cast<uint16_t>(std::rand() & 0x3FF));
+                y[n].push_back((std::rand() & 7) == 0 ? 0x3FF : static_cast<uint16_t>(std::rand() & 0x3FF));
+            }
+
+            nx[n].resize(count);
+            ny[n].resize(count);
+
+            px[n] = x[n].data();
+            py[n] = y[n].data();
+            pnx[n] = nx[n].data();
+            pny[n] = ny[n].data();
+        }
+
+        NormalizeIR(px, py, pnx, pny, visible.data(), count);
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            IRData ir;
+
+            std::memset(&ir, 0, sizeof(ir));
+
+            for (unsigned n = 0; n < 4; ++n)
+            {
+                ir.dots[n].raw.x = x[n][i];
+                ir.dots[n].raw.y = y[n][i];
+            }
+
+            NormalizeReference(ir);
+
+            unsigned bits = 0;
+
+            for (unsigned n = 0; n < 4; ++n)
+            {
+                CHECK(std::memcmp(&nx[n][i], &ir.dots[n].normalized.x, sizeof(float)) == 0);
+                CHECK(std::memcmp(&ny[n][i], &ir.dots[n].normalized.y, sizeof(float)) == 0);
+
+                bits |= ir.dots[n].visible ? 1u << n : 0u;
+            }
+
+            CHECK(visible[i] == bits);
+        }
+
+        // Nothing is written past the end
+        CHECK(visible[count] == 0xEE);
+    }
+}
@@ -0,0 +1,387 @@
+// This file is distributed under the MIT license.
+// See the LICENSE file for details.
+
+#include "Test.h"
+
+#ifndef _WIN32
+
+#include "Wiimote/Capture.h"
+
+#include "Capture.h"
+
+#include <cmath>
+#include <csignal>
+#include <cstring>
+#include <vector>
+
+#include <sys/resource.h>
+
+using namespace wii;
+
+//--------------------------------------------------------------------------------------------------
+// Importing Bluetooth traces (ImportTrace())
+//--------------------------------------------------------------------------------------------------
+
+namespace
+{
+
+// Direction of an HCI packet as seen by the host
+enum : unsigned {
+    Sent        = 0,
+    Received    = 1,
+};
+
+// H4 packet types
+enum : unsigned {
+    Acl         = 0x02,
+    Event       = 0x04,
+};
+
+// Microseconds from 0 AD to 1970 (btsnoop time stamps)
+uint64_t const btsnoopEpoch = 0x00DCDDB30F2F8000ull;
+
+// An HCI packet of a trace
+struct Packet
+{
+    // Time stamp in seconds
+    double time;
+    unsigned direction;
+    // H4 packet type
+    unsigned type;
+    // The packet without the H4 packet type
+    std::vector<uint8_t> data;
+};
+
+// A report the import must find
+struct Expected
+{
+    double time;
+    CaptureWriter::Direction direction;
+    std::vector<uint8_t> report;
+};
+
+void AppendLE(std::vector<uint8_t>& out, uint64_t n, unsigned bytes)
+{
+    for (unsigned i = 0; i < bytes; ++i)
+        out.push_back(static_cast<uint8_t>(n >> (8 * i)));
+}
+
+void AppendBE(std::vector<uint8_t>& out, uint64_t n, unsigned bytes)
+{
+    for (unsigned i = bytes; i > 0; --i)
+        out.push_back(static_cast<uint8_t>(n >> (8 * (i - 1))));
+}
+
+// ACL connection handle of the Wiimote
+unsigned const handle = 0x000B;
+
+// An ACL packet with the given packet boundary flag and payload
+Packet AclPacket(double time, unsigned direction, unsigned boundary, std::vector<uint8_t> const& payload)
+{
+    Packet packet = { time, direction, Acl, {} };
+
+    AppendLE(packet.data, handle | boundary << 12, 2);
+    AppendLE(packet.data, payload.size(), 2);
+
+    packet.data.insert(packet.data.end(), payload.begin(), payload.end());
+
+    return packet;
+}
+
+// An L2CAP frame on the given channel
+std::vector<uint8_t> Frame(unsigned cid, std::vector<uint8_t> const& payload)
+{
+    std::vector<uint8_t> frame;
+
+    AppendLE(frame, payload.size(), 2);
+    AppendLE(frame, cid, 2);
+
+    frame.insert(frame.end(), payload.begin(), payload.end());
+
+    return frame;
+}
+
+// An L2CAP connection request (0x02) or response (0x03) on the signaling channel
+Packet Signal(double time, unsigned direction, unsigned code, std::vector<uint8_t> const& params)
+{
+    std::vector<uint8_t> command = { static_cast<uint8_t>(code), 0x01 };
+
+    AppendLE(command, params.size(), 2);
+
+    command.insert(command.end(), params.begin(), params.end());
+
+    return AclPacket(time, direction, 0x02, Frame(0x0001, command));
+}
+
+//
+// The HCI traffic of a Wiimote connecting: the connection, the HID control (PSM 0x11) and
+// interrupt (PSM 0x13) channels, and reports on both. The host's channels are 0x40 and
+// 0x41, the Wiimote's 0x50 and 0x51. Only the reports on the interrupt channel count; one
+// of them is split into two ACL packets.
+//
+std::vector<Packet> MakeSession(std::vector<Expected>& expected)
+{
+    std::vector<Packet> packets;
+
+    Packet connected = { 1.0, Received, Event, { 0x03, 11, 0x00, handle, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x01, 0x00 } };
+
+    packets.push_back(connected);
+
+    packets.push_back(Signal(1.1, Sent, 0x02, { 0x11, 0x00, 0x40, 0x00 }));
+    packets.push_back(Signal(1.2, Received, 0x03, { 0x50, 0x00, 0x40, 0x00, 0x00, 0x00, 0x00, 0x00 }));
+    packets.push_back(Signal(1.3, Sent, 0x02, { 0x13, 0x00, 0x41, 0x00 }));
+    packets.push_back(Signal(1.4, Received, 0x03, { 0x51, 0x00, 0x41, 0x00, 0x00, 0x00, 0x00, 0x00 }));
+
+    // Reports on the interrupt channel are addressed to the receiver's CID
+    packets.push_back(AclPacket(2.0, Received, 0x02, Frame(0x41, { 0xA1, 0x30, 0x00, 0x08 })));
+    packets.push_back(AclPacket(2.1, Sent, 0x02, Frame(0x51, { 0xA2, 0x11, 0x10 })));
+
+    // Not on the interrupt channel
+    packets.push_back(AclPacket(2.2, Received, 0x02, Frame(0x40, { 0xA1, 0x30, 0x00, 0x04 })));
+    packets.push_back(AclPacket(2.3, Sent, 0x02, Frame(0x50, { 0xA2, 0x11, 0x20 })));
+
+    // Fragmented; recorded when the frame is complete
+    std::vector<uint8_t> frame = Frame(0x41, { 0xA1, 0x31, 0x00, 0x00, 0x80, 0x81, 0x82 });
+
+    packets.push_back(AclPacket(2.4, Received, 0x02, std::vector<uint8_t>(frame.begin(), frame.begin() + 6)));
+    packets.push_back(AclPacket(2.5, Received, 0x01, std::vector<uint8_t>(frame.begin() + 6, frame.end())));
+
+    packets.push_back(AclPacket(3.0, Received, 0x02, Frame(0x41, { 0xA1, 0x30, 0x00, 0x00 })));
+
+    expected = {
+        { 2.0, CaptureWriter::Direction::Input, { 0x30, 0x00, 0x08 } },
+        { 2.1, CaptureWriter::Direction::Output, { 0x11, 0x10 } },
+        { 2.5, CaptureWriter::Direction::Input, { 0x31, 0x00, 0x00, 0x80, 0x81, 0x82 } },
+        { 3.0, CaptureWriter::Direction::Input, { 0x30, 0x00, 0x00 } },
+    };
+
+    return packets;
+}
+
+// A btsnoop trace (HCI H4)
+std::vector<uint8_t> WriteBtsnoop(std::vector<Packet> const& packets)
+{
+    std::vector<uint8_t> trace = { 'b', 't', 's', 'n', 'o', 'o', 'p', 0 };
+
+    AppendBE(trace, 1, 4);
+    AppendBE(trace, 1002, 4);
+
+    for (Packet const& packet : packets)
+    {
+        unsigned flags = (packet.direction == Received ? 1 : 0) | (packet.type == Event ? 2 : 0);
+
+        AppendBE(trace, packet.data.size() + 1, 4);
+        AppendBE(trace, packet.data.size() + 1, 4);
+        AppendBE(trace, flags, 4);
+        AppendBE(trace, 0, 4);
+        AppendBE(trace, btsnoopEpoch + static_cast<uint64_t>(std::llround(packet.time * 1e6)), 8);
+
+        trace.push_back(static_cast<uint8_t>(packet.type));
+        trace.insert(trace.end(), packet.data.begin(), packet.data.end());
+    }
+
+    return trace;
+}
+
+// A pcap trace (HCI H4 with direction)
+std::vector<uint8_t> WritePcap(std::vector<Packet> const& packets)
+{
+    std::vector<uint8_t> trace;
+
+    AppendLE(trace, 0xA1B2C3D4, 4);
+    AppendLE(trace, 2, 2);
+    AppendLE(trace, 4, 2);
+    AppendLE(trace, 0, 4);
+    AppendLE(trace, 0, 4);
+    AppendLE(trace, 65535, 4);
+    AppendLE(trace, 201, 4);
+
+    for (Packet const& packet : packets)
+    {
+        uint64_t time = static_cast<uint64_t>(std::llround(packet.time * 1e6));
+
+        AppendLE(trace, time / 1000000, 4);
+        AppendLE(trace, time % 1000000, 4);
+        AppendLE(trace, packet.data.size() + 5, 4);
+        AppendLE(trace, packet.data.size() + 5, 4);
+
+        AppendBE(trace, packet.direction == Received ? 1 : 0, 4);
+
+        trace.push_back(static_cast<uint8_t>(packet.type));
+        trace.insert(trace.end(), packet.data.begin(), packet.data.end());
+    }
+
+    return trace;
+}
+
+// A pcapng trace (Linux monitor)
+std::vector<uint8_t> WritePcapng(std::vector<Packet> const& packets)
+{
+    std::vector<uint8_t> trace;
+
+    // Section header block
+    AppendLE(trace, 0x0A0D0D0A, 4);
+    AppendLE(trace, 28, 4);
+    AppendLE(trace, 0x1A2B3C4D, 4);
+    AppendLE(trace, 1, 2);
+    AppendLE(trace, 0, 2);
+    AppendLE(trace, ~0ull, 8);
+    AppendLE(trace, 28, 4);
+
+    // Interface description block
+    AppendLE(trace, 1, 4);
+    AppendLE(trace, 20, 4);
+    AppendLE(trace, 254, 2);
+    AppendLE(trace, 0, 2);
+    AppendLE(trace, 0, 4);
+    AppendLE(trace, 20, 4);
+
+    for (Packet const& packet : packets)
+    {
+        // Adapter 0 and the monitor opcode: event, ACL TX or ACL RX
+        std::vector<uint8_t> data;
+
+        AppendBE(data, 0, 2);
+        AppendBE(data, packet.type == Event ? 3 : (packet.direction == Sent ? 4 : 5), 2);
+
+        data.insert(data.end(), packet.data.begin(), packet.data.end());
+
+        size_t padded = (data.size() + 3) & ~size_t(3);
+        uint64_t time = static_cast<uint64_t>(std::llround(packet.time * 1e6));
+
+        // Enhanced packet block
+        AppendLE(trace, 6, 4);
+        AppendLE(trace, 32 + padded, 4);
+        AppendLE(trace, 0, 4);
+        AppendLE(trace, time >> 32, 4);
+        AppendLE(trace, time & 0xFFFFFFFF, 4);
+        AppendLE(trace, data.size(), 4);
+        AppendLE(trace, data.size(), 4);
+
+        data.resize(padded);
+
+        trace.insert(trace.end(), data.begin(), data.end());
+
+        AppendLE(trace, 32 + padded, 4);
+    }
+
+    return trace;
+}
+
+// Import the trace of MakeSession() and check the recorded reports
+void CheckImport(std::vector<uint8_t> const& trace)
+{
+    std::vector<Expected> expected;
+    std::vector<Packet> packets = MakeSession(expected);
+
+    TempFile traceFile;
+    TempFile captureFile;
+
+    REQUIRE(traceFile.Valid() && captureFile.Valid());
+    REQUIRE(traceFile.Write(trace));
+
+    CaptureWriter capture;
+
+    REQUIRE(capture.Open(captureFile.path));
+
+    ImportStats stats;
+
+    REQUIRE(ImportTrace(traceFile.path, capture, &stats));
+
+    // Written once the import returns
+    CHECK(capture.Written() == expected.size());
+
+    capture.Close();
+
+    CHECK(stats.packets == packets.size());
+    CHECK(stats.reports == expected.size());
+    CHECK(stats.devices == 1);
+
+    std::vector<uint8_t> file = captureFile.Read();
+
+    CaptureReader reader;
+
+    REQUIRE(reader.Open(file.data(), file.size()));
+
+    for (Expected const& e : expected)
+    {
+        CaptureRecord record;
+
+        REQUIRE(reader.Next(record));
+
+        CHECK(std::llabs(static_cast<long long>(record.time) - std::llround(e.time * 1e9)) < 1000);
+        CHECK(record.device == 0);
+        CHECK(record.direction == static_cast<unsigned>(e.direction));
+        CHECK(record.length == e.report.size());
+        CHECK(std::memcmp(record.report, e.report.data(), e.report.size()) == 0);
+    }
+
+    CaptureRecord record;
+
+    CHECK(!reader.Next(record));
+}
+
+} // namespace
+
+TEST(ImportBtsnoop)
+{
+    std::vector<Expected> expected;
+
+    CheckImport(WriteBtsnoop(MakeSession(expected)));
+}
+
+TEST(ImportPcap)
+{
+    std::vector<Expected> expected;
+
+    CheckImport(WritePcap(MakeSession(expected)));
+}
+
+TEST(ImportPcapng)
+{
+    std::vector<Expected> expected;
+
+    CheckImport(WritePcapng(MakeSession(expected)));
+}
+
+TEST(ImportFailsIfCaptureCannotBeWritten)
+{
+    std::vector<Expected> expected;
+
+    TempFile traceFile;
+    TempFile captureFile;
+
+    REQUIRE(traceFile.Valid() && captureFile.Valid());
+    REQUIRE(traceFile.Write(WriteBtsnoop(MakeSession(expected))));
+
+    CaptureWriter capture;
+
+    REQUIRE(capture.Open(captureFile.path));
+
+    //
+    // Nothing can be written past the header. The import must not wait for records which
+    // are never written.
+    //
+
+    rlimit limit;
+
+    REQUIRE(getrlimit(RLIMIT_FSIZE, &limit) == 0);
+
+    rlimit small = limit;
+    small.rlim_cur = WII_CAPTURE_HEADER_SIZE;
+
+    void (*handler)(int) = std::signal(SIGXFSZ, SIG_IGN);
+
+    REQUIRE(setrlimit(RLIMIT_FSIZE, &small) == 0);
+
+    bool imported = ImportTrace(traceFile.path, capture, nullptr);
+
+    setrlimit(RLIMIT_FSIZE, &limit);
+    std::signal(SIGXFSZ, handler);
+
+    CHECK(!imported);
+    CHECK(capture.Written() == 0);
+    CHECK(capture.Dropped() != 0);
+}
+
+#endif // _WIN32
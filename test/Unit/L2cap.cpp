@@ -0,0 +1,227 @@
+// This file is distributed under the MIT license.
+// See the LICENSE file for details.
+
+#include "Test.h"
+
+#ifndef _WIN32
+
+#include "Wiimote/Transport.h"
+
+#include <cstdint>
+#include <cstring>
+#include <thread>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace wii;
+
+//--------------------------------------------------------------------------------------------------
+// The L2CAP transport against SOCK_SEQPACKET stand-ins
+//--------------------------------------------------------------------------------------------------
+
+namespace
+{
+
+// A transport whose interrupt channel is one end of a SOCK_SEQPACKET socketpair.
+// The other end plays the Wiimote.
+struct L2capDevice
+{
+    std::unique_ptr<Transport> transport;
+    int peer;
+
+    L2capDevice()
+        : transport()
+        , peer(-1)
+    {
+        int fds[2];
+
+        if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds) < 0)
+            return;
+
+        transport = CreateL2capTransport(fds[0]);
+        peer = fds[1];
+    }
+
+    ~L2capDevice()
+    {
+        if (peer >= 0)
+            close(peer);
+    }
+
+    // Send a packet with the given HID transaction header
+    bool Send(uint8_t header, uint8_t const* report, unsigned len)
+    {
+        uint8_t packet[1 + 22];
+
+        packet[0] = header;
+        std::memcpy(packet + 1, report, len);
+
+        return write(peer, packet, len + 1) == static_cast<ssize_t>(len + 1);
+    }
+};
+
+} // namespace
+
+TEST(L2capReadStripsHeader)
+{
+    L2capDevice dev;
+
+    REQUIRE(dev.transport != nullptr);
+
+    uint8_t sent[22];
+    MakeReport(sent, 9);
+
+    REQUIRE(dev.Send(0xA1, sent, sizeof(sent)));
+
+    uint8_t report[22] = {0};
+    double time = 0.0;
+
+    CHECK(dev.transport->Read(report, time, 100000) == Transport::Result::OK);
+    CHECK(std::memcmp(report, sent, sizeof(sent)) == 0);
+}
+
+TEST(L2capReadShortReport)
+{
+    L2capDevice dev;
+
+    REQUIRE(dev.transport != nullptr);
+
+    uint8_t sent[4] = { 0x22, 0x00, 0x00, 0x15 };
+
+    REQUIRE(dev.Send(0xA1, sent, sizeof(sent)));
+
+    uint8_t report[22];
+    std::memset(report, 0xFF, sizeof(report));
+    double time = 0.0;
+
+    CHECK(dev.transport->Read(report, time, 100000) == Transport::Result::OK);
+    CHECK(std::memcmp(report, sent, sizeof(sent)) == 0);
+    CHECK(report[4] == 0 && report[21] == 0);
+}
+
+TEST(L2capReadSkipsOtherTransactions)
+{
+    L2capDevice dev;
+
+    REQUIRE(dev.transport != nullptr);
+
+    uint8_t skipped[22];
+    MakeReport(skipped, 1);
+
+    uint8_t sent[22];
+    MakeReport(sent, 2);
+
+    // A handshake, an output report echo and an unknown transaction precede the input report
+    REQUIRE(dev.Send(0x00, skipped, 1));
+    REQUIRE(dev.Send(0xA2, skipped, sizeof(skipped)));
+    REQUIRE(dev.Send(0x53, skipped, sizeof(skipped)));
+    REQUIRE(dev.Send(0xA1, sent, sizeof(sent)));
+
+    uint8_t report[22] = {0};
+    double time = 0.0;
+
+    CHECK(dev.transport->Read(report, time, 0) == Transport::Result::OK);
+    CHECK(std::memcmp(report, sent, sizeof(sent)) == 0);
+
+    // Nothing but skipped packets: time out
+    REQUIRE(dev.Send(0xA2, skipped, sizeof(skipped)));
+
+    CHECK(dev.transport->Read(report, time, 0) == Transport::Result::Timeout);
+}
+
+TEST(L2capReadTimeout)
+{
+    L2capDevice dev;
+
+    REQUIRE(dev.transport != nullptr);
+
+    uint8_t report[22];
+    double time = 0.0;
+
+    double start = GetTime();
+
+    CHECK(dev.transport->Read(report, time, 20000) == Transport::Result::Timeout);
+
+    double elapsed = GetTime() - start;
+
+    CHECK(elapsed >= 0.019);
+    CHECK(elapsed < 0.5);
+}
+
+TEST(L2capReadTimeoutWithSkippedPackets)
+{
+    L2capDevice dev;
+
+    REQUIRE(dev.transport != nullptr);
+
+    //
+    // Packets which are not input reports keep arriving during the wait.
+    // They must not restart the timeout.
+    //
+
+    int peer = dev.peer;
+
+    std::thread sender([peer]() {
+        uint8_t packet[2] = { 0xA2, 0x11 };
+
+        for (unsigned n = 0; n < 20; ++n)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+            if (write(peer, packet, sizeof(packet)) != static_cast<ssize_t>(sizeof(packet)))
+                break;
+        }
+    });
+
+    uint8_t report[22];
+    double time = 0.0;
+
+    double start = GetTime();
+
+    CHECK(dev.transport->Read(report, time, 50000) == Transport::Result::Timeout);
+
+    double elapsed = GetTime() - start;
+
+    sender.join();
+
+    CHECK(elapsed >= 0.049);
+    CHECK(elapsed < 0.15);
+}
+
+TEST(L2capWriteAddsHeader)
+{
+    L2capDevice dev;
+
+    REQUIRE(dev.transport != nullptr);
+
+    uint8_t leds[2] = { 0x11, 0x10 };
+
+    CHECK(dev.transport->Write(leds, sizeof(leds)));
+
+    uint8_t packet[32];
+
+    CHECK(read(dev.peer, packet, sizeof(packet)) == 3);
+    CHECK(packet[0] == 0xA2 && packet[1] == 0x11 && packet[2] == 0x10);
+}
+
+TEST(L2capError)
+{
+    L2capDevice dev;
+
+    REQUIRE(dev.transport != nullptr);
+
+    close(dev.peer);
+    dev.peer = -1;
+
+    uint8_t report[22];
+    double time = 0.0;
+
+    CHECK(dev.transport->Read(report, time, -1) == Transport::Result::Error);
+
+    uint8_t leds[2] = { 0x11, 0x10 };
+
+    CHECK(!dev.transport->Write(leds, sizeof(leds)));
+}
+
+#endif
@@ -0,0 +1,35 @@
+// This file is distributed under the MIT license.
+// See the LICENSE file for details.
+
+#include "Test.h"
+
+#include <cstring>
+
+//
+// Runs all tests -- or the tests whose names contain the first argument.
+// Returns 0 if all checks passed.
+//
+int main(int argc, char* argv[])
+{
+    char const* filter = argc > 1 ? argv[1] : "";
+
+    unsigned count = 0;
+
+    for (auto const& tc : test::Tests())
+    {
+        if (std::strstr(tc.name, filter) == nullptr)
+            continue;
+
+        unsigned failures = test::Failures();
+
+        tc.func();
+
+        std::printf("%-40s %s\n", tc.name, test::Failures() == failures ? "ok" : "FAILED");
+
+        count++;
+    }
+
+    std::printf("%u tests, %u failed checks\n", count, test::Failures());
+
+    return test::Failures() == 0 ? 0 : 1;
+}
@@ -0,0 +1,146 @@
+// This file is distributed under the MIT license.
+// See the LICENSE file for details.
+
+#include "Test.h"
+#include "FakeTree.h"
+
+#ifndef _WIN32
+
+#include "Wiimote/Monitor.h"
+#include "Wiimote/Transport.h"
+
+#include <vector>
+
+#include <fcntl.h>
+
+using namespace wii;
+
+//--------------------------------------------------------------------------------------------------
+// WiimoteMonitor against a fake /dev and /sys tree
+//--------------------------------------------------------------------------------------------------
+
+TEST(MonitorAttachesWiimotes)
+{
+    FakeTree tree;
+
+    REQUIRE(!tree.root.empty());
+
+    // A Wiimote, a keyboard and a node which is not a hidraw node at all
+    REQUIRE(tree.AddNode("hidraw0", 0x057E, 0x0306));
+    REQUIRE(tree.AddNode("hidraw1", 0x046D, 0xC31C));
+    REQUIRE(tree.AddNode("event0", 0x057E, 0x0306));
+
+    Wiimote wiimotes[2];
+
+    WiimoteMonitor monitor(wiimotes, 2, tree.dev.c_str(), tree.sys.c_str());
+
+    REQUIRE(monitor.Descriptor() >= 0);
+
+    // Existing nodes are found by scanning
+    CHECK(monitor.Update(0) == 1);
+    CHECK(wiimotes[0].GetOutputStats().reports == 1);
+    CHECK(wiimotes[1].GetOutputStats().reports == 0);
+
+    // Attaching sets the LEDs
+    std::vector<uint8_t> written = tree.Written("hidraw0");
+
+    CHECK(written.size() == 2 && written[0] == 0x11);
+
+    // New nodes are reported by inotify
+    CHECK(monitor.Update(0) == 0);
+
+    REQUIRE(tree.AddNode("hidraw2", 0x057E, 0x0330));
+
+    CHECK(monitor.Update(1000) == 1);
+    CHECK(wiimotes[1].GetOutputStats().reports == 1);
+
+    // All slots are occupied
+    REQUIRE(tree.AddNode("hidraw3", 0x057E, 0x0306));
+
+    CHECK(monitor.Update(100) == 0);
+
+    wiimotes[0].Disconnect();
+    wiimotes[1].Disconnect();
+}
+
+TEST(MonitorReattachesLostWiimote)
+{
+    FakeTree tree;
+
+    REQUIRE(!tree.root.empty());
+    REQUIRE(tree.AddNode("hidraw0", 0x057E, 0x0306));
+
+    Wiimote wiimote;
+
+    WiimoteMonitor monitor(&wiimote, 1, tree.dev.c_str(), tree.sys.c_str());
+
+    CHECK(monitor.Update(0) == 1);
+    CHECK(monitor.GetReconnectLatency(0) == 0.0);
+
+    REQUIRE(wiimote.SetReportMode(Wiimote::ReportMode::ButtonsAccel));
+    REQUIRE(wiimote.SetLEDs(State::LED2 | State::LED3));
+
+    tree.Written("hidraw0");
+
+    // The node goes away: the slot is lost
+    REQUIRE(tree.RemoveNode("hidraw0"));
+
+    CHECK(monitor.Update(1000) == 0);
+    CHECK(monitor.GetReconnectLatency(0) == 0.0);
+
+    // ... and comes back under another name with the settings restored
+    REQUIRE(tree.AddNode("hidraw4", 0x057E, 0x0306));
+
+    CHECK(monitor.Update(1000) == 1);
+    CHECK(monitor.GetReconnectLatency(0) > 0.0);
+    CHECK(wiimote.GetState().leds == (State::LED2 | State::LED3));
+
+    std::vector<uint8_t> written = tree.Written("hidraw4");
+
+    REQUIRE(written.size() >= 2);
+    CHECK(written[0] == 0x12);
+    CHECK(written[written.size() - 2] == 0x11);
+    CHECK(written[written.size() - 1] == (State::LED2 | State::LED3));
+
+    wiimote.Disconnect();
+}
+
+TEST(MonitorSkipsPreconnectedWiimote)
+{
+    FakeTree tree;
+
+    REQUIRE(!tree.root.empty());
+    REQUIRE(tree.AddNode("hidraw0", 0x057E, 0x0306));
+
+    // The first Wiimote is connected to the node before the monitor exists
+    int fd = open((tree.dev + "/hidraw0").c_str(), O_RDWR | O_NONBLOCK);
+
+    REQUIRE(fd >= 0);
+
+    Wiimote wiimotes[2];
+
+    REQUIRE(wiimotes[0].Connect(CreateHidrawTransport(fd)));
+
+    WiimoteMonitor monitor(wiimotes, 2, tree.dev.c_str(), tree.sys.c_str());
+
+    // The scan finds the node, which must not be attached to the free slot
+    CHECK(monitor.Update(0) == 0);
+    CHECK(wiimotes[1].GetOutputStats().reports == 0);
+
+    // Not even under another name
+    REQUIRE(tree.AddAlias("hidraw7", "hidraw0", 0x057E, 0x0306));
+
+    CHECK(monitor.Update(1000) == 0);
+    CHECK(wiimotes[1].GetOutputStats().reports == 0);
+
+    // Other Wiimotes are still attached to the free slot
+    REQUIRE(tree.AddNode("hidraw1", 0x057E, 0x0306));
+
+    CHECK(monitor.Update(1000) == 1);
+    CHECK(wiimotes[1].GetOutputStats().reports == 1);
+
+    wiimotes[0].Disconnect();
+    wiimotes[1].Disconnect();
+}
+
+#endif
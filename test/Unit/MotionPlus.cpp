@@ -0,0 +1,348 @@
+// This file is distributed under the MIT license.
+// See the LICENSE file for details.
+
+#include "Test.h"
+
+#include "Wiimote/Batch.h"
+#include "Wiimote/Capture.h"
+
+#include "Capture.h"
+#include "Data.h"
+#include "MotionPlus.h"
+#include "Simd.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+using namespace wii;
+
+//--------------------------------------------------------------------------------------------------
+// Vectorized motion-plus normalization against ParseMotionPlus
+//--------------------------------------------------------------------------------------------------
+//
+// The vectorized paths are chosen at compile time (see Simd.h). Build the tests with -mavx2,
+// with the default flags and with -DWII_HAVE_SSE2=0 to cover all of them.
+//
+
+namespace
+{
+
+// Motion-plus extension data (6 bytes) for the given raw rates and flags
+void MakeMotionPlus(uint8_t* buf, unsigned x, unsigned y, unsigned z, bool fastX, bool fastY, bool fastZ, bool ext)
+{
+    buf[0] = static_cast<uint8_t>(z & 0xFF);
+    buf[1] = static_cast<uint8_t>(y & 0xFF);
+    buf[2] = static_cast<uint8_t>(x & 0xFF);
+    buf[3] = static_cast<uint8_t>(((z >> 8) << 2) | (fastX ? 0 : 0x01) | (fastZ ? 0 : 0x02));
+    buf[4] = static_cast<uint8_t>(((y >> 8) << 2) | (fastY ? 0 : 0x02) | (ext ? 0x01 : 0));
+    buf[5] = static_cast<uint8_t>(((x >> 8) << 2) | 0x02);
+}
+
+//
+// Record a stream of ButtonsExt reports like a motion-plus held in the hand: the rates drift,
+// every axis switches between slow and fast units now and then, and with 'passthrough', every
+// other report carries nunchuk data instead.
+// Returns the reports read back from the capture file, 22 bytes each.
+//
+std::vector<uint8_t> RecordStream(size_t count, bool passthrough)
+{
+    std::vector<uint8_t> reports;
+
+#ifdef _WIN32
+    char path[] = "wiimote-mp-XXXXXX";
+
+    if (_mktemp_s(path, sizeof(path)) != 0)
+        return reports;
+#else
+    char path[] = "/tmp/wiimote-mp-XXXXXX";
+
+    int fd = mkstemp(path);
+
+    if (fd < 0)
+        return reports;
+
+    close(fd);
+#endif
+
+    CaptureWriter writer;
+
+    if (!writer.Open(path, CaptureWriter::Format::Compressed))
+        return reports;
+
+    int rate[3] = { 8063, 7000, 9000 };
+    bool fast[3] = { false, false, true };
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        uint8_t report[22] = { 0x32, 0x00, 0x00 };
+
+        if (passthrough && (i & 1))
+        {
+            // Nunchuk data in pass-through mode: bit 1 of byte 5 is clear
+            for (unsigned n = 0; n < 6; ++n)
+                report[3 + n] = static_cast<uint8_t>(std::rand() & 0xFD);
+        }
+        else
+        {
+            for (unsigned n = 0; n < 3; ++n)
+            {
+                rate[n] += std::rand() % 301 - 150;
+                rate[n] = rate[n] < 0 ? 0 : rate[n] > 0x3FFF ? 0x3FFF : rate[n];
+
+                if (std::rand() % 64 == 0)
+                    fast[n] = !fast[n];
+            }
+
+            // All corner values now and then
+            if (i % 97 == 0)
+                rate[i % 3] = (i & 2) ? 0x3FFF : 0;
+
+            MakeMotionPlus(report + 3, rate[0], rate[1], rate[2], fast[0], fast[1], fast[2], passthrough);
+        }
+
+        writer.Record(i * 0.005, 0, CaptureWriter::Direction::Input, report, sizeof(report));
+    }
+
+    writer.Close();
+
+    //
+    // Read the reports back
+    //
+
+    std::vector<uint8_t> file;
+
+    if (FILE* f = std::fopen(path, "rb"))
+    {
+        uint8_t buf[4096];
+        size_t len;
+
+        while ((len = std::fread(buf, 1, sizeof(buf), f)) > 0)
+            file.insert(file.end(), buf, buf + len);
+
+        std::fclose(f);
+    }
+
+    std::remove(path);
+
+    CaptureReader reader;
+
+    if (!reader.Open(file.data(), file.size()))
+        return reports;
+
+    CaptureRecord record;
+
+    while (reader.Next(record))
+        reports.insert(reports.end(), record.report, record.report + 22);
+
+    return reports;
+}
+
+// Calibration data of a real motion-plus -- or none
+MotionPlusData::CalibrationData MakeCalibration(bool valid)
+{
+    MotionPlusData::CalibrationData cal;
+
+    std::memset(&cal, 0, sizeof(cal));
+
+    if (valid)
+    {
+        cal.biasSlow.x = 7906; cal.biasSlow.y = 8011; cal.biasSlow.z = 7767;
+        cal.biasFast.x = 7949; cal.biasFast.y = 7981; cal.biasFast.z = 7839;
+        cal.scaleSlow.x = 0.0551f; cal.scaleSlow.y = 0.0543f; cal.scaleSlow.z = 0.0557f;
+        cal.scaleFast.x = 0.2496f; cal.scaleFast.y = 0.2478f; cal.scaleFast.z = 0.2519f;
+        cal.valid = true;
+    }
+
+    return cal;
+}
+
+// Compare the vectorized normalization of the stream with ParseMotionPlus, sample by sample.
+// Returns the number of mismatches.
+unsigned CompareStream(std::vector<uint8_t> const& reports, unsigned extension, MotionPlusData::CalibrationData const& cal)
+{
+    size_t count = reports.size() / 22;
+
+    ReportBatch batch;
+
+    if (DecodeReports(batch, reports.data(), count, Wiimote::ReportMode::ButtonsExt, extension) != count)
+        return ~0u;
+
+    //
+    // The scalar reference
+    //
+
+    std::vector<float> expected(count * 3);
+    std::vector<bool> hasMotionPlus(count);
+
+    State state;
+
+    std::memset(&state, 0, sizeof(state));
+
+    state.extension.type = extension;
+    state.extension.motionPlus.cal = cal;
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        state.data = 0;
+
+        ParseExtension(state, &reports[i * 22 + 3]);
+
+        hasMotionPlus[i] = (state.data & State::MotionPlus) != 0;
+
+        expected[i * 3 + 0] = state.extension.motionPlus.normalized.x;
+        expected[i * 3 + 1] = state.extension.motionPlus.normalized.y;
+        expected[i * 3 + 2] = state.extension.motionPlus.normalized.z;
+    }
+
+    unsigned mismatches = 0;
+
+    auto compare = [&](size_t i, float x, float y, float z) {
+        if (hasMotionPlus[i]
+            && (std::memcmp(&x, &expected[i * 3 + 0], sizeof(float)) != 0
+             || std::memcmp(&y, &expected[i * 3 + 1], sizeof(float)) != 0
+             || std::memcmp(&z, &expected[i * 3 + 2], sizeof(float)) != 0))
+        {
+            mismatches++;
+        }
+    };
+
+    //
+    // The whole batch
+    //
+
+    NormalizeMotionPlus(batch, cal);
+
+    for (size_t i = 0; i < count; ++i)
+        compare(i, batch.mpNormalizedX[i], batch.mpNormalizedY[i], batch.mpNormalizedZ[i]);
+
+    //
+    // Every length up to a few vectors, at every start offset within a vector, so that the
+    // scalar tail handles 0 to 7 samples after the vector loop
+    //
+
+    std::vector<float> nx(count);
+    std::vector<float> ny(count);
+    std::vector<float> nz(count);
+
+    for (size_t start = 0; start < 8 && start < count; ++start)
+    {
+        for (size_t len = 0; len <= 35 && start + len <= count; ++len)
+        {
+            std::fill(nx.begin(), nx.end(), -1.0f);
+
+            NormalizeMotionPlus(cal,
+                batch.mpX.data() + start, batch.mpY.data() + start, batch.mpZ.data() + start, batch.mpFlags.data() + start,
+                nx.data() + start, ny.data() + start, nz.data() + start, len);
+
+            for (size_t i = start; i < start + len; ++i)
+                compare(i, nx[i], ny[i], nz[i]);
+
+            // Nothing is written past the end
+            if (start + len < count && nx[start + len] != -1.0f)
+                mismatches++;
+        }
+    }
+
+    return mismatches;
+}
+
+} // namespace
+
+TEST(MotionPlusNormalizeCapture)
+{
+    std::srand(24);
+
+    std::vector<uint8_t> reports = RecordStream(4099, false);
+
+    REQUIRE(reports.size() == 4099 * 22);
+
+    CHECK(CompareStream(reports, Extension::MotionPlus, MakeCalibration(false)) == 0);
+    CHECK(CompareStream(reports, Extension::MotionPlus, MakeCalibration(true)) == 0);
+}
+
+TEST(MotionPlusNormalizePassthroughCapture)
+{
+    std::srand(25);
+
+    std::vector<uint8_t> reports = RecordStream(2053, true);
+
+    REQUIRE(reports.size() == 2053 * 22);
+
+    unsigned const extension = Extension::MotionPlus | Extension::Nunchuk;
+
+    CHECK(CompareStream(reports, extension, MakeCalibration(false)) == 0);
+    CHECK(CompareStream(reports, extension, MakeCalibration(true)) == 0);
+}
+
+TEST(MotionPlusNormalizeAllRates)
+{
+    //
+    // Every raw rate in slow and fast units, in a length which is not a multiple of the
+    // vector width
+    //
+
+    size_t const count = 2 * 16384 + 5;
+
+    std::vector<uint16_t> x(count);
+    std::vector<uint16_t> y(count);
+    std::vector<uint16_t> z(count);
+    std::vector<uint8_t> flags(count);
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        x[i] = static_cast<uint16_t>(i & 0x3FFF);
+        y[i] = static_cast<uint16_t>((i * 7) & 0x3FFF);
+        z[i] = static_cast<uint16_t>(0x3FFF - (i & 0x3FFF));
+        flags[i] = static_cast<uint8_t>((i >> 14) ? (i % 7) : (i % 9 == 0 ? 0u + MotionPlusExt : 0u));
+    }
+
+    for (int valid = 0; valid < 2; ++valid)
+    {
+        MotionPlusData::CalibrationData cal = MakeCalibration(valid != 0);
+
+        std::vector<float> nx(count);
+        std::vector<float> ny(count);
+        std::vector<float> nz(count);
+
+        NormalizeMotionPlus(cal, x.data(), y.data(), z.data(), flags.data(), nx.data(), ny.data(), nz.data(), count);
+
+        unsigned mismatches = 0;
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            State state;
+
+            std::memset(&state, 0, sizeof(state));
+
+            state.extension.motionPlus.cal = cal;
+
+            uint8_t buf[6];
+
+            MakeMotionPlus(buf, x[i], y[i], z[i],
+                (flags[i] & MotionPlusFastX) != 0, (flags[i] & MotionPlusFastY) != 0, (flags[i] & MotionPlusFastZ) != 0,
+                (flags[i] & MotionPlusExt) != 0);
+
+            ParseMotionPlus(state, buf);
+
+            Point3f const& expected = state.extension.motionPlus.normalized;
+
+            if (std::memcmp(&nx[i], &expected.x, sizeof(float)) != 0
+                || std::memcmp(&ny[i], &expected.y, sizeof(float)) != 0
+                || std::memcmp(&nz[i], &expected.z, sizeof(float)) != 0)
+            {
+                mismatches++;
+            }
+        }
+
+        CHECK(mismatches == 0);
+    }
+}
@@ -0,0 +1,403 @@
+// This file is distributed under the MIT license.
+// See the LICENSE file for details.
+
+#include "Test.h"
+
+#ifndef _WIN32
+
+#include "Wiimote/Reactor.h"
+#include "Wiimote/Transport.h"
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <termios.h>
+#include <unistd.h>
+
+using namespace wii;
+
+//--------------------------------------------------------------------------------------------------
+// WiimoteReactor's backends with socketpair and pty stand-ins
+//--------------------------------------------------------------------------------------------------
+
+namespace
+{
+
+enum class StandIn {
+    // A socketpair: a hidraw transport with receive time stamps, which the io_uring
+    // backend only polls
+    Socket,
+    // A pty: a raw hidraw transport, which the io_uring backend reads itself
+    Pty,
+    // A socketpair carrying L2CAP packets: the peer adds the HID transaction header
+    L2cap,
+};
+
+// Open a pty in raw mode.
+// Returns the master in fds[1] and the slave in fds[0], like socketpair().
+bool OpenPty(int fds[2])
+{
+    fds[1] = posix_openpt(O_RDWR | O_NOCTTY);
+
+    if (fds[1] < 0)
+        return false;
+
+    fds[0] = -1;
+
+    if (grantpt(fds[1]) == 0 && unlockpt(fds[1]) == 0)
+        fds[0] = open(ptsname(fds[1]), O_RDWR | O_NOCTTY);
+
+    termios tio;
+
+    if (fds[0] < 0 || tcgetattr(fds[0], &tio) < 0)
+    {
+        close(fds[1]);
+        return false;
+    }
+
+    cfmakeraw(&tio);
+    tcsetattr(fds[0], TCSANOW, &tio);
+
+    return true;
+}
+
+// A reactor with the given backend and 'count' stand-in devices in ButtonsAccel mode.
+// The other ends of the stand-ins play the devices.
+struct Fleet
+{
+    WiimoteReactor reactor;
+    StandIn standIn;
+    std::vector<int> devices;
+    std::vector<int> peers;
+
+    Fleet(WiimoteReactor::Backend backend, unsigned count, StandIn standIn = StandIn::Socket)
+        : reactor(backend)
+        , standIn(standIn)
+        , devices()
+        , peers()
+    {
+        if (reactor.GetBackend() != backend)
+            return;
+
+        for (unsigned n = 0; n < count; ++n)
+        {
+            int fds[2];
+
+            if (standIn == StandIn::Pty ? !OpenPty(fds) : socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds) < 0)
+                break;
+
+            Wiimote* wiimote = reactor.Add(standIn == StandIn::L2cap ? CreateL2capTransport(fds[0], -1) : CreateHidrawTransport(fds[0]));
+
+            if (wiimote)
+                wiimote->SetReportMode(Wiimote::ReportMode::ButtonsAccel);
+
+            devices.push_back(fds[0]);
+            peers.push_back(fds[1]);
+        }
+    }
+
+    ~Fleet()
+    {
+        for (int fd : peers)
+            close(fd);
+    }
+
+    // Whether the backend is available
+    bool Available() const
+    {
+        return !peers.empty();
+    }
+
+    // Send an input report from the given device
+    bool Send(unsigned index, uint8_t const* report)
+    {
+        uint8_t packet[1 + 22];
+
+        unsigned len = 0;
+
+        if (standIn == StandIn::L2cap)
+            packet[len++] = 0xA1; // DATA | Input
+
+        std::memcpy(packet + len, report, 22);
+        len += 22;
+
+        return write(peers[index], packet, len) == static_cast<ssize_t>(len);
+    }
+
+    // Run the reactor until 'expected' reports have been processed or a second has passed.
+    // Returns the number of reports processed.
+    unsigned RunFor(unsigned expected)
+    {
+        unsigned processed = 0;
+
+        for (double end = GetTime() + 1.0; processed < expected && GetTime() < end; )
+            processed += reactor.Run(10);
+
+        return processed;
+    }
+};
+
+// The buttons of a ButtonsAccel report
+unsigned Buttons(uint8_t const* report)
+{
+    return (report[1] | (report[2] << 8)) & State::ButtonMask;
+}
+
+} // namespace
+
+TEST(ReactorUringKeepsNonBlocking)
+{
+    Fleet fleet(WiimoteReactor::Backend::Uring, 1, StandIn::Pty);
+
+    if (!fleet.Available())
+        return;
+
+    // The transport relies on it for its timeouts, and a blocking read would hold a kernel
+    // worker thread per idle device
+    CHECK((fcntl(fleet.devices[0], F_GETFL) & O_NONBLOCK) != 0);
+
+    uint8_t report[22];
+    MakeReport(report, 1);
+
+    REQUIRE(fleet.Send(0, report));
+
+    CHECK(fleet.RunFor(1) == 1);
+    CHECK(fleet.reactor[0].GetState().buttons == Buttons(report));
+}
+
+TEST(ReactorUringReleasesDevices)
+{
+    StandIn const standIns[] = { StandIn::Socket, StandIn::Pty };
+
+    for (StandIn standIn : standIns)
+    {
+        std::vector<int> devices;
+        std::vector<int> peers;
+
+        {
+            Fleet fleet(WiimoteReactor::Backend::Uring, 8, standIn);
+
+            if (!fleet.Available())
+                return;
+
+            fleet.reactor.Run(10);
+
+            devices.swap(fleet.devices);
+            peers.swap(fleet.peers);
+        }
+
+        //
+        // The outstanding reads and polls have been cancelled and reaped before the reactor
+        // went away, so nothing refers to the devices any longer.
+        //
+
+        for (int device : devices)
+            CHECK(fcntl(device, F_GETFD) < 0);
+
+        uint8_t report[22];
+        MakeReport(report, 3);
+
+        for (int peer : peers)
+        {
+            if (standIn == StandIn::Socket)
+                CHECK(send(peer, report, sizeof(report), MSG_NOSIGNAL) < 0);
+
+            close(peer);
+        }
+    }
+}
+
+TEST(ReactorUringLostDevice)
+{
+    StandIn const standIns[] = { StandIn::Socket, StandIn::Pty };
+
+    for (StandIn standIn : standIns)
+    {
+        Fleet fleet(WiimoteReactor::Backend::Uring, 2, standIn);
+
+        if (!fleet.Available())
+            return;
+
+        fleet.reactor.Run(0);
+
+        // The first device goes away
+        close(fleet.peers[0]);
+        fleet.peers[0] = -1;
+
+        fleet.reactor.Run(10);
+
+        // The second one is unaffected
+        uint8_t report[22];
+        MakeReport(report, 4);
+
+        REQUIRE(fleet.Send(1, report));
+
+        CHECK(fleet.RunFor(1) == 1);
+        CHECK(fleet.reactor[1].GetState().buttons == Buttons(report));
+
+        fleet.peers.erase(fleet.peers.begin());
+    }
+}
+
+TEST(ReactorUringL2cap)
+{
+    Fleet fleet(WiimoteReactor::Backend::Uring, 2, StandIn::L2cap);
+
+    if (!fleet.Available())
+        return;
+
+    //
+    // The transport strips the HID transaction headers and skips other transactions; the
+    // ring only tells when to read
+    //
+
+    uint8_t handshake[] = { 0x00 }; // HANDSHAKE | SUCCESSFUL
+
+    REQUIRE(write(fleet.peers[0], handshake, sizeof(handshake)) == static_cast<ssize_t>(sizeof(handshake)));
+
+    uint8_t first[22];
+    uint8_t second[22];
+
+    MakeReport(first, 0x10);
+    MakeReport(second, 0x30);
+
+    double sent = GetTime();
+
+    REQUIRE(fleet.Send(0, first));
+    REQUIRE(fleet.Send(1, second));
+
+    // The reports are stamped with the time the socket received them, not when they are read
+    usleep(50000);
+
+    CHECK(fleet.RunFor(2) == 2);
+
+    CHECK(fleet.reactor[0].GetState().buttons == Buttons(first));
+    CHECK(fleet.reactor[1].GetState().buttons == Buttons(second));
+
+    CHECK(fleet.reactor[0].GetState().time < sent + 0.04);
+    CHECK(fleet.reactor[1].GetState().time < sent + 0.04);
+
+    // The device keeps being polled
+    MakeReport(first, 0x50);
+
+    REQUIRE(fleet.Send(0, first));
+
+    CHECK(fleet.RunFor(1) == 1);
+    CHECK(fleet.reactor[0].GetState().buttons == Buttons(first));
+}
+
+TEST(ReactorEpollDispatches)
+{
+    Fleet fleet(WiimoteReactor::Backend::Epoll, 3);
+
+    REQUIRE(fleet.Available());
+
+    //
+    // Every report goes to the Wiimote at the other end of its device -- and only there
+    //
+
+    uint8_t first[22];
+    uint8_t third[22];
+
+    MakeReport(first, 0x10);
+    MakeReport(third, 0x40);
+
+    REQUIRE(send(fleet.peers[0], first, sizeof(first), 0) == static_cast<ssize_t>(sizeof(first)));
+    REQUIRE(send(fleet.peers[2], third, sizeof(third), 0) == static_cast<ssize_t>(sizeof(third)));
+
+    CHECK(fleet.RunFor(2) == 2);
+
+    CHECK(fleet.reactor[0].GetState().buttons == Buttons(first));
+    CHECK(fleet.reactor[1].GetState().buttons == 0);
+    CHECK(fleet.reactor[2].GetState().buttons == Buttons(third));
+}
+
+TEST(ReactorEpollLostDevice)
+{
+    Fleet fleet(WiimoteReactor::Backend::Epoll, 2);
+
+    REQUIRE(fleet.Available());
+
+    fleet.reactor.Run(0);
+
+    // The first device goes away
+    close(fleet.peers[0]);
+    fleet.peers[0] = -1;
+
+    fleet.reactor.Run(10);
+
+    //
+    // The lost device has been removed from the epoll set. Otherwise its hang-up would end
+    // every wait right away.
+    //
+
+    double start = GetTime();
+
+    CHECK(fleet.reactor.Run(50) == 0);
+    CHECK(GetTime() - start >= 0.04);
+
+    // The second one is unaffected
+    uint8_t report[22];
+    MakeReport(report, 4);
+
+    REQUIRE(send(fleet.peers[1], report, sizeof(report), 0) == static_cast<ssize_t>(sizeof(report)));
+
+    CHECK(fleet.RunFor(1) == 1);
+    CHECK(fleet.reactor[1].GetState().buttons == Buttons(report));
+
+    fleet.peers.erase(fleet.peers.begin());
+}
+
+TEST(ReactorEpollPollsUnwaitable)
+{
+    Fleet fleet(WiimoteReactor::Backend::Epoll, 1);
+
+    REQUIRE(fleet.Available());
+
+    //
+    // An emulated Wiimote and a replay can not be waited on; they are polled alongside the
+    // device which can
+    //
+
+    std::vector<uint8_t> reports(3 * 22);
+
+    for (unsigned n = 0; n < 3; ++n)
+    {
+        uint8_t report[22];
+        MakeReport(report, static_cast<uint8_t>(0x20 * (n + 1)));
+
+        std::memcpy(&reports[n * 22], report, 22);
+    }
+
+    Wiimote* loopback = fleet.reactor.Add(CreateLoopbackTransport());
+    Wiimote* replay = fleet.reactor.Add(CreateReplayTransport(reports.data(), 3));
+
+    REQUIRE(loopback && replay);
+
+    CHECK(loopback->SetReportMode(Wiimote::ReportMode::ButtonsAccel));
+    CHECK(replay->SetReportMode(Wiimote::ReportMode::ButtonsAccel));
+
+    uint8_t report[22];
+    MakeReport(report, 5);
+
+    REQUIRE(send(fleet.peers[0], report, sizeof(report), 0) == static_cast<ssize_t>(sizeof(report)));
+
+    // The replay's three reports, the device's report and at least one emulated report
+    CHECK(fleet.RunFor(5) >= 5);
+
+    CHECK(fleet.reactor[0].GetState().buttons == Buttons(report));
+    CHECK(replay->GetState().buttons == Buttons(&reports[2 * 22]));
+    CHECK(loopback->GetState().time > 0.0);
+
+    // A wait must not hold up the polled Wiimotes; the replay has ended, the emulation not
+    double start = GetTime();
+
+    CHECK(fleet.reactor.Run(1000) > 0);
+    CHECK(GetTime() - start < 0.5);
+}
+
+#endif
@@ -0,0 +1,292 @@
+// This file is distributed under the MIT license.
+// See the LICENSE file for details.
+
+#include "Test.h"
+
+#include "Wiimote/Capture.h"
+#include "Wiimote/Transport.h"
+
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+using namespace wii;
+
+//--------------------------------------------------------------------------------------------------
+// Playing back captures (CreateCaptureTransport())
+//--------------------------------------------------------------------------------------------------
+
+namespace
+{
+
+// A recorded session
+struct Session
+{
+    // Number of input reports recorded
+    unsigned reports;
+    // The state after the last report
+    State state;
+};
+
+//
+// Record a session of an emulated Wiimote with a Nunchuk in the given report mode: the
+// startup requests and their responses, followed by data reports.
+//
+bool RecordSession(char const* path, unsigned polls, Wiimote::ReportMode mode, Session& session)
+{
+    CaptureWriter capture;
+
+    if (!capture.Open(path))
+        return false;
+
+    Wiimote wiimote;
+
+    if (!wiimote.Connect(CreateLoopbackTransport(Extension::Nunchuk)))
+        return false;
+
+    wiimote.SetCapture(&capture);
+    wiimote.SetReportMode(mode);
+
+    session.reports = 0;
+
+    for (unsigned n = 0; n < polls; ++n)
+    {
+        if (wiimote.Poll(std::chrono::microseconds(0)) == Wiimote::PollResult::Report)
+            session.reports++;
+    }
+
+    session.state = wiimote.GetState();
+
+    wiimote.SetCapture(nullptr);
+    wiimote.Disconnect();
+
+    capture.Close();
+
+    return session.reports == polls;
+}
+
+} // namespace
+
+TEST(ReplayCaptureAtFullSpeed)
+{
+    TempFile file;
+
+    REQUIRE(file.Valid());
+
+    Session session;
+
+    REQUIRE(RecordSession(file.path, 500, Wiimote::ReportMode::ButtonsAccelExt, session));
+
+    Wiimote wiimote;
+
+    REQUIRE(wiimote.Connect(CreateCaptureTransport(file.path)));
+    REQUIRE(wiimote.SetReportMode(Wiimote::ReportMode::ButtonsAccelExt));
+
+    // All input reports are delivered -- responses included -- until the recording ends
+    unsigned count = 0;
+
+    while (wiimote.Poll(std::chrono::microseconds(0)) == Wiimote::PollResult::Report)
+        count++;
+
+    CHECK(count == session.reports);
+
+    State const& state = wiimote.GetState();
+
+    // Reports keep their recorded time stamps (stored in ns)
+    CHECK(std::abs(state.time - session.state.time) < 1e-6);
+
+    CHECK(state.buttons == session.state.buttons);
+    CHECK(state.accel.raw.x == session.state.accel.raw.x);
+    CHECK(state.accel.raw.y == session.state.accel.raw.y);
+    CHECK(state.accel.raw.z == session.state.accel.raw.z);
+    CHECK(state.accel.cal.valid && state.accel.cal.zero.x == session.state.accel.cal.zero.x);
+    CHECK(state.extension.type == Extension::Nunchuk);
+    CHECK(state.extension.nunchuk.stick.raw.x == session.state.extension.nunchuk.stick.raw.x);
+
+    wiimote.Disconnect();
+}
+
+TEST(ReplayCaptureTimed)
+{
+    TempFile file;
+
+    REQUIRE(file.Valid());
+
+    //
+    // Ten data reports 20 ms apart, played back at twice the speed
+    //
+
+    {
+        CaptureWriter capture;
+
+        REQUIRE(capture.Open(file.path));
+
+        for (unsigned n = 0; n < 10; ++n)
+        {
+            uint8_t report[22];
+            MakeReport(report, static_cast<uint8_t>(n));
+
+            capture.Record(100.0 + n * 0.02, 0, CaptureWriter::Direction::Input, report, sizeof(report));
+        }
+    }
+
+    std::unique_ptr<Transport> transport = CreateCaptureTransport(file.path, 0, 2.0);
+
+    REQUIRE(transport != nullptr);
+
+    std::vector<double> stamps;
+    std::vector<double> delivered;
+
+    uint8_t report[22];
+    double time = 0.0;
+
+    while (transport->Read(report, time, -1) == Transport::Result::OK)
+    {
+        stamps.push_back(time);
+        delivered.push_back(GetTime());
+
+        CHECK(report[0] == 0x31 && report[1] == static_cast<uint8_t>(stamps.size()));
+    }
+
+    REQUIRE(stamps.size() == 10);
+
+    for (size_t n = 1; n < stamps.size(); ++n)
+    {
+        // Stamped with the playback time ...
+        CHECK(std::abs(stamps[n] - stamps[n - 1] - 0.01) < 1e-6);
+
+        // ... and never delivered early. A late report only shortens the gap to the next one.
+        CHECK(delivered[n] >= stamps[n]);
+    }
+
+    CHECK(delivered.back() - delivered.front() < 0.09 + 0.1);
+
+    // A report which is not due yet times out
+    transport = CreateCaptureTransport(file.path, 0, 2.0);
+
+    REQUIRE(transport->Read(report, time, 0) == Transport::Result::OK);
+    CHECK(transport->Read(report, time, 1000) == Transport::Result::Timeout);
+}
+
+TEST(ReplayCaptureAnswersRequests)
+{
+    TempFile file;
+
+    REQUIRE(file.Valid());
+
+    //
+    // A status request and a read of the accelerometer calibration, answered by the device,
+    // and a data report
+    //
+
+    uint8_t const statusRequest[] = { 0x15, 0x00 };
+    uint8_t const status[22] = { 0x20, 0x00, 0x00, 0x0A, 0x00, 0x00, 0xC0 };
+    uint8_t const readRequest[] = { 0x17, 0x00, 0x00, 0x00, 0x16, 0x00, 0x08 };
+    uint8_t const read[22] = { 0x21, 0x00, 0x00, 0x70, 0x00, 0x16, 0x80, 0x80, 0x80, 0x00, 0x9A, 0x9A, 0x9A, 0x00 };
+
+    uint8_t data[22];
+    MakeReport(data, 5);
+
+    {
+        CaptureWriter capture;
+
+        REQUIRE(capture.Open(file.path));
+
+        capture.Record(1.000, 0, CaptureWriter::Direction::Output, statusRequest, sizeof(statusRequest));
+        capture.Record(1.001, 0, CaptureWriter::Direction::Input, status, sizeof(status));
+        capture.Record(1.002, 0, CaptureWriter::Direction::Output, readRequest, sizeof(readRequest));
+        capture.Record(1.003, 0, CaptureWriter::Direction::Input, read, sizeof(read));
+        capture.Record(1.004, 0, CaptureWriter::Direction::Input, data, sizeof(data));
+    }
+
+    std::unique_ptr<Transport> transport = CreateCaptureTransport(file.path, 0, 100.0);
+
+    REQUIRE(transport != nullptr);
+
+    uint8_t report[22];
+    double time = 0.0;
+
+    // The responses are held back; only the data report is played back on its own
+    REQUIRE(transport->Read(report, time, -1) == Transport::Result::OK);
+    CHECK(std::memcmp(report, data, 22) == 0);
+
+    // ... and answer the requests instead
+    REQUIRE(transport->Write(readRequest, sizeof(readRequest)));
+    REQUIRE(transport->Write(statusRequest, sizeof(statusRequest)));
+
+    REQUIRE(transport->Read(report, time, 0) == Transport::Result::OK);
+    CHECK(std::memcmp(report, read, 22) == 0);
+
+    REQUIRE(transport->Read(report, time, 0) == Transport::Result::OK);
+    CHECK(std::memcmp(report, status, 22) == 0);
+
+    // Requests which have not been recorded fail like reads of unmapped memory
+    uint8_t const otherRequest[] = { 0x17, 0x04, 0xA4, 0x00, 0xFA, 0x00, 0x06 };
+
+    REQUIRE(transport->Write(otherRequest, sizeof(otherRequest)));
+    REQUIRE(transport->Read(report, time, 0) == Transport::Result::OK);
+    CHECK(report[0] == 0x21 && (report[3] & 0x0F) == 0x07);
+
+    CHECK(transport->Read(report, time, 0) == Transport::Result::Error);
+}
+
+TEST(ReplayCaptureSeek)
+{
+    TempFile file;
+
+    REQUIRE(file.Valid());
+
+    // Long enough for several index entries
+    Session session;
+
+    REQUIRE(RecordSession(file.path, 10000, Wiimote::ReportMode::ButtonsAccelIRExt, session));
+
+    Wiimote wiimote;
+
+    REQUIRE(wiimote.Connect(CreateCaptureTransport(file.path)));
+    REQUIRE(wiimote.SetReportMode(Wiimote::ReportMode::ButtonsAccelIRExt));
+
+    //
+    // Somewhere in the middle -- long after the startup requests. The time stamps of the
+    // recording are not spread evenly, so count reports rather than split the time span.
+    //
+
+    for (unsigned n = 0; n < 6000; ++n)
+        REQUIRE(wiimote.Poll(std::chrono::microseconds(0)) == Wiimote::PollResult::Report);
+
+    double seekTime = wiimote.GetState().time;
+
+    REQUIRE(wiimote.Seek(seekTime));
+
+    //
+    // The Wiimote starts over. Its requests are answered from the checkpoint before the
+    // seek time and the responses recorded since.
+    //
+
+    unsigned count = 0;
+
+    for (unsigned n = 0; n < 200; ++n)
+    {
+        if (wiimote.Poll(std::chrono::microseconds(0)) != Wiimote::PollResult::Report)
+            break;
+
+        count++;
+    }
+
+    CHECK(count == 200);
+
+    State const& state = wiimote.GetState();
+
+    CHECK(state.time >= seekTime);
+    CHECK(state.time < session.state.time);
+
+    CHECK(state.accel.cal.valid);
+    CHECK(state.accel.cal.zero.x == session.state.accel.cal.zero.x);
+    CHECK(state.accel.cal.g.x == session.state.accel.cal.g.x);
+    CHECK(state.extension.type == Extension::Nunchuk);
+    CHECK(state.extension.nunchuk.accel.cal.valid);
+    CHECK(state.irEnabled);
+    CHECK(state.ir.mode == IRData::Mode::Basic);
+
+    wiimote.Disconnect();
+}
@@ -0,0 +1,169 @@
+// This file is distributed under the MIT license.
+// See the LICENSE file for details.
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+//--------------------------------------------------------------------------------------------------
+//
+//--------------------------------------------------------------------------------------------------
+
+namespace test
+{
+
+// A test case
+struct TestCase
+{
+    // Name of the test
+    char const* name;
+    // The test
+    void (*func)();
+};
+
+// Returns all registered tests
+inline std::vector<TestCase>& Tests()
+{
+    static std::vector<TestCase> tests;
+    return tests;
+}
+
+// Returns the number of failed checks
+inline unsigned& Failures()
+{
+    static unsigned failures = 0;
+    return failures;
+}
+
+// Registers a test case
+struct Register
+{
+    Register(char const* name, void (*func)())
+    {
+        TestCase tc = { name, func };
+        Tests().push_back(tc);
+    }
+};
+
+// Prevent:
+// C4127: conditional expression is constant
+inline bool False() { return false; }
+
+// Report a failed check
+inline void Fail(char const* file, int line, char const* expr)
+{
+    std::printf("%s(%d): check failed: %s\n", file, line, expr);
+    Failures()++;
+}
+
+} // namespace test
+
+//--------------------------------------------------------------------------------------------------
+// Fixtures
+//--------------------------------------------------------------------------------------------------
+
+// A ButtonsAccel data report with the given (fake) payload
+inline void MakeReport(uint8_t (&report)[22], uint8_t value)
+{
+    report[0] = 0x31;
+
+    for (unsigned n = 1; n < 22; ++n)
+        report[n] = static_cast<uint8_t>(value + n);
+}
+
+// A temporary file, removed when it goes out of scope
+struct TempFile
+{
+    char path[64];
+
+    TempFile()
+    {
+#ifdef _WIN32
+        std::strcpy(path, "wiimote-test-XXXXXX");
+
+        if (_mktemp_s(path, sizeof(path)) != 0)
+            path[0] = 0;
+#else
+        std::strcpy(path, "/tmp/wiimote-test-XXXXXX");
+
+        int fd = mkstemp(path);
+
+        if (fd < 0)
+            path[0] = 0;
+        else
+            close(fd);
+#endif
+    }
+
+    ~TempFile()
+    {
+        if (path[0] != 0)
+            std::remove(path);
+    }
+
+    // Whether the file could be created
+    bool Valid() const
+    {
+        return path[0] != 0;
+    }
+
+    // Replace the contents of the file
+    bool Write(std::vector<uint8_t> const& data) const
+    {
+        FILE* f = std::fopen(path, "wb");
+
+        if (f == nullptr)
+            return false;
+
+        bool ok = std::fwrite(data.data(), 1, data.size(), f) == data.size();
+
+        return std::fclose(f) == 0 && ok;
+    }
+
+    // Returns the contents of the file
+    std::vector<uint8_t> Read() const
+    {
+        std::vector<uint8_t> data;
+
+        if (FILE* f = std::fopen(path, "rb"))
+        {
+            uint8_t buf[4096];
+            size_t len;
+
+            while ((len = std::fread(buf, 1, sizeof(buf), f)) > 0)
+                data.insert(data.end(), buf, buf + len);
+
+            std::fclose(f);
+        }
+
+        return data;
+    }
+};
+
+//--------------------------------------------------------------------------------------------------
+//
+//--------------------------------------------------------------------------------------------------
+
+// Define a test case
+#define TEST(NAME) \
+    static void NAME(); \
+    static ::test::Register NAME##_register(#NAME, &NAME); \
+    static void NAME()
+
+// Check a condition; the test continues if it fails
+#define CHECK(X) \
+    ((X) ? (void)0 : ::test::Fail(__FILE__, __LINE__, #X))
+
+// Check a condition; the test returns if it fails
+#define REQUIRE(X) \
+    do { if (!(X)) { ::test::Fail(__FILE__, __LINE__, #X); return; } } while (::test::False())
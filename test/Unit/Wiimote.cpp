@@ -0,0 +1,740 @@
+// This file is distributed under the MIT license.
+// See the LICENSE file for details.
+
+#include "Test.h"
+
+#include "Wiimote/Capture.h"
+#include "Wiimote/Transport.h"
+
+#include "Capture.h"
+#include "TokenBucket.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace wii;
+
+//--------------------------------------------------------------------------------------------------
+// Wiimote against a scripted transport
+//--------------------------------------------------------------------------------------------------
+
+namespace
+{
+
+// Reports passed through a FakeTransport
+struct FakeLink
+{
+    struct Report
+    {
+        uint8_t data[22];
+        unsigned len;
+        // Time the report has been read or written
+        double time;
+    };
+
+    std::mutex lock;
+    // Input reports to be read
+    std::deque<Report> inputs;
+    // Output reports written
+    std::vector<Report> outputs;
+    // Whether writes fail
+    bool failWrites;
+    // Number of failed writes
+    unsigned failedWrites;
+    // Whether reads wait for a failed write before they return a report
+    bool holdReads;
+    // Whether reads fail
+    bool failReads;
+    // Whether writes wait until the flag is cleared
+    bool holdWrites;
+    // Whether a write is waiting
+    bool writeHeld;
+
+    FakeLink()
+        : lock()
+        , inputs()
+        , outputs()
+        , failWrites(false)
+        , failedWrites(0)
+        , holdReads(false)
+        , failReads(false)
+        , holdWrites(false)
+        , writeHeld(false)
+    {
+    }
+
+    void Send(uint8_t const* report, unsigned len)
+    {
+        Report r;
+
+        std::memset(r.data, 0, sizeof(r.data));
+        std::memcpy(r.data, report, len);
+        r.len = len;
+        r.time = 0.0;
+
+        std::lock_guard<std::mutex> guard(lock);
+        inputs.push_back(r);
+    }
+
+    std::vector<Report> Outputs()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        return outputs;
+    }
+};
+
+// A transport which reads the inputs of a FakeLink and records the outputs
+class FakeTransport : public Transport
+{
+    std::shared_ptr<FakeLink> link;
+
+public:
+    explicit FakeTransport(std::shared_ptr<FakeLink> link)
+        : link(link)
+    {
+    }
+
+    virtual Result Read(uint8_t* report, double& time, int64_t timeout) override
+    {
+        // Whether a failed write was seen by an earlier iteration; gives the writer thread
+        // time to flag the error
+        bool failed = false;
+
+        for (;;)
+        {
+            {
+                std::lock_guard<std::mutex> guard(link->lock);
+
+                if (link->failReads)
+                    return Result::Error;
+
+                if (!link->inputs.empty() && (!link->holdReads || failed))
+                {
+                    std::memcpy(report, link->inputs.front().data, 22);
+                    link->inputs.pop_front();
+
+                    time = GetTime();
+
+                    return Result::OK;
+                }
+
+                failed = link->failedWrites > 0;
+            }
+
+            if (timeout == 0)
+                return Result::Timeout;
+
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+            if (timeout > 0)
+                timeout = timeout > 1000 ? timeout - 1000 : 0;
+        }
+    }
+
+    virtual bool Write(uint8_t const* report, unsigned len) override
+    {
+        std::unique_lock<std::mutex> guard(link->lock);
+
+        while (link->holdWrites)
+        {
+            link->writeHeld = true;
+
+            guard.unlock();
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            guard.lock();
+        }
+
+        link->writeHeld = false;
+
+        if (link->failWrites)
+        {
+            link->failedWrites++;
+            return false;
+        }
+
+        FakeLink::Report r;
+
+        std::memset(r.data, 0, sizeof(r.data));
+        std::memcpy(r.data, report, len);
+        r.len = len;
+        r.time = GetTime();
+
+        link->outputs.push_back(r);
+
+        return true;
+    }
+};
+
+} // namespace
+
+TEST(PollDispatchesReportBeforeWriterError)
+{
+    std::shared_ptr<FakeLink> link(new FakeLink);
+
+    Wiimote wiimote;
+
+    REQUIRE(wiimote.Connect(std::unique_ptr<Transport>(new FakeTransport(link))));
+    REQUIRE(wiimote.EnableWriterThread(true));
+    REQUIRE(wiimote.SetReportMode(Wiimote::ReportMode::Buttons));
+
+    // The first report starts reading the calibration data
+    uint8_t report[22] = { 0x30 };
+
+    link->Send(report, sizeof(report));
+
+    CHECK(wiimote.Poll(std::chrono::microseconds(0)) == Wiimote::PollResult::Report);
+
+    //
+    // The next Poll() queues the read request for the writer thread, which fails to write it
+    // while Poll() waits for the next report.
+    //
+
+    {
+        std::lock_guard<std::mutex> guard(link->lock);
+        link->failWrites = true;
+        link->holdReads = true;
+    }
+
+    report[2] = 0x08; // Button A
+
+    link->Send(report, sizeof(report));
+
+    CHECK(wiimote.Poll(std::chrono::microseconds(1000000)) == Wiimote::PollResult::Report);
+    CHECK(wiimote.GetState().buttons == State::A);
+
+    // The error is reported by the next call
+    CHECK(wiimote.Poll(std::chrono::microseconds(0)) == Wiimote::PollResult::Error);
+    CHECK(wiimote.Poll(std::chrono::microseconds(0)) == Wiimote::PollResult::Error);
+
+    wiimote.Disconnect();
+}
+
+TEST(PollReportsWriterErrorWithoutReport)
+{
+    std::shared_ptr<FakeLink> link(new FakeLink);
+
+    Wiimote wiimote;
+
+    REQUIRE(wiimote.Connect(std::unique_ptr<Transport>(new FakeTransport(link))));
+    REQUIRE(wiimote.EnableWriterThread(true));
+    REQUIRE(wiimote.SetReportMode(Wiimote::ReportMode::Buttons));
+
+    {
+        std::lock_guard<std::mutex> guard(link->lock);
+        link->failWrites = true;
+    }
+
+    bool failed = false;
+
+    for (unsigned n = 0; n < 1000 && !failed; ++n)
+    {
+        failed = !wiimote.SetLEDs(n & 1 ? State::LED1 : State::LED2);
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    REQUIRE(failed);
+
+    // Nothing to read: the error is reported right away
+    CHECK(wiimote.Poll(std::chrono::microseconds(0)) == Wiimote::PollResult::Error);
+
+    wiimote.Disconnect();
+}
+
+TEST(SetRumbleWithPendingRequest)
+{
+    std::shared_ptr<FakeLink> link(new FakeLink);
+
+    Wiimote wiimote;
+
+    REQUIRE(wiimote.Connect(std::unique_ptr<Transport>(new FakeTransport(link))));
+    REQUIRE(wiimote.SetReportMode(Wiimote::ReportMode::Buttons));
+
+    // The first report queues the startup requests
+    uint8_t report[22] = { 0x30 };
+
+    link->Send(report, sizeof(report));
+
+    CHECK(wiimote.Poll(std::chrono::microseconds(0)) == Wiimote::PollResult::Report);
+
+    size_t written = link->Outputs().size();
+
+    // The rumble bit is sent along with the next request
+    CHECK(wiimote.SetRumble(true));
+    CHECK(link->Outputs().size() == written);
+
+    CHECK(wiimote.Poll(std::chrono::microseconds(0)) == Wiimote::PollResult::NoData);
+
+    std::vector<FakeLink::Report> outputs = link->Outputs();
+
+    REQUIRE(outputs.size() == written + 1);
+    CHECK((outputs.back().data[1] & 0x01) != 0);
+
+    wiimote.Disconnect();
+}
+
+TEST(SetRumbleAfterLinkLost)
+{
+    std::shared_ptr<FakeLink> link(new FakeLink);
+
+    Wiimote wiimote;
+
+    REQUIRE(wiimote.Connect(std::unique_ptr<Transport>(new FakeTransport(link))));
+    REQUIRE(wiimote.SetReportMode(Wiimote::ReportMode::Buttons));
+
+    {
+        std::lock_guard<std::mutex> guard(link->lock);
+        link->failReads = true;
+    }
+
+    CHECK(wiimote.Poll(std::chrono::microseconds(0)) == Wiimote::PollResult::Error);
+
+    //
+    // A request queued now is never sent, since the Wiimote is no longer polled.
+    // The rumble change must go out on its own.
+    //
+
+    wiimote.CheckForMotionPlus();
+
+    size_t written = link->Outputs().size();
+
+    CHECK(wiimote.SetRumble(true));
+
+    std::vector<FakeLink::Report> outputs = link->Outputs();
+
+    REQUIRE(outputs.size() == written + 1);
+    CHECK(outputs.back().data[0] == 0x11);
+    CHECK((outputs.back().data[1] & 0x01) != 0);
+
+    wiimote.Disconnect();
+
+    // Without a link, the change can not be sent at all
+    CHECK(!wiimote.SetRumble(false));
+}
+
+TEST(ReaderThreadQueuesReportsInOrder)
+{
+    std::shared_ptr<FakeLink> link(new FakeLink);
+
+    Wiimote wiimote;
+
+    REQUIRE(wiimote.Connect(std::unique_ptr<Transport>(new FakeTransport(link))));
+    REQUIRE(wiimote.SetReportMode(Wiimote::ReportMode::ButtonsAccel));
+    REQUIRE(wiimote.EnableReaderThread(true));
+
+    static const unsigned N = 16;
+
+    uint8_t reports[N][22];
+
+    for (unsigned n = 0; n < N; ++n)
+    {
+        MakeReport(reports[n], static_cast<uint8_t>(n));
+
+        link->Send(reports[n], 22);
+    }
+
+    // Let the reader thread read all the reports before they are processed
+    for (unsigned n = 0; n < 1000; ++n)
+    {
+        {
+            std::lock_guard<std::mutex> guard(link->lock);
+
+            if (link->inputs.empty())
+                break;
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    double last = 0.0;
+
+    for (unsigned n = 0; n < N; ++n)
+    {
+        REQUIRE(wiimote.Poll(std::chrono::microseconds(0)) == Wiimote::PollResult::Report);
+
+        State const& state = wiimote.GetState();
+
+        CHECK(state.buttons == ((reports[n][1] | (reports[n][2] << 8)) & State::ButtonMask));
+
+        // Stamped when read by the reader thread, not when processed
+        CHECK(state.time >= last);
+        CHECK(state.time < state.processTime);
+
+        last = state.time;
+    }
+
+    CHECK(wiimote.Poll(std::chrono::microseconds(0)) == Wiimote::PollResult::NoData);
+
+    //
+    // The reader thread is blocked in a read now.
+    // Stopping it must not wait for the next report.
+    //
+
+    auto start = std::chrono::steady_clock::now();
+
+    CHECK(wiimote.EnableReaderThread(false));
+
+    CHECK(std::chrono::steady_clock::now() - start < std::chrono::seconds(1));
+
+    // Reports are read directly again
+    link->Send(reports[0], 22);
+
+    CHECK(wiimote.Poll(std::chrono::microseconds(0)) == Wiimote::PollResult::Report);
+
+    wiimote.Disconnect();
+}
+
+TEST(PollAllInvokesCallbackInOrder)
+{
+    std::shared_ptr<FakeLink> link(new FakeLink);
+
+    Wiimote wiimote;
+
+    REQUIRE(wiimote.Connect(std::unique_ptr<Transport>(new FakeTransport(link))));
+    REQUIRE(wiimote.SetReportMode(Wiimote::ReportMode::ButtonsAccel));
+
+    static const unsigned N = 8;
+
+    uint8_t reports[N][22];
+
+    for (unsigned n = 0; n < N; ++n)
+    {
+        MakeReport(reports[n], static_cast<uint8_t>(n));
+
+        link->Send(reports[n], 22);
+    }
+
+    std::vector<unsigned> buttons;
+
+    unsigned count = 0;
+
+    // At most maxReports are processed ...
+    CHECK(wiimote.PollAll(count, [&](State const& state) { buttons.push_back(state.buttons); }, 3) == Wiimote::PollResult::Report);
+    CHECK(count == 3);
+
+    // ... the rest by the next call
+    CHECK(wiimote.PollAll(count, [&](State const& state) { buttons.push_back(state.buttons); }) == Wiimote::PollResult::Report);
+    CHECK(count == N - 3);
+
+    REQUIRE(buttons.size() == N);
+
+    for (unsigned n = 0; n < N; ++n)
+        CHECK(buttons[n] == ((reports[n][1] | (reports[n][2] << 8)) & State::ButtonMask));
+
+    CHECK(wiimote.PollAll(count) == Wiimote::PollResult::NoData);
+    CHECK(count == 0);
+
+    wiimote.Disconnect();
+}
+
+TEST(PollAllReportsLinkLost)
+{
+    std::shared_ptr<FakeLink> link(new FakeLink);
+
+    Wiimote wiimote;
+
+    REQUIRE(wiimote.Connect(std::unique_ptr<Transport>(new FakeTransport(link))));
+    REQUIRE(wiimote.EnableReaderThread(true));
+    REQUIRE(wiimote.SetReportMode(Wiimote::ReportMode::ButtonsAccel));
+
+    uint8_t report[22];
+    MakeReport(report, 1);
+
+    link->Send(report, 22);
+    link->Send(report, 22);
+
+    // Wait for the reader thread to read both reports, then break the link
+    for (unsigned n = 0; n < 1000; ++n)
+    {
+        {
+            std::lock_guard<std::mutex> guard(link->lock);
+
+            if (link->inputs.empty())
+            {
+                link->failReads = true;
+                break;
+            }
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    // The reports read before the link broke are processed, then the error is reported
+    unsigned count = 0;
+
+    CHECK(wiimote.PollAll(count) == Wiimote::PollResult::Error);
+    CHECK(count == 2);
+
+    CHECK(wiimote.PollAll(count) == Wiimote::PollResult::Error);
+    CHECK(count == 0);
+
+    wiimote.Disconnect();
+}
+
+TEST(WriterMergesSupersededReports)
+{
+    std::shared_ptr<FakeLink> link(new FakeLink);
+
+    Wiimote wiimote;
+
+    REQUIRE(wiimote.Connect(std::unique_ptr<Transport>(new FakeTransport(link))));
+    REQUIRE(wiimote.EnableWriterThread(true));
+
+    //
+    // Block the writer thread in the first write, so that everything else queues up
+    //
+
+    {
+        std::lock_guard<std::mutex> guard(link->lock);
+        link->holdWrites = true;
+    }
+
+    REQUIRE(wiimote.SetLEDs(State::LED1));
+
+    bool held = false;
+
+    for (unsigned n = 0; n < 1000 && !held; ++n)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+        std::lock_guard<std::mutex> guard(link->lock);
+        held = link->writeHeld;
+    }
+
+    REQUIRE(held);
+
+    // Superseded by the LED report below
+    CHECK(wiimote.SetLEDs(State::LED2));
+    // Superseded by the next report mode, which directly follows it
+    CHECK(wiimote.SetReportMode(Wiimote::ReportMode::Buttons));
+    CHECK(wiimote.SetReportMode(Wiimote::ReportMode::ButtonsAccel));
+    CHECK(wiimote.SetLEDs(State::LED3));
+    // Goes along with the queued reports
+    CHECK(wiimote.SetRumble(true));
+
+    // Queues the IR initialization and another report mode, which must not overtake it
+    CHECK(wiimote.SetReportMode(Wiimote::ReportMode::ButtonsAccelIR));
+
+    // Sends the first memory write of the IR initialization ...
+    CHECK(wiimote.Poll(std::chrono::microseconds(0)) == Wiimote::PollResult::NoData);
+
+    uint8_t ack[22] = { 0x22, 0x00, 0x00, 0x16, 0x00 };
+
+    link->Send(ack, sizeof(ack));
+
+    CHECK(wiimote.Poll(std::chrono::microseconds(0)) == Wiimote::PollResult::Report);
+
+    // ... and, once acknowledged, the second one
+    CHECK(wiimote.Poll(std::chrono::microseconds(0)) == Wiimote::PollResult::NoData);
+
+    CHECK(wiimote.SetLEDs(State::LED4));
+
+    {
+        std::lock_guard<std::mutex> guard(link->lock);
+        link->holdWrites = false;
+    }
+
+    // Flushes the queue
+    CHECK(wiimote.EnableWriterThread(false));
+
+    std::vector<FakeLink::Report> outputs = link->Outputs();
+
+    REQUIRE(outputs.size() == 8);
+
+    CHECK(outputs[0].data[0] == 0x11 && outputs[0].data[1] == State::LED1);
+
+    // Only the last LED report is written -- with the rumble bit
+    CHECK(outputs[1].data[0] == 0x11 && outputs[1].data[1] == (State::LED4 | 0x01));
+
+    // Only the last of two successive report modes is written
+    CHECK(outputs[2].data[0] == 0x12 && outputs[2].data[2] == 0x31);
+    CHECK((outputs[2].data[1] & 0x01) != 0);
+
+    CHECK(outputs[3].data[0] == 0x13);
+    CHECK(outputs[4].data[0] == 0x1A);
+    CHECK(outputs[5].data[0] == 0x12 && outputs[5].data[2] == 0x33);
+
+    // Acknowledged reports are never merged
+    CHECK(outputs[6].data[0] == 0x16 && outputs[6].data[4] == 0x30);
+    CHECK(outputs[7].data[0] == 0x16 && outputs[7].data[4] == 0x00);
+
+    wiimote.Disconnect();
+}
+
+TEST(TokenBucketSpacesReservations)
+{
+    TokenBucket bucket;
+
+    // Unlimited
+    CHECK(bucket.Reserve(1.0) == 0.0);
+    CHECK(bucket.Reserve(1.0) == 0.0);
+
+    // 100 tokens per second, bursts of 2
+    bucket.Configure(100.0, 2);
+
+    CHECK(bucket.Reserve(1.0) == 0.0);
+    CHECK(bucket.Reserve(1.0) == 0.0);
+
+    // The burst is used up; each further reservation waits another 10 ms
+    CHECK(std::abs(bucket.Reserve(1.0) - 0.01) < 1e-9);
+    CHECK(std::abs(bucket.Reserve(1.0) - 0.02) < 1e-9);
+
+    // Refills over time, but not beyond the burst size
+    CHECK(bucket.Reserve(1.035) == 0.0);
+    CHECK(bucket.Reserve(2.0) == 0.0);
+    CHECK(bucket.Reserve(2.0) == 0.0);
+    CHECK(bucket.Reserve(2.0) > 0.0);
+}
+
+TEST(OutputPacingDelaysReports)
+{
+    std::shared_ptr<FakeLink> link(new FakeLink);
+
+    Wiimote wiimote;
+
+    REQUIRE(wiimote.Connect(std::unique_ptr<Transport>(new FakeTransport(link))));
+
+    // One report every 20 ms
+    wiimote.SetOutputPacing(50.0, 1);
+
+    for (unsigned n = 0; n < 5; ++n)
+        CHECK(wiimote.SetLEDs(n & 1 ? State::LED1 : State::LED2));
+
+    std::vector<FakeLink::Report> outputs = link->Outputs();
+
+    REQUIRE(outputs.size() == 5);
+
+    for (size_t n = 1; n < outputs.size(); ++n)
+        CHECK(outputs[n].time - outputs[n - 1].time > 0.015);
+
+    OutputStats stats = wiimote.GetOutputStats();
+
+    CHECK(stats.reports == 5);
+    CHECK(stats.delayed == 4);
+    CHECK(stats.waitTime > 0.06);
+    CHECK(stats.maxWaitTime > 0.015 && stats.maxWaitTime <= stats.waitTime);
+
+    wiimote.SetOutputPacing(0.0);
+    wiimote.Disconnect();
+}
+
+TEST(GlobalOutputPacingSharedByWiimotes)
+{
+    std::shared_ptr<FakeLink> link(new FakeLink);
+
+    Wiimote wiimotes[2];
+
+    REQUIRE(wiimotes[0].Connect(std::unique_ptr<Transport>(new FakeTransport(link))));
+    REQUIRE(wiimotes[1].Connect(std::unique_ptr<Transport>(new FakeTransport(link))));
+
+    // One report every 20 ms across both Wiimotes, which are not limited on their own
+    SetGlobalOutputPacing(50.0, 1);
+
+    for (unsigned n = 0; n < 6; ++n)
+        CHECK(wiimotes[n & 1].SetLEDs(State::LED1));
+
+    SetGlobalOutputPacing(0.0);
+
+    std::vector<FakeLink::Report> outputs = link->Outputs();
+
+    REQUIRE(outputs.size() == 6);
+
+    for (size_t n = 1; n < outputs.size(); ++n)
+        CHECK(outputs[n].time - outputs[n - 1].time > 0.015);
+
+    CHECK(wiimotes[0].GetOutputStats().delayed + wiimotes[1].GetOutputStats().delayed == 5);
+    CHECK(wiimotes[1].GetOutputStats().waitTime > 0.0);
+
+    wiimotes[0].Disconnect();
+    wiimotes[1].Disconnect();
+}
+
+TEST(CaptureRecordsWrittenOutputReports)
+{
+    TempFile file;
+
+    REQUIRE(file.Valid());
+
+    std::shared_ptr<FakeLink> link(new FakeLink);
+
+    Wiimote wiimote;
+
+    REQUIRE(wiimote.Connect(std::unique_ptr<Transport>(new FakeTransport(link))));
+
+    {
+        CaptureWriter capture;
+
+        REQUIRE(capture.Open(file.path));
+
+        wiimote.SetCapture(&capture, 3);
+
+        REQUIRE(wiimote.EnableWriterThread(true));
+
+        {
+            std::lock_guard<std::mutex> guard(link->lock);
+            link->holdWrites = true;
+        }
+
+        CHECK(wiimote.SetLEDs(State::LED1));
+
+        bool held = false;
+
+        for (unsigned n = 0; n < 1000 && !held; ++n)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+            std::lock_guard<std::mutex> guard(link->lock);
+            held = link->writeHeld;
+        }
+
+        REQUIRE(held);
+
+        // Merged while the writer is blocked; only the last one goes out
+        CHECK(wiimote.SetLEDs(State::LED2));
+        CHECK(wiimote.SetLEDs(State::LED3));
+
+        {
+            std::lock_guard<std::mutex> guard(link->lock);
+            link->holdWrites = false;
+        }
+
+        CHECK(wiimote.EnableWriterThread(false));
+
+        // Once stopped, nothing is recorded into the capture any more
+        wiimote.SetCapture(nullptr);
+
+        CHECK(wiimote.SetLEDs(State::LED4));
+    }
+
+    std::vector<uint8_t> data = file.Read();
+
+    CaptureReader reader;
+
+    REQUIRE(reader.Open(data.data(), data.size()));
+
+    unsigned const expected[] = { State::LED1, State::LED3 };
+
+    CaptureRecord record;
+
+    for (unsigned n = 0; n < 2; ++n)
+    {
+        REQUIRE(reader.Next(record));
+
+        CHECK(record.device == 3);
+        CHECK(record.direction == static_cast<unsigned>(CaptureWriter::Direction::Output));
+        CHECK(record.report[0] == 0x11 && record.report[1] == expected[n]);
+    }
+
+    CHECK(!reader.Next(record));
+
+    wiimote.Disconnect();
+}